@@ -0,0 +1,26 @@
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+std::atomic<uint64_t> numAllocations(0);
+
+uint64_t getNumAllocations() {
+    return numAllocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size) {
+    numAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
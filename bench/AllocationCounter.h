@@ -0,0 +1,14 @@
+#ifndef ALLOCATION_COUNTER_H_
+#define ALLOCATION_COUNTER_H_
+
+#include <cstdint>
+
+/**
+ * Returns the number of heap allocations made so far. The global operator new
+ * is replaced in AllocationCounter.cpp to count them. The replacements are
+ * kept in their own file so that the compiler cannot inline them into code
+ * that frees memory from the standard library allocations.
+ */
+uint64_t getNumAllocations();
+
+#endif
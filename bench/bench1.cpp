@@ -0,0 +1,365 @@
+#include "AllocationCounter.h"
+#include "BackupTools/Application.h"
+#include "BackupTools/FileHandler.h"
+#include "BackupTools/FileReader.h"
+#include "BackupTools/TreeGenerator.h"
+#include "BackupTools/TreeState.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * Returns a directory for the benchmark data, it gets created empty.
+ */
+fs::path makeBenchDirectory(const std::string& name) {
+    const fs::path directory = fs::temp_directory_path() / ("backup_tools_bench_" + name);
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+    return directory;
+}
+
+/**
+ * Writes a file of the given size, the seed sets the contents.
+ */
+void writeBenchFile(const fs::path& filename, size_t size, unsigned int seed) {
+    std::string data(size, '\0');
+    std::minstd_rand rng(seed);
+    for (auto& c : data) {
+        c = static_cast<char>(rng());
+    }
+    std::ofstream(filename, std::ios::binary | std::ios::trunc).write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+/**
+ * Returns options for a forced check or backup without the cache, nothing
+ * gets printed except for status messages.
+ */
+Application::BackupOptions makeBenchOptions(PageCacheMode pageCacheMode) {
+    Application::BackupOptions options;
+    options.outputLimit = 0;
+    options.displayConfirmation = false;
+    options.skipCache = true;
+    options.fastCompare = false;
+    options.forceBackup = true;    // Skips printing the changes.
+    options.resumeBackup = false;
+    options.durability = DurabilityLevel::None;
+    options.ioThrottle = nullptr;
+    options.ioPriority = IoPriority::Unchanged;
+    options.pageCacheMode = pageCacheMode;
+    options.ioOrder = IoOrder::Name;
+    options.incremental = false;
+    options.dirtyPaths = nullptr;
+    options.copyQueue = nullptr;
+    options.changeWriter = nullptr;
+    return options;
+}
+
+/**
+ * Sets the modification times of root and the directories below it an hour
+ * back so that a TreeState trusts their listings.
+ */
+void setBenchTreeTimes(const fs::path& root) {
+    const auto lastWriteTime = fs::file_time_type::clock::now() - std::chrono::hours(1);
+    for (const auto& entry : fs::recursive_directory_iterator(root)) {
+        if (entry.is_directory()) {
+            fs::last_write_time(entry.path(), lastWriteTime);
+        }
+    }
+    fs::last_write_time(root, lastWriteTime);
+}
+
+// ****************************************************************************
+// * Globbing and ignores                                                     *
+// ****************************************************************************
+
+void BM_FnmatchPortable(benchmark::State& state) {
+    const std::vector<std::pair<const char*, const char*>> cases = {
+        {"*.txt", "some_longer_filename.txt"},
+        {"*.txt", "some_longer_filename.dat"},
+        {"[a-m]*_?ile*.d[a-z]t", "some_longer_file_name.dat"},
+        {"*a*b*c*d*e*", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbcccccd"}
+    };
+    const auto& testCase = cases[static_cast<size_t>(state.range(0))];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(FileHandler::fnmatchPortable(testCase.first, testCase.second));
+    }
+}
+BENCHMARK(BM_FnmatchPortable)->DenseRange(0, 3);
+
+void BM_CompareFilename(benchmark::State& state) {
+    std::vector<fs::path> paths;
+    std::minstd_rand rng(1);
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        paths.emplace_back("/home/user/Documents/Project" + std::to_string(rng() % 100) + "/src/File" + std::to_string(rng()) + ".cpp");
+    }
+    for (auto _ : state) {
+        std::vector<fs::path> sortedPaths = paths;
+        std::sort(sortedPaths.begin(), sortedPaths.end(), compareFilename);
+        benchmark::DoNotOptimize(sortedPaths.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CompareFilename)->Range(1 << 10, 1 << 16);
+
+void BM_CheckPathIgnored(benchmark::State& state) {
+    const fs::path directory = makeBenchDirectory("ignored");
+    fs::create_directory(directory / "src");
+    {
+        std::ofstream configFile(directory / "config.txt");
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            configFile << "ignore *.ext" << i << "\n";
+        }
+        configFile << "in \"" << (directory / "dest").string() << "\" add \"" << (directory / "src").string() << "\"\n";
+    }
+    FileHandler fileHandler;
+    fileHandler.loadConfigFile(directory / "config.txt");
+    fileHandler.nextWriteReadPathTree();    // Reads the ignores.
+    
+    std::vector<fs::path> paths;
+    for (int i = 0; i < 1000; ++i) {
+        paths.push_back(directory / "dest" / ("dir" + std::to_string(i % 10)) / ("file" + std::to_string(i) + ".ext" + std::to_string(i % (state.range(0) * 2))));
+    }
+    for (auto _ : state) {
+        for (const auto& p : paths) {
+            benchmark::DoNotOptimize(fileHandler.checkPathIgnored(p));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(paths.size()));
+    fs::remove_all(directory);
+}
+BENCHMARK(BM_CheckPathIgnored)->Range(1, 64);
+
+/**
+ * Globs a whole generated tree, range(0) is the depth (fan-out is 4 with 8
+ * empty files per directory). With range(1) set, the listings come from a
+ * TreeState that has already seen the tree (like an incremental check).
+ */
+void BM_GlobPortable(benchmark::State& state) {
+    const fs::path directory = makeBenchDirectory("glob");
+    TreeGenerator::Options options;
+    options.depth = static_cast<int>(state.range(0));
+    options.fanOut = 4;
+    options.filesPerDirectory = 8;
+    options.medianFileSize = 0;
+    options.hiddenRatio = 0.0;
+    options.duplicateRatio = 0.0;
+    const TreeGenerator::Totals totals = TreeGenerator(1).generate(directory, options);
+    const size_t numItems = totals.numDirectories + totals.numFiles;
+    setBenchTreeTimes(directory);
+    const bool useTreeState = (state.range(1) != 0);
+    TreeState treeState;
+    for (auto _ : state) {
+        FileHandler fileHandler;    // A new one each time, read paths are only returned once per FileHandler.
+        if (useTreeState) {
+            treeState.startScan();
+            fileHandler.setTreeState(&treeState);
+        }
+        benchmark::DoNotOptimize(fileHandler.globPortable(directory / "**" / "*.txt"));
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(numItems));
+    fs::remove_all(directory);
+}
+BENCHMARK(BM_GlobPortable)->ArgsProduct({{3, 5, 6}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+/**
+ * Reads a config that adds a generated tree of empty files, range(0) is the
+ * depth with a fan-out of 10 and 90 files per directory (depth 4 is 1M files,
+ * depth 5 is 10M). With range(1) set, the listings come from a TreeState that
+ * was filled by an untimed scan first (a warm rescan instead of a cold one).
+ * Reports the heap allocations made for each scanned item.
+ */
+void BM_ScanTree(benchmark::State& state) {
+    const fs::path directory = makeBenchDirectory("scan_tree");
+    TreeGenerator::Options options;
+    options.depth = static_cast<int>(state.range(0));
+    options.fanOut = 10;
+    options.filesPerDirectory = 90;
+    options.medianFileSize = 0;
+    options.duplicateRatio = 0.0;
+    TreeGenerator(1).generate(directory / "src", options);
+    setBenchTreeTimes(directory / "src");
+    std::ofstream(directory / "config.txt") << "in \"" << (directory / "dest").string() << "\" add \"" << (directory / "src").string() << "\"\n";
+    
+    const bool useTreeState = (state.range(1) != 0);
+    TreeState treeState;
+    auto scanTree = [&]() {
+        size_t count = 0;
+        FileHandler fileHandler;
+        if (useTreeState) {
+            treeState.startScan();
+            fileHandler.setTreeState(&treeState);
+        }
+        fileHandler.loadConfigFile(directory / "config.txt");
+        for (WriteReadPathTree pathTree = fileHandler.nextWriteReadPathTree(); !pathTree.isEmpty(); pathTree = fileHandler.nextWriteReadPathTree()) {
+            count += pathTree.relativePaths.size();
+        }
+        return count;
+    };
+    if (useTreeState) {
+        scanTree();
+    }
+    
+    size_t numItems = 0;
+    uint64_t allocations = 0;
+    for (auto _ : state) {
+        const uint64_t startAllocations = getNumAllocations();
+        numItems = scanTree();
+        allocations += getNumAllocations() - startAllocations;
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(numItems));
+    state.counters["allocs_per_item"] = static_cast<double>(allocations) / static_cast<double>(state.iterations() * numItems);
+    if (useTreeState) {
+        state.counters["dirs_reused"] = static_cast<double>(treeState.getNumReused());
+        state.counters["dirs_listed"] = static_cast<double>(treeState.getNumListed());
+    }
+    fs::remove_all(directory);
+}
+BENCHMARK(BM_ScanTree)->ArgsProduct({{2, 3, 4, 5}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+// ****************************************************************************
+// * Comparing files and the cache                                            *
+// ****************************************************************************
+
+void BM_CheckFileEquivalence(benchmark::State& state) {
+    const fs::path directory = makeBenchDirectory("compare");
+    const size_t size = static_cast<size_t>(state.range(0));
+    writeBenchFile(directory / "source", size, 1);
+    fs::copy_file(directory / "source", directory / "dest");
+    FileHandler fileHandler;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fileHandler.checkFileEquivalence(directory / "source", directory / "dest", true, false));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size) * 2);
+    fs::remove_all(directory);
+}
+BENCHMARK(BM_CheckFileEquivalence)->RangeMultiplier(16)->Range(1 << 10, 1 << 26);
+
+/**
+ * Fills the cache of fileHandler with numEntries compared pairs of files.
+ */
+void fillCache(FileHandler& fileHandler, const fs::path& directory, int64_t numEntries) {
+    fs::create_directories(directory / "src");
+    fs::create_directories(directory / "dest");
+    for (int64_t i = 0; i < numEntries; ++i) {
+        const std::string filename = "file" + std::to_string(i);
+        std::ofstream(directory / "src" / filename) << i;
+        std::ofstream(directory / "dest" / filename) << i;
+        fileHandler.checkFileEquivalence(directory / "src" / filename, directory / "dest" / filename, false, false);
+    }
+}
+
+void BM_CacheSave(benchmark::State& state) {
+    const fs::path directory = makeBenchDirectory("cache_save");
+    FileHandler fileHandler;
+    fillCache(fileHandler, directory, state.range(0));
+    const fs::file_time_type configFileWriteTime = fs::file_time_type::clock::now();
+    for (auto _ : state) {
+        fileHandler.saveCacheFile(directory / "bench.cache", configFileWriteTime);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    fs::remove_all(directory);
+}
+BENCHMARK(BM_CacheSave)->Arg(1000)->Arg(20000)->Unit(benchmark::kMillisecond);
+
+void BM_CacheLoad(benchmark::State& state) {
+    const fs::path directory = makeBenchDirectory("cache_load");
+    const fs::file_time_type configFileWriteTime = fs::file_time_type::clock::now();
+    {
+        FileHandler fileHandler;
+        fillCache(fileHandler, directory, state.range(0));
+        fileHandler.saveCacheFile(directory / "bench.cache", configFileWriteTime);
+    }
+    FileHandler fileHandler;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fileHandler.loadCacheFile(directory / "bench.cache", configFileWriteTime));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    fs::remove_all(directory);
+}
+BENCHMARK(BM_CacheLoad)->Arg(1000)->Arg(20000)->Unit(benchmark::kMillisecond);
+
+// ****************************************************************************
+// * Copying files                                                            *
+// ****************************************************************************
+
+/**
+ * Backs up 64 MiB into an empty destination, range(0) is the page cache mode
+ * (normal, drop-behind, direct) and range(1) is the file size. Files up to
+ * the drop window of FileReader are copied by the kernel in every mode except
+ * direct, larger ones are copied in blocks unless the mode is normal. The
+ * sources are dropped from the page cache before each backup.
+ */
+void BM_BackupCopy(benchmark::State& state) {
+    const fs::path directory = makeBenchDirectory("backup_copy");
+    const size_t fileSize = static_cast<size_t>(state.range(1));
+    const size_t numFiles = 64 * 1024 * 1024 / fileSize;
+    fs::create_directory(directory / "src");
+    for (size_t i = 0; i < numFiles; ++i) {
+        writeBenchFile(directory / "src" / ("file" + std::to_string(i)), fileSize, static_cast<unsigned int>(i + 1));
+    }
+    std::ofstream(directory / "config.txt") << "in \"" << (directory / "dest").string() << "\" add \"" << (directory / "src").string() << "\"\n";
+    const PageCacheMode modes[] = {PageCacheMode::Normal, PageCacheMode::DropBehind, PageCacheMode::Direct};
+    const Application::BackupOptions options = makeBenchOptions(modes[state.range(0)]);
+    
+    const fs::path previousPath = fs::current_path();
+    fs::current_path(directory);    // The journal goes in the .backuptools directory here.
+    std::ostringstream output;
+    std::streambuf* const coutBuffer = std::cout.rdbuf(output.rdbuf());
+    for (auto _ : state) {
+        state.PauseTiming();
+        fs::remove_all(directory / "dest");
+        for (size_t i = 0; i < numFiles; ++i) {    // Every mode starts with the sources out of the cache, otherwise normal would read from memory.
+            FileReader::dropFromCache(directory / "src" / ("file" + std::to_string(i)));
+        }
+        output.str("");
+        state.ResumeTiming();
+        Application().startBackup("config.txt", options);
+    }
+    std::cout.rdbuf(coutBuffer);
+    fs::current_path(previousPath);
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(numFiles * fileSize));
+    fs::remove_all(directory);
+}
+BENCHMARK(BM_BackupCopy)->ArgsProduct({{0, 1, 2}, {64 * 1024, 16 * 1024 * 1024}})->UseRealTime()->Unit(benchmark::kMillisecond);
+
+/**
+ * Rename detection where every added and deleted file has the same size, so
+ * the contents decide. Each addition matches one of the deletions. Runs a
+ * whole check with checkBackup(), the scan itself is small next to the
+ * comparisons of the renamed files.
+ */
+void BM_OptimizeForRenames(benchmark::State& state) {
+    const fs::path directory = makeBenchDirectory("renames");
+    fs::create_directories(directory / "src");
+    fs::create_directories(directory / "dest" / "src");
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        const std::string filename = "file" + std::to_string(i);
+        writeBenchFile(directory / "src" / ("new_" + filename), 4096, static_cast<unsigned int>(i + 1));
+        writeBenchFile(directory / "dest" / "src" / filename, 4096, static_cast<unsigned int>(state.range(0) - i));
+    }
+    std::ofstream(directory / "config.txt") << "in \"" << (directory / "dest").string() << "\" add \"" << (directory / "src").string() << "\"\n";
+    
+    const Application::BackupOptions options = makeBenchOptions(PageCacheMode::Normal);
+    std::ostringstream output;
+    std::streambuf* const coutBuffer = std::cout.rdbuf(output.rdbuf());    // The status messages would mix with the results.
+    for (auto _ : state) {
+        Application::FileChanges changes = Application().checkBackup(directory / "config.txt", options);
+        benchmark::DoNotOptimize(changes.renames.size());
+        output.str("");
+    }
+    std::cout.rdbuf(coutBuffer);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    fs::remove_all(directory);
+}
+BENCHMARK(BM_OptimizeForRenames)->Arg(16)->Arg(128)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
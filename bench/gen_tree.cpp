@@ -0,0 +1,155 @@
+#include "BackupTools/ArgumentParser.h"
+#include "BackupTools/IoThrottle.h"
+#include "BackupTools/TreeGenerator.h"
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace fs = std::filesystem;
+
+/**
+ * Shows the usage of the tool.
+ */
+void showHelp() {
+    std::cout << "Generates file trees for scale testing, the same seed and options always give the same tree.\n";
+    std::cout << "\n";
+    std::cout << "Usage:\n";
+    std::cout << "  gen_tree create <DIRECTORY> [OPTION]   Creates a new tree in the directory.\n";
+    std::cout << "  gen_tree mutate <DIRECTORY> [OPTION]   Applies random changes to an existing tree (use a new seed for each step).\n";
+    std::cout << "  gen_tree count [OPTION]                Prints the number of files that create would make.\n";
+    std::cout << "\n";
+    std::cout << "Options:\n";
+    std::cout << "  --seed N                 Seed for the random choices (1 by default).\n";
+    std::cout << "  --depth N                Levels of directories below the root (3 by default).\n";
+    std::cout << "  --fan-out N              Sub-directories in each directory (8 by default).\n";
+    std::cout << "  --files N                Files in each directory (16 by default).\n";
+    std::cout << "  --median-size SIZE       Median file size, K, M, G suffixes allowed (4K by default).\n";
+    std::cout << "  --size-sigma X           Spread of the log-normal file sizes, 0 for all the same (1.5 by default).\n";
+    std::cout << "  --max-size SIZE          Largest file size (64M by default).\n";
+    std::cout << "  --hidden RATIO           Fraction of hidden files and directories (0.05 by default).\n";
+    std::cout << "  --duplicates RATIO       Fraction of files that copy an earlier file (0.05 by default).\n";
+    std::cout << "  --adds N                 Files to add with mutate.\n";
+    std::cout << "  --deletes N              Files to delete with mutate.\n";
+    std::cout << "  --modifies N             Files to modify with mutate (same size, new contents).\n";
+    std::cout << "  --renames N              Files to rename with mutate (can move them to another directory).\n";
+    std::cout << "\n";
+    std::cout << "Approximate tree sizes: --depth 3 --fan-out 8 --files 16 gives 9k files, --depth 4 --fan-out 10\n";
+    std::cout << "--files 90 gives 1M files, and --depth 5 --fan-out 10 --files 90 gives 10M files.\n";
+}
+
+/**
+ * Parses a number for the option with the given name.
+ */
+double parseNumber(const char* optionArg, const std::string& name) {
+    try {
+        return std::stod(optionArg);
+    } catch (...) {
+        throw std::runtime_error("Value for \"" + name + "\" must be a number.");
+    }
+}
+
+int main(int argc, const char** argv) {
+    try {
+        if (argc < 2 || std::string(argv[1]) == "help") {
+            showHelp();
+            return 0;
+        }
+        const std::string command(argv[1]);
+        if (command != "create" && command != "mutate" && command != "count") {
+            throw std::runtime_error("Unknown command \"" + command + "\".");
+        }
+        const int startIndex = (command == "count" ? 2 : 3);
+        if (argc < startIndex) {
+            throw std::runtime_error("Missing path to directory.");
+        }
+        
+        uint64_t seed = 1;
+        TreeGenerator::Options options;
+        TreeGenerator::Mutations mutations;
+        ArgumentParser argParser({
+            {'\0', "seed", ArgumentParser::RequiredArg, nullptr, 's'},
+            {'\0', "depth", ArgumentParser::RequiredArg, nullptr, 'd'},
+            {'\0', "fan-out", ArgumentParser::RequiredArg, nullptr, 'f'},
+            {'\0', "files", ArgumentParser::RequiredArg, nullptr, 'n'},
+            {'\0', "median-size", ArgumentParser::RequiredArg, nullptr, 'm'},
+            {'\0', "size-sigma", ArgumentParser::RequiredArg, nullptr, 'g'},
+            {'\0', "max-size", ArgumentParser::RequiredArg, nullptr, 'x'},
+            {'\0', "hidden", ArgumentParser::RequiredArg, nullptr, 'h'},
+            {'\0', "duplicates", ArgumentParser::RequiredArg, nullptr, 'u'},
+            {'\0', "adds", ArgumentParser::RequiredArg, nullptr, 'A'},
+            {'\0', "deletes", ArgumentParser::RequiredArg, nullptr, 'D'},
+            {'\0', "modifies", ArgumentParser::RequiredArg, nullptr, 'M'},
+            {'\0', "renames", ArgumentParser::RequiredArg, nullptr, 'R'}
+        });
+        argParser.setArguments(argv, startIndex);
+        
+        int opt;
+        std::string errorMessage;
+        while ((opt = argParser.nextOption(&errorMessage)) != -1) {
+            const char* optionArg = argParser.getOptionArg();
+            if (opt == 's') {
+                seed = static_cast<uint64_t>(parseNumber(optionArg, "seed"));
+            } else if (opt == 'd') {
+                options.depth = static_cast<int>(parseNumber(optionArg, "depth"));
+            } else if (opt == 'f') {
+                options.fanOut = static_cast<int>(parseNumber(optionArg, "fan-out"));
+            } else if (opt == 'n') {
+                options.filesPerDirectory = static_cast<int>(parseNumber(optionArg, "files"));
+            } else if (opt == 'm') {
+                options.medianFileSize = static_cast<uintmax_t>(IoThrottle::parseByteRate(optionArg));
+            } else if (opt == 'g') {
+                options.fileSizeSigma = parseNumber(optionArg, "size-sigma");
+            } else if (opt == 'x') {
+                options.maxFileSize = static_cast<uintmax_t>(IoThrottle::parseByteRate(optionArg));
+            } else if (opt == 'h') {
+                options.hiddenRatio = parseNumber(optionArg, "hidden");
+            } else if (opt == 'u') {
+                options.duplicateRatio = parseNumber(optionArg, "duplicates");
+            } else if (opt == 'A') {
+                mutations.numAdds = static_cast<size_t>(parseNumber(optionArg, "adds"));
+            } else if (opt == 'D') {
+                mutations.numDeletes = static_cast<size_t>(parseNumber(optionArg, "deletes"));
+            } else if (opt == 'M') {
+                mutations.numModifies = static_cast<size_t>(parseNumber(optionArg, "modifies"));
+            } else if (opt == 'R') {
+                mutations.numRenames = static_cast<size_t>(parseNumber(optionArg, "renames"));
+            } else if (opt == '?' || opt == ':') {
+                throw std::runtime_error(errorMessage + ".");
+            }
+        }
+        if (argParser.getIndex() < argc) {
+            throw std::runtime_error("Invalid argument \"" + std::string(argv[argParser.getIndex()]) + "\".");
+        }
+        if (options.depth < 0 || options.fanOut < 0 || options.filesPerDirectory < 0) {
+            throw std::runtime_error("Values for \"depth\", \"fan-out\", and \"files\" must not be negative.");
+        }
+        
+        if (command == "count") {
+            std::cout << TreeGenerator::countFiles(options) << "\n";
+            return 0;
+        }
+        const fs::path root(argv[2]);
+        if (command == "create" && fs::exists(root) && !fs::is_empty(root)) {
+            throw std::runtime_error("\"" + root.string() + "\": Directory is not empty.");
+        }
+        const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        TreeGenerator generator(seed);
+        TreeGenerator::Totals totals = (command == "create" ? generator.generate(root, options) : generator.mutate(root, mutations, options));
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        
+        if (command == "create") {
+            std::cout << "Created " << totals.numFiles << " files (" << totals.numDuplicates << " duplicates) in " << totals.numDirectories << " directories, ";
+        } else {
+            std::cout << "Applied " << mutations.numAdds << " adds, " << mutations.numDeletes << " deletes, " << mutations.numModifies << " modifies, and " << mutations.numRenames << " renames, wrote " << totals.numFiles << " files, ";
+        }
+        std::cout << totals.numBytes << " bytes total (" << seconds << "s).\n";
+    } catch (fs::filesystem_error& ex) {
+        std::cerr << "Error: " << ex.code().message() << ": \"" << ex.path1().string() << "\"\n";
+        return 1;
+    } catch (std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
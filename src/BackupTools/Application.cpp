@@ -1,17 +1,161 @@
 #include "BackupTools/Application.h"
+#include "BackupTools/Compressor.h"
+#include "BackupTools/DirectoryReader.h"
+#include "BackupTools/ProgressReporter.h"
+#include "BackupTools/Stats.h"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <cmath>
+#include <ctime>
+#include <exception>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <set>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+constexpr size_t STREAM_QUEUE_SIZE = 1024;    // Copies found by the scan that can wait for the copy thread, see startBackup().
+constexpr size_t TREE_OUTPUT_BUFFER_SIZE = 1024 * 1024;    // Output of printTree2() is written in chunks of about this size.
 
 bool compareFileChange(const std::pair<fs::path, fs::path>& lhs, const std::pair<fs::path, fs::path>& rhs) {
     return compareFilename(lhs.second, rhs.second);
 }
 
+/**
+ * Stream buffer that can be swapped into std::cout to redirect the output of
+ * some threads into their own string (see startBackups()). Threads that have
+ * not set a capture string write to the original buffer.
+ */
+class CapturedOutputBuffer : public std::streambuf {
+public:
+    CapturedOutputBuffer(std::streambuf* output) : output_(output) {}
+    
+    /**
+     * Sends the output of the calling thread to the string, or back to the
+     * original buffer if nullptr.
+     */
+    static void setCapture(std::string* capture) { capture_ = capture; }
+    static bool isCapturing() { return capture_ != nullptr; }
+    
+protected:
+    int overflow(int c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) {
+            return traits_type::not_eof(c);
+        } else if (capture_ != nullptr) {
+            capture_->push_back(traits_type::to_char_type(c));
+            return c;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        return output_->sputc(traits_type::to_char_type(c));
+    }
+    
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        if (capture_ != nullptr) {
+            capture_->append(s, static_cast<size_t>(n));
+            return n;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        return output_->sputn(s, n);
+    }
+    
+    int sync() override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return output_->pubsync();
+    }
+    
+private:
+    static thread_local std::string* capture_;
+    std::streambuf* output_;
+    std::mutex mutex_;
+};
+
+thread_local std::string* CapturedOutputBuffer::capture_ = nullptr;
+
+/**
+ * Progress is not shown for a thread with captured output, the progress thread
+ * would write straight to the terminal.
+ */
+ProgressOutput getProgressOutput() {
+    return (CapturedOutputBuffer::isCapturing() ? ProgressOutput::None : ProgressReporter::detectOutput());
+}
+
+/**
+ * Returns true if path is parent or somewhere below it.
+ */
+bool isPathInside(const fs::path& path, const fs::path& parent) {
+    return std::mismatch(parent.begin(), parent.end(), path.begin(), path.end()).first == parent.end();
+}
+
+/**
+ * Returns true if the path or one of its parents is in dirtyPaths.
+ */
+bool isPathDirty(const fs::path& path, const std::set<fs::path>& dirtyPaths) {
+    for (fs::path p = path; ; p = p.parent_path()) {
+        if (dirtyPaths.count(p) > 0) {
+            return true;
+        } else if (!p.has_relative_path()) {
+            return false;
+        }
+    }
+}
+
+/**
+ * Adds the paths of everything inside a directory, like iterating with
+ * fs::recursive_directory_iterator but with the saved listings in treeState.
+ * Symlinks to directories are not followed.
+ */
+void listTreeRecursive(TreeState& treeState, const fs::path& directory, std::set<fs::path>& paths, IoThrottle* ioThrottle) {
+    std::vector<fs::path> directoryStack = {directory};
+    while (!directoryStack.empty()) {
+        const fs::path currentDirectory = std::move(directoryStack.back());
+        directoryStack.pop_back();
+        for (const auto& entry : treeState.listDirectory(currentDirectory)) {
+            fs::path path = currentDirectory / entry.name;
+            if (entry.type == TreeState::EntryType::Directory) {
+                if (ioThrottle != nullptr) {    // Each directory costs an extra operation to list its contents.
+                    ioThrottle->acquireOps(1);
+                }
+                directoryStack.push_back(path);
+            }
+            paths.emplace(std::move(path));
+        }
+    }
+}
+
+/**
+ * Adds the paths of everything inside a directory, same as iterating with
+ * fs::recursive_directory_iterator (symlinks to directories are not followed).
+ * Throws fs::filesystem_error if a directory cannot be listed.
+ */
+void listDirectoryRecursive(const fs::path& directory, std::set<fs::path>& paths, IoThrottle* ioThrottle) {
+    DirectoryReader directoryReader;
+    std::vector<fs::path> directoryStack = {directory};
+    while (!directoryStack.empty()) {
+        const fs::path currentDirectory = std::move(directoryStack.back());
+        directoryStack.pop_back();
+        Stats::add(Stats::DirectoriesListed);
+        directoryReader.open(currentDirectory);
+        DirectoryReader::Entry entry;
+        while (directoryReader.next(entry)) {
+            fs::path path = currentDirectory / entry.name;
+            if (entry.type == DirectoryReader::EntryType::Directory) {
+                if (ioThrottle != nullptr) {    // Each directory costs an extra operation to list its contents.
+                    ioThrottle->acquireOps(1);
+                }
+                directoryStack.push_back(path);
+            }
+            paths.emplace(std::move(path));
+        }
+    }
+}
+
 bool Application::checkUserConfirmation() {
     std::string input, inputCleaned;
     std::getline(std::cin, input);
@@ -27,15 +171,26 @@ bool Application::checkUserConfirmation() {
     return acceptInputs.count(inputCleaned) > 0;
 }
 
+Application::Application() :
+    keepSession_(false) {
+}
+
+void Application::setKeepSession(bool keepSession) {
+    keepSession_ = keepSession;
+    if (!keepSession_) {
+        session_.reset();
+    }
+}
+
 void Application::printPaths(const fs::path& configFilename, bool verbose, bool countOnly, bool pruneIgnored) {
-    std::map<fs::path, fs::path> readPathsMapping;    // Maps read path to corresponding write path.
+    std::unordered_map<std::string, fs::path> readPathsMapping;    // Maps read path to corresponding write path.
     std::map<fs::path, std::string> longestParentPaths;    // Longest common path among readPath entries (per root path).
+    std::unordered_set<std::string> trackedParents;    // Directories that contain a tracked item, only these and the tracked directories get listed in printTree().
     FileHandler fileHandler;
-    fileHandler.loadConfigFile(configFilename);
+    fileHandler.loadConfigPlan(loadConfigPlan(configFilename, false));
     
-    int spinnerIndex = 0;
-    std::chrono::steady_clock::time_point spinnerLastTime = std::chrono::steady_clock::now();
     std::cout << "Scanning directory structure...\n";
+    auto progress = std::make_unique<ProgressReporter>(getProgressOutput(), "items scanned");
     size_t scanCounter = 0;
     
     WriteReadPathTree pathTree = fileHandler.nextWriteReadPathTree();
@@ -43,6 +198,7 @@ void Application::printPaths(const fs::path& configFilename, bool verbose, bool
     scanCounter += pathTree.relativePaths.size();
     
     if (pathTree.isEmpty()) {
+        progress.reset();
         std::cout << "\nNo files or directories found to track.\n";
         return;
     }
@@ -60,7 +216,7 @@ void Application::printPaths(const fs::path& configFilename, bool verbose, bool
         if (verbose) {    // Only set the writePath if we actually use it.
             writePath = pathTree.writePrefix / *relativePathIter;
         }
-        if (!readPathsMapping.emplace(readPath, writePath).second) {
+        if (!readPathsMapping.emplace(readPath.string(), writePath).second) {
             std::cout << CSI::Yellow << "Warning: Skipping duplicate read path: " << readPath.string() << CSI::Reset << "\n";
         }
         auto findResult = longestParentPaths.find(readPath.root_path());
@@ -69,52 +225,153 @@ void Application::printPaths(const fs::path& configFilename, bool verbose, bool
         }
         
         findCommonParentPath(findResult->second, readPath.string(), readPath.root_path().string());    // Update the longest parent path.
+        for (fs::path parentPath = readPath.parent_path(); parentPath.has_relative_path() && trackedParents.insert(parentPath.string()).second; parentPath = parentPath.parent_path()) {}    // Stops at the first parent already added, the ones above it are in the set too.
         
-        printSpinner(spinnerIndex, spinnerLastTime);
+        progress->add();
         ++relativePathIter;
     }
-    std::cout << "Discovered " << scanCounter << " items.\n\n";    // Clear spinner and output scan totals.
+    progress.reset();    // Clears the spinner.
+    std::cout << "Discovered " << scanCounter << " items.\n\n";
     
     for (auto mapIter = longestParentPaths.begin(); mapIter != longestParentPaths.end(); ++mapIter) {
         if (mapIter != longestParentPaths.begin()) {
             std::cout << "\n";
         }
-        if (fs::is_regular_file(mapIter->second) && mapIter->second.rfind(FileHandler::pathSeparator) != std::string::npos) {    // If parent path is a file, cut off the file portion before call to printTree().
-            std::string::size_type previousSeparator = mapIter->second.rfind(FileHandler::pathSeparator);
+        if (fs::is_regular_file(mapIter->second) && mapIter->second.rfind(FileHandler::PATH_SEPARATOR) != std::string::npos) {    // If parent path is a file, cut off the file portion before call to printTree().
+            std::string::size_type previousSeparator = mapIter->second.rfind(FileHandler::PATH_SEPARATOR);
             fs::path searchPath;
             if (previousSeparator == std::string::npos || mapIter->first.string().length() > previousSeparator) {    // Edge case in case we're close to the root path.
                 searchPath = mapIter->first;
             } else {
                 searchPath = mapIter->second.substr(0, previousSeparator);
             }
-            printTree(searchPath, readPathsMapping, verbose, countOnly, pruneIgnored);
+            printTree(searchPath, readPathsMapping, trackedParents, verbose, countOnly, pruneIgnored);
         } else {
-            printTree(fs::path(mapIter->second), readPathsMapping, verbose, countOnly, pruneIgnored);
+            printTree(fs::path(mapIter->second), readPathsMapping, trackedParents, verbose, countOnly, pruneIgnored);
         }
     }
 }
 
 Application::FileChanges Application::checkBackup(const fs::path& configFilename, const BackupOptions& options) {
+    IoThrottle::PriorityScope priorityScope(options.ioPriority);
+    fs::path cacheFilePath(".backuptools/" + configFilename.string() + ".cache");
+    fs::path treeStatePath(".backuptools/" + configFilename.string() + ".tree");
+    fs::file_time_type configFileWriteTime = fs::last_write_time(configFilename);
+    SessionState* session = nullptr;
+    if (keepSession_ && !options.skipCache) {
+        if (!session_ || session_->configFilename != configFilename || session_->configFileWriteTime != configFileWriteTime) {
+            session_ = std::make_unique<SessionState>();
+            session_->configFilename = configFilename;
+            session_->configFileWriteTime = configFileWriteTime;
+        }
+        session = session_.get();
+        
+        if (session->changesValid && session->watcher && session->lastFastCompare == options.fastCompare && options.dirtyPaths == nullptr) {    // Nothing needs to be scanned if no events arrived since the last scan.
+            std::set<fs::path> changedPaths;
+            session->watcher->waitForChanges(std::chrono::milliseconds(0), changedPaths);
+            if (changedPaths.empty() && !session->watcher->checkOverflow()) {
+                std::cout << "No directories changed since the last scan, reusing its results.\n\n";
+                if (options.changeWriter != nullptr) {
+                    writeChanges(session->lastChanges, *options.changeWriter);
+                    options.changeWriter->writeSummary(session->lastScanCount);
+                } else if (!options.forceBackup) {
+                    printChanges(session->lastChanges, options.outputLimit, options.displayConfirmation);
+                }
+                return session->lastChanges;
+            }
+        }
+        session->changesValid = false;
+        session->watcher.reset();
+        if (DirectoryWatcher::isSupported()) {
+            session->watcher = std::make_unique<DirectoryWatcher>();
+        }
+        session->treeState.setWatcher(session->watcher.get());
+    }
+    
     FileChanges changes;
     std::map<fs::path, std::set<fs::path>> writePathsChecklist;    // Maps a destination path to the current contents of that path.
     auto lastWritePathIter = writePathsChecklist.end();
-    FileHandler fileHandler;
-    fileHandler.loadConfigFile(configFilename);
+    FileHandler localFileHandler;
+    FileHandler& fileHandler = (session != nullptr ? session->fileHandler : localFileHandler);
+    if (session != nullptr) {
+        if (!session->plan) {
+            session->plan = loadConfigPlan(configFilename, options.skipCache);
+        }
+        fileHandler.loadConfigPlan(session->plan);
+    } else {
+        fileHandler.loadConfigPlan(loadConfigPlan(configFilename, options.skipCache));
+    }
+    fileHandler.setIoThrottle(options.ioThrottle);
+    fileHandler.setPageCacheMode(options.pageCacheMode);
     
-    fs::path cacheFilePath(".backuptools/" + configFilename.string() + ".cache");
-    fs::file_time_type configFileWriteTime = fs::last_write_time(configFilename);
-    if (!options.skipCache && fs::exists(cacheFilePath)) {
+    const bool incremental = ((options.incremental || session != nullptr) && !options.skipCache);    // A session always keeps its listings in memory.
+    TreeState localTreeState;
+    TreeState& treeState = (session != nullptr ? session->treeState : localTreeState);
+    if (session != nullptr && session->hasScanned) {
+        treeState.startScan();
+    } else if (options.incremental && !options.skipCache) {
+        treeState.load(treeStatePath);
+    }
+    if (incremental) {
+        fileHandler.setTreeState(&treeState);
+    }
+    const bool cacheLoaded = (session != nullptr && session->hasScanned && fs::exists(cacheFilePath) && fs::last_write_time(cacheFilePath) == session->cacheFileWriteTime);
+    if (!options.skipCache && !cacheLoaded && fs::exists(cacheFilePath)) {
+        Stats::ScopedTimer timer(Stats::ParseCache);
         std::cout << "Parsing cache file...";
         if (!fileHandler.loadCacheFile(cacheFilePath, configFileWriteTime)) {
-            std::cout << " Canceled (config file was updated).";
+            std::cout << " Canceled (config file was updated or cache is from an older version).";
         }
         std::cout << "\n";
     }
     
-    int spinnerIndex = 0;
-    std::chrono::steady_clock::time_point spinnerLastTime = std::chrono::steady_clock::now();
     std::cout << "Scanning for changes...\n";
+    auto progress = std::make_unique<ProgressReporter>(getProgressOutput(), "items scanned");
     size_t scanCounter = 0;
+    const bool deferCompares = !options.fastCompare;    // Binary scans wait until all of them are known so they can be sorted, and sources shared by multiple destinations are read once.
+    struct PendingCompare {
+        fs::path readPath, comparePath, writePath;
+        bool snapshot;
+        bool compressed;    // The destination has compression or decompression set.
+    };
+    std::vector<PendingCompare> pendingCompares;
+    const std::time_t snapshotTime = std::time(nullptr);
+    std::map<fs::path, std::pair<fs::path, fs::path>> snapshotPaths;    // Maps a snapshot write path to the previous and new snapshot directories.
+    std::set<fs::path> snapshotListings;
+    fs::path previousSnapshot, currentSnapshot;
+    std::map<fs::path, std::unique_ptr<ChunkStore>> chunkStores;
+    ChunkStore* currentStore = nullptr;
+    const bool streamChanges = (options.copyQueue != nullptr || options.changeWriter != nullptr);
+    std::set<fs::path> streamedPrefixes;    // Destinations that were empty, additions to these get streamed.
+    bool streamAdditions = false;
+    auto streamChange = [&options, &changes](BackupJournal::OperationType type, const fs::path& readPath, const fs::path& writePath) {
+        if (options.changeWriter != nullptr) {
+            options.changeWriter->writeChange((type == BackupJournal::Add ? ChangeWriter::Addition : ChangeWriter::Modification), readPath, writePath);
+        } else {
+            const bool decompress = std::any_of(changes.decompressedPaths.begin(), changes.decompressedPaths.end(), [&writePath](const fs::path& p) {
+                return isPathInside(writePath, p);
+            });
+            if (decompress && !fs::is_directory(readPath)) {
+                type = BackupJournal::Decompress;
+            }
+            options.copyQueue->push({type, readPath, writePath});    // Fails only if the copy thread stopped with an error, which startBackup() reports.
+        }
+    };
+    auto addResult = [&](const fs::path& readPath, const fs::path& comparePath, const fs::path& writePath, bool snapshot, bool equivalent) {
+        if (options.changeWriter != nullptr && !snapshot && !equivalent) {    // A modification never turns into a rename.
+            streamChange(BackupJournal::Replace, readPath, writePath);
+            return;
+        } else if (options.copyQueue != nullptr && !snapshot && !equivalent && fs::is_regular_file(readPath) && fs::is_regular_file(comparePath)) {
+            const bool compressed = std::any_of(changes.compressedPaths.begin(), changes.compressedPaths.end(), [&writePath](const fs::path& p) {
+                return isPathInside(writePath, p);
+            });
+            if (!compressed) {
+                streamChange(BackupJournal::Replace, readPath, writePath);
+                return;
+            }
+        }
+        addComparisonResult(changes, readPath, comparePath, writePath, snapshot, equivalent);
+    };
     
     WriteReadPathTree pathTree = fileHandler.nextWriteReadPathTree();
     auto relativePathIter = pathTree.relativePaths.begin();
@@ -129,43 +386,136 @@ Application::FileChanges Application::checkBackup(const fs::path& configFilename
         }
         
         if (relativePathIter == pathTree.relativePaths.begin()) {    // If first path in the set, add directory contents if it is a new writePrefix.
-            auto insertResult = writePathsChecklist.emplace(pathTree.writePrefix, std::set<fs::path>());
-            if (insertResult.second) {
+            Stats::ScopedTimer timer(Stats::ListDestinations);
+            fs::path listingPrefix = pathTree.writePrefix;
+            if (pathTree.chunkStore) {    // For a chunk store, compare with the manifest of the latest snapshot. Entries are written to the store path and saved in a new snapshot.
+                auto storeIter = chunkStores.find(pathTree.writePrefix);
+                if (storeIter == chunkStores.end()) {
+                    storeIter = chunkStores.emplace(pathTree.writePrefix, std::make_unique<ChunkStore>(pathTree.writePrefix, true)).first;    // A check must not create the store, the backup does that later.
+                    changes.storeCommits.emplace(pathTree.writePrefix, makeSnapshotPath(storeIter->second->getSnapshotsPath(), snapshotTime));
+                }
+                currentStore = storeIter->second.get();
+                previousSnapshot = findLatestSnapshot(currentStore->getSnapshotsPath());
+                currentSnapshot = pathTree.writePrefix;
+                listingPrefix = previousSnapshot;
+                snapshotListings.insert(listingPrefix);
+            } else if (pathTree.snapshot) {    // For a snapshot, compare with the contents of the previous snapshot and write to a new one.
+                auto snapshotIter = snapshotPaths.find(pathTree.writePrefix);
+                if (snapshotIter == snapshotPaths.end()) {
+                    snapshotIter = snapshotPaths.emplace(pathTree.writePrefix, std::make_pair(findLatestSnapshot(pathTree.writePrefix), makeSnapshotPath(pathTree.writePrefix, snapshotTime))).first;
+                    changes.links.emplace(fs::path(), snapshotIter->second.second);
+                }
+                previousSnapshot = snapshotIter->second.first;
+                currentSnapshot = snapshotIter->second.second;
+                listingPrefix = previousSnapshot;
+                snapshotListings.insert(listingPrefix);
+            }
+            if (pathTree.compress && !pathTree.chunkStore) {
+                changes.compressedPaths.insert(pathTree.writePrefix);
+            }
+            if (pathTree.decompress && !pathTree.chunkStore) {
+                changes.decompressedPaths.insert(pathTree.writePrefix);
+            }
+            auto insertResult = writePathsChecklist.emplace(listingPrefix, std::set<fs::path>());
+            const bool newListing = insertResult.second;
+            if (insertResult.second && pathTree.chunkStore) {
+                for (const auto& entry : currentStore->loadManifest(previousSnapshot)) {
+                    insertResult.first->second.emplace(previousSnapshot / entry.first);
+                }
+            } else if (insertResult.second && !listingPrefix.empty()) {
                 try {
-                    for (const auto& entry : fs::recursive_directory_iterator(pathTree.writePrefix)) {
-                        insertResult.first->second.emplace(entry.path());
+                    if (incremental) {
+                        listTreeRecursive(treeState, listingPrefix, insertResult.first->second, options.ioThrottle);
+                    } else {
+                        listDirectoryRecursive(listingPrefix, insertResult.first->second, options.ioThrottle);
                     }
                 } catch (fs::filesystem_error&) {    // If exception during iteration of writePrefix, assume the directory does not currently exist and attempt to create it.
-                    fs::create_directories(pathTree.writePrefix);
+                    if (!pathTree.snapshot) {
+                        fs::create_directories(pathTree.writePrefix);
+                    }
                 }
             }
             
+            if (newListing && streamChanges && !pathTree.snapshot && !pathTree.chunkStore && !pathTree.compress && insertResult.first->second.empty()) {
+                streamedPrefixes.insert(listingPrefix);
+            }
+            streamAdditions = (streamedPrefixes.count(listingPrefix) > 0);
             lastWritePathIter = insertResult.first;
         }
         
         fs::path readPath = pathTree.readPrefix / *relativePathIter;
-        fs::path writePath = pathTree.writePrefix / *relativePathIter;
-        if (lastWritePathIter->second.erase(writePath) == 0) {    // Attempt to remove the write path from the checklist. If it's not found, then it doesn't currently exist and needs to be added.
+        const bool usesSnapshot = (pathTree.snapshot || pathTree.chunkStore);
+        fs::path writePath = (usesSnapshot ? currentSnapshot : pathTree.writePrefix) / *relativePathIter;
+        fs::path comparePath = (usesSnapshot ? previousSnapshot / *relativePathIter : writePath);
+        const bool exists = (lastWritePathIter->second.erase(comparePath) > 0);    // Attempt to remove the write path from the checklist. If it's not found, then it doesn't currently exist and needs to be added.
+        if (!exists && streamAdditions) {    // Parents come before their contents in relativePaths, so directories get created first.
+            streamChange(BackupJournal::Add, readPath, writePath);
+        } else if (!exists) {
             auto emplaceResult = changes.additions.emplace(readPath, writePath);
             assert(emplaceResult.second);
-        } else if (!fileHandler.checkFileEquivalence(readPath, writePath, options.skipCache, options.fastCompare)) {    // If file exists but contents differ, it needs to be updated.
-            auto emplaceResult = changes.modifications.emplace(readPath, writePath);
-            assert(emplaceResult.second);
+        } else if (options.dirtyPaths != nullptr && !isPathDirty(readPath, *options.dirtyPaths)) {    // Nothing changed here since the last backup.
+            addComparisonResult(changes, readPath, comparePath, writePath, usesSnapshot, true);
+        } else if (pathTree.chunkStore) {
+            addComparisonResult(changes, readPath, comparePath, writePath, true, checkStoreEquivalence(readPath, currentStore->loadManifest(previousSnapshot).at(*relativePathIter), options));
+        } else if (deferCompares && !fileHandler.isEquivalenceCached(readPath, comparePath)) {    // File needs a binary scan, wait until all of them are known so they can be sorted.
+            pendingCompares.push_back({readPath, comparePath, writePath, pathTree.snapshot, pathTree.compress || pathTree.decompress});
+        } else {
+            addResult(readPath, comparePath, writePath, pathTree.snapshot, fileHandler.checkFileEquivalence(readPath, comparePath, options.skipCache, options.fastCompare, pathTree.compress || pathTree.decompress));
         }
         
-        printSpinner(spinnerIndex, spinnerLastTime);
+        progress->add();
         ++relativePathIter;
     }
     
+    if (!pendingCompares.empty()) {
+        std::vector<fs::path> readPaths;
+        readPaths.reserve(pendingCompares.size());
+        for (const auto& p : pendingCompares) {
+            readPaths.push_back(p.readPath);
+        }
+        std::map<fs::path, std::vector<size_t>> compareGroups;
+        for (size_t i = 0; i < pendingCompares.size(); ++i) {
+            compareGroups[pendingCompares[i].readPath].push_back(i);
+        }
+        IoScheduler scheduler(options.ioOrder);
+        std::vector<fs::path> comparePaths;
+        for (size_t i : scheduler.sortPaths(readPaths)) {
+            auto groupIter = compareGroups.find(readPaths[i]);
+            if (groupIter == compareGroups.end()) {
+                continue;
+            }
+            const std::vector<size_t>& group = groupIter->second;
+            if (group.size() == 1) {
+                const PendingCompare& p = pendingCompares[i];
+                addResult(p.readPath, p.comparePath, p.writePath, p.snapshot, fileHandler.checkFileEquivalence(p.readPath, p.comparePath, options.skipCache, options.fastCompare, p.compressed));
+            } else {    // Source fans out to multiple destinations, compare them all in one read.
+                comparePaths.clear();
+                bool compressed = false;
+                for (size_t j : group) {
+                    comparePaths.push_back(pendingCompares[j].comparePath);
+                    compressed = (compressed || pendingCompares[j].compressed);
+                }
+                const std::vector<bool> results = fileHandler.checkFileEquivalence(readPaths[i], comparePaths, options.skipCache, options.fastCompare, compressed);
+                for (size_t j = 0; j < group.size(); ++j) {
+                    const PendingCompare& p = pendingCompares[group[j]];
+                    addResult(p.readPath, p.comparePath, p.writePath, p.snapshot, results[j]);
+                }
+            }
+            compareGroups.erase(groupIter);
+        }
+        pendingCompares.clear();
+    }
+    
     for (auto& writePath : writePathsChecklist) {    // Any remaining paths in the checklist (that do not match an ignore) do not belong, mark these for deletion.
+        auto& removedPaths = (snapshotListings.count(writePath.first) > 0 ? changes.drops : changes.deletions);    // Previous snapshots are never modified, the removed items are just left out of the new one.
         for (auto setIter = writePath.second.rbegin(); setIter != writePath.second.rend(); ++setIter) {    // Iterate in reverse order to check paths at the leaves of the directory tree first.
             if (!fileHandler.checkPathIgnored(*setIter)) {
-                auto emplaceResult = changes.deletions.emplace(*setIter);
+                auto emplaceResult = removedPaths.emplace(*setIter);
                 assert(emplaceResult.second);
             } else {    // If one of these matches an ignore, it's parent paths are also ignored so they don't get deleted.
                 fs::path ignoredPath = *setIter;
                 std::string ignoredPathStr = ignoredPath.string();
-                for (std::string::size_type lastSeparator = ignoredPathStr.rfind(FileHandler::pathSeparator); lastSeparator != std::string::npos; lastSeparator = ignoredPathStr.rfind(FileHandler::pathSeparator)) {
+                for (std::string::size_type lastSeparator = ignoredPathStr.rfind(FileHandler::PATH_SEPARATOR); lastSeparator != std::string::npos; lastSeparator = ignoredPathStr.rfind(FileHandler::PATH_SEPARATOR)) {
                     ignoredPathStr.erase(lastSeparator);
                     writePath.second.erase(fs::path(ignoredPathStr));
                 }
@@ -174,25 +524,67 @@ Application::FileChanges Application::checkBackup(const fs::path& configFilename
                 --setIter;    // Converting to a reverse_iterator advances by 1, undo this.
             }
         }
-        printSpinner(spinnerIndex, spinnerLastTime);
     }
     writePathsChecklist.clear();
     
     optimizeForRenames(fileHandler, changes, options.skipCache, options.fastCompare);
+    fileHandler.closeDirectories();    // The backup may change the directories, and a session could keep them open until the next check.
     
     if (!options.skipCache) {
+        Stats::ScopedTimer timer(Stats::SaveCache);
         fs::create_directory(cacheFilePath.parent_path());
         fileHandler.saveCacheFile(cacheFilePath, configFileWriteTime);
+        if (options.incremental) {
+            treeState.save(treeStatePath);
+        }
+    }
+    if (session != nullptr) {
+        session->cacheFileWriteTime = fs::last_write_time(cacheFilePath);
+        session->hasScanned = true;
+        if (session->watcher && session->watcher->isWatchLimitReached()) {    // Not every directory is watched, the next check needs a full scan.
+            session->watcher.reset();
+            treeState.setWatcher(nullptr);
+        }
+        session->changesValid = (options.changeWriter == nullptr);    // Streamed changes are not kept.
+        session->lastFastCompare = options.fastCompare;
+        session->lastChanges = changes;
+        session->lastScanCount = scanCounter;
     }
     
-    std::cout << "Discovered " << scanCounter << " items.\n\n";    // Clear spinner and output scan totals.
-    if (!options.forceBackup) {
+    progress.reset();    // Clears the spinner.
+    std::cout << "Discovered " << scanCounter << " items";
+    if (incremental) {
+        std::cout << " (reused " << treeState.getNumReused() << " of " << (treeState.getNumReused() + treeState.getNumListed()) << " directory listings)";
+    }
+    std::cout << ".\n\n";
+    if (options.changeWriter != nullptr) {
+        writeChanges(changes, *options.changeWriter);
+        options.changeWriter->writeSummary(scanCounter);
+    } else if (!options.forceBackup) {
         printChanges(changes, options.outputLimit, options.displayConfirmation);
     }
     
     return changes;
 }
 
+void Application::writeChanges(const FileChanges& changes, ChangeWriter& writer) {
+    for (const auto& p : changes.deletions) {
+        writer.writeChange(ChangeWriter::Deletion, fs::path(), p);
+    }
+    for (const auto& p : changes.additions) {
+        writer.writeChange(ChangeWriter::Addition, p.first, p.second);
+    }
+    for (const auto& p : changes.modifications) {
+        writer.writeChange(ChangeWriter::Modification, p.first, p.second);
+    }
+    for (const auto& p : changes.renames) {
+        writer.writeChange(ChangeWriter::Rename, p.first, p.second);
+    }
+    for (const auto& p : changes.drops) {
+        writer.writeChange(ChangeWriter::Drop, fs::path(), p);
+    }
+}
+
 void Application::printChanges(const FileChanges& changes, size_t outputLimit, bool displayConfirmation) {
     if (changes.isEmpty()) {
         std::cout << "All up to date.\n";
@@ -255,6 +647,20 @@ void Application::printChanges(const FileChanges& changes, size_t outputLimit, b
         std::cout << CSI::Reset << "\n";
     }
     
+    if (!changes.drops.empty()) {
+        std::cout << "Dropped from snapshots:\n" << CSI::Red;
+        size_t i = 0;
+        for (const auto& p : changes.drops) {
+            if (i == outputLimit) {
+                std::cout << "    (and " << changes.drops.size() - i << " more)\n";
+                break;
+            }
+            std::cout << "x   " << p.string() << "\n";
+            ++i;
+        }
+        std::cout << CSI::Reset << "\n";
+    }
+    
     if (displayConfirmation) {
         std::cout << "After this operation:\n";
         if (!changes.deletions.empty()) {
@@ -269,6 +675,12 @@ void Application::printChanges(const FileChanges& changes, size_t outputLimit, b
         if (!changes.renames.empty()) {
             std::cout << std::setw(5) << changes.renames.size() << " item(s) will be renamed.\n";
         }
+        if (!changes.links.empty()) {
+            std::cout << std::setw(5) << changes.links.size() << " item(s) will be linked from the previous snapshot.\n";
+        }
+        if (!changes.drops.empty()) {
+            std::cout << std::setw(5) << changes.drops.size() << " item(s) will be left out of the new snapshot.\n";
+        }
         std::cout << "\nDo you want to continue [Y/n]? ";
     } else {
         if (!changes.deletions.empty()) {
@@ -283,61 +695,89 @@ void Application::printChanges(const FileChanges& changes, size_t outputLimit, b
         if (!changes.renames.empty()) {
             std::cout << std::setw(5) << changes.renames.size() << " item(s) to rename.\n";
         }
+        if (!changes.links.empty()) {
+            std::cout << std::setw(5) << changes.links.size() << " item(s) to link from the previous snapshot.\n";
+        }
+        if (!changes.drops.empty()) {
+            std::cout << std::setw(5) << changes.drops.size() << " item(s) to leave out of the new snapshot.\n";
+        }
     }
 }
 
 void Application::startBackup(const fs::path& configFilename, const BackupOptions& options) {
-    FileChanges changes = checkBackup(configFilename, options);
-    if (changes.isEmpty()) {
-        return;
-    }
-    if (!options.forceBackup && !checkUserConfirmation()) {
-        std::cout << "\nBackup canceled.\n";
-        return;
-    }
-    
-    size_t numOperations = changes.getCount();
-    size_t numCompleted = 0;
-    std::cout << "\n\n\n";    // Go down 3 lines (1 for spacing, 2 for printProgressBar() alignment).
-    
-    for (const auto& p : changes.additions) {
-        printProgressBar(numCompleted, numOperations);
-        std::cout << "Adding " << p.second.string() << "\n";
-        if (fs::is_directory(p.first)) {
-            fs::create_directory(p.second);
+    IoThrottle::PriorityScope priorityScope(options.ioPriority);
+    BackupJournal journal;
+    fs::path journalPath = BackupJournal::getJournalPath(configFilename);
+    if (options.resumeBackup) {
+        if (!journal.load(journalPath)) {
+            throw std::runtime_error("\"" + configFilename.string() + "\": No interrupted backup found to resume.");
+        }
+        std::cout << "Resuming backup, " << journal.getNumCompleted() << " of " << journal.getOperations().size() << " file operations were previously completed.\n";
+    } else {
+        if (fs::exists(journalPath)) {
+            std::cout << CSI::Yellow << "Warning: Found journal from an interrupted backup. Continuing will replace it, use \"--resume\" to finish that backup instead." << CSI::Reset << "\n";
+        }
+        FileChanges changes;
+        if (options.forceBackup && !keepSession_) {    // No confirmation needed, so the safe copies can start while the scan is still running.
+            fs::remove(journalPath);    // Can't be resumed once the streamed copies change the destination, see the header.
+            BoundedQueue<BackupJournal::Operation> copyQueue(STREAM_QUEUE_SIZE);
+            size_t numStreamed = 0;
+            std::exception_ptr copyError;
+            std::thread copyThread([&]() {
+                try {
+                    numStreamed = runStreamedOperations(copyQueue, options);
+                } catch (...) {
+                    copyError = std::current_exception();
+                    copyQueue.close();    // Stops the scan from waiting on a full queue.
+                }
+            });
+            struct CopyThreadGuard {    // Makes sure the thread is done if the scan throws.
+                BoundedQueue<BackupJournal::Operation>& queue;
+                std::thread& thread;
+                ~CopyThreadGuard() {
+                    queue.close();
+                    thread.join();
+                }
+            };
+            {
+                CopyThreadGuard guard{copyQueue, copyThread};
+                BackupOptions checkOptions = options;
+                checkOptions.copyQueue = &copyQueue;
+                changes = checkBackup(configFilename, checkOptions);
+            }
+            if (copyError) {
+                std::rethrow_exception(copyError);
+            }
+            if (numStreamed > 0) {
+                std::cout << "Finished " << numStreamed << " file operations during the scan.\n";
+            }
         } else {
-            fs::copy_file(p.first, p.second);    // Note, fs::copy_file() is used explicitly here since there seems to be some bugs present in fs::copy() (observed when copying single file from FAT32 to NTFS drive).
+            changes = checkBackup(configFilename, options);
         }
-        ++numCompleted;
-    }
-    
-    for (const auto& p : changes.renames) {    // Renaming must happen after additions and before removals so that there are no missing directory conflicts.
-        printProgressBar(numCompleted, numOperations);
-        std::cout << "Renaming " << p.first.string() << "\n";
-        fs::rename(p.first, p.second);
-        ++numCompleted;
-    }
-    
-    for (auto setIter = changes.deletions.rbegin(); setIter != changes.deletions.rend(); ++setIter) {    // Iterate through deletions in reverse to avoid using recursive delete function.
-        printProgressBar(numCompleted, numOperations);
-        std::cout << "Removing " << setIter->string() << "\n";
-        fs::remove(*setIter);
-        ++numCompleted;
-    }
-    
-    for (const auto& p : changes.modifications) {
-        printProgressBar(numCompleted, numOperations);
-        std::cout << "Replacing " << p.second.string() << "\n";
-        fs::copy_file(p.first, p.second, fs::copy_options::overwrite_existing);
-        ++numCompleted;
+        if (changes.isEmpty()) {
+            fs::remove(journalPath);    // Any interrupted backup has been completed by other means.
+            return;
+        }
+        if (!options.forceBackup && !checkUserConfirmation()) {
+            std::cout << "\nBackup canceled.\n";
+            return;
+        }
+        
+        for (const auto& p : changes.storeCommits) {    // Entries left from an interrupted backup that was not resumed are discarded.
+            ChunkStore(p.first).discardPending();
+        }
+        journal.create(journalPath, planOperations(changes, options.ioOrder));
     }
     
-    printProgressBar(numCompleted, numOperations);
+    std::cout << "\n";
+    runOperations(journal, options);
+    journal.remove();
     std::cout << "File operations completed.\n";
     
-    if (!options.forceBackup) {
+    if (!options.forceBackup || options.resumeBackup) {    // A resumed backup never ran a check, so this also brings the cache up to date.
         BackupOptions options2 = options;
         options2.forceBackup = true;
+        options2.resumeBackup = false;
         FileChanges changesAfter = checkBackup(configFilename, options2);
         if (!changesAfter.isEmpty()) {
             std::cout << CSI::Yellow << "Warning: Found remaining changes after running backup. This may have been caused by an error during\n";
@@ -348,14 +788,255 @@ void Application::startBackup(const fs::path& configFilename, const BackupOption
     }
 }
 
+size_t Application::startBackups(const std::vector<fs::path>& configFilenames, const BackupOptions& options, unsigned int numThreads) {
+    numThreads = std::max(1u, std::min(numThreads, static_cast<unsigned int>(configFilenames.size())));
+    std::cout << "Starting backups of " << configFilenames.size() << " configs with " << numThreads << " threads.\n" << std::flush;
+    
+    CapturedOutputBuffer outputBuffer(std::cout.rdbuf());
+    struct OutputRestore {    // Puts back the original buffer when done.
+        std::streambuf* buffer;
+        ~OutputRestore() { std::cout.rdbuf(buffer); }
+    } outputRestore = {std::cout.rdbuf(&outputBuffer)};
+    
+    std::atomic<size_t> nextIndex(0), numFailed(0);
+    std::mutex printMutex;
+    auto runBackups = [&]() {
+        std::string output;
+        for (size_t i = nextIndex++; i < configFilenames.size(); i = nextIndex++) {
+            output.clear();
+            CapturedOutputBuffer::setCapture(&output);
+            bool failed = true;
+            try {
+                Application app;
+                app.startBackup(configFilenames[i], options);
+                failed = false;
+            } catch (fs::filesystem_error& ex) {
+                std::cout << CSI::Red << "Error: " << ex.code().message() << ": \"" << ex.path1().string() << "\"";
+                if (!ex.path2().empty()) {
+                    std::cout << ", \"" << ex.path2().string() << "\"";
+                }
+                std::cout << CSI::Reset << "\n";
+            } catch (std::exception& ex) {
+                std::cout << CSI::Red << "Error: " << ex.what() << CSI::Reset << "\n";
+            }
+            numFailed += (failed ? 1 : 0);
+            CapturedOutputBuffer::setCapture(nullptr);
+            
+            std::lock_guard<std::mutex> lock(printMutex);
+            std::cout << "\n" << CSI::Bold << "[" << configFilenames[i].string() << "]" << CSI::Reset << "\n" << output << std::flush;
+        }
+    };
+    
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < numThreads; ++i) {
+        threads.emplace_back(runBackups);
+    }
+    runBackups();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    std::cout << "\nFinished backups of " << configFilenames.size() - numFailed << " of " << configFilenames.size() << " configs.\n";
+    return numFailed;
+}
+
+void Application::watchBackup(const fs::path& configFilename, const BackupOptions& options, std::chrono::milliseconds delay) {
+    constexpr auto IDLE_POLL_INTERVAL = std::chrono::seconds(1);    // How often the config file is checked for updates.
+    constexpr auto FULL_SCAN_INTERVAL = std::chrono::minutes(10);    // Used when not every directory could be watched.
+    constexpr int MAX_DELAY_FACTOR = 10;
+    if (!DirectoryWatcher::isSupported()) {
+        throw std::runtime_error("Watching for file changes is not supported on this system.");
+    }
+    struct SessionPause {    // The watch keeps its own state, the session is turned back on if it stops with an error.
+        bool& keepSession;
+        bool previous;
+        ~SessionPause() { keepSession = previous; }
+    } sessionPause = {keepSession_, keepSession_};
+    keepSession_ = false;
+    BackupOptions watchOptions = options;
+    watchOptions.forceBackup = true;
+    watchOptions.resumeBackup = false;
+    std::set<fs::path> dirtyPaths;
+    
+    while (true) {    // Restarts here when the config file changes.
+        const fs::file_time_type configFileWriteTime = fs::last_write_time(configFilename);
+        DirectoryWatcher watcher;    // Watches are added before the first backup so that nothing is missed in between.
+        const std::set<fs::path> watchDirectories = findWatchDirectories(configFilename);
+        for (const auto& directory : watchDirectories) {
+            if (!watcher.addWatch(directory) && watcher.isWatchLimitReached()) {
+                break;
+            }
+        }
+        if (watcher.isWatchLimitReached()) {
+            std::cout << CSI::Yellow << "Warning: Reached the limit of " << DirectoryWatcher::getWatchLimit() << " watched directories (see /proc/sys/fs/inotify/max_user_watches).\n";
+            std::cout << "Only part of the files are watched, a full scan is done every " << std::chrono::duration_cast<std::chrono::minutes>(FULL_SCAN_INTERVAL).count() << " minutes instead." << CSI::Reset << "\n";
+        }
+        std::cout << "Watching " << watcher.getNumWatches() << " directories for changes.\n";
+        
+        watchOptions.dirtyPaths = nullptr;
+        startBackup(configFilename, watchOptions);
+        dirtyPaths.clear();
+        bool missedEvents = watcher.checkOverflow();
+        std::chrono::steady_clock::time_point lastScanTime = std::chrono::steady_clock::now();
+        
+        auto removeCachePaths = [&dirtyPaths, cacheDirectory = fs::absolute(".backuptools")]() {    // Saving the cache file would trigger another backup if it is in a watched directory.
+            for (auto iter = dirtyPaths.lower_bound(cacheDirectory); iter != dirtyPaths.end() && isPathInside(*iter, cacheDirectory); ) {
+                iter = dirtyPaths.erase(iter);
+            }
+        };
+        
+        while (fs::last_write_time(configFilename) == configFileWriteTime) {
+            const bool fullScanDue = (watcher.isWatchLimitReached() && std::chrono::steady_clock::now() - lastScanTime >= FULL_SCAN_INTERVAL);
+            watcher.waitForChanges(IDLE_POLL_INTERVAL, dirtyPaths);
+            removeCachePaths();
+            missedEvents = (watcher.checkOverflow() || missedEvents);
+            if (dirtyPaths.empty() && !fullScanDue && !missedEvents) {
+                continue;
+            }
+            const std::chrono::steady_clock::time_point batchStartTime = std::chrono::steady_clock::now();
+            while (watcher.waitForChanges(delay, dirtyPaths) && std::chrono::steady_clock::now() - batchStartTime < delay * MAX_DELAY_FACTOR) {}    // Wait for the changes to settle down.
+            removeCachePaths();
+            
+            if (watcher.isWatchLimitReached()) {
+                watchOptions.dirtyPaths = nullptr;
+            } else if (watcher.checkOverflow() || missedEvents) {    // Some events were lost, rescan everything that is watched.
+                std::cout << CSI::Yellow << "Warning: Missed some file change events, rescanning the watched directories." << CSI::Reset << "\n";
+                dirtyPaths.insert(watchDirectories.begin(), watchDirectories.end());
+                watchOptions.dirtyPaths = &dirtyPaths;
+            } else {
+                watchOptions.dirtyPaths = &dirtyPaths;
+            }
+            std::time_t currentTime = std::time(nullptr);
+            std::cout << "\n[" << std::put_time(std::localtime(&currentTime), "%Y-%m-%d %H:%M:%S") << "] Found changes in " << dirtyPaths.size() << " paths.\n";
+            try {
+                startBackup(configFilename, watchOptions);
+                dirtyPaths.clear();    // Kept for the next try if the backup failed.
+                missedEvents = false;
+            } catch (std::exception& ex) {
+                std::cout << CSI::Red << "Error: " << ex.what() << CSI::Reset << "\n";
+            }
+            lastScanTime = std::chrono::steady_clock::now();
+        }
+        std::cout << "\nConfig file was updated, restarting watch.\n";
+    }
+}
+
+std::shared_ptr<const ConfigPlan> Application::loadConfigPlan(const fs::path& configFilename, bool skipCache) {
+    auto plan = std::make_shared<ConfigPlan>();
+    if (skipCache) {
+        plan->compile(configFilename);
+        return plan;
+    }
+    fs::path planFilePath(".backuptools/" + configFilename.string() + ".plan");
+    if (!plan->loadOrCompile(configFilename, planFilePath)) {
+        try {
+            fs::create_directory(planFilePath.parent_path());
+            plan->save(planFilePath);
+        } catch (std::exception& ex) {    // The plan only saves time, the scan can go on without it.
+            std::cout << CSI::Yellow << "Warning: Unable to save config plan: " << ex.what() << CSI::Reset << "\n";
+        }
+    }
+    return plan;
+}
+
+std::set<fs::path> Application::findWatchDirectories(const fs::path& configFilename) {
+    std::set<fs::path> directories;
+    FileHandler fileHandler;
+    fileHandler.loadConfigPlan(loadConfigPlan(configFilename, false));
+    for (WriteReadPathTree pathTree = fileHandler.nextWriteReadPathTree(); !pathTree.isEmpty(); pathTree = fileHandler.nextWriteReadPathTree()) {
+        directories.insert(pathTree.readPrefix);    // New items matching a glob pattern show up here.
+        for (const auto& p : pathTree.relativePaths) {
+            fs::path readPath = pathTree.readPrefix / p;
+            if (fs::is_directory(fs::symlink_status(readPath))) {
+                directories.insert(std::move(readPath));
+            }
+        }
+    }
+    return directories;
+}
+
+void Application::restoreChunkStore(const fs::path& storePath, const fs::path& outputPath, const std::string& snapshotName) {
+    if (!ChunkStore::isStore(storePath)) {
+        throw std::runtime_error("\"" + storePath.string() + "\": Path is not a chunk store.");
+    }
+    ChunkStore store(storePath);
+    fs::path snapshotPath = (snapshotName.empty() ? findLatestSnapshot(store.getSnapshotsPath()) : store.getSnapshotsPath() / snapshotName);
+    if (snapshotPath.empty() || !fs::exists(snapshotPath / "manifest")) {
+        throw std::runtime_error("\"" + storePath.string() + "\": Snapshot not found.");
+    }
+    std::cout << "Restoring snapshot " << snapshotPath.filename().string() << "...\n";
+    store.restoreSnapshot(snapshotPath, outputPath);
+    std::cout << "Done.\n";
+}
+
+constexpr size_t SNAPSHOT_NAME_LENGTH = 17;    // Length of "YYYY-MM-DD_HHMMSS".
+
+/**
+ * Returns the suffix number of a snapshot directory name (zero if no suffix),
+ * or -1 if the name is not a snapshot.
+ */
+long parseSnapshotName(const std::string& name) {
+    constexpr char format[] = "dddd-dd-dd_dddddd";
+    if (name.length() < SNAPSHOT_NAME_LENGTH) {
+        return -1;
+    }
+    for (size_t i = 0; i < SNAPSHOT_NAME_LENGTH; ++i) {
+        if (format[i] == 'd' ? !std::isdigit(static_cast<unsigned char>(name[i])) : name[i] != format[i]) {
+            return -1;
+        }
+    }
+    if (name.length() == SNAPSHOT_NAME_LENGTH) {
+        return 0;
+    } else if (name[SNAPSHOT_NAME_LENGTH] != '-' || name.length() == SNAPSHOT_NAME_LENGTH + 1 || name.length() > SNAPSHOT_NAME_LENGTH + 9) {
+        return -1;
+    }
+    long suffix = 0;
+    for (size_t i = SNAPSHOT_NAME_LENGTH + 1; i < name.length(); ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(name[i]))) {
+            return -1;
+        }
+        suffix = suffix * 10 + (name[i] - '0');
+    }
+    return suffix;
+}
+
+fs::path Application::findLatestSnapshot(const fs::path& snapshotRoot) {
+    fs::path latestSnapshot;
+    std::pair<std::string, long> latestKey;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(snapshotRoot, ec)) {
+        const std::string name = entry.path().filename().string();
+        const long suffix = parseSnapshotName(name);
+        if (suffix < 0 || !entry.is_directory(ec)) {
+            continue;
+        }
+        std::pair<std::string, long> key(name.substr(0, SNAPSHOT_NAME_LENGTH), suffix);    // Compare the suffix as a number so that "-10" comes after "-9".
+        if (latestSnapshot.empty() || key > latestKey) {
+            latestSnapshot = entry.path();
+            latestKey = key;
+        }
+    }
+    return latestSnapshot;
+}
+
+fs::path Application::makeSnapshotPath(const fs::path& snapshotRoot, std::time_t time) {
+    char name[32];
+    std::strftime(name, sizeof(name), "%Y-%m-%d_%H%M%S", std::localtime(&time));
+    fs::path snapshotPath = snapshotRoot / name;
+    for (int i = 1; fs::exists(snapshotPath); ++i) {
+        snapshotPath = snapshotRoot / (std::string(name) + "-" + std::to_string(i));
+    }
+    return snapshotPath;
+}
+
 void Application::findCommonParentPath(std::string& lastPath, const std::string& currentPath, const std::string& currentRootPath) {
-    std::string::size_type nextSeparator = currentPath.find(FileHandler::pathSeparator, lastPath.length());    // Find the separator in currentPath after the length of lastPath (may not be found).
+    std::string::size_type nextSeparator = currentPath.find(FileHandler::PATH_SEPARATOR, lastPath.length());    // Find the separator in currentPath after the length of lastPath (may not be found).
     
     if (lastPath != currentPath.substr(0, nextSeparator)) {    // If the paths differ, need to update lastPath.
         size_t i = 0;
         while (true) {
             if (i >= lastPath.length() || i >= currentPath.length() || lastPath[i] != currentPath[i]) {    // When a different sub-path is found, step back to the last sub-path that both have in common and make this the new lastPath.
-                std::string::size_type previousSeparator = currentPath.rfind(FileHandler::pathSeparator, i - 1);
+                std::string::size_type previousSeparator = currentPath.rfind(FileHandler::PATH_SEPARATOR, i - 1);
                 
                 if (previousSeparator == std::string::npos || currentRootPath.length() > previousSeparator) {    // Edge case in case we're close to the root path.
                     lastPath = currentRootPath;
@@ -369,14 +1050,14 @@ void Application::findCommonParentPath(std::string& lastPath, const std::string&
     }
 }
 
-void Application::printTree(const fs::path& searchPath, const std::map<fs::path, fs::path>& readPathsMapping, bool verbose, bool countOnly, bool pruneIgnored) {
+void Application::printTree(const fs::path& searchPath, const std::unordered_map<std::string, fs::path>& readPathsMapping, const std::unordered_set<std::string>& trackedParents, bool verbose, bool countOnly, bool pruneIgnored) {
     fs::file_status searchPathStatus = fs::status(searchPath);
     if (!fs::exists(searchPathStatus)) {
         throw std::runtime_error("\"" + searchPath.string() + "\": Unable to find path.");
     } else if (fs::is_directory(searchPathStatus)) {
         std::cout << CSI::Cyan << searchPath.string() << CSI::Reset << "\n";
         PrintTreeStats stats;
-        printTree2(searchPath, readPathsMapping, verbose, !countOnly, pruneIgnored, "", &stats);
+        printTree2(searchPath, readPathsMapping, trackedParents, verbose, !countOnly, pruneIgnored, &stats);
         
         std::cout << "\n" << stats.numDirectories << " directories, " << stats.numFiles << " files\n";
         std::cout << stats.numIgnoredDirectories << " ignored directories, " << stats.numIgnoredFiles << " ignored files\n";
@@ -385,82 +1066,180 @@ void Application::printTree(const fs::path& searchPath, const std::map<fs::path,
     }
 }
 
-void Application::printTree2(const fs::path& searchPath, const std::map<fs::path, fs::path>& readPathsMapping, bool verbose, bool printOutput, bool pruneIgnored, const std::string& prefix, PrintTreeStats* stats) {
-    std::vector<fs::directory_entry> searchContents;
-    //std::priority_queue<fs::directory_entry, std::vector<fs::directory_entry>, decltype(&compareFilename)> searchContents(&compareFilename);    // Tested priority queue optimization, but turned out to be about 1.5 times slower.
-    try {
-        for (const auto& entry : fs::directory_iterator(searchPath)) {
-            searchContents.emplace_back(entry);
-        }
-    } catch (fs::filesystem_error& ex) {
-        if (printOutput) {
-            std::cout << CSI::Red << "Error: " << ex.code().message() << ": \"" << ex.path1().string() << "\"";
-            if (!ex.path2().empty()) {
-                std::cout << ", \"" << ex.path2().string() << "\"";
-            }
-            std::cout << CSI::Reset << "\n";
-        }
-        return;
-    } catch (std::exception& ex) {
-        if (printOutput) {
-            std::cout << prefix << CSI::Red << "Error: " << ex.what() << CSI::Reset << "\n";
-        }
-        return;
-    }
-    if (searchContents.empty()) {    // Current directory is empty.
-        auto findResult = readPathsMapping.find(searchPath);
-        if (verbose && printOutput && findResult != readPathsMapping.end()) {
-            std::cout << prefix << " -> " << findResult->second.string() << "\n";
-        }
-        return;
-    }
+/**
+ * The path and prefix are shared by all levels, each directory appends to them
+ * and they get cut back to the parent once it is done. The entries of the
+ * directories being printed are kept in one vector (and their names in one
+ * string), so a directory costs no allocations once these have grown.
+ */
+void Application::printTree2(const fs::path& searchPath, const std::unordered_map<std::string, fs::path>& readPathsMapping, const std::unordered_set<std::string>& trackedParents, bool verbose, bool printOutput, bool pruneIgnored, PrintTreeStats* stats) {
+    struct TreeEntry {
+        size_t nameOffset;    // Position in names.
+        size_t nameLength;
+        bool isDirectory;
+        bool expand;    // Directory is tracked or has a tracked item inside.
+        const fs::path* writePath;    // Set if the item is tracked.
+    };
+    struct TreeLevel {
+        size_t entriesBegin;
+        size_t nextEntry;
+        size_t namesBegin;
+        size_t parentPathLength;
+        size_t parentPrefixLength;
+        bool printOutput;
+    };
     
-    std::sort(searchContents.begin(), searchContents.end(), compareFilename);
+    std::string path = searchPath.string();
+    std::string prefix, names, output;
+    std::vector<TreeEntry> entries;
+    std::vector<TreeLevel> levels;
+    DirectoryReader directoryReader;
+    output.reserve(TREE_OUTPUT_BUFFER_SIZE + 4096);
     
-    if (pruneIgnored) {    // Determine if all children are ignored, and display ellipsis if so.
+    auto appendCsi = [&output](CSI csiCode) {
+        output += "\033[";
+        output += std::to_string(static_cast<int>(csiCode));
+        output += 'm';
+    };
+    auto appendName = [&](CSI color, const char* name, size_t nameLength) {
+        appendCsi(color);
+        output.append(name, nameLength);
+        appendCsi(CSI::Reset);
+        output += '\n';
+    };
+    auto flushOutput = [&output]() {
+        std::cout.write(output.data(), static_cast<std::streamsize>(output.size()));
+        output.clear();
+    };
+    
+    // Lists the directory at path and adds a level for it. The path and prefix are restored to the parent's if nothing was added.
+    auto enterDirectory = [&](size_t parentPathLength, size_t parentPrefixLength, bool levelPrintOutput) {
+        const size_t entriesBegin = entries.size();
+        const size_t namesBegin = names.size();
         bool allIgnored = true;
-        for (size_t i = 0; i < searchContents.size(); ++i) {
-            if (readPathsMapping.find(searchContents[i].path()) != readPathsMapping.end()) {
-                allIgnored = false;
-                break;
+        try {
+            directoryReader.open(path);
+            const bool needsSeparator = (!path.empty() && path.back() != FileHandler::PATH_SEPARATOR);
+            const size_t pathLength = path.length();
+            DirectoryReader::Entry entry;
+            while (directoryReader.next(entry)) {
+                if (needsSeparator) {
+                    path += FileHandler::PATH_SEPARATOR;
+                }
+                path += entry.name;
+                auto findResult = readPathsMapping.find(path);
+                const bool isDirectory = directoryReader.isDirectory(entry);
+                const bool tracked = (findResult != readPathsMapping.end());
+                const bool expand = isDirectory && (tracked || trackedParents.count(path) > 0);
+                allIgnored = allIgnored && !tracked && !expand;
+                entries.push_back({names.size(), entry.name.length(), isDirectory, expand, (tracked ? &findResult->second : nullptr)});
+                names += entry.name;
+                path.resize(pathLength);
+            }
+        } catch (fs::filesystem_error& ex) {
+            if (levelPrintOutput) {
+                appendCsi(CSI::Red);
+                output += "Error: " + ex.code().message() + ": \"" + ex.path1().string() + "\"";
+                if (!ex.path2().empty()) {
+                    output += ", \"" + ex.path2().string() + "\"";
+                }
+                appendCsi(CSI::Reset);
+                output += '\n';
+            }
+            entries.resize(entriesBegin);
+        } catch (std::exception& ex) {
+            if (levelPrintOutput) {
+                output += prefix;
+                appendCsi(CSI::Red);
+                output += "Error: " + std::string(ex.what());
+                appendCsi(CSI::Reset);
+                output += '\n';
+            }
+            entries.resize(entriesBegin);
+        }
+        
+        if (entries.size() == entriesBegin) {    // Current directory is empty (or could not be listed).
+            names.resize(namesBegin);
+            if (verbose && levelPrintOutput) {
+                auto findResult = readPathsMapping.find(path);
+                if (findResult != readPathsMapping.end()) {
+                    output += prefix + " -> " + findResult->second.string() + "\n";
+                }
             }
+            path.resize(parentPathLength);
+            prefix.resize(parentPrefixLength);
+            return;
         }
-        if (allIgnored && printOutput) {
-            std::cout << prefix << "\'-- " << CSI::Yellow << "(...)" << CSI::Reset << "\n";
-            printOutput = false;
+        std::sort(entries.begin() + entriesBegin, entries.end(), [&names](const TreeEntry& lhs, const TreeEntry& rhs) {
+            return compareFilenameView(std::string_view(names.data() + lhs.nameOffset, lhs.nameLength), std::string_view(names.data() + rhs.nameOffset, rhs.nameLength));
+        });
+        if (pruneIgnored && allIgnored && levelPrintOutput) {    // Display ellipsis if all children are ignored.
+            output += prefix + "\'-- ";
+            appendName(CSI::Yellow, "(...)", 5);
+            levelPrintOutput = false;
         }
-    }
-    for (size_t i = 0; i < searchContents.size(); ++i) {
-        if (printOutput) {
-            std::cout << prefix;
+        levels.push_back({entriesBegin, entriesBegin, namesBegin, parentPathLength, parentPrefixLength, levelPrintOutput});
+    };
+    
+    enterDirectory(path.length(), 0, printOutput);
+    while (!levels.empty()) {
+        TreeLevel& level = levels.back();
+        if (level.nextEntry == entries.size()) {    // Done with this directory, go back to the parent.
+            entries.resize(level.entriesBegin);
+            names.resize(level.namesBegin);
+            path.resize(level.parentPathLength);
+            prefix.resize(level.parentPrefixLength);
+            levels.pop_back();
+            continue;
         }
-        auto findResult = readPathsMapping.find(searchContents[i].path());
-        const bool isTracked = (findResult != readPathsMapping.end());
-        const bool isLast = (i + 1 == searchContents.size());
+        const TreeEntry entry = entries[level.nextEntry];
+        ++level.nextEntry;
+        const bool isLast = (level.nextEntry == entries.size());
+        const bool levelPrintOutput = level.printOutput;
+        const char* name = names.data() + entry.nameOffset;
+        const bool isTracked = (entry.writePath != nullptr);
         
-        if (searchContents[i].is_directory()) {
+        if (levelPrintOutput) {
+            output += prefix;
+            output += (isLast ? "\'-- " : "|-- ");
+        }
+        if (entry.isDirectory) {
             ++stats->numDirectories;
-            if (printOutput) {
-                std::cout << (isLast ? "\'-- " : "|-- ") << (isTracked ? CSI::Cyan : CSI::Yellow) << searchContents[i].path().filename().string() << CSI::Reset << "\n";
+            if (levelPrintOutput) {
+                appendName(isTracked ? CSI::Cyan : CSI::Yellow, name, entry.nameLength);
             }
             if (!isTracked) {
                 ++stats->numIgnoredDirectories;
             }
-            printTree2(searchContents[i].path(), readPathsMapping, verbose, printOutput, pruneIgnored, prefix + (isLast ? "    " : "|   "), stats);
+            if (entry.expand) {    // Ignored directories are not listed, they could be much larger than the tracked ones.
+                const size_t pathLength = path.length(), prefixLength = prefix.length();
+                if (!path.empty() && path.back() != FileHandler::PATH_SEPARATOR) {
+                    path += FileHandler::PATH_SEPARATOR;
+                }
+                path.append(name, entry.nameLength);
+                prefix += (isLast ? "    " : "|   ");
+                enterDirectory(pathLength, prefixLength, levelPrintOutput);
+            }
         } else {
             ++stats->numFiles;
-            if (printOutput) {
-                std::cout << (isLast ? "\'-- " : "|-- ") << (isTracked ? CSI::Green : CSI::Yellow) << searchContents[i].path().filename().string() << CSI::Reset << "\n";
+            if (levelPrintOutput) {
+                appendName(isTracked ? CSI::Green : CSI::Yellow, name, entry.nameLength);
             }
             if (isTracked) {
-                if (verbose && printOutput) {
-                    std::cout << prefix << (isLast ? "    " : "|   ") << " -> " << findResult->second.string() << "\n";
+                if (verbose && levelPrintOutput) {
+                    output += prefix;
+                    output += (isLast ? "    " : "|   ");
+                    output += " -> " + entry.writePath->string() + "\n";
                 }
             } else {
                 ++stats->numIgnoredFiles;
             }
         }
+        if (output.size() >= TREE_OUTPUT_BUFFER_SIZE) {
+            flushOutput();
+        }
     }
+    flushOutput();
 }
 
 /**
@@ -473,10 +1252,16 @@ void Application::printTree2(const fs::path& searchPath, const std::map<fs::path
  * this.
  */
 void Application::optimizeForRenames(FileHandler& fileHandler, FileChanges& changes, bool skipCache, bool fastCompare) {
+    Stats::ScopedTimer timer(Stats::DetectRenames);
     std::map<std::uintmax_t, std::set<fs::path>> deletionsFileSizes;    // Map file sizes to their paths for quick lookup of which files match the contents of a path.
     for (const auto& p : changes.deletions) {
         if (fs::is_regular_file(p)) {
-            deletionsFileSizes[fs::file_size(p)].emplace(p);
+            Compressor::Header header;
+            if (!changes.compressedPaths.empty() && Compressor::readHeader(p, header)) {    // Compressed files are matched by their original size.
+                deletionsFileSizes[header.size].emplace(p);
+            } else {
+                deletionsFileSizes[fs::file_size(p)].emplace(p);
+            }
         }
     }
     
@@ -486,7 +1271,7 @@ void Application::optimizeForRenames(FileHandler& fileHandler, FileChanges& chan
             auto findResult = deletionsFileSizes.find(fs::file_size(additionsIter->first));
             if (findResult != deletionsFileSizes.end()) {    // If file matches size of one of the deleted ones, check if contents match.
                 for (auto deletionsSetIter = findResult->second.begin(); deletionsSetIter != findResult->second.end(); ++deletionsSetIter) {
-                    if (fileHandler.checkFileEquivalence(additionsIter->first, *deletionsSetIter, skipCache, fastCompare)) {
+                    if (fileHandler.checkFileEquivalence(additionsIter->first, *deletionsSetIter, skipCache, fastCompare, !changes.compressedPaths.empty())) {
                         changes.renames.emplace(*deletionsSetIter, additionsIter->second);    // Found a match, add it as a rename and remove the corresponding addition and deletion (subdirectories are not touched because fs::rename() expects existing directories).
                         auto deletionsIter = changes.deletions.find(*deletionsSetIter);
                         changes.deletions.erase(deletionsIter);
@@ -505,25 +1290,418 @@ void Application::optimizeForRenames(FileHandler& fileHandler, FileChanges& chan
     }
 }
 
-void Application::printSpinner(int& index, std::chrono::steady_clock::time_point& lastTime) {
-    constexpr char spinnerStr[] = "|/-\\";
-    std::chrono::steady_clock::time_point currTime = std::chrono::steady_clock::now();
+void Application::addComparisonResult(FileChanges& changes, const fs::path& readPath, const fs::path& comparePath, const fs::path& writePath, bool snapshot, bool equivalent) {
+    if (!snapshot) {
+        if (!equivalent) {    // If file exists but contents differ, it needs to be updated.
+            auto emplaceResult = changes.modifications.emplace(readPath, writePath);
+            assert(emplaceResult.second);
+        }
+    } else if (equivalent) {    // Unchanged items are linked to the previous snapshot, directories just get created.
+        changes.links.emplace((fs::is_directory(comparePath) ? fs::path() : comparePath), writePath);
+    } else if (fs::is_directory(readPath)) {    // Type changed from file to directory.
+        changes.additions.emplace(readPath, writePath);
+    } else {
+        changes.modifications.emplace(readPath, writePath);
+    }
+}
+
+bool Application::checkStoreEquivalence(const fs::path& source, const ChunkStore::ManifestEntry& entry, const BackupOptions& options) {
+    Stats::ScopedTimer timer(Stats::CompareFiles);
+    fs::file_status sourceStatus = fs::status(source);
+    if (!fs::exists(sourceStatus)) {
+        return false;
+    } else if (fs::is_directory(sourceStatus) || entry.isDirectory) {
+        return fs::is_directory(sourceStatus) && entry.isDirectory;
+    } else if (fs::file_size(source) != entry.size) {
+        return false;
+    }
     
-    if (std::chrono::duration_cast<std::chrono::milliseconds>(currTime - lastTime).count() > 200) {
-        index = (index + 1) % 4;
-        std::cout << spinnerStr[index];
-        std::cout << "\033[1D";    // Move cursor back 1.
-        lastTime = currTime;
+    const fs::file_time_type::duration sourceTime = fs::last_write_time(source).time_since_epoch();
+    if (options.fastCompare) {
+        auto writeTimeDifference = std::chrono::duration_cast<std::chrono::milliseconds>(sourceTime - fs::file_time_type::duration(entry.writeTime)).count();
+        return std::abs(writeTimeDifference) < 2000;
+    } else if (!options.skipCache && sourceTime.count() == entry.writeTime) {
+        return true;
     }
+    return ChunkStore::hashFile(source, options.ioThrottle, options.pageCacheMode) == entry.digest;
 }
 
-void Application::printProgressBar(size_t current, size_t total) {
-    constexpr int MAX_BAR_SIZE = 80;
+std::vector<BackupJournal::Operation> Application::planOperations(const FileChanges& changes, IoOrder ioOrder) {
+    std::vector<BackupJournal::Operation> operations;
+    operations.reserve(changes.getCount() + changes.links.size() + changes.storeCommits.size());
+    IoScheduler scheduler(ioOrder);
+    std::vector<fs::path> sourcePaths;
+    std::vector<const fs::path*> destPaths;
+    std::vector<BackupJournal::OperationType> copyTypes;
+    std::map<fs::path, size_t> sourceCounts;    // Finds sources that fan out to multiple destinations.
+    bool fanOut = false;
+    for (const auto& p : changes.additions) {
+        fanOut = (++sourceCounts[p.first] > 1 || fanOut);
+    }
+    for (const auto& p : changes.modifications) {
+        fanOut = (++sourceCounts[p.first] > 1 || fanOut);
+    }
+    const bool directoriesFirst = (ioOrder != IoOrder::Name || !changes.links.empty() || fanOut);
+    auto getType = [&changes](BackupJournal::OperationType type, const fs::path& source, const fs::path& dest) {    // Changes the type to Store or Keep if dest is inside a chunk store, or Compress/Decompress if it needs compression or decompression.
+        for (const auto& p : changes.storeCommits) {
+            if (isPathInside(dest, p.first)) {
+                return (type == BackupJournal::Link ? BackupJournal::Keep : BackupJournal::Store);
+            }
+        }
+        if (type != BackupJournal::Link) {
+            for (const auto& p : changes.compressedPaths) {
+                if (isPathInside(dest, p) && !fs::is_directory(source)) {
+                    return BackupJournal::Compress;
+                }
+            }
+            for (const auto& p : changes.decompressedPaths) {
+                if (isPathInside(dest, p) && !fs::is_directory(source)) {
+                    return BackupJournal::Decompress;
+                }
+            }
+        }
+        return type;
+    };
+    auto addCopies = [&]() {    // Adds the file copies sorted by source location. Copies of the same source are kept together so that it only needs to be read once.
+        std::map<fs::path, std::vector<size_t>> fanOutGroups;
+        for (size_t i = 0; fanOut && i < sourcePaths.size(); ++i) {
+            fanOutGroups[sourcePaths[i]].push_back(i);
+        }
+        for (size_t i : scheduler.sortPaths(sourcePaths)) {
+            if (!fanOut) {
+                operations.push_back({getType(copyTypes[i], sourcePaths[i], *destPaths[i]), sourcePaths[i], *destPaths[i]});
+                continue;
+            }
+            auto groupIter = fanOutGroups.find(sourcePaths[i]);
+            if (groupIter == fanOutGroups.end()) {
+                continue;
+            }
+            for (size_t j : groupIter->second) {
+                operations.push_back({getType(copyTypes[j], sourcePaths[j], *destPaths[j]), sourcePaths[j], *destPaths[j]});
+            }
+            fanOutGroups.erase(groupIter);
+        }
+        sourcePaths.clear();
+        destPaths.clear();
+        copyTypes.clear();
+    };
+    
+    for (const auto& p : changes.links) {    // New directories in a snapshot, these get merged with the added directories below.
+        if (p.first.empty()) {
+            operations.push_back({BackupJournal::Link, p.first, p.second});
+        }
+    }
+    for (const auto& p : changes.additions) {
+        if (!directoriesFirst || fs::is_directory(p.first)) {
+            operations.push_back({getType(BackupJournal::Add, p.first, p.second), p.first, p.second});
+        } else {
+            sourcePaths.push_back(p.first);
+            destPaths.push_back(&p.second);
+            copyTypes.push_back(BackupJournal::Add);
+        }
+    }
+    for (const auto& p : changes.modifications) {    // A modification with the same source as an addition goes with it.
+        if (fanOut && sourceCounts[p.first] > 1 && std::find(sourcePaths.begin(), sourcePaths.end(), p.first) != sourcePaths.end()) {
+            sourcePaths.push_back(p.first);
+            destPaths.push_back(&p.second);
+            copyTypes.push_back(BackupJournal::Replace);
+        }
+    }
+    std::stable_sort(operations.begin(), operations.end(), [](const BackupJournal::Operation& lhs, const BackupJournal::Operation& rhs) {    // Directories are created in name order so that parents are created before children.
+        return compareFilename(lhs.dest, rhs.dest);
+    });
+    for (const auto& p : changes.links) {    // Linking unchanged files in a snapshot is cheap, do it before copying anything.
+        if (!p.first.empty()) {
+            operations.push_back({getType(BackupJournal::Link, p.first, p.second), p.first, p.second});
+        }
+    }
+    std::set<fs::path> copiedSources;
+    if (fanOut) {
+        copiedSources.insert(sourcePaths.begin(), sourcePaths.end());
+    }
+    addCopies();
+    for (const auto& p : changes.renames) {    // Renaming must happen after additions and before removals so that there are no missing directory conflicts.
+        operations.push_back({BackupJournal::Rename, p.first, p.second});
+    }
+    for (auto setIter = changes.deletions.rbegin(); setIter != changes.deletions.rend(); ++setIter) {    // Iterate through deletions in reverse to avoid using recursive delete function.
+        operations.push_back({BackupJournal::Remove, fs::path(), *setIter});
+    }
+    for (const auto& p : changes.modifications) {
+        if (copiedSources.count(p.first) == 0) {
+            sourcePaths.push_back(p.first);
+            destPaths.push_back(&p.second);
+            copyTypes.push_back(BackupJournal::Replace);
+        }
+    }
+    addCopies();
+    for (const auto& p : changes.storeCommits) {    // The new snapshots are saved once everything else is done.
+        operations.push_back({BackupJournal::Commit, p.first, p.second});
+    }
+    
+    return operations;
+}
+
+/**
+ * Returns the chunk store that contains path, the store is opened and added to
+ * chunkStores if it was not used yet.
+ */
+ChunkStore& findChunkStore(std::map<fs::path, std::unique_ptr<ChunkStore>>& chunkStores, const fs::path& path) {
+    for (fs::path root = path; ; root = root.parent_path()) {
+        auto storeIter = chunkStores.find(root);
+        if (storeIter != chunkStores.end()) {
+            return *storeIter->second;
+        } else if (ChunkStore::isStore(root)) {
+            return *chunkStores.emplace(root, std::make_unique<ChunkStore>(root)).first->second;
+        } else if (!root.has_relative_path()) {
+            throw std::runtime_error("\"" + path.string() + "\": Path is not inside a chunk store.");
+        }
+    }
+}
+
+size_t Application::runStreamedOperations(BoundedQueue<BackupJournal::Operation>& queue, const BackupOptions& options) {
+    // Not timed as FileOperations, this runs at the same time as the scan which is already timed (the bytes and syscalls still count).
+    FileSyncer syncer(options.durability);
+    DirectoryHandles sourceDirectories;
+    size_t numCompleted = 0;
+    BackupJournal::Operation op;
+    while (queue.pop(op)) {
+        IoThrottle::IoSlot ioSlot(options.ioThrottle);
+        if (op.type == BackupJournal::Add && fs::is_directory(op.source)) {
+            fs::create_directory(op.dest);
+            syncer.commitDirectory(op.dest.parent_path());
+        } else {
+            copyFileAtomic(op.source, op.dest, syncer, sourceDirectories, options, op.type);
+        }
+        if (syncer.needsFlush()) {
+            syncer.flush();
+        }
+        ++numCompleted;
+    }
+    syncer.flush();
+    return numCompleted;
+}
+
+/**
+ * Each operation is safe to run a second time, this happens on resume if the
+ * process was killed after an operation finished but before it was marked as
+ * complete in the journal. With the Batch durability level, operations are
+ * only marked complete after the syncer flushes them, otherwise a resume after
+ * power loss could skip a file that never made it to the disk.
+ */
+void Application::runOperations(BackupJournal& journal, const BackupOptions& options) {
+    Stats::ScopedTimer timer(Stats::FileOperations);
+    const std::vector<BackupJournal::Operation>& operations = journal.getOperations();
+    size_t numOperations = operations.size();
+    FileSyncer syncer(options.durability);
+    DirectoryHandles sourceDirectories;    // Sources are only read here, so the directories can stay open until all operations are done.
+    std::vector<size_t> pendingCompletions;
+    std::map<fs::path, std::unique_ptr<ChunkStore>> chunkStores;
+    std::map<fs::path, std::vector<size_t>> storeCompletions;    // Store and Keep operations of each chunk store, these are only durable once its snapshot is committed.
+    ProgressReporter progress(getProgressOutput(), "file operations completed", numOperations, journal.getNumCompleted());
     
-    std::string percent = std::to_string(std::lround(static_cast<double>(current) / total * 100.0)) + "%";
-    int barLength = std::lround(static_cast<double>(current) / total * MAX_BAR_SIZE);
-    std::cout << "\033[2A";    // Move cursor up by 2.
-    std::cout << std::left << std::setw(4) << percent << std::right << '[' << std::setfill('=') << std::setw(barLength) << '>' << std::setfill(' ') << std::setw(MAX_BAR_SIZE - barLength + (barLength > 0 ? 1 : 0)) << ']' << '\n';
-    std::cout << "\033[2K";    // Clear line.
-    // The message line should be outputted next followed by a newline.
+    for (size_t i = 0; i < numOperations; ++i) {
+        if (journal.isCompleted(i)) {
+            continue;
+        }
+        const BackupJournal::Operation& op = operations[i];
+        
+        size_t groupEnd = i + 1;    // Copies of the same source that follow this one are done together (fan-out).
+        auto isCopy = [](const BackupJournal::Operation& op2) {
+            return op2.type == BackupJournal::Add || op2.type == BackupJournal::Replace;
+        };
+        if (isCopy(op)) {
+            while (groupEnd < numOperations && !journal.isCompleted(groupEnd) && isCopy(operations[groupEnd]) && operations[groupEnd].source == op.source) {
+                ++groupEnd;
+            }
+            if (groupEnd > i + 1 && fs::is_directory(op.source)) {
+                groupEnd = i + 1;
+            }
+        }
+        
+        IoThrottle::IoSlot ioSlot(options.ioThrottle);
+        if (groupEnd > i + 1) {
+            std::vector<fs::path> dests;
+            for (size_t j = i; j < groupEnd; ++j) {
+                progress.setMessage((operations[j].type == BackupJournal::Add ? "Adding " : "Replacing ") + operations[j].dest.string());
+                dests.push_back(operations[j].dest);
+            }
+            copyFileFanOut(op.source, dests, syncer, sourceDirectories, options);
+        } else if (op.type == BackupJournal::Add) {
+            progress.setMessage("Adding " + op.dest.string());
+            if (fs::is_directory(op.source)) {
+                fs::create_directory(op.dest);
+                syncer.commitDirectory(op.dest.parent_path());
+            } else {
+                copyFileAtomic(op.source, op.dest, syncer, sourceDirectories, options);
+            }
+        } else if (op.type == BackupJournal::Compress || op.type == BackupJournal::Decompress) {
+            progress.setMessage((op.type == BackupJournal::Compress ? "Compressing " : "Decompressing ") + op.dest.string());
+            copyFileAtomic(op.source, op.dest, syncer, sourceDirectories, options, op.type);
+        } else if (op.type == BackupJournal::Link) {
+            progress.setMessage("Linking " + op.dest.string());
+            if (op.source.empty()) {
+                fs::create_directories(op.dest);
+            } else if (!fs::exists(op.dest)) {    // Skip if the link was already made.
+                fs::create_hard_link(op.source, op.dest);
+            }
+            syncer.commitDirectory(op.dest.parent_path());
+        } else if (op.type == BackupJournal::Store) {
+            progress.setMessage("Storing " + op.dest.string());
+            ChunkStore& store = findChunkStore(chunkStores, op.dest);
+            if (fs::is_directory(op.source)) {
+                store.storeDirectory(op.dest.lexically_relative(store.getRoot()));
+            } else {
+                store.storeFile(op.source, op.dest.lexically_relative(store.getRoot()), options.ioThrottle, options.pageCacheMode);
+            }
+            storeCompletions[store.getRoot()].push_back(i);
+        } else if (op.type == BackupJournal::Keep) {
+            progress.setMessage("Keeping " + op.dest.string());
+            ChunkStore& store = findChunkStore(chunkStores, op.dest);
+            store.keepEntry(op.source);
+            storeCompletions[store.getRoot()].push_back(i);
+        } else if (op.type == BackupJournal::Commit) {
+            progress.setMessage("Committing snapshot " + op.dest.string());
+            ChunkStore& store = findChunkStore(chunkStores, op.source);
+            store.commitSnapshot(op.dest, syncer);
+            for (size_t j : storeCompletions[store.getRoot()]) {    // The syncer was flushed, so the manifest with these entries is durable now.
+                journal.markCompleted(j);
+            }
+            storeCompletions.erase(store.getRoot());
+        } else if (op.type == BackupJournal::Rename) {
+            progress.setMessage("Renaming " + op.source.string());
+            if (fs::exists(op.source) || !fs::exists(op.dest)) {    // Skip if the rename already happened.
+                fs::rename(op.source, op.dest);
+            }
+            syncer.commitDirectory(op.source.parent_path());
+            syncer.commitDirectory(op.dest.parent_path());
+        } else if (op.type == BackupJournal::Remove) {
+            progress.setMessage("Removing " + op.dest.string());
+            fs::remove(op.dest);
+            syncer.commitDirectory(op.dest.parent_path());
+        } else {
+            progress.setMessage("Replacing " + op.dest.string());
+            copyFileAtomic(op.source, op.dest, syncer, sourceDirectories, options);
+        }
+        
+        for (; i < groupEnd; ++i) {
+            if (operations[i].type == BackupJournal::Store || operations[i].type == BackupJournal::Keep) {    // Marked with the Commit instead, the store only flushes its files when committing.
+                progress.add();
+                continue;
+            }
+            if (options.durability == DurabilityLevel::Batch) {
+                pendingCompletions.push_back(i);
+                if (syncer.needsFlush()) {
+                    syncer.flush();
+                    for (size_t j : pendingCompletions) {
+                        journal.markCompleted(j);
+                    }
+                    pendingCompletions.clear();
+                }
+            } else {
+                journal.markCompleted(i);
+            }
+            progress.add();
+        }
+        --i;
+    }
+    
+    syncer.flush();    // Everything must be durable before the cache gets saved again.
+    for (size_t j : pendingCompletions) {
+        journal.markCompleted(j);
+    }
+}
+
+void Application::copyFileAtomic(const fs::path& source, const fs::path& dest, FileSyncer& syncer, DirectoryHandles& sourceDirectories, const BackupOptions& options, BackupJournal::OperationType type) {
+    fs::path tempPath = dest;
+    tempPath += ".backuptools-tmp";
+    IoThrottle* ioThrottle = (options.ioThrottle != nullptr && options.ioThrottle->isLimited() ? options.ioThrottle : nullptr);
+    if ((type == BackupJournal::Compress && Compressor::compressFile(source, tempPath, ioThrottle, options.pageCacheMode)) || (type == BackupJournal::Decompress && Compressor::decompressFile(source, tempPath, ioThrottle))) {
+        fs::permissions(tempPath, fs::status(source).permissions());
+    } else if (ioThrottle == nullptr && (options.pageCacheMode == PageCacheMode::Normal || (options.pageCacheMode == PageCacheMode::DropBehind && fs::file_size(source) <= FileReader::DROP_WINDOW_SIZE))) {
+        fs::copy_file(source, tempPath, fs::copy_options::overwrite_existing);    // Note, fs::copy_file() is used explicitly here since there seems to be some bugs present in fs::copy() (observed when copying single file from FAT32 to NTFS drive).
+        if (options.pageCacheMode == PageCacheMode::DropBehind) {    // Small files still get the fast in-kernel copy, their pages are dropped afterwards (like a single window of FileReader).
+            FileReader::dropFromCache(source);
+        }
+        if (Stats::isEnabled()) {    // The calls made by fs::copy_file() are not known, so these are not counted as syscalls.
+            Stats::add(Stats::BytesRead, fs::file_size(tempPath));
+        }
+    } else {
+        FileReader sourceFile;
+        if (!sourceFile.open(source, options.pageCacheMode, &sourceDirectories)) {
+            throw std::runtime_error("\"" + source.string() + "\": Unable to open file for reading.");
+        }
+        std::ofstream tempFile(tempPath, std::ios::binary | std::ios::trunc);
+        if (!tempFile.is_open()) {
+            throw std::runtime_error("\"" + tempPath.string() + "\": Unable to open file for writing.");
+        }
+        
+        constexpr size_t COPY_BUFFER_SIZE = 256 * 1024;
+        AlignedBuffer buffer(COPY_BUFFER_SIZE);
+        while (true) {
+            const size_t numRead = sourceFile.read(buffer.data(), COPY_BUFFER_SIZE);
+            if (numRead == 0) {
+                break;
+            }
+            if (ioThrottle != nullptr) {
+                ioThrottle->acquireRead(static_cast<uintmax_t>(numRead));
+                ioThrottle->acquireWrite(static_cast<uintmax_t>(numRead));
+            }
+            tempFile.write(buffer.data(), static_cast<std::streamsize>(numRead));
+            Stats::add(Stats::Syscalls);
+        }
+        sourceFile.close();
+        tempFile.close();
+        if (!tempFile) {
+            throw std::runtime_error("\"" + source.string() + "\": Failed to copy file.");
+        }
+        fs::permissions(tempPath, fs::status(source).permissions());
+    }
+    syncer.commitFile(tempPath, dest, fs::file_size(tempPath));
+}
+
+void Application::copyFileFanOut(const fs::path& source, const std::vector<fs::path>& dests, FileSyncer& syncer, DirectoryHandles& sourceDirectories, const BackupOptions& options) {
+    IoThrottle* ioThrottle = (options.ioThrottle != nullptr && options.ioThrottle->isLimited() ? options.ioThrottle : nullptr);
+    FileReader sourceFile;
+    if (!sourceFile.open(source, options.pageCacheMode, &sourceDirectories)) {
+        throw std::runtime_error("\"" + source.string() + "\": Unable to open file for reading.");
+    }
+    std::vector<fs::path> tempPaths;
+    std::vector<std::ofstream> tempFiles;
+    for (const auto& dest : dests) {
+        tempPaths.push_back(dest);
+        tempPaths.back() += ".backuptools-tmp";
+        tempFiles.emplace_back(tempPaths.back(), std::ios::binary | std::ios::trunc);
+        if (!tempFiles.back().is_open()) {
+            throw std::runtime_error("\"" + tempPaths.back().string() + "\": Unable to open file for writing.");
+        }
+    }
+    
+    constexpr size_t COPY_BUFFER_SIZE = 256 * 1024;
+    AlignedBuffer buffer(COPY_BUFFER_SIZE);
+    while (true) {
+        const size_t numRead = sourceFile.read(buffer.data(), COPY_BUFFER_SIZE);
+        if (numRead == 0) {
+            break;
+        }
+        if (ioThrottle != nullptr) {
+            ioThrottle->acquireRead(static_cast<uintmax_t>(numRead));
+        }
+        for (auto& tempFile : tempFiles) {
+            if (ioThrottle != nullptr) {
+                ioThrottle->acquireWrite(static_cast<uintmax_t>(numRead));
+            }
+            tempFile.write(buffer.data(), static_cast<std::streamsize>(numRead));
+            Stats::add(Stats::Syscalls);
+        }
+    }
+    sourceFile.close();
+    const fs::perms permissions = fs::status(source).permissions();
+    for (size_t i = 0; i < dests.size(); ++i) {
+        tempFiles[i].close();
+        if (!tempFiles[i]) {
+            throw std::runtime_error("\"" + source.string() + "\": Failed to copy file.");
+        }
+        fs::permissions(tempPaths[i], permissions);
+        syncer.commitFile(tempPaths[i], dests[i], fs::file_size(tempPaths[i]));
+    }
 }
@@ -1,12 +1,27 @@
 #ifndef APPLICATION_H_
 #define APPLICATION_H_
 
+#include "BackupTools/BackupJournal.h"
+#include "BackupTools/BoundedQueue.h"
+#include "BackupTools/ChangeWriter.h"
+#include "BackupTools/ChunkStore.h"
+#include "BackupTools/ConfigPlan.h"
+#include "BackupTools/DirectoryHandles.h"
+#include "BackupTools/DirectoryWatcher.h"
 #include "BackupTools/FileHandler.h"
+#include "BackupTools/FileSyncer.h"
+#include "BackupTools/IoScheduler.h"
+#include "BackupTools/IoThrottle.h"
+#include "BackupTools/TreeState.h"
 #include <chrono>
+#include <ctime>
 #include <filesystem>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -33,9 +48,14 @@ public:
         std::set<std::pair<fs::path, fs::path>, decltype(&compareFileChange)> additions;
         std::set<std::pair<fs::path, fs::path>, decltype(&compareFileChange)> modifications;
         std::set<std::pair<fs::path, fs::path>, decltype(&compareFileChange)> renames;
+        std::set<std::pair<fs::path, fs::path>, decltype(&compareFileChange)> links;    // Unchanged items in a snapshot, the first path is the item in the previous snapshot (empty for directories).
+        std::set<fs::path, decltype(&compareFilename)> drops;    // Items in the previous snapshot that are no longer in the source, these are left out of the new snapshot.
+        std::map<fs::path, fs::path> storeCommits;    // Maps a chunk store to the new snapshot to save in it.
+        std::set<fs::path> compressedPaths;    // Destinations that have compression enabled.
+        std::set<fs::path> decompressedPaths;    // Destinations that have decompression enabled, their sources may be compressed.
         
-        FileChanges() : deletions(&compareFilename), additions(&compareFileChange), modifications(&compareFileChange), renames(&compareFileChange) {}
-        bool isEmpty() const { return deletions.empty() && additions.empty() && modifications.empty() && renames.empty(); }
+        FileChanges() : deletions(&compareFilename), additions(&compareFileChange), modifications(&compareFileChange), renames(&compareFileChange), links(&compareFileChange), drops(&compareFilename) {}
+        bool isEmpty() const { return deletions.empty() && additions.empty() && modifications.empty() && renames.empty() && drops.empty(); }    // The links only matter if something else changed.
         size_t getCount() const { return deletions.size() + additions.size() + modifications.size() + renames.size(); }
     };
     
@@ -49,6 +69,16 @@ public:
         bool skipCache;
         bool fastCompare;
         bool forceBackup;
+        bool resumeBackup;
+        DurabilityLevel durability;
+        IoThrottle* ioThrottle;
+        IoPriority ioPriority;    // Applied while checkBackup() or startBackup() runs, then the previous priority is put back.
+        PageCacheMode pageCacheMode;
+        IoOrder ioOrder;
+        bool incremental;    // Reuses the saved listings of unchanged directories (see TreeState).
+        const std::set<fs::path>* dirtyPaths;    // Used by watchBackup(), only these source paths (and their contents) are compared if set. New and removed items are always found.
+        BoundedQueue<BackupJournal::Operation>* copyQueue;    // Set by startBackup() for a forced backup, see checkBackup(). Should be nullptr otherwise.
+        ChangeWriter* changeWriter;    // Changes are written here instead of being printed if set, see checkBackup().
     };
     
     /**
@@ -57,6 +87,18 @@ public:
      */
     static bool checkUserConfirmation();
     
+    Application();
+    
+    /**
+     * Keeps the loaded cache, directory listings, and the last scan results
+     * between calls to checkBackup() (used in interactive mode). These are
+     * only revalidated by the next check of the same config file: the cache
+     * is not parsed again unless the file changed on disk, directories are
+     * only listed again if modified, and if no directory was modified since
+     * the last scan (found with a DirectoryWatcher) its results are reused.
+     */
+    void setKeepSession(bool keepSession);
+    
     /**
      * Displays tree of tracked files.
      */
@@ -64,6 +106,17 @@ public:
     
     /**
      * Lists changes to make during backup.
+     * 
+     * If options.copyQueue is set, the copies that can't be affected by rename
+     * detection are pushed to the queue as soon as they are found instead of
+     * being added to the returned changes. These are modifications of regular
+     * files, and additions to a destination that was empty when it was listed
+     * (no deletions there can turn them into renames). Snapshots, chunk
+     * stores, and compressed destinations are never streamed.
+     * 
+     * If options.changeWriter is set, the same changes (and any modification)
+     * are written to it as soon as they are found. The rest of the changes
+     * are written at the end of the scan, followed by the summary line.
      */
     FileChanges checkBackup(const fs::path& configFilename, const BackupOptions& options);
     
@@ -74,11 +127,100 @@ public:
     void printChanges(const FileChanges& changes, size_t outputLimit, bool displayConfirmation = false);
     
     /**
-     * Starts a backup/restore of files.
+     * Writes each of the given changes to the writer (no summary).
+     */
+    static void writeChanges(const FileChanges& changes, ChangeWriter& writer);
+    
+    /**
+     * Starts a backup/restore of files. The file operations are recorded in a
+     * journal first, if the backup gets interrupted then it can be continued
+     * later with the resumeBackup option (this skips the scan for changes, the
+     * check afterwards still runs to update the cache and report anything that
+     * changed since the interruption).
+     * 
+     * With forceBackup set (and outside of a session), the scan and the copies
+     * run as a pipeline: checkBackup() streams the safe copies into a bounded
+     * queue that another thread works through while the scan continues. The
+     * rest of the changes (deletions, renames, and anything rename detection
+     * could still change) wait for the end of the scan as usual.
+     * 
+     * Streamed copies are not in the journal, which is still crash-safe: each
+     * one replaces the destination with a rename of a finished temporary file
+     * (see copyFileAtomic()) so a destination is never partly written, and no
+     * other operation depends on them since rename detection never uses these
+     * files. A backup interrupted during the scan just finds the missing
+     * copies again on the next scan (a leftover temporary file gets deleted
+     * as an extra item). The journal of an earlier interrupted backup is
+     * removed before the copies start, resuming it afterwards would run
+     * operations planned for the destination as it was before them.
      */
     void startBackup(const fs::path& configFilename, const BackupOptions& options);
     
+    /**
+     * Runs startBackup() for each of the config files using a pool of
+     * numThreads threads, each config gets its own Application. The output of
+     * a backup is held back and printed all at once when it finishes so that
+     * the configs don't get mixed together, this means the options should have
+     * forceBackup set (a confirmation can't be answered). A shared ioThrottle
+     * in the options limits the I/O of all the backups together. An error only
+     * stops the config it happened in, returns the number of configs that
+     * failed.
+     */
+    static size_t startBackups(const std::vector<fs::path>& configFilenames, const BackupOptions& options, unsigned int numThreads);
+    
+    /**
+     * Runs a backup, then keeps watching the source directories and backs up
+     * the changes as they happen. Changes are batched until no events arrive
+     * for the delay (or ten times the delay if files keep changing), and only
+     * the changed paths get compared. Falls back to a rescan of the watched
+     * directories if events were lost, or to periodic full scans if the
+     * system limit on watches is reached. Restarts when the config file is
+     * updated. Runs until the process is stopped.
+     */
+    void watchBackup(const fs::path& configFilename, const BackupOptions& options, std::chrono::milliseconds delay);
+    
+    /**
+     * Writes the files in a snapshot of a chunk store to outputPath. The most
+     * recent snapshot is used if snapshotName is empty.
+     */
+    void restoreChunkStore(const fs::path& storePath, const fs::path& outputPath, const std::string& snapshotName);
+    
+    /**
+     * Returns the most recent snapshot directory in snapshotRoot, or an empty
+     * path if there is none. Snapshot directories are named by the time of the
+     * backup like "2021-05-31_153000" (with a "-N" suffix if more than one was
+     * made in the same second).
+     */
+    static fs::path findLatestSnapshot(const fs::path& snapshotRoot);
+    
+    /**
+     * Returns the path for a new snapshot in snapshotRoot for the given time.
+     * The path is guaranteed to not exist yet.
+     */
+    static fs::path makeSnapshotPath(const fs::path& snapshotRoot, std::time_t time);
+    
 private:
+    /**
+     * State kept by setKeepSession() for one config file.
+     */
+    struct SessionState {
+        fs::path configFilename;
+        fs::file_time_type configFileWriteTime;
+        fs::file_time_type cacheFileWriteTime;    // Write time of the cache file when it was last saved.
+        bool hasScanned = false;
+        std::shared_ptr<const ConfigPlan> plan;    // Compiled once for the session, the session is reset if the config changes.
+        FileHandler fileHandler;    // Holds the cached file write times.
+        TreeState treeState;
+        std::unique_ptr<DirectoryWatcher> watcher;    // Has a watch on each directory listed in the last scan, nullptr if some are missing.
+        bool changesValid = false;    // The last scan completed and lastChanges can be reused if nothing changed.
+        bool lastFastCompare = false;
+        FileChanges lastChanges;
+        size_t lastScanCount = 0;    // Number of items scanned to find lastChanges.
+    };
+    
+    bool keepSession_;
+    std::unique_ptr<SessionState> session_;
+    
     /**
      * Used in printTree() to display totals at the end.
      */
@@ -91,6 +233,20 @@ private:
         PrintTreeStats() : numDirectories(0), numFiles(0), numIgnoredDirectories(0), numIgnoredFiles(0) {}
     };
     
+    /**
+     * Returns the compiled config. The plan saved in the .backuptools
+     * directory is used if it was made from the same config contents,
+     * otherwise the config is compiled and the plan is saved for next time.
+     * With skipCache, the config is always compiled and nothing is saved.
+     */
+    static std::shared_ptr<const ConfigPlan> loadConfigPlan(const fs::path& configFilename, bool skipCache);
+    
+    /**
+     * Returns the tracked source directories (and the directories that glob
+     * patterns start from) for watchBackup().
+     */
+    static std::set<fs::path> findWatchDirectories(const fs::path& configFilename);
+    
     /**
      * Determines the longest common parent between lastPath and currentPath and
      * updates lastPath to equal this. This can only cause lastPath to stay the
@@ -102,13 +258,17 @@ private:
     /**
      * Used in printPaths() to handle the output of the file tree once the split
      * points for each tree are found (a tree cannot span multiple root paths).
+     * Only the tracked directories and the trackedParents (directories with a
+     * tracked item somewhere inside) are listed, so the ignored items next to
+     * tracked ones show up but ignored directories are not expanded.
      */
-    static void printTree(const fs::path& searchPath, const std::map<fs::path, fs::path>& readPathsMapping, bool verbose, bool countOnly, bool pruneIgnored);
+    static void printTree(const fs::path& searchPath, const std::unordered_map<std::string, fs::path>& readPathsMapping, const std::unordered_set<std::string>& trackedParents, bool verbose, bool countOnly, bool pruneIgnored);
     
     /**
-     * Recursive call in printTree().
+     * Walks the directories for printTree() with an explicit stack, the output
+     * is written to std::cout in large chunks.
      */
-    static void printTree2(const fs::path& searchPath, const std::map<fs::path, fs::path>& readPathsMapping, bool verbose, bool printOutput, bool pruneIgnored, const std::string& prefix, PrintTreeStats* stats);
+    static void printTree2(const fs::path& searchPath, const std::unordered_map<std::string, fs::path>& readPathsMapping, const std::unordered_set<std::string>& trackedParents, bool verbose, bool printOutput, bool pruneIgnored, PrintTreeStats* stats);
     
     /**
      * Modifies changes so that files that are equivalent and have different
@@ -118,15 +278,68 @@ private:
     static void optimizeForRenames(FileHandler& fileHandler, FileChanges& changes, bool skipCache, bool fastCompare);
     
     /**
-     * Displays a spinner at the cursor, the spinner only updates every 200ms.
+     * Adds the result of comparing readPath with comparePath to changes. For a
+     * normal destination the two paths are the same file and writePath is
+     * comparePath. For a snapshot, comparePath is in the previous snapshot and
+     * writePath is in the new one, so equivalent items get linked.
+     */
+    static void addComparisonResult(FileChanges& changes, const fs::path& readPath, const fs::path& comparePath, const fs::path& writePath, bool snapshot, bool equivalent);
+    
+    /**
+     * Compares a source file with its entry in the latest snapshot of a chunk
+     * store. The modification time saved in the entry acts like the cache for
+     * normal destinations, the file is only hashed if it differs (or if
+     * skipCache is set).
+     */
+    static bool checkStoreEquivalence(const fs::path& source, const ChunkStore::ManifestEntry& entry, const BackupOptions& options);
+    
+    /**
+     * Converts changes into a list of file operations in the order that they
+     * must be run. Within the additions (after all new directories are created)
+     * and the modifications, the files are sorted by their source location on
+     * disk with the given ioOrder. Snapshot links run after the directories
+     * are created and before any files are copied. Destinations inside a chunk
+     * store use the Store and Keep types instead, and each store gets a Commit
+     * at the end. Files copied to a destination with compression use the
+     * Compress type, and with decompression the Decompress type.
+     */
+    static std::vector<BackupJournal::Operation> planOperations(const FileChanges& changes, IoOrder ioOrder);
+    
+    /**
+     * Runs each operation in the journal that has not been completed yet, and
+     * marks them as complete once they are durable. The Store and Keep
+     * operations of a chunk store are marked when its Commit finishes, so a
+     * resumed backup stores them again if the snapshot was not committed.
+     */
+    static void runOperations(BackupJournal& journal, const BackupOptions& options);
+    
+    /**
+     * Runs the copies that checkBackup() pushes into the queue until it gets
+     * closed, returns the number of them. Only Add and Replace operations are
+     * expected (and Decompress for files).
+     */
+    static size_t runStreamedOperations(BoundedQueue<BackupJournal::Operation>& queue, const BackupOptions& options);
+    
+    /**
+     * Copies source to a temporary file next to dest, then has the syncer
+     * rename it to dest. A partially copied file never shows up at the
+     * destination this way. If the ioThrottle has limits set or a page cache
+     * mode other than Normal is used, the file is copied in blocks so that the
+     * reads can be throttled and kept out of the cache. With the Compress type,
+     * the dest is written compressed if the file is worth compressing. With the
+     * Decompress type, a compressed source is decompressed, so restoring from a
+     * compressed backup gives back the original files. Any other type makes a
+     * plain copy. Block copies open the source relative to its directory in
+     * sourceDirectories.
      */
-    static void printSpinner(int& index, std::chrono::steady_clock::time_point& lastTime);
+    static void copyFileAtomic(const fs::path& source, const fs::path& dest, FileSyncer& syncer, DirectoryHandles& sourceDirectories, const BackupOptions& options, BackupJournal::OperationType type = BackupJournal::Add);
     
     /**
-     * Display progress bar with a message below. Progress goes from 0% up to
-     * 100% when current is equal to total.
+     * Copies one source file to multiple destinations (fan-out) with a single
+     * read of the source. Each dest is written and committed the same way as
+     * copyFileAtomic().
      */
-    static void printProgressBar(size_t current, size_t total);
+    static void copyFileFanOut(const fs::path& source, const std::vector<fs::path>& dests, FileSyncer& syncer, DirectoryHandles& sourceDirectories, const BackupOptions& options);
 };
 
 #endif
@@ -65,10 +65,18 @@ int ArgumentParser::nextOption(std::string* errorMessagePtr) {
                 
                 int optionFormatResult = hasOptionFormat(argv_[index_]);
                 if (optionFormatResult == 2) {    // Check long options.
-                    std::string optionStr(argv_[index_]);
+                    const char* equalsSign = std::strchr(argv_[index_] + 2, '=');    // The parameter can also be attached with "--name=value".
+                    const size_t nameLength = (equalsSign != nullptr ? static_cast<size_t>(equalsSign - argv_[index_] - 2) : std::strlen(argv_[index_] + 2));
+                    std::string optionStr(argv_[index_], nameLength + 2);
                     
                     for (const OptionEntry& option : options_) {
-                        if (std::strcmp(option.longName, argv_[index_] + 2) == 0) {
+                        if (nameLength > 0 && std::strlen(option.longName) == nameLength && std::strncmp(option.longName, argv_[index_] + 2, nameLength) == 0) {
+                            if (equalsSign != nullptr && option.argumentType == NoArg) {
+                                ++index_;
+                                throw OptionNotFoundError(std::string(argv_[index_ - 1]));
+                            } else if (equalsSign != nullptr) {
+                                optionArg_ = equalsSign + 1;
+                            }
                             ++index_;
                             return foundOption(option, optionStr);
                         }
@@ -181,7 +189,7 @@ bool ArgumentParser::hasParameter() {
 }
 
 int ArgumentParser::foundOption(const OptionEntry& option, const std::string& optionStr) {
-    if (option.argumentType == RequiredArg || option.argumentType == OptionalArg) {
+    if (optionArg_ == nullptr && (option.argumentType == RequiredArg || option.argumentType == OptionalArg)) {    // Skip if the parameter was attached to the option.
         if (hasParameter()) {
             optionArg_ = argv_[index_];
             ++index_;
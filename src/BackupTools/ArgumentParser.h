@@ -11,7 +11,8 @@
  * setArguments() to initialize, then get options from nextOption() in a loop.
  * Options are considered as each character following a single dash '-' and
  * long options are identifiers following two dashes. If an option includes a
- * parameter passed to it, it must follow immediately after the option. After
+ * parameter passed to it, it must follow immediately after the option (a long
+ * option can also attach it with an equals sign, like "--name=value"). After
  * all arguments finish parsing, nextOption() returns -1 and the contents of
  * argv are rearranged to place all non-option arguments (except for option
  * parameters) at the end. This uses a stable sort to preserve ordering. After
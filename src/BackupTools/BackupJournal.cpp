@@ -0,0 +1,124 @@
+#include "BackupTools/BackupJournal.h"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+BackupJournal::BackupJournal() :
+    numCompleted_(0) {
+}
+
+fs::path BackupJournal::getJournalPath(const fs::path& configFilename) {
+    return fs::path(".backuptools/" + configFilename.string() + ".journal");
+}
+
+void BackupJournal::create(const fs::path& filename, const std::vector<Operation>& operations) {
+    if (journalFile_.is_open()) {
+        journalFile_.close();
+    }
+    fs::create_directories(filename.parent_path());
+    journalFile_.open(filename, std::ios::binary | std::ios::trunc);
+    if (!journalFile_.is_open()) {
+        throw std::runtime_error("\"" + filename.string() + "\": Unable to open file for writing.");
+    }
+    
+    filename_ = filename;
+    operations_ = operations;
+    completed_.assign(operations_.size(), false);
+    numCompleted_ = 0;
+    
+    const uint64_t numOperations = operations_.size();
+    journalFile_.write(reinterpret_cast<const char*>(&numOperations), sizeof(numOperations));
+    journalFile_.put('\n');
+    for (const auto& op : operations_) {
+        journalFile_.put(static_cast<char>(op.type));
+        journalFile_.write(op.source.string().c_str(), op.source.string().length());    // Write source and destination paths with null characters after each.
+        journalFile_.put('\0');
+        journalFile_.write(op.dest.string().c_str(), op.dest.string().length());
+        journalFile_.put('\0');
+        journalFile_.put('\n');
+    }
+    journalFile_.flush();    // The plan must be written out in full before the first file operation starts.
+    if (!journalFile_) {
+        throw std::runtime_error("\"" + filename.string() + "\": Failed to write journal.");
+    }
+}
+
+bool BackupJournal::load(const fs::path& filename) {
+    if (journalFile_.is_open()) {
+        journalFile_.close();
+    }
+    operations_.clear();
+    completed_.clear();
+    numCompleted_ = 0;
+    
+    std::ifstream inputFile(filename, std::ios::binary);
+    if (!inputFile.is_open()) {
+        return false;
+    }
+    
+    uint64_t numOperations = 0;
+    inputFile.read(reinterpret_cast<char*>(&numOperations), sizeof(numOperations));
+    inputFile.get();
+    if (!inputFile) {
+        throw std::runtime_error("\"" + filename.string() + "\": Journal file is corrupt.");
+    }
+    
+    operations_.reserve(static_cast<size_t>(numOperations));
+    std::string source, dest;
+    for (uint64_t i = 0; i < numOperations; ++i) {
+        char type = static_cast<char>(inputFile.get());
+        std::getline(inputFile, source, '\0');
+        std::getline(inputFile, dest, '\0');
+        inputFile.get();
+        if (!inputFile || (type != Add && type != Rename && type != Remove && type != Replace && type != Link && type != Store && type != Keep && type != Commit && type != Compress && type != Decompress)) {
+            throw std::runtime_error("\"" + filename.string() + "\": Journal file is corrupt.");
+        }
+        operations_.push_back({static_cast<OperationType>(type), fs::path(source), fs::path(dest)});
+    }
+    completed_.assign(operations_.size(), false);
+    
+    std::streamoff validLength = inputFile.tellg();    // Everything after this point is a list of completed operations.
+    uint64_t index;
+    while (inputFile.read(reinterpret_cast<char*>(&index), sizeof(index))) {
+        if (index < completed_.size() && !completed_[index]) {
+            completed_[index] = true;
+            ++numCompleted_;
+        }
+        validLength += sizeof(index);
+    }
+    inputFile.close();
+    
+    if (static_cast<uintmax_t>(validLength) != fs::file_size(filename)) {    // Trim off the partial index so that new entries stay aligned.
+        fs::resize_file(filename, static_cast<uintmax_t>(validLength));
+    }
+    filename_ = filename;
+    journalFile_.open(filename, std::ios::binary | std::ios::app);
+    if (!journalFile_.is_open()) {
+        throw std::runtime_error("\"" + filename.string() + "\": Unable to open file for writing.");
+    }
+    return true;
+}
+
+void BackupJournal::markCompleted(size_t index) {
+    if (completed_[index]) {
+        return;
+    }
+    completed_[index] = true;
+    ++numCompleted_;
+    
+    const uint64_t index64 = index;
+    journalFile_.write(reinterpret_cast<const char*>(&index64), sizeof(index64));
+    journalFile_.flush();
+}
+
+void BackupJournal::remove() {
+    if (journalFile_.is_open()) {
+        journalFile_.close();
+    }
+    if (!filename_.empty()) {
+        fs::remove(filename_);
+    }
+    operations_.clear();
+    completed_.clear();
+    numCompleted_ = 0;
+}
@@ -0,0 +1,96 @@
+#ifndef BACKUP_JOURNAL_H_
+#define BACKUP_JOURNAL_H_
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * Write-ahead log for the file operations of a backup. The full list of
+ * operations is written to the journal before any files are touched, and each
+ * operation gets marked as complete after it finishes. If the process is killed
+ * partway through a backup, the journal can be loaded to replay only the
+ * operations that did not finish (without scanning the directories again).
+ */
+class BackupJournal {
+public:
+    /**
+     * The type of a file operation. Values are the characters written to the
+     * journal file.
+     */
+    enum OperationType : char {
+        Add = 'A', Rename = 'R', Remove = 'D', Replace = 'M', Link = 'L', Store = 'S', Keep = 'K', Commit = 'C', Compress = 'Z', Decompress = 'X'
+    };
+    
+    /**
+     * A single file operation. The source is unused for the Remove type. For
+     * the Link type, the dest is a hard link to the source (or a new directory
+     * if the source is empty).
+     * 
+     * The Store, Keep, and Commit types write to a ChunkStore. For Store and
+     * Keep, the dest is the store path joined with the path of the entry. The
+     * source is a file or directory to store, or an entry in a previous
+     * snapshot to keep. For Commit, the source is the store and the dest is the
+     * new snapshot to save.
+     * 
+     * The Compress type is like Add or Replace for a file, but the dest is
+     * written as a compressed file. The Decompress type is the same, but a
+     * compressed source is decompressed into the dest.
+     */
+    struct Operation {
+        OperationType type;
+        fs::path source;
+        fs::path dest;
+    };
+    
+    BackupJournal();
+    
+    /**
+     * Returns the path of the journal file that corresponds to the given config
+     * file (placed next to the cache file in .backuptools/).
+     */
+    static fs::path getJournalPath(const fs::path& configFilename);
+    
+    /**
+     * Writes a new journal file with the given operations (overwrites an
+     * existing one) and keeps it open to mark completed operations. The file
+     * format is the number of operations, followed by each operation (type
+     * character, source path, null character, destination path, null
+     * character, newline character). Completed operations are appended after
+     * this as the index of each operation.
+     */
+    void create(const fs::path& filename, const std::vector<Operation>& operations);
+    
+    /**
+     * Parses an existing journal file and keeps it open to mark more completed
+     * operations. Returns false if the file does not exist. A partially written
+     * index at the end of the file (from a killed process) is ignored.
+     */
+    bool load(const fs::path& filename);
+    
+    /**
+     * Appends the index of a completed operation to the journal. The entry is
+     * flushed immediately so that it survives a crash of the process.
+     */
+    void markCompleted(size_t index);
+    
+    /**
+     * Closes and deletes the journal file, done after all operations finish.
+     */
+    void remove();
+    
+    const std::vector<Operation>& getOperations() const { return operations_; }
+    bool isCompleted(size_t index) const { return completed_[index]; }
+    size_t getNumCompleted() const { return numCompleted_; }
+    
+private:
+    fs::path filename_;
+    std::ofstream journalFile_;
+    std::vector<Operation> operations_;
+    std::vector<bool> completed_;
+    size_t numCompleted_;
+};
+
+#endif
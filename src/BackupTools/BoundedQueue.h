@@ -0,0 +1,82 @@
+#ifndef BOUNDED_QUEUE_H_
+#define BOUNDED_QUEUE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * Queue for passing items between the stages of a pipeline running on
+ * different threads. At most capacity items are held, push() waits while the
+ * queue is full so that a fast producer can't get far ahead of the consumer.
+ * Either side can close the queue, after that push() fails and pop() returns
+ * the remaining items before failing.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(size_t capacity) :
+        capacity_(capacity),
+        closed_(false) {
+    }
+    
+    /**
+     * Adds the item to the back of the queue, waiting for space if needed.
+     * Returns false (and drops the item) if the queue is closed.
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this]() {
+            return items_.size() < capacity_ || closed_;
+        });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        lock.unlock();
+        notEmpty_.notify_one();
+        return true;
+    }
+    
+    /**
+     * Takes the item at the front of the queue, waiting for one if needed.
+     * Returns false once the queue is closed and empty.
+     */
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this]() {
+            return !items_.empty() || closed_;
+        });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        notFull_.notify_one();
+        return true;
+    }
+    
+    /**
+     * Marks the end of the items and wakes up all waiting threads.
+     */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        notFull_.notify_all();
+        notEmpty_.notify_all();
+    }
+    
+private:
+    size_t capacity_;
+    bool closed_;
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable notFull_, notEmpty_;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "BackupTools/ChangeWriter.h"
+#include <cstdint>
+#include <stdexcept>
+
+constexpr const char* CHANGE_TYPE_NAMES[ChangeWriter::NumChangeTypes][2] = {
+    {"delete", "deletions"},
+    {"add", "additions"},
+    {"modify", "modifications"},
+    {"rename", "renames"},
+    {"drop", "drops"}
+};
+
+ChangeWriter::ChangeWriter(std::streambuf* output, size_t bufferSize) :
+    output_(output),
+    bufferSize_(bufferSize),
+    counts_() {
+        
+    buffer_.reserve(bufferSize_ + 256);
+}
+
+ChangeWriter::~ChangeWriter() {
+    try {
+        flush();
+    } catch (...) {}
+}
+
+void ChangeWriter::writeChange(ChangeType type, const fs::path& source, const fs::path& dest) {
+    ++counts_[type];
+    buffer_ += "{\"type\":\"";
+    buffer_ += CHANGE_TYPE_NAMES[type][0];
+    buffer_ += "\",";
+    if (type != Deletion && type != Drop) {
+        buffer_ += "\"source\":";
+        appendJsonString(source.string());
+        buffer_ += ",";
+    }
+    buffer_ += "\"dest\":";
+    appendJsonString(dest.string());
+    buffer_ += "}\n";
+    if (buffer_.size() >= bufferSize_) {
+        flush();
+    }
+}
+
+void ChangeWriter::writeSummary(size_t numScanned) {
+    buffer_ += "{\"type\":\"summary\",\"scanned\":" + std::to_string(numScanned);
+    for (int i = 0; i < NumChangeTypes; ++i) {
+        buffer_ += ",\"";
+        buffer_ += CHANGE_TYPE_NAMES[i][1];
+        buffer_ += "\":" + std::to_string(counts_[i]);
+    }
+    buffer_ += "}\n";
+    flush();
+}
+
+void ChangeWriter::flush() {
+    if (buffer_.empty()) {
+        return;
+    }
+    const std::streamsize size = static_cast<std::streamsize>(buffer_.size());
+    const bool failed = (output_->sputn(buffer_.data(), size) != size || output_->pubsync() == -1);
+    buffer_.clear();
+    if (failed) {
+        throw std::runtime_error("Failed to write changes to output.");
+    }
+}
+
+/**
+ * Returns the length of the UTF-8 sequence starting at str[index], or zero if
+ * it is not valid (truncated, overlong, a surrogate, or above U+10FFFF).
+ */
+size_t getUtf8SequenceLength(const std::string& str, size_t index) {
+    const unsigned char lead = static_cast<unsigned char>(str[index]);
+    size_t length;
+    uint32_t codePoint;
+    if (lead < 0x80) {
+        return 1;
+    } else if (lead >= 0xc2 && lead <= 0xdf) {
+        length = 2;
+        codePoint = lead & 0x1f;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        length = 3;
+        codePoint = lead & 0x0f;
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        length = 4;
+        codePoint = lead & 0x07;
+    } else {
+        return 0;
+    }
+    if (str.length() - index < length) {
+        return 0;
+    }
+    for (size_t i = 1; i < length; ++i) {
+        const unsigned char c = static_cast<unsigned char>(str[index + i]);
+        if ((c & 0xc0) != 0x80) {
+            return 0;
+        }
+        codePoint = (codePoint << 6) | (c & 0x3f);
+    }
+    if ((length == 3 && (codePoint < 0x800 || (codePoint >= 0xd800 && codePoint <= 0xdfff))) || (length == 4 && (codePoint < 0x10000 || codePoint > 0x10ffff))) {
+        return 0;
+    }
+    return length;
+}
+
+void ChangeWriter::appendJsonString(const std::string& str) {
+    constexpr char hexDigits[] = "0123456789abcdef";
+    buffer_ += '"';
+    for (size_t i = 0; i < str.length();) {
+        const char c = str[i];
+        const size_t length = getUtf8SequenceLength(str, i);
+        if (length == 0) {    // The output must be valid UTF-8 for JSON parsers to accept it.
+            buffer_ += "\\ufffd";
+            ++i;
+            continue;
+        }
+        if (c == '"' || c == '\\') {
+            buffer_ += '\\';
+            buffer_ += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {    // Control characters need an escape.
+            buffer_ += "\\u00";
+            buffer_ += hexDigits[(c >> 4) & 0xf];
+            buffer_ += hexDigits[c & 0xf];
+        } else {
+            buffer_.append(str, i, length);
+        }
+        i += length;
+    }
+    buffer_ += '"';
+}
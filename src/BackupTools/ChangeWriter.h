@@ -0,0 +1,69 @@
+#ifndef CHANGE_WRITER_H_
+#define CHANGE_WRITER_H_
+
+#include <filesystem>
+#include <streambuf>
+#include <string>
+
+namespace fs = std::filesystem;
+
+/**
+ * Writes the changes found by a check as newline-delimited JSON (one object
+ * per line) for other programs to read. Modifications and additions into an
+ * empty destination are written as soon as they are found, the rest (like
+ * deletions, and additions that may still turn into renames) are collected by
+ * the check and written at the end. The last line is a summary with the
+ * totals. Paths that are not valid UTF-8 have each invalid byte replaced with
+ * U+FFFD, so these do not name the original file exactly.
+ *
+ * Example output:
+ * {"type":"add","source":"src/a.txt","dest":"dst/src/a.txt"}
+ * {"type":"delete","dest":"dst/src/old.txt"}
+ * {"type":"summary","scanned":42,"deletions":1,"additions":1,"modifications":0,"renames":0,"drops":0}
+ */
+class ChangeWriter {
+public:
+    enum ChangeType {
+        Deletion, Addition, Modification, Rename, Drop, NumChangeTypes
+    };
+    
+    /**
+     * Output goes to the stream buffer in chunks of bufferSize bytes.
+     */
+    ChangeWriter(std::streambuf* output, size_t bufferSize = DEFAULT_BUFFER_SIZE);
+    ~ChangeWriter();
+    ChangeWriter(const ChangeWriter&) = delete;
+    ChangeWriter& operator=(const ChangeWriter&) = delete;
+    
+    /**
+     * Writes a change. The source is not included for a Deletion or a Drop
+     * (an item left out of a new snapshot), for a Rename it is the old
+     * destination path.
+     */
+    void writeChange(ChangeType type, const fs::path& source, const fs::path& dest);
+    
+    /**
+     * Writes the summary line with the number of scanned items and the count of
+     * each type of change, then flushes the output.
+     */
+    void writeSummary(size_t numScanned);
+    
+    size_t getCount(ChangeType type) const { return counts_[type]; }
+    void flush();
+    
+private:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+    
+    std::streambuf* output_;
+    size_t bufferSize_;
+    std::string buffer_;
+    size_t counts_[NumChangeTypes];
+    
+    /**
+     * Appends str to the buffer as a quoted JSON string. Invalid UTF-8 bytes
+     * become U+FFFD.
+     */
+    void appendJsonString(const std::string& str);
+};
+
+#endif
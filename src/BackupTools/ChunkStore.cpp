@@ -0,0 +1,460 @@
+#include "BackupTools/ChunkStore.h"
+#include "BackupTools/FileSyncer.h"
+#include "BackupTools/IoThrottle.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+constexpr char STORE_MARKER_FILENAME[] = "backuptools-store";
+constexpr char STORE_MARKER_CONTENTS[] = "BackupTools chunk store 1\n";
+constexpr size_t INDEX_RECORD_SIZE = 32 + 4 + 4 + 8;
+
+// Normalized chunking uses a harder to match mask before the average size and an easier one after it, this keeps most chunk sizes close to the average.
+constexpr uint64_t CHUNK_MASK_SMALL = 0xffffc00000000000ull;    // 18 bits.
+constexpr uint64_t CHUNK_MASK_LARGE = 0xfffc000000000000ull;    // 14 bits.
+
+/**
+ * Returns the table of random values for the gear hash, generated with
+ * splitmix64 from a fixed seed so that chunk boundaries never change between
+ * versions.
+ */
+const std::array<uint64_t, 256>& getGearTable() {
+    static const std::array<uint64_t, 256> table = []() {
+        std::array<uint64_t, 256> result;
+        uint64_t state = 0x4261636b7570546full;
+        for (auto& x : result) {
+            state += 0x9e3779b97f4a7c15ull;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            x = z ^ (z >> 31);
+        }
+        return result;
+    }();
+    return table;
+}
+
+bool ChunkStore::isStore(const fs::path& root) {
+    return fs::is_regular_file(root / STORE_MARKER_FILENAME);
+}
+
+size_t ChunkStore::findChunkBoundary(const uint8_t* data, size_t size) {
+    if (size <= MIN_CHUNK_SIZE) {
+        return size;
+    }
+    const std::array<uint64_t, 256>& gear = getGearTable();
+    const size_t limit = std::min(size, MAX_CHUNK_SIZE);
+    const size_t normalSize = std::min(limit, AVERAGE_CHUNK_SIZE);
+    uint64_t hash = 0;
+    size_t i = MIN_CHUNK_SIZE;    // Cut points are never checked below the minimum size (skips hashing those bytes too).
+    for (; i < normalSize; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & CHUNK_MASK_SMALL) == 0) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & CHUNK_MASK_LARGE) == 0) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+ChunkStore::Digest ChunkStore::hashFile(const fs::path& filename, IoThrottle* ioThrottle, PageCacheMode pageCacheMode) {
+    FileReader reader;
+    if (!reader.open(filename, pageCacheMode)) {
+        throw std::runtime_error("\"" + filename.string() + "\": Unable to open file for reading.");
+    }
+    constexpr size_t HASH_BUFFER_SIZE = 256 * 1024;
+    AlignedBuffer buffer(HASH_BUFFER_SIZE);
+    Sha256 sha;
+    size_t numRead;
+    while ((numRead = reader.read(buffer.data(), HASH_BUFFER_SIZE)) > 0) {
+        if (ioThrottle != nullptr) {
+            ioThrottle->acquireRead(static_cast<uintmax_t>(numRead));
+        }
+        sha.update(buffer.data(), numRead);
+    }
+    return sha.finish();
+}
+
+ChunkStore::ChunkStore(const fs::path& root, bool readOnly) :
+    root_(root),
+    indexLoaded_(false),
+    packNumber_(0),
+    packSize_(0) {
+        
+    if (!isStore(root_)) {
+        if (fs::exists(root_) && !fs::is_empty(root_)) {
+            throw std::runtime_error("\"" + root_.string() + "\": Directory is not empty and cannot be used as a chunk store.");
+        } else if (readOnly) {
+            return;
+        }
+        fs::create_directories(root_ / "packs");
+        fs::create_directories(root_ / "snapshots");
+        std::ofstream markerFile(root_ / STORE_MARKER_FILENAME, std::ios::binary);
+        markerFile << STORE_MARKER_CONTENTS;
+        if (!markerFile) {
+            throw std::runtime_error("\"" + root_.string() + "\": Unable to create chunk store.");
+        }
+    }
+}
+
+const ChunkStore::Manifest& ChunkStore::loadManifest(const fs::path& snapshotPath) {
+    auto manifestIter = manifests_.find(snapshotPath);
+    if (manifestIter != manifests_.end()) {
+        return manifestIter->second;
+    }
+    Manifest& manifest = manifests_[snapshotPath];
+    if (snapshotPath.empty()) {
+        return manifest;
+    }
+    
+    const fs::path manifestPath = snapshotPath / "manifest";
+    std::ifstream manifestFile(manifestPath, std::ios::binary);
+    if (!manifestFile.is_open()) {
+        throw std::runtime_error("\"" + manifestPath.string() + "\": Unable to open file for reading.");
+    }
+    fs::path relativePath;
+    ManifestEntry entry;
+    while (readEntry(manifestFile, relativePath, entry)) {
+        manifest[relativePath] = std::move(entry);
+    }
+    if (!manifestFile.eof()) {
+        throw std::runtime_error("\"" + manifestPath.string() + "\": Manifest file is corrupt.");
+    }
+    return manifest;
+}
+
+void ChunkStore::discardPending() {
+    pendingFile_.close();
+    fs::remove(getSnapshotsPath() / "pending");
+}
+
+void ChunkStore::storeFile(const fs::path& source, const fs::path& relativePath, IoThrottle* ioThrottle, PageCacheMode pageCacheMode) {
+    loadIndex();
+    FileReader reader;
+    if (!reader.open(source, pageCacheMode)) {
+        throw std::runtime_error("\"" + source.string() + "\": Unable to open file for reading.");
+    }
+    
+    ManifestEntry entry;
+    entry.isDirectory = false;
+    entry.size = 0;
+    entry.writeTime = fs::last_write_time(source).time_since_epoch().count();
+    Sha256 fileSha;
+    
+    constexpr size_t READ_SIZE = MAX_CHUNK_SIZE;
+    readBuffer_.resize(READ_SIZE);
+    chunkBuffer_.resize(MAX_CHUNK_SIZE * 2);
+    size_t start = 0, end = 0;
+    bool endOfFile = false;
+    while (true) {
+        if (!endOfFile && end - start < MAX_CHUNK_SIZE) {    // Keep at least one max size chunk in the buffer so the boundary search sees all of it.
+            std::memmove(chunkBuffer_.data(), chunkBuffer_.data() + start, end - start);
+            end -= start;
+            start = 0;
+            while (!endOfFile && end < MAX_CHUNK_SIZE) {
+                const size_t numRead = reader.read(readBuffer_.data(), READ_SIZE);
+                if (numRead == 0) {
+                    endOfFile = true;
+                    break;
+                }
+                if (ioThrottle != nullptr) {
+                    ioThrottle->acquireRead(static_cast<uintmax_t>(numRead));
+                }
+                std::memcpy(chunkBuffer_.data() + end, readBuffer_.data(), numRead);
+                end += numRead;
+            }
+        }
+        if (start == end) {
+            break;
+        }
+        
+        const size_t chunkSize = findChunkBoundary(chunkBuffer_.data() + start, end - start);
+        const Digest chunkDigest = Sha256::hash(chunkBuffer_.data() + start, chunkSize);
+        fileSha.update(chunkBuffer_.data() + start, chunkSize);
+        addChunk(chunkDigest, chunkBuffer_.data() + start, chunkSize, ioThrottle);
+        entry.chunks.push_back(chunkDigest);
+        entry.size += chunkSize;
+        start += chunkSize;
+    }
+    entry.digest = fileSha.finish();
+    
+    packFile_.flush();    // Chunks must reach the pack before the index, and the index before the manifest entry that uses it.
+    indexFile_.flush();
+    if (!packFile_ || !indexFile_) {
+        throw std::runtime_error("\"" + root_.string() + "\": Failed to write to chunk store.");
+    }
+    addPendingEntry(relativePath, entry);
+}
+
+void ChunkStore::storeDirectory(const fs::path& relativePath) {
+    ManifestEntry entry = {};
+    entry.isDirectory = true;
+    addPendingEntry(relativePath, entry);
+}
+
+void ChunkStore::keepEntry(const fs::path& previousEntry) {
+    const fs::path relativeEntry = previousEntry.lexically_relative(getSnapshotsPath());
+    if (relativeEntry.empty() || relativeEntry.begin() == relativeEntry.end()) {
+        throw std::runtime_error("\"" + previousEntry.string() + "\": Path is not in a snapshot.");
+    }
+    const fs::path snapshotPath = getSnapshotsPath() / *relativeEntry.begin();
+    const fs::path relativePath = previousEntry.lexically_relative(snapshotPath);
+    const Manifest& manifest = loadManifest(snapshotPath);
+    auto entryIter = manifest.find(relativePath);
+    if (entryIter == manifest.end()) {
+        throw std::runtime_error("\"" + previousEntry.string() + "\": Entry not found in snapshot.");
+    }
+    addPendingEntry(relativePath, entryIter->second);
+}
+
+void ChunkStore::commitSnapshot(const fs::path& snapshotPath, FileSyncer& syncer) {
+    packFile_.close();
+    indexFile_.close();
+    pendingFile_.close();
+    const fs::path pendingPath = getSnapshotsPath() / "pending";
+    if (fs::exists(snapshotPath / "manifest") && !fs::exists(pendingPath)) {    // Already committed, this happens on resume if the process was killed right after.
+        return;
+    }
+    if (syncer.getLevel() != DurabilityLevel::None) {
+        for (uint32_t pack : writtenPacks_) {    // Includes the full packs, the index must never point to chunks that are not on disk.
+            FileSyncer::syncPath(getPackPath(pack), false);
+        }
+        if (fs::exists(root_ / "index")) {
+            FileSyncer::syncPath(root_ / "index", false);
+        }
+    }
+    packSize_ = 0;
+    writtenPacks_.clear();
+    
+    Manifest manifest;
+    std::ifstream pendingFile(pendingPath, std::ios::binary);
+    fs::path relativePath;
+    ManifestEntry entry;
+    while (pendingFile.is_open() && readEntry(pendingFile, relativePath, entry)) {    // Entries that were stored again after a resume replace the earlier ones.
+        manifest[relativePath] = std::move(entry);
+    }
+    pendingFile.close();
+    
+    fs::create_directories(snapshotPath);
+    const fs::path tempPath = snapshotPath / "manifest.tmp";
+    std::ofstream manifestFile(tempPath, std::ios::binary | std::ios::trunc);
+    for (const auto& x : manifest) {
+        writeEntry(manifestFile, x.first, x.second);
+    }
+    manifestFile.close();
+    if (!manifestFile) {
+        throw std::runtime_error("\"" + tempPath.string() + "\": Failed to write manifest.");
+    }
+    syncer.commitFile(tempPath, snapshotPath / "manifest", fs::file_size(tempPath));
+    syncer.commitDirectory(getSnapshotsPath());
+    syncer.flush();    // The pending entries can only be removed once the manifest is in place.
+    fs::remove(pendingPath);
+    manifests_[snapshotPath] = std::move(manifest);
+}
+
+void ChunkStore::restoreSnapshot(const fs::path& snapshotPath, const fs::path& outputPath) {
+    loadIndex();
+    const Manifest& manifest = loadManifest(snapshotPath);
+    for (const auto& x : manifest) {    // A damaged manifest could otherwise write outside of outputPath.
+        const bool hasParentReference = std::any_of(x.first.begin(), x.first.end(), [](const fs::path& p) { return p == ".."; });
+        if (x.first.empty() || x.first.has_root_path() || hasParentReference) {
+            throw std::runtime_error("\"" + snapshotPath.string() + "\": Invalid path \"" + x.first.string() + "\" in manifest.");
+        }
+    }
+    fs::create_directories(outputPath);
+    for (const auto& x : manifest) {    // Parent directories sort before their contents.
+        const fs::path filename = outputPath / x.first;
+        if (x.second.isDirectory) {
+            fs::create_directories(filename);
+            continue;
+        }
+        std::ofstream outputFile(filename, std::ios::binary | std::ios::trunc);
+        if (!outputFile.is_open()) {
+            throw std::runtime_error("\"" + filename.string() + "\": Unable to open file for writing.");
+        }
+        Sha256 fileSha;
+        for (const Digest& chunkDigest : x.second.chunks) {
+            std::vector<uint8_t> chunk = readChunk(chunkDigest);
+            fileSha.update(chunk.data(), chunk.size());
+            outputFile.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+        }
+        outputFile.close();
+        if (!outputFile) {
+            throw std::runtime_error("\"" + filename.string() + "\": Failed to write file.");
+        } else if (fileSha.finish() != x.second.digest) {
+            throw std::runtime_error("\"" + filename.string() + "\": Restored file does not match its digest.");
+        }
+        fs::last_write_time(filename, fs::file_time_type(fs::file_time_type::duration(x.second.writeTime)));
+    }
+}
+
+fs::path ChunkStore::getPackPath(uint32_t pack) const {
+    char filename[32];
+    std::snprintf(filename, sizeof(filename), "%08u.pack", static_cast<unsigned int>(pack));
+    return root_ / "packs" / filename;
+}
+
+void ChunkStore::loadIndex() {
+    if (indexLoaded_) {
+        return;
+    }
+    indexLoaded_ = true;
+    const fs::path indexPath = root_ / "index";
+    std::ifstream inputFile(indexPath, std::ios::binary);
+    uint64_t validLength = 0;
+    char record[INDEX_RECORD_SIZE];
+    while (inputFile.read(record, INDEX_RECORD_SIZE)) {
+        Digest digest;
+        ChunkLocation location;
+        std::memcpy(digest.data(), record, 32);
+        std::memcpy(&location.pack, record + 32, 4);
+        std::memcpy(&location.length, record + 36, 4);
+        std::memcpy(&location.offset, record + 40, 8);
+        index_.emplace(digest, location);
+        validLength += INDEX_RECORD_SIZE;
+    }
+    inputFile.close();
+    if (fs::exists(indexPath) && fs::file_size(indexPath) != validLength) {    // Drop a partial record left by a killed process.
+        fs::resize_file(indexPath, validLength);
+    }
+    
+    for (const auto& entry : fs::directory_iterator(root_ / "packs")) {    // New chunks always go in a new pack, the end of an old one may be garbage from a killed process.
+        const std::string stem = entry.path().stem().string();
+        if (entry.path().extension() == ".pack" && !stem.empty() && std::all_of(stem.begin(), stem.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; })) {
+            packNumber_ = std::max(packNumber_, static_cast<uint32_t>(std::stoul(stem)) + 1);
+        }
+    }
+}
+
+void ChunkStore::addChunk(const Digest& digest, const uint8_t* data, size_t size, IoThrottle* ioThrottle) {
+    if (index_.count(digest) > 0) {
+        return;
+    }
+    if (packFile_.is_open() && packSize_ + size > MAX_PACK_SIZE) {
+        packFile_.close();
+        ++packNumber_;
+        packSize_ = 0;
+    }
+    if (!packFile_.is_open()) {
+        packFile_.open(getPackPath(packNumber_), std::ios::binary | std::ios::app);
+        packSize_ = fs::file_size(getPackPath(packNumber_));
+        if (writtenPacks_.empty() || writtenPacks_.back() != packNumber_) {
+            writtenPacks_.push_back(packNumber_);
+        }
+    }
+    if (!indexFile_.is_open()) {
+        indexFile_.open(root_ / "index", std::ios::binary | std::ios::app);
+    }
+    if (!packFile_.is_open() || !indexFile_.is_open()) {
+        throw std::runtime_error("\"" + root_.string() + "\": Unable to open chunk store for writing.");
+    }
+    if (ioThrottle != nullptr) {
+        ioThrottle->acquireWrite(static_cast<uintmax_t>(size));
+    }
+    
+    const ChunkLocation location = {packNumber_, static_cast<uint32_t>(size), packSize_};
+    packFile_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    packSize_ += size;
+    char record[INDEX_RECORD_SIZE];
+    std::memcpy(record, digest.data(), 32);
+    std::memcpy(record + 32, &location.pack, 4);
+    std::memcpy(record + 36, &location.length, 4);
+    std::memcpy(record + 40, &location.offset, 8);
+    indexFile_.write(record, INDEX_RECORD_SIZE);
+    index_.emplace(digest, location);
+}
+
+std::vector<uint8_t> ChunkStore::readChunk(const Digest& digest) {
+    auto locationIter = index_.find(digest);
+    if (locationIter == index_.end()) {
+        throw std::runtime_error("\"" + root_.string() + "\": Missing chunk " + Sha256::toHex(digest) + ".");
+    }
+    const ChunkLocation& location = locationIter->second;
+    std::ifstream packFile(getPackPath(location.pack), std::ios::binary);
+    std::vector<uint8_t> chunk(location.length);
+    packFile.seekg(static_cast<std::streamoff>(location.offset));
+    packFile.read(reinterpret_cast<char*>(chunk.data()), static_cast<std::streamsize>(location.length));
+    if (!packFile || Sha256::hash(chunk.data(), chunk.size()) != digest) {
+        throw std::runtime_error("\"" + getPackPath(location.pack).string() + "\": Chunk " + Sha256::toHex(digest) + " is corrupt.");
+    }
+    return chunk;
+}
+
+void ChunkStore::addPendingEntry(const fs::path& relativePath, const ManifestEntry& entry) {
+    if (!pendingFile_.is_open()) {
+        const fs::path pendingPath = getSnapshotsPath() / "pending";
+        if (fs::exists(pendingPath)) {    // Drop a partial entry left by a killed process, otherwise the entries appended after it could not be read.
+            std::ifstream inputFile(pendingPath, std::ios::binary);
+            fs::path existingPath;
+            ManifestEntry existingEntry;
+            std::streamoff validLength = 0;
+            while (readEntry(inputFile, existingPath, existingEntry)) {
+                validLength = inputFile.tellg();
+            }
+            inputFile.close();
+            if (fs::file_size(pendingPath) != static_cast<uintmax_t>(validLength)) {
+                fs::resize_file(pendingPath, static_cast<uintmax_t>(validLength));
+            }
+        }
+        pendingFile_.open(pendingPath, std::ios::binary | std::ios::app);
+        if (!pendingFile_.is_open()) {
+            throw std::runtime_error("\"" + pendingPath.string() + "\": Unable to open file for writing.");
+        }
+    }
+    writeEntry(pendingFile_, relativePath, entry);
+    pendingFile_.flush();
+}
+
+void ChunkStore::writeEntry(std::ostream& out, const fs::path& relativePath, const ManifestEntry& entry) {
+    const std::string pathString = relativePath.generic_string();
+    const uint64_t size = entry.size;
+    const uint32_t numChunks = static_cast<uint32_t>(entry.chunks.size());
+    out.put(entry.isDirectory ? 'D' : 'F');
+    out.write(pathString.c_str(), static_cast<std::streamsize>(pathString.length() + 1));    // Includes the null character.
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(reinterpret_cast<const char*>(&entry.writeTime), sizeof(entry.writeTime));
+    out.write(reinterpret_cast<const char*>(entry.digest.data()), entry.digest.size());
+    out.write(reinterpret_cast<const char*>(&numChunks), sizeof(numChunks));
+    for (const Digest& chunkDigest : entry.chunks) {
+        out.write(reinterpret_cast<const char*>(chunkDigest.data()), chunkDigest.size());
+    }
+    out.put('\n');
+}
+
+bool ChunkStore::readEntry(std::istream& in, fs::path& relativePath, ManifestEntry& entry) {
+    const int type = in.get();
+    if (type != 'D' && type != 'F') {
+        return false;
+    }
+    std::string pathString;
+    uint64_t size;
+    uint32_t numChunks;
+    std::getline(in, pathString, '\0');
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    in.read(reinterpret_cast<char*>(&entry.writeTime), sizeof(entry.writeTime));
+    in.read(reinterpret_cast<char*>(entry.digest.data()), entry.digest.size());
+    in.read(reinterpret_cast<char*>(&numChunks), sizeof(numChunks));
+    if (!in || numChunks > size / MIN_CHUNK_SIZE + 1) {    // A sanity check on the count avoids a huge allocation from a corrupt entry.
+        return false;
+    }
+    entry.chunks.resize(numChunks);
+    for (Digest& chunkDigest : entry.chunks) {
+        in.read(reinterpret_cast<char*>(chunkDigest.data()), chunkDigest.size());
+    }
+    if (in.get() != '\n' || !in) {
+        return false;
+    }
+    entry.isDirectory = (type == 'D');
+    entry.size = static_cast<uintmax_t>(size);
+    relativePath = fs::path(pathString);
+    return true;
+}
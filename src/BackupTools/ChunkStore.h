@@ -0,0 +1,175 @@
+#ifndef CHUNK_STORE_H_
+#define CHUNK_STORE_H_
+
+#include "BackupTools/FileReader.h"
+#include "BackupTools/Sha256.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class FileSyncer;
+class IoThrottle;
+
+/**
+ * Content-addressed backup destination. Files are split into variable-sized
+ * chunks with content-defined chunking (FastCDC), so identical or shifted data
+ * within and across files is only stored once. Chunks are appended to pack
+ * files and found through an index of their SHA-256 digests. Each backup
+ * creates a snapshot with a manifest that lists every file and the chunks it
+ * is made of.
+ *
+ * Layout of the store directory:
+ *     backuptools-store         Marker file with the format version.
+ *     index                     Digest, pack number, length, and offset of each chunk.
+ *     packs/00000000.pack       Chunk data.
+ *     snapshots/<time>/manifest Files in a snapshot.
+ *     snapshots/pending         Manifest entries of the snapshot being written.
+ */
+class ChunkStore {
+public:
+    using Digest = Sha256::Digest;
+    
+    /**
+     * An item in a snapshot. The size, writeTime, digest, and chunks are only
+     * used for files. The writeTime is the source modification time when the
+     * file was stored (ticks of fs::file_time_type).
+     */
+    struct ManifestEntry {
+        bool isDirectory;
+        uintmax_t size;
+        int64_t writeTime;
+        Digest digest;
+        std::vector<Digest> chunks;
+    };
+    using Manifest = std::map<fs::path, ManifestEntry>;
+    
+    static constexpr size_t MIN_CHUNK_SIZE = 16 * 1024;
+    static constexpr size_t AVERAGE_CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t MAX_CHUNK_SIZE = 256 * 1024;
+    
+    /**
+     * Returns true if the directory contains a chunk store.
+     */
+    static bool isStore(const fs::path& root);
+    
+    /**
+     * Finds the length of the next chunk at the start of data using the FastCDC
+     * gear hash with normalized chunking. The size should be at least
+     * MAX_CHUNK_SIZE unless this is the end of the file.
+     */
+    static size_t findChunkBoundary(const uint8_t* data, size_t size);
+    
+    /**
+     * Returns the SHA-256 digest of the file contents.
+     */
+    static Digest hashFile(const fs::path& filename, IoThrottle* ioThrottle, PageCacheMode pageCacheMode);
+    
+    /**
+     * Opens the store in the root directory, a new store is created if it does
+     * not exist yet. With readOnly set, nothing gets created and the store
+     * should only be used with loadManifest() (a missing store has no
+     * snapshots).
+     */
+    ChunkStore(const fs::path& root, bool readOnly = false);
+    
+    const fs::path& getRoot() const { return root_; }
+    fs::path getSnapshotsPath() const { return root_ / "snapshots"; }
+    
+    /**
+     * Returns the manifest for a snapshot directory (an empty manifest if the
+     * path is empty). Throws if the manifest is missing or corrupt.
+     */
+    const Manifest& loadManifest(const fs::path& snapshotPath);
+    
+    /**
+     * Removes the entries of an unfinished snapshot, done before starting a
+     * new backup (not when resuming one).
+     */
+    void discardPending();
+    
+    /**
+     * Chunks the source file, writes any chunks not already in the store, and
+     * adds the file to the pending snapshot.
+     */
+    void storeFile(const fs::path& source, const fs::path& relativePath, IoThrottle* ioThrottle, PageCacheMode pageCacheMode);
+    
+    /**
+     * Adds a directory to the pending snapshot.
+     */
+    void storeDirectory(const fs::path& relativePath);
+    
+    /**
+     * Copies an unchanged entry from a previous snapshot to the pending one.
+     * The previousEntry is the snapshot path joined with the relative path.
+     */
+    void keepEntry(const fs::path& previousEntry);
+    
+    /**
+     * Makes the new chunks durable, then writes the pending entries as the
+     * manifest for snapshotPath.
+     */
+    void commitSnapshot(const fs::path& snapshotPath, FileSyncer& syncer);
+    
+    /**
+     * Writes all of the files in a snapshot to outputPath. The digest of each
+     * chunk and file is checked while reading. Throws if an entry has an
+     * absolute path or a ".." component, before anything is written.
+     */
+    void restoreSnapshot(const fs::path& snapshotPath, const fs::path& outputPath);
+    
+private:
+    struct ChunkLocation {
+        uint32_t pack;
+        uint32_t length;
+        uint64_t offset;
+    };
+    
+    static constexpr uint64_t MAX_PACK_SIZE = 64 * 1024 * 1024;
+    
+    fs::path root_;
+    bool indexLoaded_;
+    std::unordered_map<Digest, ChunkLocation, DigestHash> index_;
+    std::ofstream indexFile_;
+    std::ofstream packFile_;
+    uint32_t packNumber_;
+    uint64_t packSize_;
+    std::vector<uint32_t> writtenPacks_;    // Packs that got new chunks since the last commit, these are synced before the index.
+    std::ofstream pendingFile_;
+    std::map<fs::path, Manifest> manifests_;
+    AlignedBuffer readBuffer_;
+    std::vector<uint8_t> chunkBuffer_;
+    
+    fs::path getPackPath(uint32_t pack) const;
+    
+    /**
+     * Reads the index file, a partially written record at the end is ignored.
+     */
+    void loadIndex();
+    
+    /**
+     * Writes the chunk to a pack file and index if it's not in the store yet.
+     */
+    void addChunk(const Digest& digest, const uint8_t* data, size_t size, IoThrottle* ioThrottle);
+    
+    /**
+     * Returns the contents of a chunk, and checks the digest.
+     */
+    std::vector<uint8_t> readChunk(const Digest& digest);
+    
+    void addPendingEntry(const fs::path& relativePath, const ManifestEntry& entry);
+    
+    /**
+     * The format of an entry is the type character ('D' or 'F'), relative
+     * path, null character, size, writeTime, digest, number of chunks, each
+     * chunk digest, and a newline character.
+     */
+    static void writeEntry(std::ostream& out, const fs::path& relativePath, const ManifestEntry& entry);
+    static bool readEntry(std::istream& in, fs::path& relativePath, ManifestEntry& entry);
+};
+
+#endif
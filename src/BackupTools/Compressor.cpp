@@ -0,0 +1,340 @@
+#include "BackupTools/Compressor.h"
+#include "BackupTools/IoThrottle.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+constexpr char COMPRESSED_MAGIC[8] = {'\x89', 'B', 'T', 'Z', '\r', '\n', '\x1a', '\x01'};
+constexpr uint32_t RAW_BLOCK_FLAG = 0x80000000;
+
+// Limits from the LZ4 block format, the last match must start at least 12 bytes before the end and the last 5 bytes are always literals.
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5;
+constexpr size_t MATCH_FIND_LIMIT = 12;
+constexpr size_t MAX_OFFSET = 65535;
+constexpr int HASH_TABLE_BITS = 14;
+
+inline uint32_t readUint32(const uint8_t* data) {
+    uint32_t x;
+    std::memcpy(&x, data, sizeof(x));
+    return x;
+}
+
+inline uint32_t hashSequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_TABLE_BITS);
+}
+
+/**
+ * Writes an LZ4 length continuation (bytes of 255 followed by the remainder).
+ */
+inline uint8_t* writeLength(uint8_t* dest, size_t length) {
+    while (length >= 255) {
+        *dest++ = 255;
+        length -= 255;
+    }
+    *dest++ = static_cast<uint8_t>(length);
+    return dest;
+}
+
+/**
+ * Reads an LZ4 length continuation and adds it to length. Returns false if the
+ * input ends first.
+ */
+inline bool readLength(const uint8_t*& source, const uint8_t* sourceEnd, size_t& length) {
+    uint8_t x;
+    do {
+        if (source >= sourceEnd) {
+            return false;
+        }
+        x = *source++;
+        length += x;
+    } while (x == 255);
+    return true;
+}
+
+bool Compressor::isAlreadyCompressed(const uint8_t* data, size_t size) {
+    auto startsWith = [data, size](size_t offset, const char* magic, size_t magicSize) {
+        return size >= offset + magicSize && std::memcmp(data + offset, magic, magicSize) == 0;
+    };
+    return startsWith(0, "\x1f\x8b", 2) ||    // gzip
+        startsWith(0, "PK\x03\x04", 4) ||    // zip (also docx, jar, apk, etc.)
+        startsWith(0, "7z\xbc\xaf\x27\x1c", 6) ||
+        startsWith(0, "\xfd" "7zXZ\x00", 6) ||
+        startsWith(0, "BZh", 3) ||
+        startsWith(0, "\x28\xb5\x2f\xfd", 4) ||    // zstd
+        startsWith(0, "\x04\x22\x4d\x18", 4) ||    // lz4 frame
+        startsWith(0, "Rar!\x1a\x07", 6) ||
+        startsWith(0, "MSCF", 4) ||    // cab
+        startsWith(0, "\x89PNG", 4) ||
+        startsWith(0, "\xff\xd8\xff", 3) ||    // jpeg
+        startsWith(0, "GIF8", 4) ||
+        (startsWith(0, "RIFF", 4) && startsWith(8, "WEBP", 4)) ||
+        startsWith(4, "ftyp", 4) ||    // mp4, mov, heic
+        startsWith(0, "\x1a\x45\xdf\xa3", 4) ||    // mkv, webm
+        startsWith(0, "OggS", 4) ||
+        startsWith(0, "fLaC", 4) ||
+        startsWith(0, "ID3", 3) ||    // mp3
+        startsWith(0, "wOF2", 4) ||
+        startsWith(0, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC));
+}
+
+size_t Compressor::compressBlock(const uint8_t* source, size_t sourceSize, uint8_t* dest, size_t destCapacity) {
+    std::vector<uint32_t> hashTable(size_t(1) << HASH_TABLE_BITS, 0);
+    uint8_t* destIter = dest;
+    uint8_t* const destEnd = dest + destCapacity;
+    size_t anchor = 0;    // Start of the literals that have not been written yet.
+    
+    if (sourceSize > MATCH_FIND_LIMIT) {
+        const size_t matchLimit = sourceSize - LAST_LITERALS;
+        const size_t findLimit = sourceSize - MATCH_FIND_LIMIT;
+        size_t i = 0;
+        while (i < findLimit) {
+            const uint32_t sequence = readUint32(source + i);
+            uint32_t& tableEntry = hashTable[hashSequence(sequence)];
+            size_t candidate = tableEntry;
+            tableEntry = static_cast<uint32_t>(i);
+            if (candidate >= i || i - candidate > MAX_OFFSET || readUint32(source + candidate) != sequence) {
+                i += 1 + ((i - anchor) >> 6);    // Skip ahead faster through data that has no matches.
+                continue;
+            }
+            
+            while (i > anchor && candidate > 0 && source[i - 1] == source[candidate - 1]) {
+                --i;
+                --candidate;
+            }
+            size_t matchLength = MIN_MATCH;
+            while (i + matchLength < matchLimit && source[i + matchLength] == source[candidate + matchLength]) {
+                ++matchLength;
+            }
+            
+            const size_t literalLength = i - anchor;
+            if (static_cast<size_t>(destEnd - destIter) < 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1) {
+                return 0;
+            }
+            uint8_t* token = destIter++;
+            if (literalLength >= 15) {
+                *token = 15 << 4;
+                destIter = writeLength(destIter, literalLength - 15);
+            } else {
+                *token = static_cast<uint8_t>(literalLength << 4);
+            }
+            std::memcpy(destIter, source + anchor, literalLength);
+            destIter += literalLength;
+            const size_t offset = i - candidate;
+            *destIter++ = static_cast<uint8_t>(offset);
+            *destIter++ = static_cast<uint8_t>(offset >> 8);
+            if (matchLength - MIN_MATCH >= 15) {
+                *token |= 15;
+                destIter = writeLength(destIter, matchLength - MIN_MATCH - 15);
+            } else {
+                *token |= static_cast<uint8_t>(matchLength - MIN_MATCH);
+            }
+            
+            i += matchLength;
+            anchor = i;
+            if (i < findLimit) {    // Adding a position inside the match helps find the next one.
+                hashTable[hashSequence(readUint32(source + i - 2))] = static_cast<uint32_t>(i - 2);
+            }
+        }
+    }
+    
+    const size_t literalLength = sourceSize - anchor;
+    if (static_cast<size_t>(destEnd - destIter) < 1 + literalLength / 255 + 1 + literalLength) {
+        return 0;
+    }
+    if (literalLength >= 15) {
+        *destIter++ = 15 << 4;
+        destIter = writeLength(destIter, literalLength - 15);
+    } else {
+        *destIter++ = static_cast<uint8_t>(literalLength << 4);
+    }
+    std::memcpy(destIter, source + anchor, literalLength);
+    destIter += literalLength;
+    return static_cast<size_t>(destIter - dest);
+}
+
+bool Compressor::decompressBlock(const uint8_t* source, size_t sourceSize, uint8_t* dest, size_t destSize) {
+    const uint8_t* const sourceEnd = source + sourceSize;
+    uint8_t* destIter = dest;
+    uint8_t* const destEnd = dest + destSize;
+    while (source < sourceEnd) {
+        const uint8_t token = *source++;
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !readLength(source, sourceEnd, literalLength)) {
+            return false;
+        }
+        if (literalLength > static_cast<size_t>(sourceEnd - source) || literalLength > static_cast<size_t>(destEnd - destIter)) {
+            return false;
+        }
+        std::memcpy(destIter, source, literalLength);
+        source += literalLength;
+        destIter += literalLength;
+        if (source == sourceEnd) {    // The last sequence only has literals.
+            break;
+        }
+        
+        if (sourceEnd - source < 2) {
+            return false;
+        }
+        const size_t offset = static_cast<size_t>(source[0]) | (static_cast<size_t>(source[1]) << 8);
+        source += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(source, sourceEnd, matchLength)) {
+            return false;
+        }
+        matchLength += MIN_MATCH;
+        if (offset == 0 || offset > static_cast<size_t>(destIter - dest) || matchLength > static_cast<size_t>(destEnd - destIter)) {
+            return false;
+        }
+        const uint8_t* match = destIter - offset;
+        if (offset >= matchLength) {
+            std::memcpy(destIter, match, matchLength);
+            destIter += matchLength;
+        } else {    // Overlapping copy repeats the last offset bytes.
+            for (size_t i = 0; i < matchLength; ++i) {
+                *destIter++ = *match++;
+            }
+        }
+    }
+    return destIter == destEnd;
+}
+
+bool Compressor::parseHeader(const char* data, size_t size, Header& header) {
+    if (size < HEADER_SIZE || std::memcmp(data, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC)) != 0) {
+        return false;
+    }
+    uint64_t uncompressedSize;
+    std::memcpy(&uncompressedSize, data + 8, sizeof(uncompressedSize));
+    header.size = static_cast<uintmax_t>(uncompressedSize);
+    std::memcpy(header.digest.data(), data + 16, header.digest.size());
+    return true;
+}
+
+bool Compressor::readHeader(const fs::path& filename, Header& header) {
+    std::ifstream inputFile(filename, std::ios::binary);
+    char data[HEADER_SIZE];
+    inputFile.read(data, HEADER_SIZE);
+    return inputFile && parseHeader(data, HEADER_SIZE, header);
+}
+
+bool Compressor::compressFile(const fs::path& source, const fs::path& dest, IoThrottle* ioThrottle, PageCacheMode pageCacheMode) {
+    FileReader sourceFile;
+    if (!sourceFile.open(source, pageCacheMode)) {
+        throw std::runtime_error("\"" + source.string() + "\": Unable to open file for reading.");
+    }
+    AlignedBuffer buffer(BLOCK_SIZE);
+    std::vector<uint8_t> compressedBuffer(BLOCK_SIZE);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(buffer.data());
+    size_t numRead = sourceFile.read(buffer.data(), BLOCK_SIZE);
+    if (ioThrottle != nullptr) {
+        ioThrottle->acquireRead(static_cast<uintmax_t>(numRead));
+    }
+    if (isAlreadyCompressed(data, numRead)) {
+        return false;
+    }
+    size_t compressedSize = compressBlock(data, numRead, compressedBuffer.data(), numRead - numRead / 16);    // The first block decides if the file is worth compressing, it must shrink by at least 1/16.
+    if (compressedSize == 0) {
+        return false;
+    }
+    
+    std::ofstream destFile(dest, std::ios::binary | std::ios::trunc);
+    if (!destFile.is_open()) {
+        throw std::runtime_error("\"" + dest.string() + "\": Unable to open file for writing.");
+    }
+    char header[HEADER_SIZE] = {};    // Size and digest are filled in at the end.
+    std::memcpy(header, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC));
+    destFile.write(header, HEADER_SIZE);
+    
+    Sha256 sha;
+    uint64_t totalSize = 0;
+    while (numRead > 0) {
+        sha.update(data, numRead);
+        totalSize += numRead;
+        uint32_t blockLength;
+        const char* block;
+        if (compressedSize > 0) {
+            blockLength = static_cast<uint32_t>(compressedSize);
+            block = reinterpret_cast<const char*>(compressedBuffer.data());
+        } else {
+            blockLength = static_cast<uint32_t>(numRead) | RAW_BLOCK_FLAG;
+            block = buffer.data();
+        }
+        destFile.write(reinterpret_cast<const char*>(&blockLength), sizeof(blockLength));
+        destFile.write(block, static_cast<std::streamsize>(blockLength & ~RAW_BLOCK_FLAG));
+        if (ioThrottle != nullptr) {
+            ioThrottle->acquireWrite(static_cast<uintmax_t>(sizeof(blockLength) + (blockLength & ~RAW_BLOCK_FLAG)));
+        }
+        
+        numRead = sourceFile.read(buffer.data(), BLOCK_SIZE);
+        if (ioThrottle != nullptr) {
+            ioThrottle->acquireRead(static_cast<uintmax_t>(numRead));
+        }
+        compressedSize = (numRead > 0 ? compressBlock(data, numRead, compressedBuffer.data(), numRead - 1) : 0);    // Store the block as is unless it shrinks.
+    }
+    sourceFile.close();
+    
+    const Sha256::Digest digest = sha.finish();
+    destFile.seekp(8);
+    destFile.write(reinterpret_cast<const char*>(&totalSize), sizeof(totalSize));
+    destFile.write(reinterpret_cast<const char*>(digest.data()), digest.size());
+    destFile.close();
+    if (!destFile) {
+        throw std::runtime_error("\"" + dest.string() + "\": Failed to write compressed file.");
+    }
+    return true;
+}
+
+bool Compressor::decompressFile(const fs::path& source, const fs::path& dest, IoThrottle* ioThrottle) {
+    Header header;
+    if (!readHeader(source, header)) {
+        return false;
+    }
+    std::ifstream sourceFile(source, std::ios::binary);
+    std::ofstream destFile(dest, std::ios::binary | std::ios::trunc);
+    if (!sourceFile.is_open()) {
+        throw std::runtime_error("\"" + source.string() + "\": Unable to open file for reading.");
+    } else if (!destFile.is_open()) {
+        throw std::runtime_error("\"" + dest.string() + "\": Unable to open file for writing.");
+    }
+    sourceFile.seekg(HEADER_SIZE);
+    
+    std::vector<char> blockBuffer(BLOCK_SIZE);
+    std::vector<char> outputBuffer(BLOCK_SIZE);
+    Sha256 sha;
+    uintmax_t remainingSize = header.size;
+    while (remainingSize > 0) {
+        const size_t outputSize = static_cast<size_t>(std::min(remainingSize, static_cast<uintmax_t>(BLOCK_SIZE)));
+        uint32_t blockLength = 0;
+        sourceFile.read(reinterpret_cast<char*>(&blockLength), sizeof(blockLength));
+        const bool rawBlock = (blockLength & RAW_BLOCK_FLAG) != 0;
+        blockLength &= ~RAW_BLOCK_FLAG;
+        if (!sourceFile || blockLength > BLOCK_SIZE || (rawBlock && blockLength != outputSize)) {
+            throw std::runtime_error("\"" + source.string() + "\": Compressed file is corrupt.");
+        }
+        sourceFile.read(blockBuffer.data(), blockLength);
+        if (ioThrottle != nullptr) {
+            ioThrottle->acquireRead(static_cast<uintmax_t>(sizeof(blockLength) + blockLength));
+            ioThrottle->acquireWrite(static_cast<uintmax_t>(outputSize));
+        }
+        const char* output = blockBuffer.data();
+        if (!rawBlock) {
+            if (!sourceFile || !decompressBlock(reinterpret_cast<const uint8_t*>(blockBuffer.data()), blockLength, reinterpret_cast<uint8_t*>(outputBuffer.data()), outputSize)) {
+                throw std::runtime_error("\"" + source.string() + "\": Compressed file is corrupt.");
+            }
+            output = outputBuffer.data();
+        }
+        sha.update(output, outputSize);
+        destFile.write(output, static_cast<std::streamsize>(outputSize));
+        remainingSize -= outputSize;
+    }
+    destFile.close();
+    if (!sourceFile || sha.finish() != header.digest) {
+        throw std::runtime_error("\"" + source.string() + "\": Compressed file is corrupt.");
+    } else if (!destFile) {
+        throw std::runtime_error("\"" + dest.string() + "\": Failed to write file.");
+    }
+    return true;
+}
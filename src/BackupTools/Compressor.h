@@ -0,0 +1,89 @@
+#ifndef COMPRESSOR_H_
+#define COMPRESSOR_H_
+
+#include "BackupTools/FileReader.h"
+#include "BackupTools/Sha256.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+class IoThrottle;
+
+/**
+ * Compression of destination files. Blocks are compressed with the LZ4 block
+ * format, which is fast enough to keep up with most drives while leaving the
+ * CPU mostly idle. A compressed file keeps its original name and starts with a
+ * header that holds the size and SHA-256 digest of the uncompressed data, so
+ * it can be compared with a source file without decompressing it.
+ *
+ * Layout of a compressed file:
+ *     magic       8 bytes, "\x89BTZ\r\n\x1a\x01" (last byte is the version).
+ *     size        Uncompressed size (uint64).
+ *     digest      SHA-256 of the uncompressed data.
+ *     blocks      Each block is a uint32 length followed by the data. Blocks
+ *                 hold BLOCK_SIZE bytes of uncompressed data (except the last
+ *                 one). If the high bit of the length is set, the block was
+ *                 stored without compression.
+ */
+class Compressor {
+public:
+    /**
+     * The uncompressed size and digest from the header of a compressed file.
+     */
+    struct Header {
+        uintmax_t size;
+        Sha256::Digest digest;
+    };
+    
+    static constexpr size_t BLOCK_SIZE = 256 * 1024;
+    static constexpr size_t HEADER_SIZE = 8 + 8 + 32;
+    
+    /**
+     * Checks the start of a file for the magic bytes of common compressed
+     * formats (archives, images, audio, video). Compressing these again would
+     * just waste time.
+     */
+    static bool isAlreadyCompressed(const uint8_t* data, size_t size);
+    
+    /**
+     * Compresses a block of up to BLOCK_SIZE bytes into dest. Returns the
+     * compressed size, or zero if the result does not fit in destCapacity.
+     */
+    static size_t compressBlock(const uint8_t* source, size_t sourceSize, uint8_t* dest, size_t destCapacity);
+    
+    /**
+     * Decompresses a block that must expand to exactly destSize bytes. Returns
+     * false if the block is corrupt.
+     */
+    static bool decompressBlock(const uint8_t* source, size_t sourceSize, uint8_t* dest, size_t destSize);
+    
+    /**
+     * Parses the header at the start of data. Returns false if the data does
+     * not begin with a compressed file header.
+     */
+    static bool parseHeader(const char* data, size_t size, Header& header);
+    
+    /**
+     * Reads the header of a file. Returns false if the file is not compressed
+     * (or cannot be opened).
+     */
+    static bool readHeader(const fs::path& filename, Header& header);
+    
+    /**
+     * Writes a compressed copy of source to dest. Returns false without
+     * writing anything if the file is already in a compressed format or the
+     * first block does not shrink enough, a plain copy should be made instead.
+     */
+    static bool compressFile(const fs::path& source, const fs::path& dest, IoThrottle* ioThrottle, PageCacheMode pageCacheMode);
+    
+    /**
+     * Writes the uncompressed contents of source to dest, and checks them
+     * against the digest. Returns false without writing anything if source is
+     * not a compressed file.
+     */
+    static bool decompressFile(const fs::path& source, const fs::path& dest, IoThrottle* ioThrottle);
+};
+
+#endif
@@ -0,0 +1,306 @@
+#include "BackupTools/ConfigPlan.h"
+#include "BackupTools/Stats.h"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+constexpr char CONFIG_PLAN_HEADER[] = "BTPLAN1\n";
+
+template<typename T>
+void writePlanValue(std::ostream& out, T value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+bool readPlanValue(std::istream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+/**
+ * Bools are stored as a single byte of 0 or 1, anything else fails to read.
+ */
+bool readPlanBool(std::istream& in, bool& value) {
+    uint8_t byte;
+    if (!readPlanValue(in, byte) || byte > 1) {
+        return false;
+    }
+    value = (byte != 0);
+    return true;
+}
+
+/**
+ * Substitute the path root for a match in rootPaths if applicable.
+ */
+fs::path substituteRootPath(const std::map<fs::path, fs::path>& rootPaths, const fs::path& path) {
+    auto pathIter = path.begin();
+    if (pathIter != path.end()) {
+        auto findResult = rootPaths.find(*pathIter);
+        if (findResult != rootPaths.end()) {
+            if (std::next(pathIter) == path.end()) {    // If this is last sub-path, return mapped root path as it is.
+                return findResult->second;
+            } else {
+                return findResult->second / fs::path(path.string().substr(pathIter->string().length() + 1));
+            }
+        }
+    }
+    return path;
+}
+
+ConfigPlan::ConfigPlan() :
+    digest_() {
+}
+
+void ConfigPlan::compile(const fs::path& configFilename) {
+    Stats::ScopedTimer timer(Stats::ParseConfig);
+    std::string contents;
+    readConfigFile(configFilename, contents);
+    parse(contents);
+}
+
+bool ConfigPlan::loadOrCompile(const fs::path& configFilename, const fs::path& planFilename) {
+    Stats::ScopedTimer timer(Stats::ParseConfig);
+    std::string contents;
+    readConfigFile(configFilename, contents);
+    if (load(planFilename)) {
+        return true;
+    }
+    parse(contents);
+    return false;
+}
+
+void ConfigPlan::save(const fs::path& filename) const {
+    fs::path tempFilename = filename;    // Write to a temporary file first so that a crash can't leave a partial plan behind.
+    tempFilename += ".tmp";
+    std::ofstream planFile(tempFilename, std::ios::binary);
+    if (!planFile.is_open()) {
+        throw std::runtime_error("\"" + tempFilename.string() + "\": Unable to open file for writing.");
+    }
+    planFile.write(CONFIG_PLAN_HEADER, sizeof(CONFIG_PLAN_HEADER) - 1);
+    planFile.write(reinterpret_cast<const char*>(digest_.data()), digest_.size());
+    writePlanValue(planFile, static_cast<uint8_t>(globOptions_.matching));
+    writePlanValue(planFile, static_cast<uint8_t>(globOptions_.matchesHiddenFiles));
+    
+    for (const auto& step : steps_) {
+        planFile.put(static_cast<char>(step.type));
+        planFile << step.path.string() << '\0';
+        if (step.type == StepType::Add) {
+            planFile << step.writePath.string() << '\0';
+            writePlanValue(planFile, static_cast<uint32_t>(step.writePathId));
+            const uint8_t flags = (step.snapshot ? 1 : 0) | (step.chunkStore ? 2 : 0) | (step.compress ? 4 : 0) | (step.fanOut ? 8 : 0) | (step.globOptions.matching ? 16 : 0) | (step.globOptions.matchesHiddenFiles ? 32 : 0) | (step.decompress ? 64 : 0);
+            writePlanValue(planFile, flags);
+        }
+    }
+    planFile.close();
+    if (!planFile) {
+        throw std::runtime_error("\"" + tempFilename.string() + "\": Failed to write config plan.");
+    }
+    fs::rename(tempFilename, filename);
+}
+
+void ConfigPlan::readConfigFile(const fs::path& configFilename, std::string& contents) {
+    std::ifstream configFile(configFilename, std::ios::binary);
+    if (!configFile.is_open()) {
+        throw std::runtime_error("\"" + configFilename.string() + "\": Unable to open file for reading.");
+    }
+    contents.assign(std::istreambuf_iterator<char>(configFile), std::istreambuf_iterator<char>());
+    configFilename_ = configFilename;
+    digest_ = Sha256::hash(contents.data(), contents.size());
+}
+
+void ConfigPlan::parse(const std::string& contents) {
+    steps_.clear();
+    globOptions_ = GlobOptions();
+    
+    std::istringstream configFile(contents);
+    std::string line;
+    unsigned int lineNumber = 0;
+    std::map<fs::path, fs::path> rootPaths;
+    std::set<fs::path> ignorePaths;    // Only used to check that each include has an ignore to remove.
+    std::map<fs::path, unsigned int> writePathIds;
+    Step addStep;    // Holds the current write path and its options.
+    bool writePathSet = false;
+    bool snapshotMode = false, chunkStoreMode = false, compressMode = false, decompressMode = false, fanOutMode = false;
+    
+    while (getline(configFile, line)) {
+        ++lineNumber;
+        try {
+            std::string::size_type index = 0;
+            FileHandler::skipWhitespace(index, line);
+            if (index >= line.length() || line[index] == '#') {
+                continue;
+            }
+            
+            std::string command = FileHandler::parseNextWord(index, line);
+            if (command == "set") {    // Syntax: set <option> <value>
+                if (index >= line.length()) {
+                    throw std::runtime_error("Missing option parameter.");
+                }
+                std::string option = FileHandler::parseNextWord(index, line);
+                
+                if (option == "glob-matching") {    // Enables/disables glob (wildcard) matching.
+                    if (index >= line.length()) {
+                        throw std::runtime_error("Missing value for \"" + option + "\".");
+                    }
+                    globOptions_.matching = FileHandler::parseNextBool(index, line);
+                } else if (option == "match-hidden") {    // Controls matching of hidden files when using glob matching.
+                    if (index >= line.length()) {
+                        throw std::runtime_error("Missing value for \"" + option + "\".");
+                    }
+                    globOptions_.matchesHiddenFiles = FileHandler::parseNextBool(index, line);
+                } else if (option == "snapshot") {    // Enables/disables snapshot backups for the following write paths.
+                    if (index >= line.length()) {
+                        throw std::runtime_error("Missing value for \"" + option + "\".");
+                    }
+                    snapshotMode = FileHandler::parseNextBool(index, line);
+                } else if (option == "chunk-store") {    // Enables/disables the deduplicating chunk store for the following write paths.
+                    if (index >= line.length()) {
+                        throw std::runtime_error("Missing value for \"" + option + "\".");
+                    }
+                    chunkStoreMode = FileHandler::parseNextBool(index, line);
+                } else if (option == "compress") {    // Enables/disables compression of files copied to the following write paths.
+                    if (index >= line.length()) {
+                        throw std::runtime_error("Missing value for \"" + option + "\".");
+                    }
+                    compressMode = FileHandler::parseNextBool(index, line);
+                } else if (option == "decompress") {    // Enables/disables decompression of files copied from compressed sources to the following write paths.
+                    if (index >= line.length()) {
+                        throw std::runtime_error("Missing value for \"" + option + "\".");
+                    }
+                    decompressMode = FileHandler::parseNextBool(index, line);
+                } else if (option == "fan-out") {    // Allows the following write paths to add read paths that were already added to another write path.
+                    if (index >= line.length()) {
+                        throw std::runtime_error("Missing value for \"" + option + "\".");
+                    }
+                    fanOutMode = FileHandler::parseNextBool(index, line);
+                } else {
+                    throw std::runtime_error("Invalid option \"" + option + "\".");
+                }
+            } else if (command == "root") {    // Syntax: root <identifier> <replacement path>
+                if (index >= line.length()) {
+                    throw std::runtime_error("Missing identifier path parameter.");
+                }
+                fs::path keyPath = FileHandler::parseNextPath(index, line);
+                if (index >= line.length()) {
+                    throw std::runtime_error("Missing replacement path parameter.");
+                }
+                fs::path valuePath = FileHandler::parseNextPath(index, line);
+                
+                rootPaths.emplace(keyPath, valuePath);
+            } else if (command == "in") {    // Syntax: in <write path> [add <read path>]
+                if (index >= line.length()) {
+                    throw std::runtime_error("Missing write path parameter.");
+                }
+                addStep.writePath = substituteRootPath(rootPaths, FileHandler::parseNextPath(index, line));
+                writePathSet = true;
+                addStep.snapshot = snapshotMode;    // The set commands after this line do not change this write path.
+                addStep.chunkStore = chunkStoreMode;
+                addStep.compress = compressMode;
+                addStep.decompress = decompressMode;
+                addStep.fanOut = fanOutMode;
+                addStep.writePathId = writePathIds.emplace(addStep.writePath, static_cast<unsigned int>(writePathIds.size())).first->second;
+                if (index < line.length()) {
+                    command = FileHandler::parseNextWord(index, line);
+                    if (command != "add") {
+                        throw std::runtime_error("Unexpected command \"" + command + "\" after \"in <write path>\".");
+                    }
+                    if (index >= line.length()) {
+                        throw std::runtime_error("Missing read path parameter.");
+                    }
+                    addStep.type = StepType::Add;
+                    addStep.path = substituteRootPath(rootPaths, FileHandler::parseNextPath(index, line));
+                    addStep.globOptions = globOptions_;
+                    steps_.push_back(addStep);
+                }
+            } else if (command == "add") {    // Syntax (write path must have previously been set): add <read path>
+                if (!writePathSet) {
+                    throw std::runtime_error("Missing previous call to \"in <write path>\".");
+                }
+                if (index >= line.length()) {
+                    throw std::runtime_error("Missing read path parameter.");
+                }
+                addStep.type = StepType::Add;
+                addStep.path = substituteRootPath(rootPaths, FileHandler::parseNextPath(index, line));
+                addStep.globOptions = globOptions_;
+                steps_.push_back(addStep);
+            } else if (command == "ignore") {    // Syntax: ignore <path>
+                if (index >= line.length()) {
+                    throw std::runtime_error("Missing ignore path parameter.");
+                }
+                Step ignoreStep;
+                ignoreStep.type = StepType::Ignore;
+                ignoreStep.path = substituteRootPath(rootPaths, FileHandler::parseNextPath(index, line));
+                ignorePaths.emplace(ignoreStep.path);
+                steps_.push_back(std::move(ignoreStep));
+            } else if (command == "include") {    // Syntax: include <path>
+                if (index >= line.length()) {
+                    throw std::runtime_error("Missing include path parameter.");
+                }
+                Step includeStep;
+                includeStep.type = StepType::Include;
+                includeStep.path = substituteRootPath(rootPaths, FileHandler::parseNextPath(index, line));
+                if (ignorePaths.erase(includeStep.path) == 0) {
+                    throw std::runtime_error("No matching ignore path found for \"" + includeStep.path.string() + "\".");
+                }
+                steps_.push_back(std::move(includeStep));
+            } else {
+                throw std::runtime_error("Unknown command \"" + command + "\".");
+            }
+            if (index < line.length()) {
+                throw std::runtime_error("Unexpected data after command: \"" + line.substr(index) + "\".");
+            }
+        } catch (std::exception& ex) {
+            steps_.clear();
+            throw std::runtime_error("\"" + configFilename_.string() + "\" at line " + std::to_string(lineNumber) + ": " + ex.what());
+        }
+    }
+}
+
+bool ConfigPlan::load(const fs::path& filename) {
+    std::ifstream planFile(filename, std::ios::binary);
+    char header[sizeof(CONFIG_PLAN_HEADER) - 1];
+    Sha256::Digest digest;
+    GlobOptions globOptions;
+    if (!planFile.read(header, sizeof(header)) || !std::equal(header, header + sizeof(header), CONFIG_PLAN_HEADER) ||
+        !planFile.read(reinterpret_cast<char*>(digest.data()), digest.size()) || digest != digest_ ||
+        !readPlanBool(planFile, globOptions.matching) || !readPlanBool(planFile, globOptions.matchesHiddenFiles)) {
+        return false;
+    }
+    
+    std::vector<Step> steps;
+    std::string path;
+    char type;
+    while (planFile.get(type)) {
+        Step step;
+        step.type = static_cast<StepType>(type);
+        if ((step.type != StepType::Ignore && step.type != StepType::Include && step.type != StepType::Add) || !std::getline(planFile, path, '\0')) {
+            return false;
+        }
+        step.path = path;
+        if (step.type == StepType::Add) {
+            uint32_t writePathId;
+            uint8_t flags;
+            if (!std::getline(planFile, path, '\0') || !readPlanValue(planFile, writePathId) || !readPlanValue(planFile, flags) || flags >= 128) {    // Unknown flags mean a corrupt plan.
+                return false;
+            }
+            step.writePath = path;
+            step.writePathId = writePathId;
+            step.snapshot = (flags & 1) != 0;
+            step.chunkStore = (flags & 2) != 0;
+            step.compress = (flags & 4) != 0;
+            step.fanOut = (flags & 8) != 0;
+            step.globOptions.matching = (flags & 16) != 0;
+            step.globOptions.matchesHiddenFiles = (flags & 32) != 0;
+            step.decompress = (flags & 64) != 0;
+        }
+        steps.push_back(std::move(step));
+    }
+    
+    steps_ = std::move(steps);
+    globOptions_ = globOptions;
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef CONFIG_PLAN_H_
+#define CONFIG_PLAN_H_
+
+#include "BackupTools/FileHandler.h"
+#include "BackupTools/Sha256.h"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * A config file compiled into the steps that FileHandler runs to find the
+ * tracked files. The root paths are already substituted and the paths are in
+ * normal form, and each add keeps the options (set commands) that were active
+ * for it. The ignore and include commands stay as steps in between the adds
+ * since an ignore only applies to the adds after it.
+ *
+ * A plan can be saved and loaded again, it is keyed by the SHA-256 digest of
+ * the config contents. Loading a saved plan skips parsing the config, which
+ * matters for large generated configs. Nothing in the plan depends on the
+ * file system or the current directory (relative patterns are resolved
+ * during the scan).
+ */
+class ConfigPlan {
+public:
+    enum class StepType : char {
+        Ignore = 'i', Include = 'n', Add = 'a'
+    };
+    
+    struct Step {
+        StepType type;
+        fs::path path;    // The ignore path, or the read path (glob pattern) for Add.
+        fs::path writePath;    // Only for Add.
+        unsigned int writePathId = 0;    // Same for each add with the same write path.
+        bool snapshot = false;
+        bool chunkStore = false;
+        bool compress = false;
+        bool decompress = false;
+        bool fanOut = false;
+        GlobOptions globOptions;
+    };
+    
+    ConfigPlan();
+    
+    /**
+     * Reads and parses the config file. Throws std::runtime_error if the file
+     * cannot be read or has an error (the message includes the line number).
+     */
+    void compile(const fs::path& configFilename);
+    
+    /**
+     * Same as compile(), but uses the plan saved in planFilename instead if it
+     * was made from the same config contents. Returns true if the saved plan
+     * was used. The plan is not saved again, call save() for that.
+     */
+    bool loadOrCompile(const fs::path& configFilename, const fs::path& planFilename);
+    
+    /**
+     * Writes the plan to a file, the previous one is replaced in a single
+     * rename.
+     */
+    void save(const fs::path& filename) const;
+    
+    const fs::path& getConfigFilename() const { return configFilename_; }
+    const Sha256::Digest& getDigest() const { return digest_; }
+    const std::vector<Step>& getSteps() const { return steps_; }
+    
+    /**
+     * Returns the glob settings once the whole config has been read.
+     */
+    const GlobOptions& getGlobOptions() const { return globOptions_; }
+    
+private:
+    fs::path configFilename_;
+    Sha256::Digest digest_;
+    std::vector<Step> steps_;
+    GlobOptions globOptions_;
+    
+    /**
+     * Reads the whole config file into contents and sets configFilename_ and
+     * digest_.
+     */
+    void readConfigFile(const fs::path& configFilename, std::string& contents);
+    
+    /**
+     * Parses the config contents into steps_ and globOptions_.
+     */
+    void parse(const std::string& contents);
+    
+    /**
+     * Reads a saved plan, returns false (and keeps nothing) if the file is
+     * missing, corrupt, or has a different digest than digest_.
+     */
+    bool load(const fs::path& filename);
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "BackupTools/DirectoryHandles.h"
+#include "BackupTools/Stats.h"
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+DirectoryHandles::DirectoryHandles(size_t maxOpen) :
+    maxOpen_(std::max<size_t>(maxOpen, 1)) {
+}
+
+DirectoryHandles::~DirectoryHandles() {
+    closeAll();
+}
+
+#ifndef _WIN32
+int DirectoryHandles::getDirectory(const fs::path& directory) {
+    const std::string& path = directory.native();
+    
+    // Find the deepest open directory that contains this one, anything after it is on a different branch.
+    size_t numAncestors = openDirectories_.size();
+    size_t subPathStart = 0;
+    while (numAncestors > 0) {
+        const std::string& ancestor = openDirectories_[numAncestors - 1].path;
+        if (path.compare(0, ancestor.length(), ancestor) == 0) {
+            if (path.length() == ancestor.length()) {
+                return openDirectories_[numAncestors - 1].fd;
+            } else if (ancestor.back() == '/' || path[ancestor.length()] == '/') {
+                subPathStart = ancestor.length();
+                break;
+            }
+        }
+        --numAncestors;
+    }
+    while (openDirectories_.size() > numAncestors) {
+        Stats::add(Stats::Syscalls);
+        ::close(openDirectories_.back().fd);
+        openDirectories_.pop_back();
+    }
+    
+    Stats::add(Stats::Syscalls);
+    int fd;
+    if (numAncestors > 0) {
+        while (subPathStart < path.length() && path[subPathStart] == '/') {
+            ++subPathStart;
+        }
+        fd = openat(openDirectories_.back().fd, path.c_str() + subPathStart, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } else {
+        fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (fd == -1) {
+        throw fs::filesystem_error("Unable to open directory", directory, std::error_code(errno, std::system_category()));
+    }
+    if (openDirectories_.size() >= maxOpen_) {    // Drop the shallowest directory, the rest of the chain still nests.
+        Stats::add(Stats::Syscalls);
+        ::close(openDirectories_.front().fd);
+        openDirectories_.erase(openDirectories_.begin());
+    }
+    openDirectories_.push_back({path, fd});
+    return fd;
+}
+
+int DirectoryHandles::openFile(const fs::path& filename, int flags) {
+    const fs::path parentPath = filename.parent_path();
+    if (parentPath.empty() || !filename.has_filename()) {
+        return ::open(filename.c_str(), flags);
+    }
+    int dirFd;
+    try {
+        dirFd = getDirectory(parentPath);
+    } catch (fs::filesystem_error& ex) {
+        errno = ex.code().value();
+        return -1;
+    }
+    return openat(dirFd, filename.filename().c_str(), flags);
+}
+#endif
+
+void DirectoryHandles::closeAll() {
+    #ifndef _WIN32
+        for (const auto& openDirectory : openDirectories_) {
+            Stats::add(Stats::Syscalls);
+            ::close(openDirectory.fd);
+        }
+    #endif
+    openDirectories_.clear();
+}
@@ -0,0 +1,66 @@
+#ifndef DIRECTORY_HANDLES_H_
+#define DIRECTORY_HANDLES_H_
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * Keeps directories open so that paths inside them can be opened relative to
+ * the directory (with openat() and fstatat()) instead of the kernel resolving
+ * each component of the full path again. The open directories form a chain
+ * where each one is inside the previous, like the stack of a depth-first
+ * traversal. Getting a directory outside of the chain closes the ones that
+ * are no longer ancestors, and only the deepest maxOpen directories are kept.
+ *
+ * The directories should only be held for one pass over a tree, a directory
+ * that gets deleted and created again while open would still refer to the old
+ * one. Only available on POSIX systems, on Windows the paths are used as-is.
+ */
+class DirectoryHandles {
+public:
+    explicit DirectoryHandles(size_t maxOpen = DEFAULT_MAX_OPEN);
+    ~DirectoryHandles();
+    DirectoryHandles(const DirectoryHandles&) = delete;
+    DirectoryHandles& operator=(const DirectoryHandles&) = delete;
+    
+    #ifndef _WIN32
+        /**
+         * Returns a descriptor for the directory, opened relative to the closest
+         * ancestor that is still open. The descriptor belongs to this object and
+         * stays valid until the next call to getDirectory() or openFile(). Throws
+         * fs::filesystem_error if the directory cannot be opened.
+         */
+        int getDirectory(const fs::path& directory);
+        
+        /**
+         * Opens a file relative to its parent directory, with the same flags as
+         * open() (files cannot be created this way). Returns the new descriptor
+         * (the caller needs to close it) or -1 with errno set if it failed.
+         */
+        int openFile(const fs::path& filename, int flags);
+    #endif
+    
+    /**
+     * Closes all of the directories.
+     */
+    void closeAll();
+    
+    size_t getNumOpen() const { return openDirectories_.size(); }
+    
+private:
+    static constexpr size_t DEFAULT_MAX_OPEN = 16;
+    
+    struct OpenDirectory {
+        std::string path;
+        int fd;
+    };
+    
+    std::vector<OpenDirectory> openDirectories_;
+    size_t maxOpen_;
+};
+
+#endif
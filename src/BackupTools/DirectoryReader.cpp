@@ -0,0 +1,178 @@
+#include "BackupTools/DirectoryReader.h"
+#include "BackupTools/Stats.h"
+#include <cerrno>
+#include <system_error>
+
+#ifdef __linux__
+    #include <dirent.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+#ifdef __linux__
+/**
+ * Record layout returned by getdents64(), glibc only declares it for newer
+ * versions.
+ */
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+/**
+ * Returns the type from an lstat() of the entry, for file systems that do not
+ * fill in d_type.
+ */
+DirectoryReader::EntryType statEntryType(int dirFd, const char* name) {
+    struct stat st;
+    Stats::add(Stats::Syscalls);
+    if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return DirectoryReader::EntryType::Other;
+    } else if (S_ISREG(st.st_mode)) {
+        return DirectoryReader::EntryType::File;
+    } else if (S_ISDIR(st.st_mode)) {
+        return DirectoryReader::EntryType::Directory;
+    } else if (S_ISLNK(st.st_mode)) {
+        return DirectoryReader::EntryType::Symlink;
+    }
+    return DirectoryReader::EntryType::Other;
+}
+#endif
+
+DirectoryReader::DirectoryReader(size_t bufferSize, size_t maxOpenDirectories)
+    #ifdef __linux__
+        : directories_(maxOpenDirectories)
+    #endif
+    {
+        
+    #ifdef __linux__
+        fd_ = -1;
+        bufferSize_ = bufferSize;
+        bufferLength_ = 0;
+        bufferOffset_ = 0;
+    #else
+        static_cast<void>(bufferSize);
+        static_cast<void>(maxOpenDirectories);
+    #endif
+}
+
+DirectoryReader::~DirectoryReader() {
+    close();
+}
+
+void DirectoryReader::open(const fs::path& directory) {
+    close();
+    directory_ = directory;
+    #ifdef __linux__
+        fd_ = directories_.getDirectory(directory_);
+        Stats::add(Stats::Syscalls);
+        if (lseek(fd_, 0, SEEK_SET) == -1) {    // The directory may have been read before (or be a parent of the previous one).
+            const int error = errno;
+            fd_ = -1;
+            throw fs::filesystem_error("Unable to read directory", directory_, std::error_code(error, std::system_category()));
+        }
+        if (!buffer_) {    // Not zeroed, only the part the kernel fills gets touched.
+            buffer_.reset(new char[bufferSize_]);
+        }
+    #else
+        Stats::add(Stats::Syscalls, 3);
+        iter_ = fs::directory_iterator(directory_);
+    #endif
+}
+
+bool DirectoryReader::next(Entry& entry) {
+    #ifdef __linux__
+        if (fd_ == -1) {
+            return false;
+        }
+        while (true) {
+            if (bufferOffset_ >= bufferLength_) {
+                Stats::add(Stats::Syscalls);
+                const long numRead = syscall(SYS_getdents64, fd_, buffer_.get(), bufferSize_);
+                if (numRead == -1) {
+                    const int error = errno;
+                    close();
+                    throw fs::filesystem_error("Unable to read directory", directory_, std::error_code(error, std::system_category()));
+                } else if (numRead == 0) {
+                    close();
+                    return false;
+                }
+                bufferLength_ = static_cast<size_t>(numRead);
+                bufferOffset_ = 0;
+            }
+            const LinuxDirent64* dirent = reinterpret_cast<const LinuxDirent64*>(buffer_.get() + bufferOffset_);
+            bufferOffset_ += dirent->d_reclen;
+            const char* name = dirent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            entry.name = std::string_view(name);
+            entry.inode = dirent->d_ino;
+            switch (dirent->d_type) {
+                case DT_REG:
+                    entry.type = EntryType::File;
+                    break;
+                case DT_DIR:
+                    entry.type = EntryType::Directory;
+                    break;
+                case DT_LNK:
+                    entry.type = EntryType::Symlink;
+                    break;
+                case DT_UNKNOWN:
+                    entry.type = statEntryType(fd_, name);
+                    break;
+                default:
+                    entry.type = EntryType::Other;
+            }
+            return true;
+        }
+    #else
+        if (iter_ == fs::directory_iterator()) {
+            return false;
+        }
+        const fs::file_status status = iter_->symlink_status();
+        name_ = iter_->path().filename().string();
+        entry.name = name_;
+        entry.inode = 0;
+        if (fs::is_regular_file(status)) {
+            entry.type = EntryType::File;
+        } else if (fs::is_directory(status)) {
+            entry.type = EntryType::Directory;
+        } else if (fs::is_symlink(status)) {
+            entry.type = EntryType::Symlink;
+        } else {
+            entry.type = EntryType::Other;
+        }
+        ++iter_;
+        return true;
+    #endif
+}
+
+void DirectoryReader::close() {
+    #ifdef __linux__
+        fd_ = -1;    // The directory stays open in directories_ for opening the ones inside it.
+        bufferLength_ = 0;
+        bufferOffset_ = 0;
+    #else
+        iter_ = fs::directory_iterator();
+    #endif
+}
+
+bool DirectoryReader::isDirectory(const Entry& entry) const {
+    if (entry.type != EntryType::Symlink) {
+        return entry.type == EntryType::Directory;
+    }
+    #ifdef __linux__
+        struct stat st;
+        Stats::add(Stats::Syscalls);
+        return fstatat(fd_, entry.name.data(), &st, 0) == 0 && S_ISDIR(st.st_mode);
+    #else
+        std::error_code ec;
+        return fs::is_directory(directory_ / entry.name, ec);
+    #endif
+}
@@ -0,0 +1,88 @@
+#ifndef DIRECTORY_READER_H_
+#define DIRECTORY_READER_H_
+
+#include "BackupTools/DirectoryHandles.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+/**
+ * Lists the items in a directory without building a full path for each one.
+ * On Linux the directory is read with getdents64() into a large buffer, so a
+ * directory with many items takes only a few system calls and the names are
+ * returned as views into that buffer. Other systems use fs::directory_iterator.
+ *
+ * The buffer is kept between calls to open(), so one reader can be used for
+ * a whole traversal. Directories are opened relative to their parent with
+ * DirectoryHandles, the reader should go out of scope once the traversal is
+ * done. The "." and ".." entries are skipped.
+ */
+class DirectoryReader {
+public:
+    enum class EntryType : char {
+        File, Directory, Symlink, Other
+    };
+    
+    struct Entry {
+        std::string_view name;    // Null-terminated, valid until the next call to next() or open().
+        EntryType type;
+        uint64_t inode;    // Zero if unknown.
+    };
+    
+    /**
+     * At most maxOpenDirectories are kept open for opening sub-directories.
+     */
+    explicit DirectoryReader(size_t bufferSize = DEFAULT_BUFFER_SIZE, size_t maxOpenDirectories = DEFAULT_MAX_OPEN_DIRECTORIES);
+    ~DirectoryReader();
+    DirectoryReader(const DirectoryReader&) = delete;
+    DirectoryReader& operator=(const DirectoryReader&) = delete;
+    
+    /**
+     * Starts listing a directory, the previous one is closed. Throws
+     * fs::filesystem_error if the directory cannot be opened (same as
+     * fs::directory_iterator).
+     */
+    void open(const fs::path& directory);
+    
+    /**
+     * Gets the next item in the directory. Returns false once all items have
+     * been read, the directory is then closed. Throws fs::filesystem_error if
+     * the read fails.
+     */
+    bool next(Entry& entry);
+    
+    void close();
+    
+    /**
+     * Returns true if the entry is a directory or a symlink to one (same as
+     * fs::directory_entry::is_directory()). Only a symlink needs a system
+     * call.
+     */
+    bool isDirectory(const Entry& entry) const;
+    
+    const fs::path& getPath() const { return directory_; }
+    
+private:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+    static constexpr size_t DEFAULT_MAX_OPEN_DIRECTORIES = 16;
+    
+    fs::path directory_;
+    #ifdef __linux__
+        DirectoryHandles directories_;
+        int fd_;    // Belongs to directories_.
+        std::unique_ptr<char[]> buffer_;
+        size_t bufferSize_;
+        size_t bufferLength_;
+        size_t bufferOffset_;
+    #else
+        fs::directory_iterator iter_;
+        std::string name_;
+    #endif
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "BackupTools/DirectoryWatcher.h"
+#include <cerrno>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef __linux__
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+#ifdef __linux__
+constexpr uint32_t WATCH_EVENT_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+#endif
+
+bool DirectoryWatcher::isSupported() {
+    #ifdef __linux__
+    return true;
+    #else
+    return false;
+    #endif
+}
+
+uintmax_t DirectoryWatcher::getWatchLimit() {
+    std::ifstream limitFile("/proc/sys/fs/inotify/max_user_watches");
+    uintmax_t limit = 0;
+    if (!(limitFile >> limit)) {
+        return 0;
+    }
+    return limit;
+}
+
+DirectoryWatcher::DirectoryWatcher() :
+    fd_(-1),
+    overflow_(false),
+    watchLimitReached_(false) {
+        
+    #ifdef __linux__
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ == -1) {
+        throw std::system_error(errno, std::generic_category(), "Unable to start watching for file changes");
+    }
+    #else
+    throw std::runtime_error("Watching for file changes is not supported on this system.");
+    #endif
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+    #ifdef __linux__
+    if (fd_ != -1) {
+        close(fd_);
+    }
+    #endif
+}
+
+bool DirectoryWatcher::addWatchRecursive(const fs::path& directory) {
+    if (!addWatch(directory)) {
+        return !watchLimitReached_;
+    }
+    std::error_code ec;
+    for (fs::recursive_directory_iterator iter(directory, fs::directory_options::skip_permission_denied, ec), end; !ec && iter != end; iter.increment(ec)) {
+        if (iter->is_directory(ec) && !iter->is_symlink(ec) && !addWatch(iter->path())) {
+            if (watchLimitReached_) {
+                return false;
+            }
+            iter.disable_recursion_pending();
+        }
+    }
+    if (ec) {    // Directory changed while iterating, the events for it may have been missed.
+        overflow_ = true;
+    }
+    return true;
+}
+
+bool DirectoryWatcher::waitForChanges(std::chrono::milliseconds timeout, std::set<fs::path>& dirtyPaths) {
+    #ifdef __linux__
+    pollfd pollFd = {fd_, POLLIN, 0};
+    const int pollResult = poll(&pollFd, 1, static_cast<int>(timeout.count()));
+    if (pollResult == -1 && errno != EINTR) {
+        throw std::system_error(errno, std::generic_category(), "Failed to wait for file changes");
+    } else if (pollResult <= 0) {
+        return false;
+    }
+    
+    alignas(inotify_event) char buffer[64 * 1024];
+    bool foundEvents = false;
+    while (true) {
+        const ssize_t numRead = read(fd_, buffer, sizeof(buffer));
+        if (numRead == -1 && errno == EINTR) {
+            continue;
+        } else if (numRead <= 0) {    // No more events queued (EAGAIN).
+            break;
+        }
+        for (const char* p = buffer; p < buffer + numRead; ) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+            foundEvents = true;
+            
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow_ = true;
+                continue;
+            }
+            auto watchIter = watchPaths_.find(event->wd);
+            if (watchIter == watchPaths_.end()) {
+                continue;
+            } else if (event->mask & IN_IGNORED) {    // Watch was removed (directory deleted or unmounted).
+                watchPaths_.erase(watchIter);
+                continue;
+            } else if (event->len == 0) {    // Event for the watched directory itself.
+                dirtyPaths.insert(watchIter->second);
+                continue;
+            }
+            
+            fs::path path = watchIter->second / event->name;
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {    // Items in a new directory may have been created before the watch was added, so the whole directory is marked.
+                addWatchRecursive(path);
+            }
+            dirtyPaths.insert(std::move(path));
+        }
+    }
+    return foundEvents;
+    #else
+    (void) timeout;
+    (void) dirtyPaths;
+    return false;
+    #endif
+}
+
+bool DirectoryWatcher::checkOverflow() {
+    const bool result = overflow_;
+    overflow_ = false;
+    return result;
+}
+
+bool DirectoryWatcher::addWatch(const fs::path& directory) {
+    #ifdef __linux__
+    const int wd = inotify_add_watch(fd_, directory.c_str(), WATCH_EVENT_MASK);
+    if (wd == -1) {
+        if (errno == ENOSPC) {
+            watchLimitReached_ = true;
+        }
+        return false;
+    }
+    watchPaths_[wd] = directory;
+    return true;
+    #else
+    (void) directory;
+    return false;
+    #endif
+}
@@ -0,0 +1,74 @@
+#ifndef DIRECTORY_WATCHER_H_
+#define DIRECTORY_WATCHER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <set>
+
+namespace fs = std::filesystem;
+
+/**
+ * Watches directory trees for changes with inotify (Linux only). The kernel
+ * only reports events for the directories that have a watch on them, so each
+ * sub-directory gets its own watch and new directories are added as they show
+ * up. The number of watches is limited by /proc/sys/fs/inotify/max_user_watches,
+ * once the limit is reached the remaining directories go unwatched and the
+ * caller needs to fall back to full scans.
+ */
+class DirectoryWatcher {
+public:
+    /**
+     * Returns true if the system supports watching directories.
+     */
+    static bool isSupported();
+    
+    /**
+     * Returns the maximum number of watches per user, or zero if unknown.
+     */
+    static uintmax_t getWatchLimit();
+    
+    DirectoryWatcher();
+    ~DirectoryWatcher();
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+    
+    /**
+     * Adds watches to the directory and all of its sub-directories (symlinks
+     * are not followed). Returns false if the watch limit was reached.
+     */
+    bool addWatchRecursive(const fs::path& directory);
+    
+    /**
+     * Adds a watch for a single directory, events for its sub-directories are
+     * not included. Returns false if it failed (the directory does not exist,
+     * or the watch limit was reached).
+     */
+    bool addWatch(const fs::path& directory);
+    
+    /**
+     * Waits up to timeout for events and adds the paths of changed items to
+     * dirtyPaths. A path for a new directory covers everything inside it.
+     * Returns true if any events were received.
+     */
+    bool waitForChanges(std::chrono::milliseconds timeout, std::set<fs::path>& dirtyPaths);
+    
+    /**
+     * Returns true if events were dropped because the kernel queue filled up
+     * (or a watch could not be added), and clears the flag. The changes since
+     * the last scan are unknown when this happens.
+     */
+    bool checkOverflow();
+    
+    size_t getNumWatches() const { return watchPaths_.size(); }
+    bool isWatchLimitReached() const { return watchLimitReached_; }
+    
+private:
+    int fd_;
+    std::map<int, fs::path> watchPaths_;
+    bool overflow_;
+    bool watchLimitReached_;
+};
+
+#endif
@@ -1,50 +1,69 @@
 #include "BackupTools/FileHandler.h"
+#include "BackupTools/Compressor.h"
+#include "BackupTools/ConfigPlan.h"
+#include "BackupTools/DirectoryReader.h"
+#include "BackupTools/IoThrottle.h"
+#include "BackupTools/Stats.h"
+#include "BackupTools/TreeState.h"
 #include <algorithm>
 #include <cctype>
 #include <chrono>
 #include <iostream>
 #include <limits>
+#include <memory_resource>
 #include <numeric>
-#include <stack>
 #include <stdexcept>
+#include <string_view>
 
-char FileHandler::pathSeparator = fs::path::preferred_separator;
-bool FileHandler::globMatching = true;
-bool FileHandler::globMatchesHiddenFiles = true;
+constexpr char CACHE_FILE_HEADER[] = "BTCACHE2\n";
+constexpr size_t COMPARE_BUFFER_SIZE = 256 * 1024;
+constexpr size_t GLOB_ARENA_BLOCK_SIZE = 64 * 1024;    // First block of the arena in globPortable(), later blocks grow from this.
 
 std::ostream& operator<<(std::ostream& out, CSI csiCode) {
     return out << '\033' << '[' << static_cast<int>(csiCode) << 'm';
 }
 
+GlobOptions::GlobOptions() :
+    pathSeparator(FileHandler::PATH_SEPARATOR),
+    matching(true),
+    matchesHiddenFiles(true) {
+}
+
 bool compareFilename(const fs::path& lhs, const fs::path& rhs) {
+    return compareFilenameView(lhs.string(), rhs.string());
+}
+
+bool compareFilenameView(std::string_view lhs, std::string_view rhs) {
     // Alternative method for cases like "lowercase must be sorted before uppercase" is to use collation table. https://stackoverflow.com/questions/19509110/sorting-a-string-with-stdsort-so-that-capital-letters-come-after-lower-case
-    const std::string lhsString = lhs.string(), rhsString = rhs.string();
-    size_t i = 0, minSize = std::min(lhsString.size(), rhsString.size());
-    while (std::tolower(static_cast<unsigned char>(lhsString[i])) == std::tolower(static_cast<unsigned char>(rhsString[i])) && i < minSize) {
-        ++i;
+    const size_t minSize = std::min(lhs.size(), rhs.size());
+    for (size_t i = 0; i < minSize; ++i) {
+        const int lhsChar = std::tolower(static_cast<unsigned char>(lhs[i])), rhsChar = std::tolower(static_cast<unsigned char>(rhs[i]));
+        if (lhsChar != rhsChar) {
+            return lhsChar < rhsChar;
+        }
     }
-    return std::tolower(static_cast<unsigned char>(lhsString[i])) < std::tolower(static_cast<unsigned char>(rhsString[i]));
+    return lhs.size() < rhs.size();
 }
 
 /**
  * Helper function for fnmatchSimple().
  */
-bool fnmatchSimple_(char const* pattern, char const* str) {
-    while (*str != '\0' && *str != FileHandler::pathSeparator) {
+bool fnmatchSimple_(char const* pattern, char const* str, char pathSeparator) {
+    while (*str != '\0' && *str != pathSeparator) {
         if (*pattern == '*') {    // Star matches zero to n characters. Does not match a leading dot in a name.
             do {    // Skip consecutive stars (globstar not supported).
                 ++pattern;
             } while (*pattern == '*');
             
-            if (fnmatchSimple_(pattern, str)) {    // Attempt to match zero characters.
+            if (fnmatchSimple_(pattern, str, pathSeparator)) {    // Attempt to match zero characters.
                 return true;
             }
             do {
                 ++str;
-                if (fnmatchSimple_(pattern, str)) {    // Skip character and attempt sub-match again (includes matching against null character).
+                if (fnmatchSimple_(pattern, str, pathSeparator)) {    // Skip character and attempt sub-match again (includes matching against null character).
                     return true;
                 }
-            } while (*str != '\0' && *str != FileHandler::pathSeparator);
+            } while (*str != '\0' && *str != pathSeparator);
             
             return false;
         } else if (*pattern == '?') {    // Question mark matches any one character. Does not match a leading dot in a name.
@@ -53,19 +72,19 @@ bool fnmatchSimple_(char const* pattern, char const* str) {
         } else if (*pattern == '[') {    // Brackets match any characters contained within (including other brackets, a ] must come first) except when brackets are empty. Can match leading dot unlike on UNIX fnmatch.
             ++pattern;
             bool invertSearch = false;
-            if (*pattern == '\0' || *pattern == FileHandler::pathSeparator) {    // Case where [ is remaining pattern.
+            if (*pattern == '\0' || *pattern == pathSeparator) {    // Case where [ is remaining pattern.
                 return *str == '[';
             } else if (*pattern == '!' || *pattern == '^') {    // Inverted search.
                 invertSearch = true;
                 ++pattern;
-                if (*pattern == '\0' || *pattern == FileHandler::pathSeparator) {    // Case where [! or [^ is remaining pattern.
+                if (*pattern == '\0' || *pattern == pathSeparator) {    // Case where [! or [^ is remaining pattern.
                     return *str == '[' && *(str + 1) == *(pattern - 1);
                 }
             }
             char const* endingBracket = pattern;
             while (true) {
                 ++endingBracket;
-                if (*endingBracket == '\0' || *endingBracket == FileHandler::pathSeparator) {
+                if (*endingBracket == '\0' || *endingBracket == pathSeparator) {
                     if (*pattern == ']') {
                         if (invertSearch) {    // Case where [!]* or [^]* is remaining pattern (and no more ] left).
                             if (*str != *(pattern - 1)) {
@@ -123,18 +142,18 @@ bool fnmatchSimple_(char const* pattern, char const* str) {
     while (*pattern == '*') {    // Skip trailing stars.
         ++pattern;
     }
-    return *pattern == '\0' || *pattern == FileHandler::pathSeparator;
+    return *pattern == '\0' || *pattern == pathSeparator;
 }
 
 /**
  * Alternative fnmatch version for cases with either no path separators, or path
  * separators only at the end of pattern and str. Called by fnmatchPortable().
  */
-bool fnmatchSimple(char const* pattern, char const* str, bool matchAllPaths = false) {
+bool fnmatchSimple(char const* pattern, char const* str, const GlobOptions& options, bool matchAllPaths = false) {
     if (matchAllPaths) {
-        return (FileHandler::globMatchesHiddenFiles || *str != '.');
-    } else if (!FileHandler::globMatching) {    // If no glob matching, just compare the strings directly.
-        while (*str != '\0' && *str != FileHandler::pathSeparator) {
+        return (options.matchesHiddenFiles || *str != '.');
+    } else if (!options.matching) {    // If no glob matching, just compare the strings directly.
+        while (*str != '\0' && *str != options.pathSeparator) {
             if (*pattern != *str) {
                 return false;
             }
@@ -142,15 +161,15 @@ bool fnmatchSimple(char const* pattern, char const* str, bool matchAllPaths = fa
             ++str;
         }
         
-        return *pattern == '\0' || *pattern == FileHandler::pathSeparator;
+        return *pattern == '\0' || *pattern == options.pathSeparator;
     }
     
     // Star does not match a leading dot in a name (because it's not supposed to match hidden files or the . and .. directories). Question mark does not match a leading dot in a name.
-    if (!FileHandler::globMatchesHiddenFiles && ((*pattern == '*' && *str == '.') || (*pattern == '?' && *str == '.'))) {
+    if (!options.matchesHiddenFiles && ((*pattern == '*' && *str == '.') || (*pattern == '?' && *str == '.'))) {
         return false;
     }
     
-    return fnmatchSimple_(pattern, str);
+    return fnmatchSimple_(pattern, str, options.pathSeparator);
 }
 
 /** Implementation of the unix fnmatch(3) function. Has a bit fewer options but still matches most patterns decently well.
@@ -167,15 +186,15 @@ bool fnmatchSimple(char const* pattern, char const* str, bool matchAllPaths = fa
         Use a - to specify a range, the range only matches if left character is less than/equal to right. Range can include non-alphanumeric characters. Put - as first (with exception of ! or ^) or last character to match the - instead.
     ** is not currently supported (globstar). It is supported in globPortable() though.
 */
-bool FileHandler::fnmatchPortable(char const* pattern, char const* str) {
+bool FileHandler::fnmatchPortable(char const* pattern, char const* str, const GlobOptions& options) {
     while (true) {
-        if (!fnmatchSimple(pattern, str)) {
+        if (!fnmatchSimple(pattern, str, options)) {
             return false;
         }
-        while (*pattern != pathSeparator && *pattern != '\0') {
+        while (*pattern != options.pathSeparator && *pattern != '\0') {
             ++pattern;
         }
-        while (*str != pathSeparator && *str != '\0') {
+        while (*str != options.pathSeparator && *str != '\0') {
             ++str;
         }
         if (*pattern != *str) {
@@ -314,77 +333,227 @@ bool FileHandler::parseNextBool(std::string::size_type& index, const std::string
     return b;
 }
 
-bool FileHandler::checkFileEquivalence(const fs::path& source, const fs::path& dest, bool skipCache, bool fastCompare) {
+FileHandler::FileHandler() :
+    nextStep_(0),
+    writePathFanOut_(false),
+    writePathId_(0),
+    ioThrottle_(nullptr),
+    treeState_(nullptr),
+    pageCacheMode_(PageCacheMode::Normal) {
+}
+
+bool FileHandler::checkFileEquivalence(const fs::path& source, const fs::path& dest, bool skipCache, bool fastCompare, bool checkCompressed) {
+    return checkFileEquivalence(source, std::vector<fs::path>(1, dest), skipCache, fastCompare, checkCompressed)[0];
+}
+
+std::vector<bool> FileHandler::checkFileEquivalence(const fs::path& source, const std::vector<fs::path>& dests, bool skipCache, bool fastCompare, bool checkCompressed) {
+    Stats::ScopedTimer timer(Stats::CompareFiles);
+    std::vector<bool> results(dests.size(), false);
     fs::file_status sourceStatus = fs::status(source);
-    fs::file_status destStatus = fs::status(dest);
-    if (!fs::exists(sourceStatus) || !fs::exists(destStatus)) {
-        return false;
-    } else if (fs::is_directory(sourceStatus) || fs::is_directory(destStatus)) {
-        return fs::is_directory(sourceStatus) && fs::is_directory(destStatus) && source.filename() == dest.filename();
-    }
-    
-    if (fastCompare) {
-        auto writeTimeDifference = std::chrono::duration_cast<std::chrono::milliseconds>(fs::last_write_time(source) - fs::last_write_time(dest)).count();
-        return std::abs(writeTimeDifference) < 2000;    // Consider the files as identical if the modification timestamps are less than 2 seconds.
+    if (!fs::exists(sourceStatus)) {
+        return results;
     }
     
-    std::map<fs::path, CachedWriteTime>::iterator lastWriteTime;
-    if (!skipCache) {
-        lastWriteTime = cachedWriteTimes_.find(source);
-        if (lastWriteTime != cachedWriteTimes_.end()) {
-            if (lastWriteTime->second.sourceTime == fs::last_write_time(source) && lastWriteTime->second.destTime == fs::last_write_time(dest)) {    // Check if the write time of both files stayed the same.
-                return lastWriteTime->second.fileEquivalence;
+    std::vector<size_t> scanIndices;    // Destinations that need a binary scan.
+    std::vector<decltype(cachedWriteTimes_)::iterator> lastWriteTimes;
+    for (size_t i = 0; i < dests.size(); ++i) {
+        fs::file_status destStatus = fs::status(dests[i]);
+        if (!fs::exists(destStatus)) {
+            continue;
+        } else if (fs::is_directory(sourceStatus) || fs::is_directory(destStatus)) {
+            results[i] = fs::is_directory(sourceStatus) && fs::is_directory(destStatus) && source.filename() == dests[i].filename();
+            continue;
+        }
+        
+        if (fastCompare) {
+            auto writeTimeDifference = std::chrono::duration_cast<std::chrono::milliseconds>(fs::last_write_time(source) - fs::last_write_time(dests[i])).count();
+            results[i] = std::abs(writeTimeDifference) < 2000;    // Consider the files as identical if the modification timestamps are less than 2 seconds.
+            continue;
+        }
+        
+        auto lastWriteTime = cachedWriteTimes_.end();
+        if (!skipCache) {
+            lastWriteTime = cachedWriteTimes_.find({source, dests[i]});
+            if (lastWriteTime != cachedWriteTimes_.end()) {
+                if (lastWriteTime->second.sourceTime == fs::last_write_time(source) && lastWriteTime->second.destTime == fs::last_write_time(dests[i])) {    // Check if the write time of both files stayed the same.
+                    results[i] = lastWriteTime->second.fileEquivalence;
+                    Stats::add(Stats::CacheHits);
+                    continue;
+                }
+            } else {
+                lastWriteTime = cachedWriteTimes_.insert({{source, dests[i]}, {}}).first;
             }
-        } else {
-            lastWriteTime = cachedWriteTimes_.insert({source, {}}).first;
+            Stats::add(Stats::CacheMisses);
         }
+        scanIndices.push_back(i);
+        lastWriteTimes.push_back(lastWriteTime);
     }
+    if (scanIndices.empty()) {
+        return results;
+    }
+    Stats::add(Stats::FilesCompared, scanIndices.size());
+    IoThrottle::IoSlot ioSlot(ioThrottle_);
     
-    // This part based on: https://stackoverflow.com/questions/15118661/in-c-whats-the-fastest-way-to-tell-whether-two-string-or-binary-files-are-di
-    bool equalResult = false;
-    std::ifstream sourceFile(source, std::ios::ate | std::ios::binary);    // Open files in binary mode and seek to end.
-    std::ifstream destFile(dest, std::ios::ate | std::ios::binary);
-    const std::ios::pos_type sourceSize = sourceFile.tellg();    // Find file sizes.
-    const std::ios::pos_type destSize = destFile.tellg();
-    
-    if (sourceFile.is_open() && destFile.is_open() && sourceSize == destSize) {
-        sourceFile.seekg(0);    // Return to beginning of files.
-        destFile.seekg(0);
+    while (destReaders_.size() < scanIndices.size()) {
+        destReaders_.push_back(std::make_unique<FileReader>());
+        destDirectories_.push_back(std::make_unique<DirectoryHandles>());
+    }
+    std::vector<size_t> compressedIndices;    // Destinations with a different size, these could still match if one of the files is compressed.
+    if (sourceReader_.open(source, pageCacheMode_, &sourceDirectories_)) {
+        sourceBuffer_.resize(COMPARE_BUFFER_SIZE);
+        destBuffer_.resize(COMPARE_BUFFER_SIZE);
+        size_t numMatching = 0;
+        for (size_t k = 0; k < scanIndices.size(); ++k) {
+            if (!destReaders_[k]->open(dests[scanIndices[k]], pageCacheMode_, destDirectories_[k].get())) {
+                continue;
+            } else if (destReaders_[k]->getSize() == sourceReader_.getSize()) {
+                results[scanIndices[k]] = true;
+                ++numMatching;
+            } else if (checkCompressed) {
+                compressedIndices.push_back(k);
+            }
+        }
         
-        std::istreambuf_iterator<char> sourceIter(sourceFile);
-        std::istreambuf_iterator<char> destIter(destFile);
+        while (numMatching > 0) {    // Compare the files one block at a time (the matching files are same length so reading stops at the same time).
+            const size_t numRead = sourceReader_.read(sourceBuffer_.data(), COMPARE_BUFFER_SIZE);
+            if (ioThrottle_ != nullptr) {
+                ioThrottle_->acquireRead(static_cast<uintmax_t>(numRead));
+            }
+            for (size_t k = 0; k < scanIndices.size(); ++k) {
+                if (!results[scanIndices[k]]) {
+                    continue;
+                }
+                const size_t destNumRead = destReaders_[k]->read(destBuffer_.data(), COMPARE_BUFFER_SIZE);
+                if (ioThrottle_ != nullptr) {
+                    ioThrottle_->acquireRead(static_cast<uintmax_t>(destNumRead));
+                }
+                if (numRead != destNumRead || !std::equal(sourceBuffer_.data(), sourceBuffer_.data() + numRead, destBuffer_.data())) {
+                    results[scanIndices[k]] = false;
+                    --numMatching;
+                }
+            }
+            if (numRead < COMPARE_BUFFER_SIZE) {
+                break;
+            }
+        }
         
-        equalResult = std::equal(sourceIter, std::istreambuf_iterator<char>(), destIter);    // Compare streams to check for equality (both streams are same length so this is safe).
+        for (size_t k : compressedIndices) {
+            if (sourceReader_.open(source, pageCacheMode_, &sourceDirectories_)) {    // Reopen to start from the beginning of the source again.
+                results[scanIndices[k]] = checkCompressedEquivalence(*destReaders_[k]);
+            }
+        }
     }
-    if (!skipCache) {
-        lastWriteTime->second.sourceTime = fs::last_write_time(source);
-        lastWriteTime->second.destTime = fs::last_write_time(dest);
-        lastWriteTime->second.fileEquivalence = equalResult;
+    sourceReader_.close();    // Close now to drop the cached pages and release the file handles.
+    for (size_t k = 0; k < scanIndices.size(); ++k) {
+        destReaders_[k]->close();
+        if (!skipCache) {
+            lastWriteTimes[k]->second.sourceTime = fs::last_write_time(source);
+            lastWriteTimes[k]->second.destTime = fs::last_write_time(dests[scanIndices[k]]);
+            lastWriteTimes[k]->second.fileEquivalence = results[scanIndices[k]];
+        }
     }
-    return equalResult;
+    return results;
 }
 
-void FileHandler::loadConfigFile(const fs::path& filename) {
-    if (configFile_.is_open()) {
-        configFile_.close();
+bool FileHandler::checkCompressedEquivalence(FileReader& destReader) {
+    const size_t numRead = sourceReader_.read(sourceBuffer_.data(), COMPARE_BUFFER_SIZE);
+    const size_t destNumRead = destReader.read(destBuffer_.data(), COMPARE_BUFFER_SIZE);
+    if (ioThrottle_ != nullptr) {
+        ioThrottle_->acquireRead(static_cast<uintmax_t>(numRead));
+        ioThrottle_->acquireRead(static_cast<uintmax_t>(destNumRead));
+    }
+    Compressor::Header sourceHeader, destHeader;
+    const bool sourceCompressed = Compressor::parseHeader(sourceBuffer_.data(), numRead, sourceHeader);
+    const bool destCompressed = Compressor::parseHeader(destBuffer_.data(), destNumRead, destHeader);
+    if (sourceCompressed && destCompressed) {
+        return sourceHeader.size == destHeader.size && sourceHeader.digest == destHeader.digest;
+    } else if (destCompressed) {
+        return destHeader.size == sourceReader_.getSize() && hashRemainingFile(sourceReader_, sourceBuffer_, numRead) == destHeader.digest;
+    } else if (sourceCompressed) {    // Restoring from a compressed backup.
+        return sourceHeader.size == destReader.getSize() && hashRemainingFile(destReader, destBuffer_, destNumRead) == sourceHeader.digest;
     }
-    configFile_.open(filename);
-    if (!configFile_.is_open()) {
-        throw std::runtime_error("\"" + filename.string() + "\": Unable to open file for reading.");
+    return false;
+}
+
+Sha256::Digest FileHandler::hashRemainingFile(FileReader& reader, AlignedBuffer& buffer, size_t numRead) {
+    Sha256 sha;
+    while (numRead > 0) {
+        sha.update(buffer.data(), numRead);
+        if (numRead < COMPARE_BUFFER_SIZE) {
+            break;
+        }
+        numRead = reader.read(buffer.data(), COMPARE_BUFFER_SIZE);
+        if (ioThrottle_ != nullptr) {
+            ioThrottle_->acquireRead(static_cast<uintmax_t>(numRead));
+        }
     }
+    return sha.finish();
+}
+
+bool FileHandler::isEquivalenceCached(const fs::path& source, const fs::path& dest) const {
+    auto lastWriteTime = cachedWriteTimes_.find({source, dest});
+    if (lastWriteTime == cachedWriteTimes_.end()) {
+        return false;
+    }
+    std::error_code sourceError, destError;
+    const fs::file_time_type sourceTime = fs::last_write_time(source, sourceError);
+    const fs::file_time_type destTime = fs::last_write_time(dest, destError);
+    return !sourceError && !destError && lastWriteTime->second.sourceTime == sourceTime && lastWriteTime->second.destTime == destTime;
+}
+
+void FileHandler::setIoThrottle(IoThrottle* ioThrottle) {
+    ioThrottle_ = ioThrottle;
+}
+
+IoThrottle* FileHandler::getIoThrottle() const {
+    return ioThrottle_;
+}
+
+void FileHandler::setPageCacheMode(PageCacheMode mode) {
+    pageCacheMode_ = mode;
+}
+
+PageCacheMode FileHandler::getPageCacheMode() const {
+    return pageCacheMode_;
+}
+
+void FileHandler::closeDirectories() {
+    sourceDirectories_.closeAll();
+    for (auto& directories : destDirectories_) {
+        directories->closeAll();
+    }
+}
+
+void FileHandler::setTreeState(TreeState* treeState) {
+    treeState_ = treeState;
+}
+
+const GlobOptions& FileHandler::getGlobOptions() const {
+    return globOptions_;
+}
+
+void FileHandler::setGlobOptions(const GlobOptions& globOptions) {
+    globOptions_ = globOptions;
+}
+
+void FileHandler::loadConfigFile(const fs::path& filename) {
+    auto plan = std::make_shared<ConfigPlan>();
+    plan->compile(filename);
+    loadConfigPlan(std::move(plan));
+}
+
+void FileHandler::loadConfigPlan(std::shared_ptr<const ConfigPlan> plan) {
+    plan_ = std::move(plan);
+    nextStep_ = 0;
+    globOptions_.matching = true;
+    globOptions_.matchesHiddenFiles = true;
     
-    globMatching = true;
-    globMatchesHiddenFiles = true;
-    
-    configFilename_ = filename;
-    lineNumber_ = 0;
-    rootPaths_.clear();
     ignorePaths_.clear();
     previousReadPaths_.clear();
-    writePath_.clear();
-    readPath_.clear();
-    writePathSet_ = false;
-    readPathSet_ = false;
+    writePathFanOut_ = false;
+    writePathId_ = 0;
+    globCache_.clear();
+    previousFanOutPaths_.clear();
 }
 
 bool FileHandler::loadCacheFile(const fs::path& filename, const fs::file_time_type& configFileWriteTime) {
@@ -395,85 +564,121 @@ bool FileHandler::loadCacheFile(const fs::path& filename, const fs::file_time_ty
         throw std::runtime_error("\"" + filename.string() + "\": Unable to open file for reading.");
     }
     
+    char header[sizeof(CACHE_FILE_HEADER) - 1];
     fs::file_time_type lastKnownWriteTime;
+    if (!cacheFile.read(header, sizeof(header)) || !std::equal(header, header + sizeof(header), CACHE_FILE_HEADER)) {    // Older versions keyed the results by one path only.
+        return false;
+    }
     cacheFile.read(reinterpret_cast<char*>(&lastKnownWriteTime), sizeof(lastKnownWriteTime));
     cacheFile.get();
     if (lastKnownWriteTime != configFileWriteTime) {
         return false;
     }
     
-    char buf[4097];    // Maximum path names are around 255 to 4096 characters on most systems.
+    char sourceBuf[4097], destBuf[4097];    // Maximum path names are around 255 to 4096 characters on most systems.
     CachedWriteTime cachedWriteTime;
     while (true) {
-        cacheFile.getline(buf, sizeof(buf), '\0');
+        cacheFile.getline(sourceBuf, sizeof(sourceBuf), '\0');
+        cacheFile.getline(destBuf, sizeof(destBuf), '\0');
         if (cacheFile.eof()) {
             break;
         }
         cacheFile.read(reinterpret_cast<char*>(&cachedWriteTime), sizeof(cachedWriteTime));
         cacheFile.get();
         
-        cachedWriteTimes_.insert({fs::path(buf), cachedWriteTime});
+        cachedWriteTimes_.insert({{fs::path(sourceBuf), fs::path(destBuf)}, cachedWriteTime});
     }
     cacheFile.close();
     return true;
 }
 
 void FileHandler::saveCacheFile(const fs::path& filename, const fs::file_time_type& configFileWriteTime) {
-    std::ofstream cacheFile(filename, std::ios::binary);
+    fs::path tempFilename = filename;    // Write to a temporary file first so that a crash can't leave a partial cache file behind.
+    tempFilename += ".tmp";
+    std::ofstream cacheFile(tempFilename, std::ios::binary);
     if (!cacheFile.is_open()) {
-        throw std::runtime_error("\"" + filename.string() + "\": Unable to open file for writing.");
+        throw std::runtime_error("\"" + tempFilename.string() + "\": Unable to open file for writing.");
     }
     
     // For NTFS, size of the file modified timestamp is 8 bytes.
-    cacheFile.write(reinterpret_cast<const char*>(&configFileWriteTime), sizeof(configFileWriteTime));    // File begins with timestamp of the config file.
+    cacheFile.write(CACHE_FILE_HEADER, sizeof(CACHE_FILE_HEADER) - 1);
+    cacheFile.write(reinterpret_cast<const char*>(&configFileWriteTime), sizeof(configFileWriteTime));    // Followed by the timestamp of the config file.
     cacheFile.put('\n');
     
     for (const auto& x : cachedWriteTimes_) {
-        cacheFile.write(x.first.string().c_str(), x.first.string().length());    // Write source filename and null character.
+        cacheFile.write(x.first.first.string().c_str(), x.first.first.string().length());    // Write source and destination filenames, each followed by a null character.
+        cacheFile.put('\0');
+        cacheFile.write(x.first.second.string().c_str(), x.first.second.string().length());
         cacheFile.put('\0');
         cacheFile.write(reinterpret_cast<const char*>(&x.second), sizeof(x.second));    // Write contents of the CachedWriteTime.
         cacheFile.put('\n');
     }
     cacheFile.close();
+    if (!cacheFile) {
+        throw std::runtime_error("\"" + tempFilename.string() + "\": Failed to write cache.");
+    }
+    fs::rename(tempFilename, filename);
 }
 
 WriteReadPathTree FileHandler::nextWriteReadPathTree() {
+    Stats::ScopedTimer timer(Stats::ScanSources);
     WriteReadPathTree result;
-    while (configFile_.is_open()) {
-        parseNextLineInFile();
+    if (!plan_) {
+        return result;
+    }
+    const std::vector<ConfigPlan::Step>& steps = plan_->getSteps();
+    while (nextStep_ < steps.size()) {
+        const ConfigPlan::Step& step = steps[nextStep_];
+        ++nextStep_;
         
-        if (readPathSet_) {    // If read path encountered, grab more results from globPortable().
-            std::pair<fs::path, std::vector<fs::path>> globPortableResults = globPortable(readPath_);
-            result.writePrefix = writePath_;
+        if (step.type == ConfigPlan::StepType::Ignore) {
+            ignorePaths_.emplace(step.path);
+        } else if (step.type == ConfigPlan::StepType::Include) {
+            ignorePaths_.erase(step.path);
+        } else {    // If read path encountered, grab more results from globPortable().
+            globOptions_.matching = step.globOptions.matching;
+            globOptions_.matchesHiddenFiles = step.globOptions.matchesHiddenFiles;
+            writePathFanOut_ = step.fanOut;
+            writePathId_ = step.writePathId;
+            std::pair<fs::path, std::vector<fs::path>> globPortableResults = globPortable(step.path);
+            result.writePrefix = step.writePath;
             result.readPrefix = globPortableResults.first;
+            result.snapshot = step.snapshot;
+            result.chunkStore = step.chunkStore;
+            result.compress = step.compress;
+            result.decompress = step.decompress;
             
-            for (const auto& p : globPortableResults.second) {    // The results from globPortable() are just the matching items, loop through and ensure each item includes its parent paths.
-                result.relativePaths.insert(p);
+            std::string pathStr;
+            for (auto& p : globPortableResults.second) {    // The results from globPortable() are just the matching items, loop through and ensure each item includes its parent paths.
+                pathStr = p.string();
+                result.relativePaths.insert(std::move(p));
                 
-                std::string::size_type lastSeparator = p.string().rfind(pathSeparator);
-                fs::path parentPath(p.string().substr(0, lastSeparator));
-                if (result.relativePaths.insert(parentPath).second) {    // If adding parent path succeeded, step through each sub-path and make sure they are added.
+                const std::string_view pathView(pathStr);    // Parent paths are sliced from this without copying the string again.
+                std::string::size_type lastSeparator = pathView.rfind(PATH_SEPARATOR);
+                if (result.relativePaths.emplace(pathView.substr(0, lastSeparator)).second) {    // If adding parent path succeeded, step through each sub-path and make sure they are added.
                     while (true) {
-                        lastSeparator = p.string().rfind(pathSeparator, lastSeparator - 1);
+                        lastSeparator = pathView.rfind(PATH_SEPARATOR, lastSeparator - 1);
                         if (lastSeparator == std::string::npos || lastSeparator == 0) {
                             break;
                         }
                         
-                        fs::path parentPath2(p.string().substr(0, lastSeparator));
-                        if (!result.relativePaths.insert(parentPath2).second) {    // If insertion fails, all of the parents have been accounted for.
+                        if (!result.relativePaths.emplace(pathView.substr(0, lastSeparator)).second) {    // If insertion fails, all of the parents have been accounted for.
                             break;
                         }
                     }
                 }
             }
             
-            readPathSet_ = false;
-            
+            if (result.relativePaths.empty()) {    // Nothing new matched (all paths went to previous write paths), an empty result would end the search early.
+                continue;
+            }
             return result;
         }
     }
     
-    return result;    // End of file reached, return empty result.
+    globOptions_.matching = plan_->getGlobOptions().matching;    // Any set commands after the last add still apply to checkPathIgnored().
+    globOptions_.matchesHiddenFiles = plan_->getGlobOptions().matchesHiddenFiles;
+    return result;    // End of plan reached, return empty result.
 }
 
 /** Globbing details:
@@ -493,11 +698,22 @@ std::pair<fs::path, std::vector<fs::path>> FileHandler::globPortable(fs::path pa
         pattern = (fs::current_path() / pattern).lexically_normal();
     }
     bool addedTrailingGlobstar = false;
-    if (!containsWildcard(pattern.filename().string().c_str()) || !globMatching) {    // If last sub-path is not a glob, assume it is a directory and match contents recursively.
+    if (!containsWildcard(pattern.filename().string().c_str()) || !globOptions_.matching) {    // If last sub-path is not a glob, assume it is a directory and match contents recursively.
         pattern /= "**";
         addedTrailingGlobstar = true;
     }
     
+    auto cacheIter = globCache_.find(pattern);
+    if (cacheIter != globCache_.end() && cacheIter->second.numIgnorePaths == ignorePaths_.size() && cacheIter->second.matchesHiddenFiles == globOptions_.matchesHiddenFiles && cacheIter->second.matching == globOptions_.matching) {    // Pattern was already scanned for another write path.
+        result.first = cacheIter->second.directoryPrefix;
+        for (const auto& p : cacheIter->second.matches) {
+            if (addReadPath(p)) {
+                result.second.emplace_back(std::string_view(p).substr(cacheIter->second.dirPrefixOffset));
+            }
+        }
+        return result;
+    }
+    
     auto patternIter = pattern.begin();
     if (pattern.has_root_name()) {    // Skip root name.
         ++patternIter;
@@ -533,90 +749,114 @@ std::pair<fs::path, std::vector<fs::path>> FileHandler::globPortable(fs::path pa
     }
     result.first = directoryPrefix;
     
-    std::stack<fs::path> pathStack;    // Stacks for recursive directory matching process.
-    pathStack.push(directoryPrefix);
-    std::stack<fs::path::iterator> iterStack;
-    iterStack.push(patternIter);
-    std::stack<std::vector<fs::path::iterator>> ignoreIterStack;
-    ignoreIterStack.push({});
+    std::vector<std::string> cacheMatches;
+    std::pmr::monotonic_buffer_resource arena(GLOB_ARENA_BLOCK_SIZE);    // Backs the strings of directories waiting to be listed, everything is released at once when the scan ends.
+    struct PendingDirectory {
+        std::pmr::string path;    // The matched path thus far.
+        fs::path::iterator patternIter;    // Iterator to the current sub-path.
+        std::pmr::vector<fs::path::iterator> ignoreIters;    // Iterators to the current positions in ignorePathsCopy.
+    };
+    std::pmr::vector<PendingDirectory> pendingStack(&arena);    // Stack for recursive directory matching process.
     
     std::vector<fs::path> ignorePathsCopy;    // Make a copy of ignorePaths_ but add a globstar to the front of local paths.
     ignorePathsCopy.reserve(ignorePaths_.size());
+    std::pmr::vector<fs::path::iterator> prefixIgnoreIters(&arena);
     for (const auto& p : ignorePaths_) {
         if (p.is_relative()) {
             ignorePathsCopy.push_back("**" / p);
         } else {
             ignorePathsCopy.push_back(p);
         }
-        ignoreIterStack.top().push_back(ignorePathsCopy.back().begin());    // Add iterator to ignoreIterStack.
+        prefixIgnoreIters.push_back(ignorePathsCopy.back().begin());
     }
     
     for (const auto& p : directoryPrefix) {    // Step through directoryPrefix to determine if an ignore matches it.
-        for (size_t i = 0; i < ignoreIterStack.top().size(); ++i) {
-            if (checkSubPathIgnored(ignorePathsCopy[i], ignoreIterStack.top()[i], p)) {
+        for (size_t i = 0; i < prefixIgnoreIters.size(); ++i) {
+            if (checkSubPathIgnored(ignorePathsCopy[i], prefixIgnoreIters[i], p, globOptions_)) {
                 return result;
             }
         }
     }
+    pendingStack.push_back({std::pmr::string(directoryPrefix.string(), &arena), patternIter, std::move(prefixIgnoreIters)});
     
-    while (!pathStack.empty()) {    // Recursive operation to iterate through matching directories.
-        fs::path pathTraversal = pathStack.top();    // The matched path thus far.
-        pathStack.pop();
-        fs::path::iterator currentPatternIter = iterStack.top();    // Iterator to the current sub-path.
-        iterStack.pop();
-        std::vector<fs::path::iterator> ignoreIters = ignoreIterStack.top();    // Iterators to the current positions in ignorePathsCopy.
-        ignoreIterStack.pop();
+    std::string subPattern, childPath;    // Reused for each entry so that matching a name does not allocate.
+    std::vector<fs::path::iterator> ignoreItersNext;
+    DirectoryReader directoryReader;
+    while (!pendingStack.empty()) {    // Recursive operation to iterate through matching directories.
+        PendingDirectory current = std::move(pendingStack.back());
+        pendingStack.pop_back();
         
-        if (currentPatternIter == pattern.end()) {
+        if (current.patternIter == pattern.end()) {
             continue;
         }
         
-        //std::cout << "Current pathTraversal is " << pathTraversal << "\n";
-        //std::cout << "Current sub-pattern is " << *currentPatternIter << "\n";
-        fs::path::iterator nextPatternIter = std::next(currentPatternIter);
+        fs::path::iterator nextPatternIter = std::next(current.patternIter);
         bool matchAllPaths = false;
         bool addToResult = (nextPatternIter == pattern.end());    // Only add to result if at the end, otherwise the path may not match the full pattern and we don't want it.
-        if (addedTrailingGlobstar && *nextPatternIter == fs::path("**") && std::next(nextPatternIter) == pattern.end()) {    // Special case if globstar appended and pattern points to a file.
+        if (addedTrailingGlobstar && nextPatternIter != pattern.end() && *nextPatternIter == fs::path("**") && std::next(nextPatternIter) == pattern.end()) {    // Special case if globstar appended and pattern points to a file.
             addToResult = true;
         }
         
-        if (*currentPatternIter == fs::path("**")) {    // If this sub-pattern is a globstar, match current path with the next sub-pattern and all contained directories with the current sub-pattern.
-            pathStack.push(pathTraversal);
-            iterStack.push(nextPatternIter);
-            ignoreIterStack.push(ignoreIters);
+        if (*current.patternIter == fs::path("**")) {    // If this sub-pattern is a globstar, match current path with the next sub-pattern and all contained directories with the current sub-pattern.
+            pendingStack.push_back({std::pmr::string(current.path, &arena), nextPatternIter, std::pmr::vector<fs::path::iterator>(current.ignoreIters, &arena)});
             
             matchAllPaths = true;
-            nextPatternIter = currentPatternIter;
+            nextPatternIter = current.patternIter;
         }
         
         try {
-            for (const auto& entry : fs::directory_iterator(pathTraversal)) {
-                if (fnmatchSimple(currentPatternIter->string().c_str(), entry.path().filename().string().c_str(), matchAllPaths)) {
+            if (ioThrottle_ != nullptr) {
+                ioThrottle_->acquireOps(1);
+            }
+            const fs::path pathTraversal(current.path);
+            subPattern = current.patternIter->string();
+            const bool needsSeparator = (!current.path.empty() && current.path.back() != PATH_SEPARATOR);
+            auto matchEntry = [&](const char* filename, size_t filenameLength, auto isDirectory) {    // The filename must be null-terminated. The isDirectory is a function so that it only runs if needed.
+                if (fnmatchSimple(subPattern.c_str(), filename, globOptions_, matchAllPaths)) {
                     bool includeThisPath = true;    // Check if path (and derived ones) can be ignored.
-                    std::vector<fs::path::iterator> ignoreItersNext = ignoreIters;
+                    ignoreItersNext.assign(current.ignoreIters.begin(), current.ignoreIters.end());
                     for (size_t i = 0; i < ignoreItersNext.size(); ++i) {
-                        if (checkSubPathIgnored(ignorePathsCopy[i], ignoreItersNext[i], entry.path().filename())) {
+                        if (checkSubPathIgnored(ignorePathsCopy[i], ignoreItersNext[i], filename, globOptions_)) {
                             includeThisPath = false;
                             break;
                         }
                     }
                     
                     if (includeThisPath) {
-                        //std::cout << "Matched " << entry.path() << "\n";
+                        childPath.assign(current.path.data(), current.path.size());
+                        if (needsSeparator) {
+                            childPath += PATH_SEPARATOR;
+                        }
+                        childPath.append(filename, filenameLength);
                         if (addToResult) {
-                            fs::path nextPathTraversal = pathTraversal / entry.path().filename();
-                            if (previousReadPaths_.insert(nextPathTraversal).second) {    // Add to result if this read path is unique.
-                                result.second.emplace_back(nextPathTraversal.string().substr(dirPrefixOffset));
+                            if (addReadPath(childPath)) {    // Add to result if this read path is unique.
+                                result.second.emplace_back(std::string_view(childPath).substr(dirPrefixOffset));
+                            }
+                            if (writePathFanOut_) {
+                                cacheMatches.push_back(childPath);
                             }
                         }
-                        if (entry.is_directory()) {
-                            pathStack.push(pathTraversal / entry.path().filename());
-                            iterStack.push(nextPatternIter);
-                            ignoreIterStack.push(std::move(ignoreItersNext));
-                            //std::cout << "    " << pathStack.top() << "\n";
+                        if (isDirectory()) {
+                            pendingStack.push_back({std::pmr::string(childPath, &arena), nextPatternIter, std::pmr::vector<fs::path::iterator>(ignoreItersNext.begin(), ignoreItersNext.end(), &arena)});
                         }
                     }
                 }
+            };
+            if (treeState_ != nullptr) {
+                for (const auto& entry : treeState_->listDirectory(pathTraversal)) {
+                    matchEntry(entry.name.c_str(), entry.name.length(), [&]() {
+                        return entry.type == TreeState::EntryType::Directory || (entry.type == TreeState::EntryType::Symlink && fs::is_directory(pathTraversal / entry.name));
+                    });
+                }
+            } else {
+                Stats::add(Stats::DirectoriesListed);
+                directoryReader.open(pathTraversal);
+                DirectoryReader::Entry entry;
+                while (directoryReader.next(entry)) {
+                    matchEntry(entry.name.data(), entry.name.length(), [&]() {
+                        return directoryReader.isDirectory(entry);
+                    });
+                }
             }
         } catch (fs::filesystem_error& ex) {    // Exception accessing path can be ignored (treat it like an empty directory).
             std::cout << CSI::Red << "Error: " << ex.code().message() << ": \"" << ex.path1().string() << "\"";
@@ -627,13 +867,22 @@ std::pair<fs::path, std::vector<fs::path>> FileHandler::globPortable(fs::path pa
         } catch (std::exception& ex) {
             std::cout << CSI::Red << "Error: " << ex.what() << CSI::Reset << "\n";
         }
-        
-        //std::cout << "========================================\n";
     }
     
+    if (writePathFanOut_) {
+        globCache_[pattern] = {directoryPrefix, dirPrefixOffset, ignorePaths_.size(), globOptions_.matchesHiddenFiles, globOptions_.matching, std::move(cacheMatches)};
+    }
     return result;
 }
 
+bool FileHandler::addReadPath(const std::string& readPath) {
+    auto insertResult = previousReadPaths_.emplace(readPath, writePathId_);
+    if (insertResult.second) {
+        return true;
+    }
+    return writePathFanOut_ && insertResult.first->second != writePathId_ && previousFanOutPaths_.emplace(writePathId_, readPath).second;
+}
+
 bool FileHandler::checkPathIgnored(const fs::path& p) const {
     for (fs::path ignorePath : ignorePaths_) {    // Step through ignores and path p to determine if there is a match.
         if (ignorePath.is_relative()) {    // Append a globstar to local paths.
@@ -641,7 +890,7 @@ bool FileHandler::checkPathIgnored(const fs::path& p) const {
         }
         fs::path::iterator ignorePathIter = ignorePath.begin();
         for (const auto& subPath : p) {
-            if (checkSubPathIgnored(ignorePath, ignorePathIter, subPath)) {
+            if (checkSubPathIgnored(ignorePath, ignorePathIter, subPath, globOptions_)) {
                 return true;
             }
         }
@@ -649,7 +898,11 @@ bool FileHandler::checkPathIgnored(const fs::path& p) const {
     return false;
 }
 
-bool FileHandler::checkSubPathIgnored(const fs::path& ignorePath, fs::path::iterator& ignoreIter, const fs::path& currentSubPath) {
+bool FileHandler::checkSubPathIgnored(const fs::path& ignorePath, fs::path::iterator& ignoreIter, const fs::path& currentSubPath, const GlobOptions& globOptions) {
+    return checkSubPathIgnored(ignorePath, ignoreIter, currentSubPath.string().c_str(), globOptions);
+}
+
+bool FileHandler::checkSubPathIgnored(const fs::path& ignorePath, fs::path::iterator& ignoreIter, const char* currentSubPath, const GlobOptions& globOptions) {
     if (ignoreIter == ignorePath.end()) {    // End iterator means match failed previously.
         return false;
     }
@@ -658,7 +911,7 @@ bool FileHandler::checkSubPathIgnored(const fs::path& ignorePath, fs::path::iter
     }
     if (ignoreIter == ignorePath.end() || ignoreIter->empty()) {    // Globstar matched the path. Note that an ignore path that ends with a directory separator also ends with an empty path.
         return true;
-    } else if (fnmatchSimple(ignoreIter->string().c_str(), currentSubPath.string().c_str())) {    // Else if sub-path matched, ignore succeeds if it's at the end.
+    } else if (fnmatchSimple(ignoreIter->string().c_str(), currentSubPath, globOptions)) {    // Else if sub-path matched, ignore succeeds if it's at the end.
         ++ignoreIter;
         return ignoreIter == ignorePath.end() || ignoreIter->empty();    // Note: If a globstar still remains, then we don't ignore the current sub-path. This matches the behavior of path matching in globPortable().
     }
@@ -671,138 +924,3 @@ bool FileHandler::checkSubPathIgnored(const fs::path& ignorePath, fs::path::iter
     }
     return false;
 }
-
-fs::path FileHandler::substituteRootPath(const fs::path& path) {
-    auto pathIter = path.begin();
-    if (pathIter != path.end()) {
-        auto findResult = rootPaths_.find(*pathIter);
-        if (findResult != rootPaths_.end()) {
-            if (std::next(pathIter) == path.end()) {    // If this is last sub-path, return mapped root path as it is.
-                return findResult->second;
-            } else {
-                return findResult->second / fs::path(path.string().substr(pathIter->string().length() + 1));
-            }
-        }
-    }
-    return path;
-}
-
-void FileHandler::parseNextLineInFile() {
-    std::string line;
-    if (!getline(configFile_, line)) {
-        configFile_.close();
-        return;
-    }
-    
-    ++lineNumber_;
-    try {
-        /*std::string::size_type lastNonSpace = line.find_last_not_of(' ');    // Trim whitespace.
-        if (lastNonSpace != std::string::npos && lastNonSpace != line.length() - 1) {
-            line.erase(lastNonSpace + 1);
-        }
-        std::string::size_type firstNonSpace = line.find_first_not_of(' ');
-        if (firstNonSpace != std::string::npos && firstNonSpace != 0) {
-            line.erase(0, firstNonSpace);
-        }*/
-        std::string::size_type index = 0;
-        skipWhitespace(index, line);
-        //std::cout << "Line " << lineNumber_ << ": [" << line << "]\n";
-        if (index >= line.length() || line[index] == '#') {
-            return;
-        }
-        
-        std::string command = parseNextWord(index, line);
-        if (command == "set") {    // Syntax: set <option> <value>
-            if (index >= line.length()) {
-                throw std::runtime_error("Missing option parameter.");
-            }
-            std::string option = parseNextWord(index, line);
-            
-            if (option == "glob-matching") {    // Enables/disables glob (wildcard) matching.
-                if (index >= line.length()) {
-                    throw std::runtime_error("Missing value for \"" + option + "\".");
-                }
-                globMatching = parseNextBool(index, line);
-            } else if (option == "match-hidden") {    // Controls matching of hidden files when using glob matching.
-                if (index >= line.length()) {
-                    throw std::runtime_error("Missing value for \"" + option + "\".");
-                }
-                globMatchesHiddenFiles = parseNextBool(index, line);
-            } else {
-                throw std::runtime_error("Invalid option \"" + option + "\".");
-            }
-        } else if (command == "root") {    // Syntax: root <identifier> <replacement path>
-            if (index >= line.length()) {
-                throw std::runtime_error("Missing identifier path parameter.");
-            }
-            fs::path keyPath = parseNextPath(index, line);
-            if (index >= line.length()) {
-                throw std::runtime_error("Missing replacement path parameter.");
-            }
-            fs::path valuePath = parseNextPath(index, line);
-            //std::cout << "    Root: [" << keyPath << "] [" << valuePath << "]\n";
-            
-            rootPaths_.emplace(keyPath, valuePath);
-        } else if (command == "in") {    // Syntax: in <write path> [add <read path>]
-            if (index >= line.length()) {
-                throw std::runtime_error("Missing write path parameter.");
-            }
-            writePath_ = substituteRootPath(parseNextPath(index, line));
-            writePathSet_ = true;
-            if (index < line.length()) {
-                command = parseNextWord(index, line);
-                if (command != "add") {
-                    throw std::runtime_error("Unexpected command \"" + command + "\" after \"in <write path>\".");
-                }
-                if (index >= line.length()) {
-                    throw std::runtime_error("Missing read path parameter.");
-                }
-                readPath_ = substituteRootPath(parseNextPath(index, line));
-                readPathSet_ = true;
-                
-                //std::cout << "    In: [" << writePath_ << "] [" << readPath_ << "]\n";
-            }
-        } else if (command == "add") {    // Syntax (write path must have previously been set): add <read path>
-            if (!writePathSet_) {
-                throw std::runtime_error("Missing previous call to \"in <write path>\".");
-            }
-            if (index >= line.length()) {
-                throw std::runtime_error("Missing read path parameter.");
-            }
-            readPath_ = substituteRootPath(parseNextPath(index, line));
-            readPathSet_ = true;
-            
-            //std::cout << "    Add: [" << writePath_ << "] [" << readPath_ << "]\n";
-        } else if (command == "ignore") {    // Syntax: ignore <path>
-            if (index >= line.length()) {
-                throw std::runtime_error("Missing ignore path parameter.");
-            }
-            fs::path ignorePath = substituteRootPath(parseNextPath(index, line));
-            
-            //std::cout << "    Ignore: [" << ignorePath << "]\n";
-            
-            ignorePaths_.emplace(ignorePath);
-        } else if (command == "include") {    // Syntax: include <path>
-            if (index >= line.length()) {
-                throw std::runtime_error("Missing include path parameter.");
-            }
-            fs::path includePath = substituteRootPath(parseNextPath(index, line));
-            
-            //std::cout << "    Include: [" << includePath << "]\n";
-            
-            auto findResult = ignorePaths_.find(includePath);
-            if (findResult != ignorePaths_.end()) {
-                ignorePaths_.erase(findResult);
-            } else {
-                throw std::runtime_error("No matching ignore path found for \"" + includePath.string() + "\".");
-            }
-        } else {
-            throw std::runtime_error("Unknown command \"" + command + "\".");
-        }
-        if (index < line.length()) {
-            throw std::runtime_error("Unexpected data after command: \"" + line.substr(index) + "\".");
-        }
-    } catch (std::exception& ex) {
-        throw std::runtime_error("\"" + configFilename_.string() + "\" at line " + std::to_string(lineNumber_) + ": " + ex.what());
-    }
-}
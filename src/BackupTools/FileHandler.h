@@ -1,15 +1,26 @@
 #ifndef FILE_HANDLER_H_
 #define FILE_HANDLER_H_
 
+#include "BackupTools/DirectoryHandles.h"
+#include "BackupTools/FileReader.h"
+#include "BackupTools/Sha256.h"
 #include <filesystem>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+class ConfigPlan;
+class IoThrottle;
+class TreeState;
+
 /**
  * Control Sequence Introducer used to set colors and formatting in terminal.
  * 
@@ -49,6 +60,10 @@ struct WriteReadPathTree {
     fs::path writePrefix;
     fs::path readPrefix;
     std::set<fs::path> relativePaths;
+    bool snapshot = false;    // Files go into a new dated directory inside writePrefix for each backup.
+    bool chunkStore = false;    // The writePrefix is a ChunkStore, relative paths are entries in its snapshots.
+    bool compress = false;    // Files copied to writePrefix get compressed (see Compressor).
+    bool decompress = false;    // Files copied to writePrefix may come from a compressed backup and get decompressed.
     
     bool isEmpty() const { return relativePaths.empty(); }
 };
@@ -80,26 +95,44 @@ private:
 };
 */
 
+/**
+ * Settings for glob matching. Each FileHandler has its own copy (the config
+ * file can change them with the set command) so that multiple configs can be
+ * scanned at the same time.
+ */
+struct GlobOptions {
+    char pathSeparator;
+    bool matching;    // Wildcards are treated as normal characters when disabled.
+    bool matchesHiddenFiles;    // Star and question mark can match a leading dot in a name.
+    
+    GlobOptions();
+};
+
 /**
  * Comparator to sort filenames (case is ignored).
  */
 bool compareFilename(const fs::path& lhs, const fs::path& rhs);
 
+/**
+ * Same as compareFilename() for names that are not in a path.
+ */
+bool compareFilenameView(std::string_view lhs, std::string_view rhs);
+
 /**
  * Utility class to deal with config file format, file globs (pattern matching),
  * and other file operations.
  */
 class FileHandler {
 public:
-    static char pathSeparator;
-    static bool globMatching;
-    static bool globMatchesHiddenFiles;
+    static constexpr char PATH_SEPARATOR = static_cast<char>(fs::path::preferred_separator);
+    
+    FileHandler();
     
     /**
      * Implementation of the unix fnmatch(3) function. More details in .cpp
      * file.
      */
-    static bool fnmatchPortable(char const* pattern, char const* str);
+    static bool fnmatchPortable(char const* pattern, char const* str, const GlobOptions& options = GlobOptions());
     
     /**
      * Determines if a string contains glob wildcards.
@@ -143,36 +176,104 @@ public:
      * returns true if the file modification timestamps match (if the times are
      * within 2 seconds of each other to be exact, due to slightly different
      * time representations across digital storage mediums).
+     * The checkCompressed parameter is for destinations with compression or
+     * decompression set. If the sizes differ and one of the files is
+     * compressed (see Compressor), the other one is compared with the size and
+     * digest in its header instead.
+     */
+    bool checkFileEquivalence(const fs::path& source, const fs::path& dest, bool skipCache = false, bool fastCompare = false, bool checkCompressed = false);
+    
+    /**
+     * Same as checkFileEquivalence() but compares source with multiple
+     * destinations. The source file is only read once, each block is compared
+     * with all of the destinations that still match.
+     */
+    std::vector<bool> checkFileEquivalence(const fs::path& source, const std::vector<fs::path>& dests, bool skipCache = false, bool fastCompare = false, bool checkCompressed = false);
+    
+    /**
+     * Returns true if checkFileEquivalence() can find the result in the cache
+     * without reading the files (both modification timestamps are unchanged).
+     */
+    bool isEquivalenceCached(const fs::path& source, const fs::path& dest) const;
+    
+    /**
+     * Sets the throttle to use for reading files in checkFileEquivalence() and
+     * scanning directories in globPortable(), or nullptr for no limit.
+     */
+    void setIoThrottle(IoThrottle* ioThrottle);
+    
+    /**
+     * Returns the throttle set with setIoThrottle().
+     */
+    IoThrottle* getIoThrottle() const;
+    
+    /**
+     * Sets how the file reads in checkFileEquivalence() use the page cache.
+     * Defaults to PageCacheMode::Normal.
      */
-    bool checkFileEquivalence(const fs::path& source, const fs::path& dest, bool skipCache = false, bool fastCompare = false);
+    void setPageCacheMode(PageCacheMode mode);
+    
+    PageCacheMode getPageCacheMode() const;
+    
+    /**
+     * Closes the directories that checkFileEquivalence() keeps open to open
+     * the files inside them. Call this once the scan is done, before any of
+     * the directories could be changed.
+     */
+    void closeDirectories();
+    
+    /**
+     * Sets the saved directory listings to use in globPortable() for
+     * incremental checks, or nullptr (the default) to list every directory.
+     */
+    void setTreeState(TreeState* treeState);
     
     /**
-     * Opens the file (closes the previous one if still open) and resets all
-     * internal state.
+     * Returns the glob settings, these get reset by loadConfigFile() and can be
+     * changed in the config file.
+     */
+    const GlobOptions& getGlobOptions() const;
+    
+    void setGlobOptions(const GlobOptions& globOptions);
+    
+    /**
+     * Compiles the config file (see ConfigPlan) and uses it with
+     * loadConfigPlan().
      */
     void loadConfigFile(const fs::path& filename);
     
+    /**
+     * Resets all internal state and starts over with the first step of the
+     * plan. The plan can be shared with other FileHandlers.
+     */
+    void loadConfigPlan(std::shared_ptr<const ConfigPlan> plan);
+    
     /**
      * Parses a cache file and stores it in cachedWriteTimes_. The cache file
-     * keeps track of each file that gets scanned by checkFileEquivalence() and
-     * stores the last known modification timestamp of the source and
-     * destination files, and whether the files were equivalent or not at that
-     * time. The file format is filename (of source), null character, the byte
-     * data of the corresponding CachedWriteTime, and a newline character.
+     * keeps track of each pair of files that gets scanned by
+     * checkFileEquivalence() and stores the last known modification timestamp
+     * of the source and destination files, and whether the files were
+     * equivalent or not at that time. The file format is a header line with
+     * the format version, the timestamp of the config file and a newline
+     * character, then for each pair the source filename, null character,
+     * destination filename, null character, the byte data of the corresponding
+     * CachedWriteTime, and a newline character.
      * 
      * The configFileWriteTime parameter is the file modification timestamp of
      * the config file that this cache file corresponds to. It's used to verify
-     * if the cache file is up-to-date and skips parsing if not.
+     * if the cache file is up-to-date and skips parsing if not (returns
+     * false). A cache file from an older version is also skipped.
      */
     bool loadCacheFile(const fs::path& filename, const fs::file_time_type& configFileWriteTime);
     
     /**
-     * Creates a cache file using the format mentioned in loadCacheFile().
+     * Creates a cache file using the format mentioned in loadCacheFile(). The
+     * previous cache file is replaced in a single rename.
      */
     void saveCacheFile(const fs::path& filename, const fs::file_time_type& configFileWriteTime);
     
     /**
-     * Get the next set of write/read paths from configFile_, or return empty
+     * Get the next set of write/read paths from the plan, or return empty
      * result if none left. Returned paths are stripped of regex and read paths
      * (the absolute paths, not just relative ones that are returned) are unique
      * and not contained in ignorePaths_.
@@ -210,32 +311,66 @@ private:
         bool fileEquivalence;
     };
     
-    std::ifstream configFile_;
-    fs::path configFilename_;
-    unsigned int lineNumber_;
-    std::map<fs::path, fs::path> rootPaths_;
+    /**
+     * Results of globPortable() for a pattern before duplicate read paths are
+     * removed. Used with fan-out so that a source added to multiple write paths
+     * is only scanned once. The entry is only valid if the ignores and glob
+     * settings are the same as when it was made.
+     */
+    struct GlobCacheEntry {
+        fs::path directoryPrefix;
+        std::string::size_type dirPrefixOffset;
+        size_t numIgnorePaths;
+        bool matchesHiddenFiles;
+        bool matching;
+        std::vector<std::string> matches;
+    };
+    
+    std::shared_ptr<const ConfigPlan> plan_;
+    size_t nextStep_;
     std::set<fs::path> ignorePaths_;
-    std::set<fs::path> previousReadPaths_;
-    fs::path writePath_, readPath_;
-    bool writePathSet_, readPathSet_;
-    std::map<fs::path, CachedWriteTime> cachedWriteTimes_;
+    std::unordered_map<std::string, unsigned int> previousReadPaths_;    // Maps each read path to the id of the first write path it was added to.
+    std::set<std::pair<unsigned int, std::string>> previousFanOutPaths_;
+    bool writePathFanOut_;
+    unsigned int writePathId_;
+    std::map<fs::path, GlobCacheEntry> globCache_;
+    std::map<std::pair<fs::path, fs::path>, CachedWriteTime> cachedWriteTimes_;    // Keyed by the source and destination path.
+    GlobOptions globOptions_;
+    IoThrottle* ioThrottle_;
+    TreeState* treeState_;
+    PageCacheMode pageCacheMode_;
+    FileReader sourceReader_;
+    std::vector<std::unique_ptr<FileReader>> destReaders_;
+    DirectoryHandles sourceDirectories_;
+    std::vector<std::unique_ptr<DirectoryHandles>> destDirectories_;    // One for each of destReaders_, so that fan-out destinations do not close each other's directories.
+    AlignedBuffer sourceBuffer_, destBuffer_;
     
     /**
-     * Determines if the current sub-path is ignored given the current position
-     * (ignoreIter) in ignorePath.
+     * Used in checkFileEquivalence() when the file sizes differ and
+     * checkCompressed is set. The first block of each file is read to look for
+     * a compressed file header.
+     */
+    bool checkCompressedEquivalence(FileReader& destReader);
+    
+    /**
+     * Returns true if readPath should be added to the current write path. A
+     * read path is normally only used for the first write path it is added to,
+     * but with fan-out it can go to each write path once.
      */
-    static bool checkSubPathIgnored(const fs::path& ignorePath, fs::path::iterator& ignoreIter, const fs::path& currentSubPath);
+    bool addReadPath(const std::string& readPath);
     
     /**
-     * Substitute the path root for a match in rootPaths_ if applicable.
+     * Returns the SHA-256 digest of the file in reader. The first numRead bytes
+     * of the file have already been read into buffer.
      */
-    fs::path substituteRootPath(const fs::path& path);
+    Sha256::Digest hashRemainingFile(FileReader& reader, AlignedBuffer& buffer, size_t numRead);
     
     /**
-     * Read next line in configFile_ (if no more lines, closes the file). Sets
-     * writePath_ and readPath_.
+     * Determines if the current sub-path is ignored given the current position
+     * (ignoreIter) in ignorePath.
      */
-    void parseNextLineInFile();
+    static bool checkSubPathIgnored(const fs::path& ignorePath, fs::path::iterator& ignoreIter, const fs::path& currentSubPath, const GlobOptions& globOptions);
+    static bool checkSubPathIgnored(const fs::path& ignorePath, fs::path::iterator& ignoreIter, const char* currentSubPath, const GlobOptions& globOptions);
 };
 
 #endif
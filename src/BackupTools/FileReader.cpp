@@ -0,0 +1,198 @@
+#include "BackupTools/FileReader.h"
+#include "BackupTools/Stats.h"
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+AlignedBuffer::AlignedBuffer(size_t size) :
+    data_(nullptr),
+    size_(0) {
+    resize(size);
+}
+
+void AlignedBuffer::resize(size_t size) {
+    if (size == size_) {
+        return;
+    }
+    storage_.resize(size + ALIGNMENT);    // Over-allocate and round the start up to the alignment.
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(storage_.data());
+    data_ = storage_.data() + (ALIGNMENT - address % ALIGNMENT) % ALIGNMENT;
+    size_ = size;
+}
+
+PageCacheMode FileReader::parsePageCacheMode(const std::string& str) {
+    if (str == "normal") {
+        return PageCacheMode::Normal;
+    } else if (str == "drop-behind") {
+        return PageCacheMode::DropBehind;
+    } else if (str == "direct") {
+        return PageCacheMode::Direct;
+    } else {
+        throw std::runtime_error("Value for \"page-cache\" must be normal, drop-behind, or direct.");
+    }
+}
+
+FileReader::FileReader() :
+    mode_(PageCacheMode::Normal),
+    size_(0),
+    offset_(0),
+    droppedOffset_(0)
+    #ifndef _WIN32
+    , fd_(-1)
+    #endif
+    {
+}
+
+FileReader::~FileReader() {
+    close();
+}
+
+bool FileReader::open(const fs::path& filename, PageCacheMode mode, DirectoryHandles* directories) {
+    close();
+    filename_ = filename;
+    mode_ = mode;
+    size_ = 0;
+    offset_ = 0;
+    droppedOffset_ = 0;
+    
+    #ifdef _WIN32
+    static_cast<void>(directories);
+    mode_ = PageCacheMode::Normal;
+    file_.open(filename, std::ios::ate | std::ios::binary);
+    if (!file_.is_open()) {
+        return false;
+    }
+    size_ = static_cast<uintmax_t>(file_.tellg());
+    file_.seekg(0);
+    #else
+    auto openFile = [&](int flags) {
+        return (directories != nullptr ? directories->openFile(filename, flags) : ::open(filename.c_str(), flags));
+    };
+    #ifdef O_DIRECT
+    if (mode_ == PageCacheMode::Direct) {
+        fd_ = openFile(O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if (fd_ < 0 && errno == EINVAL) {    // Filesystem does not support direct I/O (tmpfs for example).
+            mode_ = PageCacheMode::DropBehind;
+        }
+    }
+    #else
+    if (mode_ == PageCacheMode::Direct) {
+        mode_ = PageCacheMode::DropBehind;
+    }
+    #endif
+    if (fd_ < 0) {
+        fd_ = openFile(O_RDONLY | O_CLOEXEC);
+    }
+    Stats::add(Stats::Syscalls, 2);    // Includes the fstat() below.
+    if (fd_ < 0) {
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fd_, &fileStat) != 0) {
+        close();
+        return false;
+    }
+    size_ = static_cast<uintmax_t>(fileStat.st_size);
+    #ifdef POSIX_FADV_SEQUENTIAL
+    if (mode_ == PageCacheMode::DropBehind) {
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);    // Allows more aggressive read-ahead.
+    }
+    #endif
+    #endif
+    return true;
+}
+
+void FileReader::close() {
+    #ifdef _WIN32
+    if (file_.is_open()) {
+        file_.close();
+    }
+    #else
+    if (fd_ >= 0) {
+        if (mode_ == PageCacheMode::DropBehind) {
+            offset_ = size_;
+            dropBehind();
+        }
+        ::close(fd_);
+        fd_ = -1;
+        Stats::add(Stats::Syscalls);
+    }
+    #endif
+}
+
+bool FileReader::isOpen() const {
+    #ifdef _WIN32
+    return file_.is_open();
+    #else
+    return fd_ >= 0;
+    #endif
+}
+
+size_t FileReader::read(char* buffer, size_t size) {
+    #ifdef _WIN32
+    file_.read(buffer, static_cast<std::streamsize>(size));
+    if (file_.bad()) {
+        throw fs::filesystem_error("Unable to read file", filename_, std::make_error_code(std::errc::io_error));
+    }
+    size_t totalRead = static_cast<size_t>(file_.gcount());
+    offset_ += totalRead;
+    Stats::add(Stats::BytesRead, totalRead);
+    return totalRead;
+    #else
+    size_t totalRead = 0;
+    while (totalRead < size) {    // Loop to handle short reads, a return of zero is the end of the file.
+        ssize_t numRead = ::read(fd_, buffer + totalRead, size - totalRead);
+        Stats::add(Stats::Syscalls);
+        if (numRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            #ifdef O_DIRECT
+            if (errno == EINVAL && mode_ == PageCacheMode::Direct) {    // Direct I/O was accepted on open but not for this read, switch to cached reads.
+                int flags = fcntl(fd_, F_GETFL);
+                if (flags >= 0 && fcntl(fd_, F_SETFL, flags & ~O_DIRECT) == 0) {
+                    mode_ = PageCacheMode::DropBehind;
+                    continue;
+                }
+            }
+            #endif
+            throw fs::filesystem_error("Unable to read file", filename_, std::error_code(errno, std::generic_category()));
+        } else if (numRead == 0) {
+            break;
+        }
+        totalRead += static_cast<size_t>(numRead);
+    }
+    offset_ += totalRead;
+    Stats::add(Stats::BytesRead, totalRead);
+    if (mode_ == PageCacheMode::DropBehind && offset_ - droppedOffset_ >= DROP_WINDOW_SIZE) {    // Drop pages in large windows to keep the number of syscalls low.
+        dropBehind();
+    }
+    return totalRead;
+    #endif
+}
+
+void FileReader::dropFromCache(const fs::path& filename) {
+    #if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+        Stats::add(Stats::Syscalls, 3);
+    }
+    #endif
+}
+
+void FileReader::dropBehind() {
+    #if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+    if (offset_ > droppedOffset_) {
+        posix_fadvise(fd_, static_cast<off_t>(droppedOffset_), static_cast<off_t>(offset_ - droppedOffset_), POSIX_FADV_DONTNEED);
+        droppedOffset_ = offset_;
+    }
+    #endif
+}
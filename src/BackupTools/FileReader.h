@@ -0,0 +1,116 @@
+#ifndef FILE_READER_H_
+#define FILE_READER_H_
+
+#include "BackupTools/DirectoryHandles.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+    #include <fstream>
+#endif
+
+namespace fs = std::filesystem;
+
+/**
+ * Controls how reading files interacts with the operating system page cache.
+ * Normal leaves caching up to the operating system. DropBehind reads
+ * sequentially and tells the kernel to drop the pages behind the read cursor,
+ * so that scanning a large archive does not push other programs out of the
+ * cache. Direct bypasses the cache completely with O_DIRECT (falls back to
+ * DropBehind if the filesystem does not support it).
+ */
+enum class PageCacheMode {
+    Normal, DropBehind, Direct
+};
+
+/**
+ * Block of memory aligned for use with O_DIRECT reads.
+ */
+class AlignedBuffer {
+public:
+    static constexpr size_t ALIGNMENT = 4096;
+    
+    AlignedBuffer(size_t size = 0);
+    
+    void resize(size_t size);
+    char* data() { return data_; }
+    size_t size() const { return size_; }
+    
+private:
+    std::vector<char> storage_;
+    char* data_;
+    size_t size_;
+};
+
+/**
+ * Reads a file sequentially in blocks, applying the PageCacheMode. Only the
+ * Normal mode is available on Windows.
+ */
+class FileReader {
+public:
+    /**
+     * Converts one of "normal", "drop-behind", or "direct" to the mode.
+     */
+    static PageCacheMode parsePageCacheMode(const std::string& str);
+    
+    FileReader();
+    ~FileReader();
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+    
+    /**
+     * Opens the file for reading (closes the previous one). Returns false if
+     * the file could not be opened. If directories is set, the file is opened
+     * relative to its parent directory.
+     */
+    bool open(const fs::path& filename, PageCacheMode mode, DirectoryHandles* directories = nullptr);
+    
+    /**
+     * Closes the file, any pages still in the cache from this file are dropped
+     * if using DropBehind.
+     */
+    void close();
+    
+    bool isOpen() const;
+    uintmax_t getSize() const { return size_; }
+    
+    /**
+     * Reads up to size bytes into buffer and returns the number read (zero at
+     * the end of the file). For the Direct mode, the buffer must come from an
+     * AlignedBuffer and the size must be a multiple of the alignment. Throws
+     * fs::filesystem_error if reading fails.
+     */
+    size_t read(char* buffer, size_t size);
+    
+    /**
+     * Drops the cached pages of the whole file. Used for files that were read
+     * without a FileReader (like with fs::copy_file()). Does nothing on
+     * systems without posix_fadvise().
+     */
+    static void dropFromCache(const fs::path& filename);
+    
+    static constexpr uintmax_t DROP_WINDOW_SIZE = 8 * 1024 * 1024;    // DropBehind releases pages once this much has been read.
+    
+private:
+    fs::path filename_;
+    PageCacheMode mode_;
+    uintmax_t size_;
+    uintmax_t offset_;
+    uintmax_t droppedOffset_;
+    #ifdef _WIN32
+    std::ifstream file_;
+    #else
+    int fd_;
+    #endif
+    
+    /**
+     * Tells the kernel that pages from droppedOffset_ up to the read cursor
+     * are no longer needed.
+     */
+    void dropBehind();
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "BackupTools/FileSyncer.h"
+#include "BackupTools/Stats.h"
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+/**
+ * Returns the directory containing path (the current directory if path has no
+ * parent).
+ */
+fs::path getParentDirectory(const fs::path& path) {
+    fs::path parentPath = path.parent_path();
+    return (parentPath.empty() ? fs::path(".") : parentPath);
+}
+
+DurabilityLevel FileSyncer::parseDurabilityLevel(const std::string& str) {
+    if (str == "none") {
+        return DurabilityLevel::None;
+    } else if (str == "batch") {
+        return DurabilityLevel::Batch;
+    } else if (str == "per-file") {
+        return DurabilityLevel::PerFile;
+    } else {
+        throw std::runtime_error("Value for \"durability\" must be none, batch, or per-file.");
+    }
+}
+
+FileSyncer::FileSyncer(DurabilityLevel level) :
+    level_(level),
+    pendingBytes_(0) {
+}
+
+void FileSyncer::commitFile(const fs::path& tempPath, const fs::path& dest, uintmax_t fileSize) {
+    Stats::add(Stats::BytesWritten, fileSize);
+    if (level_ == DurabilityLevel::None) {
+        fs::rename(tempPath, dest);
+        Stats::add(Stats::Syscalls);
+    } else if (level_ == DurabilityLevel::PerFile) {
+        syncPath(tempPath, false);    // Contents must be durable before the rename, otherwise a crash could leave an empty file at dest.
+        fs::rename(tempPath, dest);
+        Stats::add(Stats::Syscalls);
+        syncPath(getParentDirectory(dest), true);
+    } else {
+        #ifdef __linux__
+        int fd = open(tempPath.c_str(), O_RDONLY | O_CLOEXEC);    // Start writeback now so that the sync in flush() has less to wait on.
+        if (fd >= 0) {
+            sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+            close(fd);
+        }
+        Stats::add(Stats::Syscalls, 3);
+        #endif
+        pendingFiles_.emplace_back(tempPath, dest);
+        pendingBytes_ += fileSize;
+    }
+}
+
+void FileSyncer::commitDirectory(const fs::path& directory) {
+    if (level_ == DurabilityLevel::PerFile) {
+        syncPath((directory.empty() ? fs::path(".") : directory), true);
+    } else if (level_ == DurabilityLevel::Batch) {
+        pendingDirectories_.insert((directory.empty() ? fs::path(".") : directory));
+    }
+}
+
+bool FileSyncer::needsFlush() const {
+    return pendingFiles_.size() >= MAX_BATCH_FILES || pendingBytes_ >= MAX_BATCH_BYTES;
+}
+
+void FileSyncer::flush() {
+    if (!pendingFiles_.empty()) {
+        if (!syncFilesystems()) {
+            for (const auto& p : pendingFiles_) {
+                syncPath(p.first, false);
+            }
+        }
+        for (const auto& p : pendingFiles_) {
+            fs::rename(p.first, p.second);
+            Stats::add(Stats::Syscalls);
+            pendingDirectories_.insert(getParentDirectory(p.second));
+        }
+        pendingFiles_.clear();
+        pendingBytes_ = 0;
+    }
+    
+    for (const auto& p : pendingDirectories_) {    // Flush the renames and any other directory changes.
+        if (fs::exists(p)) {
+            syncPath(p, true);
+        }
+    }
+    pendingDirectories_.clear();
+}
+
+void FileSyncer::syncPath(const fs::path& path, bool isDirectory) {
+    #ifdef _WIN32
+    if (isDirectory) {    // Flushing a directory handle is not supported on Windows, NTFS journals the metadata anyways.
+        return;
+    }
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        throw fs::filesystem_error("Unable to open file for sync", path, std::error_code(GetLastError(), std::system_category()));
+    }
+    BOOL success = FlushFileBuffers(handle);
+    DWORD lastError = GetLastError();
+    CloseHandle(handle);
+    if (!success) {
+        throw fs::filesystem_error("Unable to sync file", path, std::error_code(lastError, std::system_category()));
+    }
+    #else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | (isDirectory ? O_DIRECTORY : 0));
+    if (fd < 0) {
+        throw fs::filesystem_error("Unable to open file for sync", path, std::error_code(errno, std::generic_category()));
+    }
+    if (fsync(fd) != 0 && errno != EINVAL) {    // Some filesystems return EINVAL for directories, these can be skipped.
+        int lastError = errno;
+        close(fd);
+        throw fs::filesystem_error("Unable to sync file", path, std::error_code(lastError, std::generic_category()));
+    }
+    close(fd);
+    Stats::add(Stats::Syscalls, 3);
+    #endif
+}
+
+bool FileSyncer::syncFilesystems() {
+    #ifdef __linux__
+    std::set<dev_t> syncedDevices;
+    for (const auto& p : pendingFiles_) {
+        struct stat fileStat;
+        if (stat(p.first.c_str(), &fileStat) != 0) {
+            throw fs::filesystem_error("Unable to stat file for sync", p.first, std::error_code(errno, std::generic_category()));
+        }
+        if (!syncedDevices.insert(fileStat.st_dev).second) {    // One syncfs() call per filesystem covers every file in the batch.
+            continue;
+        }
+        int fd = open(p.first.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw fs::filesystem_error("Unable to open file for sync", p.first, std::error_code(errno, std::generic_category()));
+        }
+        if (syncfs(fd) != 0) {
+            int lastError = errno;
+            close(fd);
+            throw fs::filesystem_error("Unable to sync filesystem", p.first, std::error_code(lastError, std::generic_category()));
+        }
+        close(fd);
+        Stats::add(Stats::Syscalls, 3);
+    }
+    return true;
+    #else
+    return false;
+    #endif
+}
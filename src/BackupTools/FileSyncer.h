@@ -0,0 +1,90 @@
+#ifndef FILE_SYNCER_H_
+#define FILE_SYNCER_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * Controls how much effort is made to get written files onto the storage
+ * device before a backup reports them as complete. None leaves this up to the
+ * operating system, Batch flushes groups of files at once, and PerFile flushes
+ * each file (and its directory) one at a time.
+ */
+enum class DurabilityLevel {
+    None, Batch, PerFile
+};
+
+/**
+ * Moves copied files into place once their contents are durable. Files are
+ * first written to a temporary path, then commitFile() renames them to the
+ * destination after the data has been flushed (depending on the durability
+ * level). For the Batch level, the renames wait until flush() is called so that
+ * many files can share a single filesystem sync.
+ */
+class FileSyncer {
+public:
+    /**
+     * Converts one of "none", "batch", or "per-file" to the durability level.
+     */
+    static DurabilityLevel parseDurabilityLevel(const std::string& str);
+    
+    FileSyncer(DurabilityLevel level);
+    
+    DurabilityLevel getLevel() const { return level_; }
+    
+    /**
+     * Renames tempPath to dest once the contents of tempPath are durable. With
+     * the Batch level this only starts writeback of the file, and the rename is
+     * delayed until the next flush().
+     */
+    void commitFile(const fs::path& tempPath, const fs::path& dest, uintmax_t fileSize);
+    
+    /**
+     * Records a change to the entries in a directory (a file or directory was
+     * created, renamed, or removed) so that the directory gets flushed too.
+     */
+    void commitDirectory(const fs::path& directory);
+    
+    /**
+     * Returns true if enough data is waiting in the current batch that flush()
+     * should be called.
+     */
+    bool needsFlush() const;
+    
+    /**
+     * Flushes all pending files, renames them into place, and flushes the
+     * modified directories. After this returns, everything passed to
+     * commitFile() and commitDirectory() is durable.
+     */
+    void flush();
+    
+    /**
+     * Flushes the data of a single file or directory to the storage device.
+     * Directories are skipped on systems that do not support this.
+     */
+    static void syncPath(const fs::path& path, bool isDirectory);
+    
+private:
+    static constexpr size_t MAX_BATCH_FILES = 512;
+    static constexpr uintmax_t MAX_BATCH_BYTES = 256 * 1024 * 1024;
+    
+    DurabilityLevel level_;
+    std::vector<std::pair<fs::path, fs::path>> pendingFiles_;
+    std::set<fs::path> pendingDirectories_;
+    uintmax_t pendingBytes_;
+    
+    /**
+     * Flushes every filesystem that contains one of the pending files. Returns
+     * false if this is not supported (the files are synced one at a time
+     * instead).
+     */
+    bool syncFilesystems();
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "BackupTools/IoScheduler.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <linux/fiemap.h>
+    #include <linux/fs.h>
+    #include <sys/ioctl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+IoOrder IoScheduler::parseIoOrder(const std::string& str) {
+    if (str == "name") {
+        return IoOrder::Name;
+    } else if (str == "inode") {
+        return IoOrder::Inode;
+    } else if (str == "physical") {
+        return IoOrder::Physical;
+    } else {
+        throw std::runtime_error("Value for \"io-order\" must be name, inode, or physical.");
+    }
+}
+
+IoScheduler::IoScheduler(IoOrder order) :
+    order_(order) {
+}
+
+std::vector<size_t> IoScheduler::sortPaths(const std::vector<fs::path>& paths) {
+    std::vector<size_t> indices(paths.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    if (order_ == IoOrder::Name) {
+        return indices;
+    }
+    
+    std::vector<std::pair<uintmax_t, uintmax_t>> locations;
+    locations.reserve(paths.size());
+    for (const auto& p : paths) {
+        locations.push_back(getLocation(p));
+    }
+    std::stable_sort(indices.begin(), indices.end(), [&locations](size_t lhs, size_t rhs) {
+        return locations[lhs] < locations[rhs];
+    });
+    return indices;
+}
+
+std::pair<uintmax_t, uintmax_t> IoScheduler::getLocation(const fs::path& path) {
+    #ifdef __linux__
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) != 0) {
+        return {0, 0};
+    }
+    const uintmax_t device = static_cast<uintmax_t>(fileStat.st_dev);
+    if (order_ == IoOrder::Inode || !S_ISREG(fileStat.st_mode)) {
+        return {device, static_cast<uintmax_t>(fileStat.st_ino)};
+    }
+    
+    auto supportedIter = physicalSupported_.find(device);
+    if (supportedIter != physicalSupported_.end() && !supportedIter->second) {
+        return {device, static_cast<uintmax_t>(fileStat.st_ino)};
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return {device, 0};
+    }
+    alignas(struct fiemap) char requestBuffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};    // Room for the header and a single extent, only the first one is needed.
+    struct fiemap* request = reinterpret_cast<struct fiemap*>(requestBuffer);
+    request->fm_start = 0;
+    request->fm_length = FIEMAP_MAX_OFFSET;
+    request->fm_extent_count = 1;
+    const int result = ioctl(fd, FS_IOC_FIEMAP, request);
+    close(fd);
+    if (result != 0) {
+        if (supportedIter == physicalSupported_.end()) {    // Only the first file on each device decides if FIEMAP is used, mixing inode numbers with block offsets would give a meaningless order.
+            physicalSupported_.emplace(device, false);
+            return {device, static_cast<uintmax_t>(fileStat.st_ino)};
+        }
+        return {device, 0};
+    }
+    physicalSupported_.emplace(device, true);
+    if (request->fm_mapped_extents == 0 || (request->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE)) != 0) {
+        return {device, 0};
+    }
+    return {device, static_cast<uintmax_t>(request->fm_extents[0].fe_physical)};
+    #else
+    (void)path;
+    return {0, 0};
+    #endif
+}
@@ -0,0 +1,60 @@
+#ifndef IO_SCHEDULER_H_
+#define IO_SCHEDULER_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * Order to read files in when copying and comparing. Name is the order the
+ * files are found in the config, Inode sorts by inode number (usually close to
+ * the order files were created on disk), and Physical sorts by the location of
+ * the first extent of the file on the storage device (Linux FIEMAP, falls back
+ * to Inode if the filesystem does not support it).
+ */
+enum class IoOrder {
+    Name, Inode, Physical
+};
+
+/**
+ * Sorts batches of files by their location on disk to reduce seeking on
+ * spinning disks. Files on the same device are grouped together, and files
+ * with no data on disk (empty or stored inline) are placed first. The
+ * locations are only supported on Linux, other systems keep the original
+ * order.
+ */
+class IoScheduler {
+public:
+    /**
+     * Converts one of "name", "inode", or "physical" to the order.
+     */
+    static IoOrder parseIoOrder(const std::string& str);
+    
+    IoScheduler(IoOrder order);
+    
+    IoOrder getOrder() const { return order_; }
+    
+    /**
+     * Returns the indices of paths sorted by disk location. The sort is stable,
+     * so paths with the same location (or any paths if the order is Name) stay
+     * in the given order.
+     */
+    std::vector<size_t> sortPaths(const std::vector<fs::path>& paths);
+    
+private:
+    IoOrder order_;
+    std::map<uintmax_t, bool> physicalSupported_;    // Maps a device ID to whether FIEMAP works for it.
+    
+    /**
+     * Returns the device ID and location key for the file, or a key of zero if
+     * it could not be found.
+     */
+    std::pair<uintmax_t, uintmax_t> getLocation(const fs::path& path);
+};
+
+#endif
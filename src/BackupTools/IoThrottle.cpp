@@ -0,0 +1,171 @@
+#include "BackupTools/IoThrottle.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#ifdef __linux__
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+RateLimiter::RateLimiter(double ratePerSecond) :
+    ratePerSecond_(ratePerSecond),
+    capacity_(ratePerSecond / 10.0),    // Allow bursts of up to 100ms worth of tokens.
+    tokens_(capacity_),
+    lastRefill_(std::chrono::steady_clock::now()) {
+}
+
+void RateLimiter::acquire(double numTokens) {
+    if (!isLimited()) {
+        return;
+    }
+    std::chrono::duration<double> waitTime(0.0);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::chrono::steady_clock::time_point currTime = std::chrono::steady_clock::now();
+        tokens_ = std::min(capacity_, tokens_ + std::chrono::duration<double>(currTime - lastRefill_).count() * ratePerSecond_);
+        lastRefill_ = currTime;
+        tokens_ -= numTokens;
+        if (tokens_ < 0.0) {
+            waitTime = std::chrono::duration<double>(-tokens_ / ratePerSecond_);
+        }
+    }
+    if (waitTime.count() > 0.0) {    // Sleep without holding the lock, other threads queue up behind the debt we just took.
+        std::this_thread::sleep_for(waitTime);
+    }
+}
+
+IoThrottle::IoSlot::IoSlot(IoThrottle* ioThrottle) :
+    ioThrottle_(ioThrottle != nullptr && ioThrottle->hasConcurrencyLimit() ? ioThrottle : nullptr) {
+        
+    if (ioThrottle_ == nullptr) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(ioThrottle_->ioSlotMutex_);
+    ioThrottle_->ioSlotFreed_.wait(lock, [this]() {
+        return ioThrottle_->numActiveIo_ < ioThrottle_->maxConcurrentIo_;
+    });
+    ++ioThrottle_->numActiveIo_;
+}
+
+IoThrottle::IoSlot::~IoSlot() {
+    if (ioThrottle_ == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(ioThrottle_->ioSlotMutex_);
+        --ioThrottle_->numActiveIo_;
+    }
+    ioThrottle_->ioSlotFreed_.notify_one();
+}
+
+#ifdef __linux__
+    constexpr int IOPRIO_CLASS_SHIFT = 13;
+    constexpr int IOPRIO_CLASS_BE = 2;
+    constexpr int IOPRIO_CLASS_IDLE = 3;
+    constexpr int IOPRIO_WHO_PROCESS = 1;    // With an ID of zero this is the calling thread.
+#endif
+
+IoThrottle::PriorityScope::PriorityScope(IoPriority priority) :
+    previousPriority_(-1) {
+        
+    if (priority == IoPriority::Unchanged) {
+        return;
+    }
+    #ifdef __linux__
+    const int ioprio = (priority == IoPriority::Idle ? IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT : (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7);    // Lowest priority level within the best-effort class.
+    const int previousPriority = static_cast<int>(syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0));    // No glibc wrappers exist for these.
+    if (previousPriority < 0 || syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) != 0) {
+        throw std::system_error(errno, std::generic_category(), "Unable to set I/O priority");
+    }
+    previousPriority_ = previousPriority;
+    #else
+    throw std::runtime_error("Setting the I/O priority is only supported on Linux.");
+    #endif
+}
+
+IoThrottle::PriorityScope::~PriorityScope() {
+    #ifdef __linux__
+    if (previousPriority_ >= 0) {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, previousPriority_);
+    }
+    #endif
+}
+
+IoThrottle::IoThrottle(double maxReadRate, double maxWriteRate, double maxIops, unsigned int maxConcurrentIo) :
+    readLimiter_(maxReadRate),
+    writeLimiter_(maxWriteRate),
+    opsLimiter_(maxIops),
+    maxConcurrentIo_(maxConcurrentIo),
+    numActiveIo_(0) {
+}
+
+bool IoThrottle::isLimited() const {
+    return readLimiter_.isLimited() || writeLimiter_.isLimited() || opsLimiter_.isLimited();
+}
+
+void IoThrottle::acquireRead(uintmax_t numBytes) {
+    opsLimiter_.acquire(1.0);
+    readLimiter_.acquire(static_cast<double>(numBytes));
+}
+
+void IoThrottle::acquireWrite(uintmax_t numBytes) {
+    opsLimiter_.acquire(1.0);
+    writeLimiter_.acquire(static_cast<double>(numBytes));
+}
+
+void IoThrottle::acquireOps(unsigned int numOps) {
+    opsLimiter_.acquire(static_cast<double>(numOps));
+}
+
+double IoThrottle::parseByteRate(const std::string& str) {
+    size_t index = 0;
+    double value;
+    try {
+        value = std::stod(str, &index);
+    } catch (...) {
+        throw std::runtime_error("Invalid byte rate \"" + str + "\".");
+    }
+    double multiplier = 1.0;
+    if (index < str.length()) {
+        char suffix = static_cast<char>(std::toupper(static_cast<unsigned char>(str[index])));
+        if (suffix == 'K') {
+            multiplier = 1024.0;
+        } else if (suffix == 'M') {
+            multiplier = 1024.0 * 1024.0;
+        } else if (suffix == 'G') {
+            multiplier = 1024.0 * 1024.0 * 1024.0;
+        } else if (suffix != 'B') {
+            throw std::runtime_error("Invalid byte rate \"" + str + "\".");
+        }
+        ++index;
+        if (index < str.length() && (str[index] == 'B' || str[index] == 'b') && suffix != 'B') {    // Allow "20M" and "20MB".
+            ++index;
+        }
+    }
+    if (index != str.length() || !std::isfinite(value) || value <= 0.0) {
+        throw std::runtime_error("Invalid byte rate \"" + str + "\".");
+    }
+    return value * multiplier;
+}
+
+IoPriority IoThrottle::parseIoPriority(const std::string& str) {
+    IoPriority priority;
+    if (str == "idle") {
+        priority = IoPriority::Idle;
+    } else if (str == "best-effort") {
+        priority = IoPriority::BestEffort;
+    } else {
+        throw std::runtime_error("Value for \"io-priority\" must be idle or best-effort.");
+    }
+    #ifdef __linux__
+    return priority;
+    #else
+    (void)priority;
+    throw std::runtime_error("Setting the I/O priority is only supported on Linux.");
+    #endif
+}
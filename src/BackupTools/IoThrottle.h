@@ -0,0 +1,128 @@
+#ifndef IO_THROTTLE_H_
+#define IO_THROTTLE_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/**
+ * I/O scheduling class to run a backup or check with (Linux only). Unchanged
+ * leaves the class of the process as it is.
+ */
+enum class IoPriority {
+    Unchanged, BestEffort, Idle
+};
+
+/**
+ * Token bucket used to limit the rate of some quantity (bytes, operations,
+ * etc.) per second. Tokens refill continuously up to a small burst size, and
+ * acquire() blocks the caller until enough tokens are available. A rate of
+ * zero means unlimited. Safe to share between threads.
+ */
+class RateLimiter {
+public:
+    RateLimiter(double ratePerSecond = 0.0);
+    
+    bool isLimited() const { return ratePerSecond_ > 0.0; }
+    
+    /**
+     * Takes the given number of tokens, sleeping if the bucket does not have
+     * enough. Requests larger than the bucket are allowed and put the bucket
+     * into debt, so later calls wait for it to be paid back.
+     */
+    void acquire(double numTokens);
+    
+private:
+    double ratePerSecond_;
+    double capacity_;
+    double tokens_;
+    std::chrono::steady_clock::time_point lastRefill_;
+    std::mutex mutex_;
+};
+
+/**
+ * Limits for disk bandwidth and IOPS shared by the comparison of files, the
+ * copying of files, and the scanning of directories. The read and write
+ * functions also count as one operation towards the IOPS limit. When backups
+ * of multiple configs run at once, the throttle is shared between them and can
+ * also limit how many files are being compared or copied at the same time.
+ */
+class IoThrottle {
+public:
+    /**
+     * Holds one of the concurrent I/O slots while in scope, waiting for one to
+     * become free first. Does nothing if the throttle is nullptr or has no
+     * concurrency limit. Must not be nested in the same thread.
+     */
+    class IoSlot {
+    public:
+        IoSlot(IoThrottle* ioThrottle);
+        ~IoSlot();
+        IoSlot(const IoSlot&) = delete;
+        IoSlot& operator=(const IoSlot&) = delete;
+        
+    private:
+        IoThrottle* ioThrottle_;
+    };
+    
+    /**
+     * Sets the I/O priority of the calling thread while in scope (threads it
+     * starts in the meantime inherit it), then puts back the previous one.
+     * Does nothing for IoPriority::Unchanged. Throws std::system_error if the
+     * priority cannot be set.
+     */
+    class PriorityScope {
+    public:
+        PriorityScope(IoPriority priority);
+        ~PriorityScope();
+        PriorityScope(const PriorityScope&) = delete;
+        PriorityScope& operator=(const PriorityScope&) = delete;
+        
+    private:
+        int previousPriority_;    // Negative if nothing was changed.
+    };
+    
+    /**
+     * Rates are given in bytes per second and operations per second, use zero
+     * for no limit. The maxConcurrentIo is the number of files that can be
+     * compared or copied at once (see IoSlot), also zero for no limit.
+     */
+    IoThrottle(double maxReadRate, double maxWriteRate, double maxIops, unsigned int maxConcurrentIo = 0);
+    
+    /**
+     * Returns true if any of the rate limits are set.
+     */
+    bool isLimited() const;
+    
+    bool hasConcurrencyLimit() const { return maxConcurrentIo_ > 0; }
+    
+    void acquireRead(uintmax_t numBytes);
+    void acquireWrite(uintmax_t numBytes);
+    void acquireOps(unsigned int numOps);
+    
+    /**
+     * Parses a byte rate like "500K", "20M", or "1.5G" (binary multiples). A
+     * number without a suffix is in bytes. The rate must be above zero.
+     */
+    static double parseByteRate(const std::string& str);
+    
+    /**
+     * Converts one of "idle" or "best-effort" to the priority. Throws
+     * std::runtime_error if setting the priority is not supported on this
+     * system.
+     */
+    static IoPriority parseIoPriority(const std::string& str);
+    
+private:
+    RateLimiter readLimiter_;
+    RateLimiter writeLimiter_;
+    RateLimiter opsLimiter_;
+    unsigned int maxConcurrentIo_;
+    unsigned int numActiveIo_;
+    std::mutex ioSlotMutex_;
+    std::condition_variable ioSlotFreed_;
+};
+
+#endif
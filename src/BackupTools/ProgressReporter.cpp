@@ -0,0 +1,111 @@
+#include "BackupTools/ProgressReporter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+ProgressOutput ProgressReporter::detectOutput() {
+    #ifdef _WIN32
+        const bool terminal = (_isatty(_fileno(stdout)) != 0);
+    #else
+        const bool terminal = (isatty(fileno(stdout)) != 0);
+    #endif
+    return (terminal ? ProgressOutput::Terminal : ProgressOutput::Log);
+}
+
+ProgressReporter::ProgressReporter(ProgressOutput output, const std::string& label, size_t total, size_t initialCount, double maxRedrawsPerSecond) :
+    output_(output),
+    label_(label),
+    total_(total),
+    count_(initialCount),
+    redrawInterval_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / std::max(maxRedrawsPerSecond, 0.01)))),
+    stopping_(false),
+    spinnerIndex_(0) {
+        
+    if (output_ == ProgressOutput::None) {
+        return;
+    } else if (output_ == ProgressOutput::Terminal && total_ > 0) {
+        std::cout << "\n\n" << std::flush;    // Space for the bar and the message line, draw() moves the cursor back up to these.
+    }
+    thread_ = std::thread(&ProgressReporter::run, this);
+}
+
+ProgressReporter::~ProgressReporter() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    stopRequested_.notify_one();
+    thread_.join();
+    try {
+        draw(true);
+    } catch (...) {}
+}
+
+void ProgressReporter::setMessage(const std::string& message) {
+    if (output_ != ProgressOutput::Terminal || total_ == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    message_ = message;
+}
+
+void ProgressReporter::run() {
+    const std::chrono::steady_clock::duration interval = (output_ == ProgressOutput::Terminal ? redrawInterval_ : std::chrono::steady_clock::duration(LOG_INTERVAL));
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopRequested_.wait_for(lock, interval, [this]() { return stopping_; })) {
+        lock.unlock();    // Workers can keep setting the message while the terminal is slow to take the output.
+        draw(false);
+        lock.lock();
+    }
+}
+
+void ProgressReporter::draw(bool final) {
+    constexpr char spinnerStr[] = "|/-\\";
+    constexpr int MAX_BAR_SIZE = 80;
+    const size_t count = getCount();
+    drawBuffer_.clear();
+    
+    if (total_ == 0) {
+        if (output_ == ProgressOutput::Log) {
+            if (!final) {
+                drawBuffer_ += std::to_string(count) + " " + label_ + ".\n";
+            }
+        } else if (final) {
+            drawBuffer_ += "\r\033[2K";    // Clear the spinner line.
+        } else {
+            spinnerIndex_ = (spinnerIndex_ + 1) % 4;
+            drawBuffer_ += spinnerStr[spinnerIndex_];
+            drawBuffer_ += " " + std::to_string(count) + " " + label_ + "\r";    // Cursor goes back to the start so that other output overwrites this.
+        }
+    } else {
+        const double fraction = std::min(static_cast<double>(count) / static_cast<double>(total_), 1.0);
+        std::string percent = std::to_string(std::lround(fraction * 100.0)) + "%";
+        if (output_ == ProgressOutput::Log) {
+            drawBuffer_ += std::to_string(count) + " of " + std::to_string(total_) + " " + label_ + " (" + percent + ").\n";
+        } else {
+            const int barLength = static_cast<int>(std::lround(fraction * MAX_BAR_SIZE));
+            percent.resize(std::max<size_t>(percent.length(), 4), ' ');
+            drawBuffer_ += "\033[2A";    // Move cursor up by 2.
+            drawBuffer_ += percent + "[" + std::string(std::max(barLength - 1, 0), '=') + ">" + std::string(MAX_BAR_SIZE - std::max(barLength, 1), ' ') + "]\n";
+            drawBuffer_ += "\033[2K";    // Clear line.
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                drawBuffer_ += message_;
+            }
+            drawBuffer_ += '\n';
+        }
+    }
+    if (!drawBuffer_.empty()) {
+        std::cout << drawBuffer_ << std::flush;
+    }
+}
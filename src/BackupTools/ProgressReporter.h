@@ -0,0 +1,86 @@
+#ifndef PROGRESS_REPORTER_H_
+#define PROGRESS_REPORTER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * How the progress gets displayed. Terminal redraws a spinner or bar in place
+ * with escape codes, Log prints a plain line every so often (for output that
+ * goes to a file or pipe), and None shows nothing.
+ */
+enum class ProgressOutput {
+    Terminal, Log, None
+};
+
+/**
+ * Shows the progress of a long running task from a separate thread, so that
+ * the workers only need to update an atomic counter. The display is redrawn at
+ * a limited rate with a single write to std::cout, no matter how fast the
+ * counter changes.
+ *
+ * With a total of zero a spinner and the count are shown (for scans where the
+ * number of items is not known), otherwise a progress bar with the latest
+ * message below it. The final state is drawn when the reporter is destroyed.
+ */
+class ProgressReporter {
+public:
+    /**
+     * Returns Terminal if standard output is an interactive terminal, or Log
+     * otherwise.
+     */
+    static ProgressOutput detectOutput();
+    
+    /**
+     * The label is used in the log lines, like "Scanned" or "Completed". The
+     * count starts at initialCount (for resuming a task).
+     */
+    ProgressReporter(ProgressOutput output, const std::string& label, size_t total = 0, size_t initialCount = 0, double maxRedrawsPerSecond = DEFAULT_REDRAW_RATE);
+    ~ProgressReporter();
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+    
+    /**
+     * Adds to the count, safe to call from any thread.
+     */
+    void add(size_t n = 1) { count_.fetch_add(n, std::memory_order_relaxed); }
+    
+    size_t getCount() const { return count_.load(std::memory_order_relaxed); }
+    
+    /**
+     * Sets the message shown below the progress bar (only the latest one gets
+     * displayed). Does nothing if there is no bar.
+     */
+    void setMessage(const std::string& message);
+    
+private:
+    static constexpr double DEFAULT_REDRAW_RATE = 10.0;
+    static constexpr std::chrono::seconds LOG_INTERVAL = std::chrono::seconds(10);
+    
+    ProgressOutput output_;
+    std::string label_;
+    size_t total_;
+    std::atomic<size_t> count_;
+    std::chrono::steady_clock::duration redrawInterval_;
+    std::string message_;
+    bool stopping_;
+    std::mutex mutex_;
+    std::condition_variable stopRequested_;
+    std::thread thread_;
+    int spinnerIndex_;
+    std::string drawBuffer_;
+    
+    void run();
+    
+    /**
+     * Writes the current state, the final draw also clears the spinner.
+     */
+    void draw(bool final);
+};
+
+#endif
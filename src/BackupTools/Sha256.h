@@ -0,0 +1,58 @@
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Incremental SHA-256 hash (FIPS 180-4). Used for the content digests of
+ * chunks and files in the chunk store.
+ */
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+    
+    Sha256();
+    
+    /**
+     * Adds more data to the hash.
+     */
+    void update(const void* data, size_t size);
+    
+    /**
+     * Finishes the hash and returns the digest. The object is reset afterwards
+     * so it can be used for another hash.
+     */
+    Digest finish();
+    
+    /**
+     * Returns the digest of a single block of data.
+     */
+    static Digest hash(const void* data, size_t size);
+    
+    /**
+     * Converts the digest to a lowercase hex string.
+     */
+    static std::string toHex(const Digest& digest);
+    
+private:
+    uint32_t state_[8];
+    uint8_t buffer_[64];
+    size_t bufferSize_;
+    uint64_t totalSize_;
+    
+    void reset();
+    void processBlock(const uint8_t* block);
+};
+
+/**
+ * Hash function for using a digest as a key in unordered containers (the
+ * digest is already uniformly distributed, so the first bytes are enough).
+ */
+struct DigestHash {
+    size_t operator()(const Sha256::Digest& digest) const;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "BackupTools/Stats.h"
+#include <iomanip>
+
+std::atomic<bool> Stats::enabled_(false);
+std::atomic<uint64_t> Stats::counters_[NumCounters];
+std::atomic<int64_t> Stats::phaseTimes_[NumPhases];
+std::chrono::steady_clock::time_point Stats::startTime_;
+std::chrono::steady_clock::time_point Stats::stopTime_;
+std::thread::id Stats::ownerThread_;
+std::atomic<int64_t> Stats::ownerPhaseTime_(0);
+thread_local Stats::ScopedTimer* Stats::currentTimer_ = nullptr;
+
+constexpr const char* COUNTER_NAMES[][2] = {    // The names for the table and for JSON.
+    {"Bytes read", "bytes_read"},
+    {"Bytes written", "bytes_written"},
+    {"Files compared", "files_compared"},
+    {"Cache hits", "cache_hits"},
+    {"Cache misses", "cache_misses"},
+    {"Directories listed", "directories_listed"},
+    {"Directories reused", "directories_reused"},
+    {"Syscalls (approx.)", "syscalls"}
+};
+constexpr const char* PHASE_NAMES[][2] = {
+    {"Parse cache", "parse_cache"},
+    {"Parse config", "parse_config"},
+    {"Scan sources", "scan_sources"},
+    {"List destinations", "list_destinations"},
+    {"Compare files", "compare_files"},
+    {"Detect renames", "detect_renames"},
+    {"Save cache", "save_cache"},
+    {"File operations", "file_operations"}
+};
+static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]) == Stats::NumCounters, "Missing counter name.");
+static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) == Stats::NumPhases, "Missing phase name.");
+
+Stats::ScopedTimer::ScopedTimer(Phase phase) :
+    phase_(phase),
+    running_(isEnabled()),
+    parent_(nullptr) {
+        
+    if (!running_) {
+        return;
+    }
+    startTime_ = std::chrono::steady_clock::now();
+    parent_ = currentTimer_;
+    if (parent_ != nullptr) {    // Pause the outer timer.
+        parent_->addElapsed(startTime_);
+    }
+    currentTimer_ = this;
+}
+
+Stats::ScopedTimer::~ScopedTimer() {
+    if (!running_) {
+        return;
+    }
+    const std::chrono::steady_clock::time_point currTime = std::chrono::steady_clock::now();
+    addElapsed(currTime);
+    currentTimer_ = parent_;
+    if (parent_ != nullptr) {
+        parent_->startTime_ = currTime;
+    }
+}
+
+void Stats::ScopedTimer::addElapsed(std::chrono::steady_clock::time_point currTime) {
+    const int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(currTime - startTime_).count();
+    phaseTimes_[phase_].fetch_add(elapsed, std::memory_order_relaxed);
+    if (std::this_thread::get_id() == ownerThread_) {
+        ownerPhaseTime_.fetch_add(elapsed, std::memory_order_relaxed);
+    }
+    startTime_ = currTime;
+}
+
+Stats::ScopedEnable::ScopedEnable(bool enabled) :
+    enabled_(enabled) {
+        
+    if (enabled_) {
+        setEnabled(true);
+    }
+}
+
+Stats::ScopedEnable::~ScopedEnable() {
+    if (enabled_) {
+        setEnabled(false);
+    }
+}
+
+void Stats::setEnabled(bool enabled) {
+    if (enabled) {
+        for (auto& counter : counters_) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+        for (auto& phaseTime : phaseTimes_) {
+            phaseTime.store(0, std::memory_order_relaxed);
+        }
+        ownerPhaseTime_.store(0, std::memory_order_relaxed);
+        ownerThread_ = std::this_thread::get_id();
+        startTime_ = std::chrono::steady_clock::now();
+    } else if (isEnabled()) {
+        stopTime_ = std::chrono::steady_clock::now();
+    }
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Stats::print(std::ostream& out, bool json) {
+    const double totalSeconds = std::chrono::duration<double>((isEnabled() ? std::chrono::steady_clock::now() : stopTime_) - startTime_).count();
+    double otherSeconds = totalSeconds - std::chrono::duration<double>(std::chrono::nanoseconds(ownerPhaseTime_.load(std::memory_order_relaxed))).count();
+    double phaseSeconds[NumPhases];
+    for (int i = 0; i < NumPhases; ++i) {
+        phaseSeconds[i] = std::chrono::duration<double>(getTime(static_cast<Phase>(i))).count();
+    }
+    if (otherSeconds < 0.0) {    // Only from rounding, the phases of one thread never overlap.
+        otherSeconds = 0.0;
+    }
+    
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(6);
+    if (json) {
+        out << "{\"phases\":{";
+        for (int i = 0; i < NumPhases; ++i) {
+            out << "\"" << PHASE_NAMES[i][1] << "\":" << phaseSeconds[i] << ",";
+        }
+        out << "\"other\":" << otherSeconds << ",\"total\":" << totalSeconds << "},\"counters\":{";
+        for (int i = 0; i < NumCounters; ++i) {
+            out << (i > 0 ? "," : "") << "\"" << COUNTER_NAMES[i][1] << "\":" << get(static_cast<Counter>(i));
+        }
+        out << "}}\n";
+    } else {
+        auto printPhase = [&](const char* name, double seconds) {
+            out << "    " << std::left << std::setw(20) << name << std::right << std::setprecision(3) << std::setw(10) << seconds << "s";
+            out << std::setprecision(1) << std::setw(7) << (totalSeconds > 0.0 ? seconds / totalSeconds * 100.0 : 0.0) << "%\n";
+        };
+        out << "Stats:\n";
+        for (int i = 0; i < NumPhases; ++i) {
+            printPhase(PHASE_NAMES[i][0], phaseSeconds[i]);
+        }
+        printPhase("Other", otherSeconds);
+        printPhase("Total", totalSeconds);
+        out << "\n";
+        for (int i = 0; i < NumCounters; ++i) {
+            out << "    " << std::left << std::setw(20) << COUNTER_NAMES[i][0] << std::right << std::setw(11) << get(static_cast<Counter>(i)) << "\n";
+        }
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,119 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+
+/**
+ * Timers and counters for the phases of a check or backup, reported with the
+ * "--stats" option. Collection is off by default, and while disabled each
+ * timer and counter only checks a flag. Counters are atomic so they can be
+ * updated from any thread.
+ *
+ * Phase times are exclusive: a timer started while another one is running on
+ * the same thread pauses the outer one (for example, the file compares done
+ * during rename detection count towards CompareFiles). Each thread times its
+ * own phases and the times of all threads are added up, so when work runs in
+ * parallel (backups of multiple configs) the phases can add up to more than
+ * the total. The copies made during the scan of a forced backup are not timed
+ * for this reason. The time not covered
+ * by any phase on the thread that enabled collection is reported as "other".
+ */
+class Stats {
+public:
+    enum Counter {
+        BytesRead,
+        BytesWritten,
+        FilesCompared,    // Binary scans, each destination compared against a source counts once.
+        CacheHits,
+        CacheMisses,
+        DirectoriesListed,
+        DirectoriesReused,    // Listings reused from the TreeState.
+        Syscalls,    // Approximate, counts the calls for file I/O (opens, reads, syncs, renames, and directory listings).
+        NumCounters
+    };
+    
+    enum Phase {
+        ParseCache,
+        ParseConfig,    // Reading the config and compiling it (or loading the saved plan).
+        ScanSources,    // Globbing the source paths.
+        ListDestinations,
+        CompareFiles,
+        DetectRenames,
+        SaveCache,
+        FileOperations,
+        NumPhases
+    };
+    
+    /**
+     * Adds the time until destruction to a phase.
+     */
+    class ScopedTimer {
+    public:
+        ScopedTimer(Phase phase);
+        ~ScopedTimer();
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+        
+    private:
+        Phase phase_;
+        bool running_;
+        ScopedTimer* parent_;
+        std::chrono::steady_clock::time_point startTime_;
+        
+        void addElapsed(std::chrono::steady_clock::time_point currTime);
+    };
+    
+    /**
+     * Enables collection while in scope if enabled is set, and disables it
+     * again when done (even if an exception is thrown). The results can still
+     * be read afterwards.
+     */
+    class ScopedEnable {
+    public:
+        ScopedEnable(bool enabled);
+        ~ScopedEnable();
+        ScopedEnable(const ScopedEnable&) = delete;
+        ScopedEnable& operator=(const ScopedEnable&) = delete;
+        
+    private:
+        bool enabled_;
+    };
+    
+    /**
+     * Enables or disables collection. Enabling also clears the previous
+     * results, starts the total time, and makes the calling thread the one
+     * that "other" is measured for.
+     */
+    static void setEnabled(bool enabled);
+    static bool isEnabled() { return enabled_.load(std::memory_order_relaxed); }
+    
+    static void add(Counter counter, uint64_t amount = 1) {
+        if (isEnabled()) {
+            counters_[counter].fetch_add(amount, std::memory_order_relaxed);
+        }
+    }
+    static uint64_t get(Counter counter) { return counters_[counter].load(std::memory_order_relaxed); }
+    static std::chrono::nanoseconds getTime(Phase phase) { return std::chrono::nanoseconds(phaseTimes_[phase].load(std::memory_order_relaxed)); }
+    
+    /**
+     * Writes the totals as a table, or as a single JSON object if json is
+     * set.
+     */
+    static void print(std::ostream& out, bool json);
+    
+private:
+    static std::atomic<bool> enabled_;
+    static std::atomic<uint64_t> counters_[NumCounters];
+    static std::atomic<int64_t> phaseTimes_[NumPhases];
+    static std::chrono::steady_clock::time_point startTime_;
+    static std::chrono::steady_clock::time_point stopTime_;
+    static std::thread::id ownerThread_;
+    static std::atomic<int64_t> ownerPhaseTime_;    // Time covered by the phases of ownerThread_.
+    static thread_local ScopedTimer* currentTimer_;
+};
+
+#endif
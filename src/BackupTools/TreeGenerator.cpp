@@ -0,0 +1,192 @@
+#include "BackupTools/TreeGenerator.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+constexpr size_t MAX_RECENT_FILES = 1024;
+constexpr const char* FILE_EXTENSIONS[] = {".txt", ".dat", ".jpg", ".cpp", ".log"};
+constexpr size_t NUM_FILE_EXTENSIONS = sizeof(FILE_EXTENSIONS) / sizeof(FILE_EXTENSIONS[0]);
+
+uintmax_t TreeGenerator::countFiles(const Options& options) {
+    uintmax_t numDirectories = 1, levelDirectories = 1;
+    for (int i = 0; i < options.depth; ++i) {
+        levelDirectories *= static_cast<uintmax_t>(options.fanOut);
+        numDirectories += levelDirectories;
+    }
+    return numDirectories * static_cast<uintmax_t>(options.filesPerDirectory);
+}
+
+TreeGenerator::TreeGenerator(uint64_t seed) :
+    rng_(seed),
+    contentPool_(CONTENT_POOL_SIZE) {
+        
+    for (size_t i = 0; i < CONTENT_POOL_SIZE; i += 8) {
+        const uint64_t value = rng_();
+        for (size_t j = 0; j < 8; ++j) {
+            contentPool_[i + j] = static_cast<char>(value >> (j * 8));
+        }
+    }
+}
+
+TreeGenerator::Totals TreeGenerator::generate(const fs::path& root, const Options& options) {
+    Totals totals;
+    fs::create_directories(root);
+    std::vector<std::pair<fs::path, int>> directoryStack = {{root, 0}};    // Directories to fill and their level.
+    while (!directoryStack.empty()) {
+        const auto [directory, level] = std::move(directoryStack.back());
+        directoryStack.pop_back();
+        for (int i = 0; i < options.filesPerDirectory; ++i) {
+            writeNewFile(directory / makeName("file" + std::to_string(i) + FILE_EXTENSIONS[i % NUM_FILE_EXTENSIONS], options), options, totals);
+        }
+        if (level < options.depth) {
+            for (int i = options.fanOut - 1; i >= 0; --i) {    // Reverse order so that the first directory gets filled next.
+                fs::path subdirectory = directory / makeName("dir" + std::to_string(i), options);
+                fs::create_directory(subdirectory);
+                ++totals.numDirectories;
+                directoryStack.emplace_back(std::move(subdirectory), level + 1);
+            }
+        }
+    }
+    return totals;
+}
+
+TreeGenerator::Totals TreeGenerator::mutate(const fs::path& root, const Mutations& mutations, const Options& options) {
+    std::vector<fs::path> files, directories = {root};
+    for (const auto& entry : fs::recursive_directory_iterator(root)) {
+        if (entry.is_symlink()) {
+            continue;
+        } else if (entry.is_directory()) {
+            directories.push_back(entry.path());
+        } else if (entry.is_regular_file()) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());    // The iteration order depends on the filesystem.
+    std::sort(directories.begin(), directories.end());
+    
+    const size_t numChanged = std::min(mutations.numDeletes + mutations.numModifies + mutations.numRenames, files.size());
+    for (size_t i = 0; i < numChanged; ++i) {    // Pick distinct files with a partial shuffle.
+        std::swap(files[i], files[i + nextBelow(files.size() - i)]);
+    }
+    
+    Totals totals;
+    size_t fileIndex = 0;
+    for (size_t i = 0; i < mutations.numDeletes && fileIndex < numChanged; ++i, ++fileIndex) {
+        fs::remove(files[fileIndex]);
+    }
+    for (size_t i = 0; i < mutations.numModifies && fileIndex < numChanged; ++i, ++fileIndex) {    // Same size, so only a binary compare finds the change.
+        const uintmax_t size = fs::file_size(files[fileIndex]);
+        writeContent(files[fileIndex], rng_(), size);
+        ++totals.numFiles;
+        totals.numBytes += size;
+    }
+    for (size_t i = 0; i < mutations.numRenames && fileIndex < numChanged; ++i, ++fileIndex) {
+        const fs::path& directory = directories[nextBelow(directories.size())];
+        fs::rename(files[fileIndex], directory / makeName("renamed" + std::to_string(rng_()) + files[fileIndex].extension().string(), options));
+    }
+    for (size_t i = 0; i < mutations.numAdds; ++i) {
+        const fs::path& directory = directories[nextBelow(directories.size())];
+        writeNewFile(directory / makeName("added" + std::to_string(rng_()) + FILE_EXTENSIONS[i % NUM_FILE_EXTENSIONS], options), options, totals);
+    }
+    return totals;
+}
+
+uint64_t TreeGenerator::nextBelow(uint64_t n) {
+    return rng_() % n;    // The bias is negligible for the sizes used here.
+}
+
+double TreeGenerator::nextUnit() {
+    return static_cast<double>(rng_() >> 11) * (1.0 / 9007199254740992.0);    // Top 53 bits divided by 2^53.
+}
+
+/**
+ * Divides value by 2^bits, rounding towards negative infinity.
+ */
+int64_t shiftRightFloor(int64_t value, int bits) {
+    return (value >= 0 ? value >> bits : -((-value + (int64_t(1) << bits) - 1) >> bits));
+}
+
+uintmax_t TreeGenerator::nextFileSize(const Options& options) {
+    constexpr int FRACTION_BITS = 16;    // Fixed-point values below have 16 fractional bits.
+    constexpr int64_t ONE = int64_t(1) << FRACTION_BITS;
+    constexpr int64_t LOG2_E = 94548;    // log2(e)
+    constexpr int64_t EXP2_COEFFICIENTS[] = {45426, 15744, 3638, 630, 87};    // ln(2)^n / n! for the series of 2^x.
+    
+    int64_t normal = -6 * ONE;    // The sum of 12 uniform values in [0, 1) minus 6 has a mean of 0 and variance of 1.
+    for (int i = 0; i < 3; ++i) {
+        const uint64_t value = rng_();
+        for (int j = 0; j < 4; ++j) {
+            normal += static_cast<int64_t>((value >> (j * 16)) & 0xffff);
+        }
+    }
+    const int64_t sigma = static_cast<int64_t>(options.fileSizeSigma * static_cast<double>(ONE) + 0.5);
+    const int64_t exponent = shiftRightFloor(shiftRightFloor(sigma * normal, FRACTION_BITS) * LOG2_E, FRACTION_BITS);    // The power of 2 to scale by.
+    const int64_t fraction = exponent & (ONE - 1);
+    int shift = static_cast<int>(shiftRightFloor(exponent, FRACTION_BITS)) - FRACTION_BITS;
+    
+    int64_t scale = 0;    // 2^fraction, from the series evaluated with Horner's method.
+    for (int i = 4; i >= 0; --i) {
+        scale = ((EXP2_COEFFICIENTS[i] + scale) * fraction) >> FRACTION_BITS;
+    }
+    scale += ONE;
+    
+    uintmax_t size = options.medianFileSize * static_cast<uintmax_t>(scale);
+    if (shift >= 0) {
+        if (shift >= 32 || size > (options.maxFileSize >> shift)) {    // Too big anyways, this also avoids an overflow.
+            return options.maxFileSize;
+        }
+        size <<= shift;
+    } else {
+        shift = -shift;
+        size = (shift >= 64 ? 0 : (size + (uintmax_t(1) << (shift - 1))) >> shift);    // Round to nearest.
+    }
+    return std::min(size, options.maxFileSize);
+}
+
+std::string TreeGenerator::makeName(const std::string& base, const Options& options) {
+    return (nextUnit() < options.hiddenRatio ? "." + base : base);
+}
+
+void TreeGenerator::writeNewFile(const fs::path& filename, const Options& options, Totals& totals) {
+    std::pair<uint64_t, uintmax_t> content;
+    if (nextUnit() < options.duplicateRatio && !recentFiles_.empty()) {
+        content = recentFiles_[nextBelow(recentFiles_.size())];
+        ++totals.numDuplicates;
+    } else {
+        content = {rng_(), nextFileSize(options)};
+        if (recentFiles_.size() < MAX_RECENT_FILES) {
+            recentFiles_.push_back(content);
+        } else {
+            recentFiles_[nextBelow(MAX_RECENT_FILES)] = content;
+        }
+    }
+    writeContent(filename, content.first, content.second);
+    ++totals.numFiles;
+    totals.numBytes += content.second;
+}
+
+void TreeGenerator::writeContent(const fs::path& filename, uint64_t contentId, uintmax_t size) {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("\"" + filename.string() + "\": Unable to open file for writing.");
+    }
+    char header[8];    // The content id makes files of the same size differ right away.
+    for (size_t i = 0; i < sizeof(header); ++i) {
+        header[i] = static_cast<char>(contentId >> (i * 8));
+    }
+    const size_t headerSize = static_cast<size_t>(std::min<uintmax_t>(size, sizeof(header)));
+    file.write(header, static_cast<std::streamsize>(headerSize));
+    uintmax_t remaining = size - headerSize;
+    size_t offset = static_cast<size_t>(contentId % CONTENT_POOL_SIZE);
+    while (remaining > 0) {
+        const size_t chunkSize = static_cast<size_t>(std::min<uintmax_t>(remaining, CONTENT_POOL_SIZE - offset));
+        file.write(contentPool_.data() + offset, static_cast<std::streamsize>(chunkSize));
+        remaining -= chunkSize;
+        offset = 0;
+    }
+    file.close();
+    if (!file) {
+        throw std::runtime_error("\"" + filename.string() + "\": Failed to write file.");
+    }
+}
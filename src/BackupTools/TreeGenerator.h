@@ -0,0 +1,116 @@
+#ifndef TREE_GENERATOR_H_
+#define TREE_GENERATOR_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * Generates synthetic file trees for scale testing. The same seed and options
+ * always give the same tree. All randomness comes from std::mt19937_64 (which
+ * has a fixed output sequence), and the conversions to sizes and choices are
+ * done here instead of with the standard library distributions, which differ
+ * between implementations. File sizes are computed with integer math only, so
+ * they also do not depend on the std::log() and std::exp() of the platform.
+ * Only used by the tests and benchmarks, this is not part of backup_tools_lib.
+ */
+class TreeGenerator {
+public:
+    struct Options {
+        int depth;    // Levels of directories below the root.
+        int fanOut;    // Sub-directories in each directory.
+        int filesPerDirectory;
+        uintmax_t medianFileSize;    // File sizes follow an approximate log-normal distribution.
+        double fileSizeSigma;    // Spread of the file sizes, zero gives every file the median size.
+        uintmax_t maxFileSize;
+        double hiddenRatio;    // Fraction of files and directories with a name starting with a dot.
+        double duplicateRatio;    // Fraction of files that are a copy of an earlier file.
+        
+        Options() : depth(3), fanOut(8), filesPerDirectory(16), medianFileSize(4096), fileSizeSigma(1.5), maxFileSize(64 * 1024 * 1024), hiddenRatio(0.05), duplicateRatio(0.05) {}
+    };
+    
+    /**
+     * Number of each change made by mutate().
+     */
+    struct Mutations {
+        size_t numAdds;
+        size_t numDeletes;
+        size_t numModifies;
+        size_t numRenames;
+        
+        Mutations() : numAdds(0), numDeletes(0), numModifies(0), numRenames(0) {}
+    };
+    
+    struct Totals {
+        size_t numDirectories;
+        size_t numFiles;
+        uintmax_t numBytes;
+        size_t numDuplicates;
+        
+        Totals() : numDirectories(0), numFiles(0), numBytes(0), numDuplicates(0) {}
+    };
+    
+    /**
+     * Returns the number of files that generate() creates for the options.
+     */
+    static uintmax_t countFiles(const Options& options);
+    
+    TreeGenerator(uint64_t seed);
+    
+    /**
+     * Creates the tree inside root (which is created if needed, and should be
+     * empty). Throws std::runtime_error if a file cannot be written.
+     */
+    Totals generate(const fs::path& root, const Options& options);
+    
+    /**
+     * Changes an existing tree: deletes, modifies (same size, new contents),
+     * and renames (possibly to another directory) distinct existing files, and
+     * adds new files to random directories. The options give the size and
+     * hidden ratio of the new files. Fewer changes are made if there are not
+     * enough files. Returns the totals of the new and modified files.
+     */
+    Totals mutate(const fs::path& root, const Mutations& mutations, const Options& options);
+    
+private:
+    static constexpr size_t CONTENT_POOL_SIZE = 1024 * 1024;
+    
+    std::mt19937_64 rng_;
+    std::vector<char> contentPool_;    // Random bytes that file contents are taken from.
+    std::vector<std::pair<uint64_t, uintmax_t>> recentFiles_;    // Content id and size of recently written files, duplicates copy one of these.
+    
+    /**
+     * Returns a number in [0, n), n must not be zero.
+     */
+    uint64_t nextBelow(uint64_t n);
+    
+    /**
+     * Returns a number in [0, 1).
+     */
+    double nextUnit();
+    
+    /**
+     * Returns the median size times e^(sigma * n), where n is close to a
+     * standard normal distribution (clipped at six standard deviations).
+     */
+    uintmax_t nextFileSize(const Options& options);
+    std::string makeName(const std::string& base, const Options& options);
+    
+    /**
+     * Writes a new file (a duplicate of a recent one if chosen) and adds it to
+     * totals.
+     */
+    void writeNewFile(const fs::path& filename, const Options& options, Totals& totals);
+    
+    /**
+     * Writes the file with contents determined by the contentId, files with the
+     * same contentId and size are identical.
+     */
+    void writeContent(const fs::path& filename, uint64_t contentId, uintmax_t size);
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include "BackupTools/TreeState.h"
+#include "BackupTools/DirectoryWatcher.h"
+#include "BackupTools/Stats.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifndef _WIN32
+    #include <sys/stat.h>
+#endif
+
+constexpr char TREE_STATE_HEADER[] = "BTTREE1\n";
+constexpr uint32_t NO_PARENT_ID = 0xffffffff;
+constexpr int64_t TRUSTED_TIME_MARGIN = 2000000000;    // Nanoseconds, covers filesystems with coarse timestamps (2 seconds for FAT).
+
+template<typename T>
+void writeValue(std::ostream& out, T value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+bool readValue(std::istream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+TreeState::TreeState() :
+    watcher_(nullptr),
+    scanStartTime_(getCurrentTime()),
+    trustedBeforeTime_(0),
+    numListed_(0),
+    numReused_(0) {
+}
+
+bool TreeState::load(const fs::path& filename) {
+    directories_.clear();
+    std::ifstream stateFile(filename, std::ios::binary);
+    char header[sizeof(TREE_STATE_HEADER) - 1];
+    int64_t previousScanTime;
+    if (!stateFile.read(header, sizeof(header)) || !std::equal(header, header + sizeof(header), TREE_STATE_HEADER) || !readValue(stateFile, previousScanTime)) {
+        return false;
+    }
+    
+    std::vector<const std::string*> pathIds;    // Each directory is stored with the id of its parent to keep the file small.
+    std::string name, entryName;
+    uint32_t parentId, numEntries;
+    while (readValue(stateFile, parentId)) {
+        DirectoryState state;
+        if (!std::getline(stateFile, name, '\0') || !readValue(stateFile, state.writeTime) || !readValue(stateFile, state.inode) || !readValue(stateFile, numEntries)) {
+            directories_.clear();
+            return false;
+        }
+        state.valid = true;
+        state.entries.reserve(numEntries);
+        for (uint32_t i = 0; i < numEntries; ++i) {
+            char type;
+            if (!stateFile.get(type) || !std::getline(stateFile, entryName, '\0')) {
+                directories_.clear();
+                return false;
+            }
+            state.entries.push_back({entryName, static_cast<EntryType>(type)});
+        }
+        
+        if (parentId != NO_PARENT_ID) {
+            if (parentId >= pathIds.size()) {
+                directories_.clear();
+                return false;
+            }
+            name = (fs::path(*pathIds[parentId]) / name).string();
+        }
+        auto insertResult = directories_.emplace(name, std::move(state));
+        pathIds.push_back(&insertResult.first->first);
+    }
+    
+    trustedBeforeTime_ = previousScanTime - TRUSTED_TIME_MARGIN;
+    return true;
+}
+
+void TreeState::startScan() {
+    trustedBeforeTime_ = scanStartTime_ - TRUSTED_TIME_MARGIN;
+    scanStartTime_ = getCurrentTime();
+    numListed_ = 0;
+    numReused_ = 0;
+    for (auto& p : directories_) {
+        p.second.used = false;
+    }
+}
+
+void TreeState::setWatcher(DirectoryWatcher* watcher) {
+    watcher_ = watcher;
+}
+
+void TreeState::save(const fs::path& filename) const {
+    std::vector<std::pair<fs::path, const DirectoryState*>> sortedDirectories;
+    for (const auto& p : directories_) {
+        if (p.second.valid && p.second.used) {
+            sortedDirectories.emplace_back(p.first, &p.second);
+        }
+    }
+    std::sort(sortedDirectories.begin(), sortedDirectories.end(), [](const auto& lhs, const auto& rhs) {    // Parents come before their children.
+        return lhs.first < rhs.first;
+    });
+    
+    fs::path tempFilename = filename;    // Write to a temporary file first so that a crash can't leave a partial file behind.
+    tempFilename += ".tmp";
+    std::ofstream stateFile(tempFilename, std::ios::binary);
+    if (!stateFile.is_open()) {
+        throw std::runtime_error("\"" + tempFilename.string() + "\": Unable to open file for writing.");
+    }
+    stateFile.write(TREE_STATE_HEADER, sizeof(TREE_STATE_HEADER) - 1);
+    writeValue(stateFile, scanStartTime_);
+    
+    std::unordered_map<std::string, uint32_t> pathIds;
+    for (const auto& p : sortedDirectories) {
+        auto parentIter = pathIds.find(p.first.parent_path().string());
+        if (parentIter != pathIds.end() && p.first.has_relative_path()) {
+            writeValue(stateFile, parentIter->second);
+            stateFile << p.first.filename().string() << '\0';
+        } else {
+            writeValue(stateFile, NO_PARENT_ID);
+            stateFile << p.first.string() << '\0';
+        }
+        writeValue(stateFile, p.second->writeTime);
+        writeValue(stateFile, p.second->inode);
+        writeValue(stateFile, static_cast<uint32_t>(p.second->entries.size()));
+        for (const auto& entry : p.second->entries) {
+            stateFile.put(static_cast<char>(entry.type));
+            stateFile << entry.name << '\0';
+        }
+        pathIds.emplace(p.first.string(), static_cast<uint32_t>(pathIds.size()));
+    }
+    stateFile.close();
+    if (!stateFile) {
+        throw std::runtime_error("\"" + tempFilename.string() + "\": Failed to write tree state.");
+    }
+    fs::rename(tempFilename, filename);
+}
+
+const std::vector<TreeState::Entry>& TreeState::listDirectory(const fs::path& directory) {
+    if (watcher_ != nullptr) {
+        watcher_->addWatch(directory);
+    }
+    int64_t writeTime;
+    uint64_t inode;
+    getDirectoryInfo(directory, writeTime, inode);    // Done before listing, a change made during the listing gives a newer time next scan.
+    DirectoryState& state = directories_[directory.string()];
+    if (state.valid && state.writeTime == writeTime && state.inode == inode && writeTime < trustedBeforeTime_) {
+        state.used = true;
+        ++numReused_;
+        Stats::add(Stats::DirectoriesReused);
+        return state.entries;
+    }
+    
+    state.entries.clear();
+    state.valid = false;    // Only saved for next time if the listing succeeds.
+    Stats::add(Stats::Syscalls, 3);    // Open, read entries, and close.
+    for (const auto& entry : fs::directory_iterator(directory)) {
+        EntryType type = EntryType::Other;
+        if (entry.is_symlink()) {
+            type = EntryType::Symlink;
+        } else if (entry.is_directory()) {
+            type = EntryType::Directory;
+        } else if (entry.is_regular_file()) {
+            type = EntryType::File;
+        }
+        state.entries.push_back({entry.path().filename().string(), type});
+    }
+    state.writeTime = writeTime;
+    state.inode = inode;
+    state.valid = true;
+    state.used = true;
+    ++numListed_;
+    Stats::add(Stats::DirectoriesListed);
+    return state.entries;
+}
+
+void TreeState::getDirectoryInfo(const fs::path& directory, int64_t& writeTime, uint64_t& inode) {
+    #ifndef _WIN32
+    struct stat st;
+    Stats::add(Stats::Syscalls);
+    if (stat(directory.c_str(), &st) != 0) {
+        throw fs::filesystem_error("Unable to get status", directory, std::error_code(errno, std::generic_category()));
+    }
+    #ifdef __APPLE__
+    writeTime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+    #else
+    writeTime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    #endif
+    inode = static_cast<uint64_t>(st.st_ino);
+    #else
+    writeTime = std::chrono::duration_cast<std::chrono::nanoseconds>(fs::last_write_time(directory).time_since_epoch()).count();
+    inode = 0;
+    #endif
+}
+
+int64_t TreeState::getCurrentTime() {
+    #ifndef _WIN32
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    #else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(fs::file_time_type::clock::now().time_since_epoch()).count();
+    #endif
+}
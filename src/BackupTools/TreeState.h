@@ -0,0 +1,98 @@
+#ifndef TREE_STATE_H_
+#define TREE_STATE_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class DirectoryWatcher;
+
+/**
+ * Saved directory listings for incremental checks. Adding, removing, or
+ * renaming an item changes the modification time of the directory it is in,
+ * so a directory with the same modification time (and inode) as last time
+ * still has the same contents and does not need to be listed again. Changes
+ * to the contents of files do not show up in the directory, these are still
+ * found with the write times in the FileHandler cache.
+ *
+ * Directories modified shortly before the previous scan started are always
+ * listed again, a change made within the same timestamp tick as that scan
+ * could otherwise go unnoticed.
+ */
+class TreeState {
+public:
+    enum class EntryType : char {
+        File = 'f', Directory = 'd', Symlink = 'l', Other = 'o'
+    };
+    
+    struct Entry {
+        std::string name;
+        EntryType type;
+    };
+    
+    TreeState();
+    
+    /**
+     * Reads the listings saved from a previous scan. Returns false (and keeps
+     * nothing) if the file is missing or corrupt.
+     */
+    bool load(const fs::path& filename);
+    
+    /**
+     * Writes the listings of the directories used since this object was
+     * created, any others are dropped.
+     */
+    void save(const fs::path& filename) const;
+    
+    /**
+     * Starts another scan with the same listings. The listings from the
+     * previous scan are trusted the same way as ones loaded from a file.
+     */
+    void startScan();
+    
+    /**
+     * Sets a watcher that gets a watch for each directory before it is listed,
+     * so any change made after the listing shows up as an event. Can be
+     * nullptr (the default).
+     */
+    void setWatcher(DirectoryWatcher* watcher);
+    
+    /**
+     * Returns the items in a directory. The saved listing is used if the
+     * directory is unchanged, otherwise it is read again. Throws
+     * fs::filesystem_error if the directory cannot be listed (same as
+     * fs::directory_iterator).
+     */
+    const std::vector<Entry>& listDirectory(const fs::path& directory);
+    
+    size_t getNumListed() const { return numListed_; }
+    size_t getNumReused() const { return numReused_; }
+    
+private:
+    struct DirectoryState {
+        int64_t writeTime = 0;
+        uint64_t inode = 0;
+        bool valid = false;    // Entries are a complete listing of the directory.
+        bool used = false;    // Directory was listed in this scan.
+        std::vector<Entry> entries;
+    };
+    
+    std::unordered_map<std::string, DirectoryState> directories_;
+    DirectoryWatcher* watcher_;
+    int64_t scanStartTime_;
+    int64_t trustedBeforeTime_;
+    size_t numListed_, numReused_;
+    
+    /**
+     * Gets the modification time and inode of a directory (the inode is zero
+     * on systems without them). Times are in nanoseconds.
+     */
+    static void getDirectoryInfo(const fs::path& directory, int64_t& writeTime, uint64_t& inode);
+    static int64_t getCurrentTime();
+};
+
+#endif
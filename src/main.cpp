@@ -1,12 +1,22 @@
 #include "BackupTools/Application.h"
 #include "BackupTools/ArgumentParser.h"
+#include "BackupTools/ChangeWriter.h"
 #include "BackupTools/FileHandler.h"
+#include "BackupTools/FileReader.h"
+#include "BackupTools/IoScheduler.h"
+#include "BackupTools/IoThrottle.h"
+#include "BackupTools/Stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstring>
 #include <filesystem>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #ifdef _WIN32
@@ -16,6 +26,102 @@
 
 namespace fs = std::filesystem;
 
+/**
+ * Arguments shared by the backup, watch, and check commands: "fast-compare",
+ * the throttle arguments, "page-cache", and "io-order". Add these to the
+ * options of the ArgumentParser with addOptions(), pass each option to
+ * parseOption(), then get the BackupOptions from makeOptions(). The rates are
+ * stored for constructing an IoThrottle, and the I/O priority is only applied
+ * by the Application while the command runs.
+ */
+struct BackupArguments {
+    int fastCompare = 0;
+    double maxReadRate = 0.0, maxWriteRate = 0.0, maxIops = 0.0;
+    IoPriority ioPriority = IoPriority::Unchanged;
+    PageCacheMode pageCacheMode = PageCacheMode::DropBehind;
+    IoOrder ioOrder = IoOrder::Name;
+    std::unique_ptr<IoThrottle> ioThrottle;
+    
+    ArgumentParser::OptionList addOptions(ArgumentParser::OptionList options) {
+        options.insert(options.end(), {
+            {'\0', "fast-compare", ArgumentParser::NoArg, &fastCompare, 1},
+            {'\0', "max-read-rate", ArgumentParser::RequiredArg, nullptr, 'r'},
+            {'\0', "max-write-rate", ArgumentParser::RequiredArg, nullptr, 'w'},
+            {'\0', "max-iops", ArgumentParser::RequiredArg, nullptr, 'i'},
+            {'\0', "io-priority", ArgumentParser::RequiredArg, nullptr, 'p'},
+            {'\0', "page-cache", ArgumentParser::RequiredArg, nullptr, 'c'},
+            {'\0', "io-order", ArgumentParser::RequiredArg, nullptr, 'o'}
+        });
+        return options;
+    }
+    
+    /**
+     * Does nothing if the option is not one of these.
+     */
+    void parseOption(int opt, const char* optionArg) {
+        if (opt == 'r') {
+            maxReadRate = IoThrottle::parseByteRate(optionArg);
+        } else if (opt == 'w') {
+            maxWriteRate = IoThrottle::parseByteRate(optionArg);
+        } else if (opt == 'i') {
+            try {
+                maxIops = std::stod(optionArg);
+            } catch (...) {
+                throw std::runtime_error("Value for \"max-iops\" must be a number.");
+            }
+            if (!std::isfinite(maxIops) || maxIops <= 0.0) {
+                throw std::runtime_error("Value for \"max-iops\" must be above zero.");
+            }
+        } else if (opt == 'p') {
+            ioPriority = IoThrottle::parseIoPriority(optionArg);
+        } else if (opt == 'c') {
+            pageCacheMode = FileReader::parsePageCacheMode(optionArg);
+        } else if (opt == 'o') {
+            ioOrder = IoScheduler::parseIoOrder(optionArg);
+        }
+    }
+    
+    /**
+     * Returns options for a check with these arguments set, the caller fills
+     * in the rest. The ioThrottle in the options is owned by this object.
+     */
+    Application::BackupOptions makeOptions(unsigned int maxConcurrentIo = 0) {
+        Application::BackupOptions options;
+        options.outputLimit = 0;
+        options.displayConfirmation = false;
+        options.skipCache = false;
+        options.fastCompare = static_cast<bool>(fastCompare);
+        options.forceBackup = false;
+        options.resumeBackup = false;
+        options.incremental = false;
+        options.durability = DurabilityLevel::None;
+        ioThrottle = std::make_unique<IoThrottle>(maxReadRate, maxWriteRate, maxIops, maxConcurrentIo);
+        options.ioThrottle = (ioThrottle->isLimited() || ioThrottle->hasConcurrencyLimit() ? ioThrottle.get() : nullptr);
+        options.ioPriority = ioPriority;
+        options.pageCacheMode = pageCacheMode;
+        options.ioOrder = ioOrder;
+        options.dirtyPaths = nullptr;
+        options.copyQueue = nullptr;
+        options.changeWriter = nullptr;
+        return options;
+    }
+};
+
+/**
+ * Handles the "stats" argument shared by the backup and check commands. The
+ * format is "text" (the default when none is given) or "json", returns true
+ * for json.
+ */
+bool parseStatsFormat(const char* optionArg) {
+    if (optionArg == nullptr || std::strcmp(optionArg, "text") == 0) {
+        return false;
+    } else if (std::strcmp(optionArg, "json") == 0) {
+        return true;
+    } else {
+        throw std::runtime_error("Value for \"stats\" must be text or json.");
+    }
+}
+
 /**
  * Starts a backup/restore of files.
  * 
@@ -31,30 +137,79 @@ namespace fs = std::filesystem;
  * argument skips binary file scans and only considers files as changed if their
  * date-modified times differ. The "force" argument overrides the confirmation
  * check and the second file check at the end, ideal for automated backup
- * purposes.
+ * purposes. The "resume" argument continues a backup that was interrupted
+ * (killed process, power loss, etc.) using the journal that was saved before
+ * it started, only the unfinished file operations are run and no scan is done.
+ * The "incremental" argument is described in runCommandCheck().
+ * The "durability" argument controls how copied files are flushed to the
+ * storage device: "none" leaves it to the operating system, "batch" (the
+ * default) flushes groups of files with one filesystem sync, and "per-file"
+ * flushes every file and directory individually (slowest). The throttle,
+ * "page-cache", and "io-order" arguments are described in runCommandCheck(),
+ * the "io-order" also sorts the files to copy. The "stats" argument is
+ * described in runCommandCheck(), for a backup it also covers the copying and
+ * the check after the backup.
+ * 
+ * With "--configs" in place of the config file, the config files that follow
+ * are backed up at the same time on a pool of threads ("jobs" sets the number
+ * of threads, the number of CPU cores by default). These backups always run
+ * without confirmation and the output of each one is printed when it
+ * finishes. The throttle arguments apply to all of them together, and the
+ * "max-concurrent-io" argument limits how many files are compared or copied at
+ * once across all configs.
  */
-void runCommandBackup(int argc, const char** argv) {
+void runCommandBackup(Application& app, int argc, const char** argv) {
     if (argc < 3) {
         throw std::runtime_error("Missing path to config file.");
     }
+    const bool multipleConfigs = (std::strcmp(argv[2], "--configs") == 0);
     fs::path configFilename = fs::path(argv[2]).lexically_normal();
     
     unsigned int outputLimit = 50;
+    unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned int maxConcurrentIo = 0;
     int skipCache = 0;
-    int fastCompare = 0;
+    int incremental = 0;
     int forceBackup = 0;
-    ArgumentParser argParser({
+    int resumeBackup = 0;
+    DurabilityLevel durability = DurabilityLevel::Batch;
+    bool stats = false, statsJson = false;
+    BackupArguments backupArgs;
+    ArgumentParser argParser(backupArgs.addOptions({
         {'l', "limit", ArgumentParser::RequiredArg, nullptr, 'l'},
         {'\0', "skip-cache", ArgumentParser::NoArg, &skipCache, 1},
-        {'\0', "fast-compare", ArgumentParser::NoArg, &fastCompare, 1},
-        {'f', "force", ArgumentParser::NoArg, &forceBackup, 1}
-    });
+        {'\0', "incremental", ArgumentParser::NoArg, &incremental, 1},
+        {'f', "force", ArgumentParser::NoArg, &forceBackup, 1},
+        {'\0', "resume", ArgumentParser::NoArg, &resumeBackup, 1},
+        {'\0', "durability", ArgumentParser::RequiredArg, nullptr, 'd'},
+        {'\0', "stats", ArgumentParser::OptionalArg, nullptr, 's'},
+        {'j', "jobs", ArgumentParser::RequiredArg, nullptr, 'j'},
+        {'\0', "max-concurrent-io", ArgumentParser::RequiredArg, nullptr, 'm'}
+    }));
     argParser.setArguments(argv, 3);
     
     int opt;
     std::string errorMessage;
     while ((opt = argParser.nextOption(&errorMessage)) != -1) {
-        if (opt == 'l') {
+        if (opt == 's') {
+            stats = true;
+            statsJson = parseStatsFormat(argParser.getOptionArg());
+        } else if (opt == 'j' || opt == 'm') {
+            const char* optionName = (opt == 'j' ? "jobs" : "max-concurrent-io");
+            if (!multipleConfigs) {
+                throw std::runtime_error("Option \"" + std::string(optionName) + "\" requires \"--configs\".");
+            }
+            int n;
+            try {
+                n = std::stoi(argParser.getOptionArg());
+            } catch (...) {
+                throw std::runtime_error("Value for \"" + std::string(optionName) + "\" must be integer.");
+            }
+            if (n < (opt == 'j' ? 1 : 0)) {
+                throw std::runtime_error("Value for \"" + std::string(optionName) + "\" is out of range.");
+            }
+            (opt == 'j' ? numThreads : maxConcurrentIo) = static_cast<unsigned int>(n);
+        } else if (opt == 'l') {
             try {
                 int n = std::stoi(argParser.getOptionArg());
                 if (n < 0) {
@@ -65,23 +220,111 @@ void runCommandBackup(int argc, const char** argv) {
             } catch (...) {
                 throw std::runtime_error("Value for \"limit\" must be integer.");
             }
+        } else if (opt == 'd') {
+            durability = FileSyncer::parseDurabilityLevel(argParser.getOptionArg());
         } else if (opt == '?' || opt == ':') {
             throw std::runtime_error(errorMessage + ".");
+        } else {
+            backupArgs.parseOption(opt, argParser.getOptionArg());
         }
     }
-    if (argParser.getIndex() < argc) {
+    std::vector<fs::path> configFilenames;
+    if (multipleConfigs) {
+        for (int i = argParser.getIndex(); i < argc; ++i) {
+            configFilenames.push_back(fs::path(argv[i]).lexically_normal());
+        }
+        if (configFilenames.empty()) {
+            throw std::runtime_error("Missing paths to config files.");
+        }
+    } else if (argParser.getIndex() < argc) {
         throw std::runtime_error("Invalid argument \"" + std::string(argv[argParser.getIndex()]) + "\".");
     }
     
-    Application app;
-    Application::BackupOptions options;
+    Application::BackupOptions options = backupArgs.makeOptions(maxConcurrentIo);
     options.outputLimit = outputLimit;
-    options.displayConfirmation = true;
+    options.displayConfirmation = !multipleConfigs;
     options.skipCache = static_cast<bool>(skipCache);
-    options.fastCompare = static_cast<bool>(fastCompare);
-    options.forceBackup = static_cast<bool>(forceBackup);
+    options.forceBackup = static_cast<bool>(forceBackup) || multipleConfigs;
+    options.resumeBackup = static_cast<bool>(resumeBackup);
+    options.incremental = static_cast<bool>(incremental);
+    options.durability = durability;
     
-    app.startBackup(configFilename, options);
+    size_t numFailed = 0;
+    {
+        Stats::ScopedEnable statsEnable(stats);
+        if (multipleConfigs) {
+            numFailed = Application::startBackups(configFilenames, options, numThreads);
+        } else {
+            app.startBackup(configFilename, options);
+        }
+    }
+    if (stats) {
+        std::cout << "\n";
+        Stats::print(std::cout, statsJson);
+    }
+    if (numFailed > 0) {
+        throw std::runtime_error("Backup failed for " + std::to_string(numFailed) + " of the configs.");
+    }
+}
+
+/**
+ * Keeps the backup up to date as files change.
+ * 
+ * Runs a backup (without confirmation), then watches the tracked source
+ * directories and runs another backup whenever something changes. Only the
+ * changed files are compared, so this is much cheaper than running a full
+ * backup on a timer. The "delay" argument sets how many seconds to wait for
+ * changes to settle down before starting a backup (2 by default), files that
+ * keep changing delay it by at most ten times this long. The config file is
+ * reloaded when it gets updated. Directory listings are always reused like
+ * with the "incremental" argument of runCommandCheck(). The other arguments
+ * are the same as for runCommandBackup(). Linux only.
+ */
+void runCommandWatch(Application& app, int argc, const char** argv) {
+    if (argc < 3) {
+        throw std::runtime_error("Missing path to config file.");
+    }
+    fs::path configFilename = fs::path(argv[2]).lexically_normal();
+    
+    double delaySeconds = 2.0;
+    DurabilityLevel durability = DurabilityLevel::Batch;
+    BackupArguments backupArgs;
+    ArgumentParser argParser(backupArgs.addOptions({
+        {'\0', "delay", ArgumentParser::RequiredArg, nullptr, 'D'},
+        {'\0', "durability", ArgumentParser::RequiredArg, nullptr, 'd'}
+    }));
+    argParser.setArguments(argv, 3);
+    
+    int opt;
+    std::string errorMessage;
+    while ((opt = argParser.nextOption(&errorMessage)) != -1) {
+        if (opt == 'D') {
+            try {
+                delaySeconds = std::stod(argParser.getOptionArg());
+            } catch (...) {
+                throw std::runtime_error("Value for \"delay\" must be a number.");
+            }
+            if (delaySeconds < 0.0) {
+                throw std::runtime_error("Value for \"delay\" must not be negative.");
+            }
+        } else if (opt == 'd') {
+            durability = FileSyncer::parseDurabilityLevel(argParser.getOptionArg());
+        } else if (opt == '?' || opt == ':') {
+            throw std::runtime_error(errorMessage + ".");
+        } else {
+            backupArgs.parseOption(opt, argParser.getOptionArg());
+        }
+    }
+    if (argParser.getIndex() < argc) {
+        throw std::runtime_error("Invalid argument \"" + std::string(argv[argParser.getIndex()]) + "\".");
+    }
+    
+    Application::BackupOptions options = backupArgs.makeOptions();
+    options.forceBackup = true;
+    options.incremental = true;
+    options.durability = durability;
+    
+    app.watchBackup(configFilename, options, std::chrono::milliseconds(std::lround(delaySeconds * 1000.0)));
 }
 
 /**
@@ -100,9 +343,42 @@ void runCommandBackup(int argc, const char** argv) {
  * avoids usage of the cache file that normally keeps track of which files have
  * changed, using this option may reduce performance. The "fast-compare"
  * argument skips binary file scans and only considers files as changed if their
- * date-modified times differ.
+ * date-modified times differ. The "incremental" argument saves the listing of
+ * each directory next to the cache file, and a directory that has the same
+ * modification time on the next run is not listed again (this applies to both
+ * the source and destination). Modified files are still found because each of
+ * them is checked against the cache.
+ * 
+ * The "max-read-rate" and "max-write-rate" arguments limit the disk bandwidth
+ * used (like "20M" for 20 MiB per second), and "max-iops" limits the number of
+ * reads, writes, and directory listings per second. The limits are shared
+ * between scanning, comparing, and copying files. The "io-priority" argument
+ * sets the Linux I/O scheduling class to "idle" or "best-effort" while
+ * the command runs so that other programs get priority for the disk.
+ * 
+ * The "page-cache" argument controls how file reads for comparing and copying
+ * use the operating system page cache. With "drop-behind" (the default) the
+ * pages are released as soon as they have been read, so a large scan does not
+ * evict the working set of other programs. "direct" bypasses the cache with
+ * O_DIRECT, and "normal" leaves caching up to the operating system.
+ * 
+ * The "io-order" argument sorts the files that need a binary scan by their
+ * location on disk before reading them, which reduces seeking on spinning
+ * disks. Use "inode" to sort by inode number or "physical" to sort by the
+ * first block of each file (Linux only), the default is "name".
+ * 
+ * The "stats" argument prints the time spent in each phase of the scan along
+ * with counters for the bytes read and written, files compared, cache hits and
+ * misses, directories listed, and file I/O calls made. Phase times are added
+ * up across threads (see Stats). The report is a table by default, or a single
+ * line of JSON with "--stats json".
+ * 
+ * The "output" argument selects how the changes are displayed. With "ndjson"
+ * each change is written to standard output as a line of JSON as soon as it is
+ * found (see ChangeWriter), followed by a summary line. Colors and the limit
+ * are not used, and the progress messages go to standard error instead.
  */
-void runCommandCheck(int argc, const char** argv) {
+void runCommandCheck(Application& app, int argc, const char** argv) {
     if (argc < 3) {
         throw std::runtime_error("Missing path to config file.");
     }
@@ -110,18 +386,32 @@ void runCommandCheck(int argc, const char** argv) {
     
     unsigned int outputLimit = 50;
     int skipCache = 0;
-    int fastCompare = 0;
-    ArgumentParser argParser({
+    int incremental = 0;
+    bool stats = false, statsJson = false;
+    bool ndjsonOutput = false;
+    BackupArguments backupArgs;
+    ArgumentParser argParser(backupArgs.addOptions({
         {'l', "limit", ArgumentParser::RequiredArg, nullptr, 'l'},
         {'\0', "skip-cache", ArgumentParser::NoArg, &skipCache, 1},
-        {'\0', "fast-compare", ArgumentParser::NoArg, &fastCompare, 1}
-    });
+        {'\0', "incremental", ArgumentParser::NoArg, &incremental, 1},
+        {'\0', "output", ArgumentParser::RequiredArg, nullptr, 'O'},
+        {'\0', "stats", ArgumentParser::OptionalArg, nullptr, 's'}
+    }));
     argParser.setArguments(argv, 3);
     
     int opt;
     std::string errorMessage;
     while ((opt = argParser.nextOption(&errorMessage)) != -1) {
-        if (opt == 'l') {
+        if (opt == 's') {
+            stats = true;
+            statsJson = parseStatsFormat(argParser.getOptionArg());
+        } else if (opt == 'O') {
+            if (std::strcmp(argParser.getOptionArg(), "ndjson") == 0) {
+                ndjsonOutput = true;
+            } else if (std::strcmp(argParser.getOptionArg(), "text") != 0) {
+                throw std::runtime_error("Value for \"output\" must be text or ndjson.");
+            }
+        } else if (opt == 'l') {
             try {
                 int n = std::stoi(argParser.getOptionArg());
                 if (n < 0) {
@@ -134,21 +424,41 @@ void runCommandCheck(int argc, const char** argv) {
             }
         } else if (opt == '?' || opt == ':') {
             throw std::runtime_error(errorMessage + ".");
+        } else {
+            backupArgs.parseOption(opt, argParser.getOptionArg());
         }
     }
     if (argParser.getIndex() < argc) {
         throw std::runtime_error("Invalid argument \"" + std::string(argv[argParser.getIndex()]) + "\".");
     }
     
-    Application app;
-    Application::BackupOptions options;
+    Application::BackupOptions options = backupArgs.makeOptions();
     options.outputLimit = outputLimit;
-    options.displayConfirmation = false;
     options.skipCache = static_cast<bool>(skipCache);
-    options.fastCompare = static_cast<bool>(fastCompare);
-    options.forceBackup = false;
+    options.incremental = static_cast<bool>(incremental);
     
-    app.checkBackup(configFilename, options);
+    std::unique_ptr<ChangeWriter> changeWriter;
+    std::streambuf* outputBuffer = std::cout.rdbuf();
+    if (ndjsonOutput) {    // Only the changes go to standard output, the progress messages and stats are moved to standard error.
+        std::cout.flush();
+        changeWriter = std::make_unique<ChangeWriter>(outputBuffer);
+        options.changeWriter = changeWriter.get();
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+    try {
+        {
+            Stats::ScopedEnable statsEnable(stats);
+            app.checkBackup(configFilename, options);
+        }
+        if (stats) {
+            std::cout << "\n";
+            Stats::print(std::cout, statsJson);
+        }
+    } catch (...) {
+        std::cout.rdbuf(outputBuffer);
+        throw;
+    }
+    std::cout.rdbuf(outputBuffer);
 }
 
 /**
@@ -160,6 +470,11 @@ void runCommandCheck(int argc, const char** argv) {
  * directory. In the case of a backup that spans multiple mount points (spread
  * across different drives) then a separate tree is displayed for each.
  * 
+ * The tree is built from the results of scanning the config, plus a listing of
+ * the directories that contain tracked items to find the ignored items next to
+ * them. Ignored directories are not expanded (their contents are not counted),
+ * so the untracked parts of the file system do not need to be scanned.
+ * 
  * The "count" argument skips displaying the tree and just outputs the final
  * count of tracked/ignored files and directories. The "verbose" argument
  * additionally displays the destination for each tracked file in the tree. The
@@ -167,7 +482,7 @@ void runCommandCheck(int argc, const char** argv) {
  * files/directories, this does not effect the total file and directory counts.
  * These are shown with an "(...)" symbol.
  */
-void runCommandTree(int argc, const char** argv) {
+void runCommandTree(Application& app, int argc, const char** argv) {
     if (argc < 3) {
         throw std::runtime_error("Missing path to config file.");
     }
@@ -194,10 +509,48 @@ void runCommandTree(int argc, const char** argv) {
         throw std::runtime_error("Invalid argument \"" + std::string(argv[argParser.getIndex()]) + "\".");
     }
     
-    Application app;
     app.printPaths(configFilename, static_cast<bool>(verbose), static_cast<bool>(countOnly), static_cast<bool>(pruneIgnored));
 }
 
+/**
+ * Restores files from a chunk store.
+ * 
+ * Writes every file in a snapshot of the chunk store to the output directory,
+ * existing files in the output get overwritten. The "snapshot" argument picks
+ * the snapshot by name (like "2021-05-31_153000"), the most recent one is used
+ * by default.
+ */
+void runCommandRestore(Application& app, int argc, const char** argv) {
+    if (argc < 3) {
+        throw std::runtime_error("Missing path to chunk store.");
+    } else if (argc < 4) {
+        throw std::runtime_error("Missing path to output directory.");
+    }
+    fs::path storePath = fs::path(argv[2]).lexically_normal();
+    fs::path outputPath = fs::path(argv[3]).lexically_normal();
+    
+    const char* snapshotName = "";
+    ArgumentParser argParser({
+        {'s', "snapshot", ArgumentParser::RequiredArg, nullptr, 's'}
+    });
+    argParser.setArguments(argv, 4);
+    
+    int opt;
+    std::string errorMessage;
+    while ((opt = argParser.nextOption(&errorMessage)) != -1) {
+        if (opt == '?' || opt == ':') {
+            throw std::runtime_error(errorMessage + ".");
+        } else if (opt == 's') {
+            snapshotName = argParser.getOptionArg();
+        }
+    }
+    if (argParser.getIndex() < argc) {
+        throw std::runtime_error("Invalid argument \"" + std::string(argv[argParser.getIndex()]) + "\".");
+    }
+    
+    app.restoreChunkStore(storePath, outputPath, snapshotName);
+}
+
 /**
  * Shows the command help menu.
  */
@@ -212,9 +565,10 @@ void showConfigHelp();
  * Parses the given arguments and attempts to run the command. The argc and
  * argv must be provided just like how main() is called (first argument is the
  * program name). Errors are caught within this function and printed to
- * standard output.
+ * standard output. The app is shared by all commands in interactive mode so
+ * that it can keep the state from previous scans.
  */
-void runCommand(int argc, const char** argv) {
+void runCommand(Application& app, int argc, const char** argv) {
     try {
         if (argc < 2) {
             return;
@@ -222,11 +576,15 @@ void runCommand(int argc, const char** argv) {
         
         std::string command(argv[1]);
         if (command == "backup") {
-            runCommandBackup(argc, argv);
+            runCommandBackup(app, argc, argv);
         } else if (command == "check") {
-            runCommandCheck(argc, argv);
+            runCommandCheck(app, argc, argv);
+        } else if (command == "watch") {
+            runCommandWatch(app, argc, argv);
         } else if (command == "tree") {
-            runCommandTree(argc, argv);
+            runCommandTree(app, argc, argv);
+        } else if (command == "restore") {
+            runCommandRestore(app, argc, argv);
         } else if (command == "help-config") {
             showConfigHelp();
         } else if (command == "help") {
@@ -303,10 +661,12 @@ int main(int argc, const char** argv) {
     SetConsoleMode(hConsole, ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT);
     #endif
     
+    Application app;
     if (argc >= 2) {
-        runCommand(argc, argv);
+        runCommand(app, argc, argv);
     } else {
         showHelp();
+        app.setKeepSession(true);    // Later commands only revalidate the cache and scan results of earlier ones.
         
         while (true) {
             std::cout << "\n>>> ";
@@ -315,7 +675,7 @@ int main(int argc, const char** argv) {
             input = "\"" + std::string(argv[0]) + "\" " + input;
             std::vector<char*> argumentVec = splitArguments(input);
             
-            runCommand(static_cast<int>(argumentVec.size() - 1), const_cast<const char**>(argumentVec.data()));
+            runCommand(app, static_cast<int>(argumentVec.size() - 1), const_cast<const char**>(argumentVec.data()));
         }
     }
     
@@ -325,21 +685,57 @@ int main(int argc, const char** argv) {
 void showHelp() {
     std::cout << "Commands:\n";
     std::cout << "  backup <CONFIG FILE> [OPTION]    Starts a backup/restore of files.\n";
+    std::cout << "  backup --configs <CONFIG FILE>... [OPTION]\n";
+    std::cout << "                                   Backs up multiple configs at the same time (without confirmation).\n";
     std::cout << "    -l, --limit N                      Limits output to N lines (50 by default). Use negative value for no limit.\n";
     std::cout << "    --skip-cache                       Skips reading/writing to cache file (tracks file modifications by timestamp).\n";
     std::cout << "    --fast-compare                     Only considers modification timestamp when checking files (no binary scan).\n";
+    std::cout << "    --incremental                      Reuses saved listings of directories that have not changed since the last run.\n";
     std::cout << "    -f, --force                        Forces backup to run without confirmation check.\n";
+    std::cout << "    --resume                           Finishes an interrupted backup without scanning again.\n";
+    std::cout << "    --durability LEVEL                 Flushing of copied files to disk: none, batch (default), or per-file.\n";
+    std::cout << "    --max-read-rate RATE               Limits disk reads to RATE bytes per second (K, M, G suffixes allowed).\n";
+    std::cout << "    --max-write-rate RATE              Limits disk writes to RATE bytes per second (K, M, G suffixes allowed).\n";
+    std::cout << "    --max-iops N                       Limits disk operations to N per second.\n";
+    std::cout << "    --io-priority CLASS                Sets I/O scheduling class to idle or best-effort (Linux only).\n";
+    std::cout << "    --page-cache MODE                  Page cache use when reading files: normal, drop-behind (default), or direct.\n";
+    std::cout << "    --io-order ORDER                   Order to read files in: name (default), inode, or physical (disk location).\n";
+    std::cout << "    --stats [FORMAT]                   Prints time per phase and I/O counters at the end, as text (default) or json.\n";
+    std::cout << "    -j, --jobs N                       Number of configs to back up at once with --configs (CPU cores by default).\n";
+    std::cout << "    --max-concurrent-io N              Limits files compared or copied at once across all configs with --configs.\n";
     std::cout << "\n";
     std::cout << "  check <CONFIG FILE> [OPTION]     Lists changes to make during backup.\n";
     std::cout << "    -l, --limit N                      Limits output to N lines (50 by default). Use negative value for no limit.\n";
     std::cout << "    --skip-cache                       Skips reading/writing to cache file (tracks file modifications by timestamp).\n";
     std::cout << "    --fast-compare                     Only considers modification timestamp when checking files (no binary scan).\n";
+    std::cout << "    --incremental                      Reuses saved listings of directories that have not changed since the last run.\n";
+    std::cout << "    --max-read-rate RATE               Limits disk reads to RATE bytes per second (K, M, G suffixes allowed).\n";
+    std::cout << "    --max-iops N                       Limits disk operations to N per second.\n";
+    std::cout << "    --io-priority CLASS                Sets I/O scheduling class to idle or best-effort (Linux only).\n";
+    std::cout << "    --page-cache MODE                  Page cache use when reading files: normal, drop-behind (default), or direct.\n";
+    std::cout << "    --io-order ORDER                   Order to read files in: name (default), inode, or physical (disk location).\n";
+    std::cout << "    --stats [FORMAT]                   Prints time per phase and I/O counters at the end, as text (default) or json.\n";
+    std::cout << "    --output FORMAT                    Format of the changes: text (default) or ndjson (one JSON object per line).\n";
+    std::cout << "\n";
+    std::cout << "  watch <CONFIG FILE> [OPTION]     Watches for file changes and keeps the backup up to date (Linux only).\n";
+    std::cout << "    --delay SECONDS                    Time to wait for changes to settle before a backup (2 by default).\n";
+    std::cout << "    --fast-compare                     Only considers modification timestamp when checking files (no binary scan).\n";
+    std::cout << "    --durability LEVEL                 Flushing of copied files to disk: none, batch (default), or per-file.\n";
+    std::cout << "    --max-read-rate RATE               Limits disk reads to RATE bytes per second (K, M, G suffixes allowed).\n";
+    std::cout << "    --max-write-rate RATE              Limits disk writes to RATE bytes per second (K, M, G suffixes allowed).\n";
+    std::cout << "    --max-iops N                       Limits disk operations to N per second.\n";
+    std::cout << "    --io-priority CLASS                Sets I/O scheduling class to idle or best-effort (Linux only).\n";
+    std::cout << "    --page-cache MODE                  Page cache use when reading files: normal, drop-behind (default), or direct.\n";
+    std::cout << "    --io-order ORDER                   Order to read files in: name (default), inode, or physical (disk location).\n";
     std::cout << "\n";
     std::cout << "  tree <CONFIG FILE> [OPTION]      Displays tree of tracked files.\n";
     std::cout << "    -c, --count                        Only display the total count.\n";
     std::cout << "    -v, --verbose                      Show tracked file destinations.\n";
     std::cout << "    -p, --prune                        Hide sub-trees that only contain ignored items.\n";
     std::cout << "\n";
+    std::cout << "  restore <STORE> <OUTPUT> [OPTION] Restores files from a chunk store.\n";
+    std::cout << "    -s, --snapshot NAME                Snapshot to restore (most recent by default).\n";
+    std::cout << "\n";
     std::cout << "  help-config                      Shows config help with examples.\n";
     std::cout << "\n";
     std::cout << "  help                             Shows this menu.\n";
@@ -1,522 +1,570 @@
 // Note: need to define /Zc:__cplusplus to get this to compile with VS2017 using c++17
+#include "BackupTools/Application.h"
 #include "BackupTools/ArgumentParser.h"
+#include "BackupTools/BackupJournal.h"
+#include "BackupTools/BoundedQueue.h"
+#include "BackupTools/ChangeWriter.h"
+#include "BackupTools/ChunkStore.h"
+#include "BackupTools/ConfigPlan.h"
+#include "BackupTools/DirectoryHandles.h"
+#include "BackupTools/DirectoryReader.h"
+#include "BackupTools/Compressor.h"
+#include "BackupTools/DirectoryWatcher.h"
 #include "BackupTools/FileHandler.h"
+#include "BackupTools/FileReader.h"
+#include "BackupTools/FileSyncer.h"
+#include "BackupTools/IoScheduler.h"
+#include "BackupTools/IoThrottle.h"
+#include "BackupTools/ProgressReporter.h"
+#include "BackupTools/Sha256.h"
+#include "BackupTools/Stats.h"
+#include "BackupTools/TreeGenerator.h"
+#include "BackupTools/TreeState.h"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
 
 // ****************************************************************************
 // * TestGlobbing                                                             *
 // ****************************************************************************
 
 TEST(TestGlobbing, NoWildcards) {
-    FileHandler::pathSeparator = '\\';
-    FileHandler::globMatchesHiddenFiles = false;
-    
-    EXPECT_EQ(FileHandler::fnmatchPortable("", ""), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a", "b"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("", "b"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a", ""), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable(" aslkwas  aowdsaknfal ", " awijalskd awoidwa "), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable(" aslkwas  aowdsaknfal ", " aslkwas  aowdsaknfal "), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("`~1!2@3#4$5%6^7&89(0)-_=+{}\\|;:\'\",<.>/", "`~1!2@3#4$5%6^7&89(0)-_=+{}\\|;:\'\",<./"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("`~1!2@3#4$5%6^7&89(0)-_=+{}\\|;:\'\",<.>/", "`~1!2@3#4$5%6^7&89(0)-_=+{}\\|;:\'\",<.>/"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("thiS iS a TEST", "this is a test"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("this is a test", "thiS iS a TEST"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("thiS iS a TEST", "thiS iS a TEST"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file.txt", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\Path\\to\\file.txt", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\other.txt", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file.txt", "C:\\path\\to\\file"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\path\\to\\file.txt", "\\path\\to\\file.txt"), true);
+    GlobOptions options;
+    options.pathSeparator = '\\';
+    options.matchesHiddenFiles = false;
+    
+    EXPECT_EQ(FileHandler::fnmatchPortable("", "", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a", "b", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("", "b", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a", "", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable(" aslkwas  aowdsaknfal ", " awijalskd awoidwa ", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable(" aslkwas  aowdsaknfal ", " aslkwas  aowdsaknfal ", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("`~1!2@3#4$5%6^7&89(0)-_=+{}\\|;:\'\",<.>/", "`~1!2@3#4$5%6^7&89(0)-_=+{}\\|;:\'\",<./", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("`~1!2@3#4$5%6^7&89(0)-_=+{}\\|;:\'\",<.>/", "`~1!2@3#4$5%6^7&89(0)-_=+{}\\|;:\'\",<.>/", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("thiS iS a TEST", "this is a test", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("this is a test", "thiS iS a TEST", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("thiS iS a TEST", "thiS iS a TEST", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file.txt", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\Path\\to\\file.txt", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\other.txt", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file.txt", "C:\\path\\to\\file", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\path\\to\\file.txt", "\\path\\to\\file.txt", options), true);
 }
 
 TEST(TestGlobbing, CommonCaseTests) {
-    FileHandler::pathSeparator = '\\';
-    FileHandler::globMatchesHiddenFiles = false;
-    
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file.txt", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file.txt", "D:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\differentkind of\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file2.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file2.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file2.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file3.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file3.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file3.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file4.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file5.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file4.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file4.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\different kind of"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home", "\\home"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home", "\\usr"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home", "\\local"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account", "\\home\\lost+found"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account", "\\home\\user account"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account", "\\home\\temp"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents", "\\home\\user account\\stuff"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents", "\\home\\user account\\music"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents", "\\home\\user account\\Open Office"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents", "\\home\\user account\\documents"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\new text doc.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\file"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\.bin"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\.hidden"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\data.bin"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\.."), false);
+    GlobOptions options;
+    options.pathSeparator = '\\';
+    options.matchesHiddenFiles = false;
+    
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file.txt", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file.txt", "D:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\differentkind of\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file2.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file2.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file2.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file3.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file3.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file3.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file4.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file5.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file4.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file4.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\different kind of", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", "C:\\really\\long\\path\\to\\a\\different kind of\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home", "\\home", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home", "\\usr", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home", "\\local", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account", "\\home\\lost+found", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account", "\\home\\user account", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account", "\\home\\temp", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents", "\\home\\user account\\stuff", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents", "\\home\\user account\\music", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents", "\\home\\user account\\Open Office", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents", "\\home\\user account\\documents", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\new text doc.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\file", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\.bin", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\.hidden", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\data.bin", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\.", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\home\\user account\\documents\\*.bin", "\\home\\user account\\documents\\..", options), false);
 }
 
 TEST(TestGlobbing, QuestionMark) {
-    FileHandler::pathSeparator = '\\';
-    FileHandler::globMatchesHiddenFiles = false;
-    
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", ""), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("", "?"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", "?"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", "x"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", "."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\?", "\\."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a?", "a."), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\a?\\", "\\a.\\"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", "\\"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", "["), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", "]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a?", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a?", "ab"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("this is a tes?", "this is a tes"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?hi???s ??te?t", "this is a test"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("???", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("???", "ab"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("???", "abc"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("???", "abcd"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\???.txt", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\????.txt", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to?file.txt", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to?file.txt", "C:\\path\\to?file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file?txt", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\?file", "C:\\path\\to\\.file"), false);
+    GlobOptions options;
+    options.pathSeparator = '\\';
+    options.matchesHiddenFiles = false;
+    
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", "", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("", "?", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", "?", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", "x", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", ".", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\?", "\\.", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a?", "a.", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\a?\\", "\\a.\\", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", "\\", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", "[", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", "]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a?", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a?", "ab", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("this is a tes?", "this is a tes", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?hi???s ??te?t", "this is a test", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("???", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("???", "ab", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("???", "abc", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("???", "abcd", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\???.txt", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\????.txt", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to?file.txt", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to?file.txt", "C:\\path\\to?file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file?txt", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\?file", "C:\\path\\to\\.file", options), false);
 }
 
 TEST(TestGlobbing, Star) {
-    FileHandler::pathSeparator = '\\';
-    FileHandler::globMatchesHiddenFiles = false;
+    GlobOptions options;
+    options.pathSeparator = '\\';
+    options.matchesHiddenFiles = false;
     
     // Single star.
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", ""), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "*"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("", "*"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a*", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a*b", "ab"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a*b", "acb"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a*b", "abc"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a*b*", "abc"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "Bunch OF random text"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "Bunch OF random text."), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".Bunch OF random text."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".Bunch OF random text"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable(".*", ".Bunch OF random text."), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable(".*", ".Bunch OF random text"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable(".*", "Bunch OF random text"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable(".*", "Bunch OF random text."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*.*", "Bunch OF random text"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*.*", "Bunch OF random text."), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*.*", "Bunch OF random.text"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*.*", ".Bunch OF random text"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "a.............."), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("app*", "apple"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("app*", "appl"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("app*", "app"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("app*", "ap"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("ap*le", "apple"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("ap*le", "apshf soasdfle"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("ap*le", "apshf soasdflge"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("h*o *d", "hello world"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("h*o *d", "he world"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("h*o*d", "he world"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*txt", "myFile.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*.txt", "myFile.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*.txt.", "myFile.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*txt", "myFile.txtx"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*txt*", "myFile.txtx"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.txt", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\*", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "C:\\"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "C:"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "home"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "\\home"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\*", "\\home"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\*", "\\.home"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\.*", "\\.home"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("\\*.", "\\."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".test"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "test"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable(".*", ".test"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable(".*", "test"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*.", "."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*.", "a."), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable(".", ".test"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "test.dat"), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "*", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("", "*", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a*", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a*b", "ab", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a*b", "acb", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a*b", "abc", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a*b*", "abc", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "Bunch OF random text", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "Bunch OF random text.", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".Bunch OF random text.", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".Bunch OF random text", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable(".*", ".Bunch OF random text.", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable(".*", ".Bunch OF random text", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable(".*", "Bunch OF random text", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable(".*", "Bunch OF random text.", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*.*", "Bunch OF random text", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*.*", "Bunch OF random text.", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*.*", "Bunch OF random.text", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*.*", ".Bunch OF random text", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "a..............", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("app*", "apple", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("app*", "appl", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("app*", "app", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("app*", "ap", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("ap*le", "apple", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("ap*le", "apshf soasdfle", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("ap*le", "apshf soasdflge", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("h*o *d", "hello world", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("h*o *d", "he world", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("h*o*d", "he world", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*txt", "myFile.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*.txt", "myFile.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*.txt.", "myFile.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*txt", "myFile.txtx", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*txt*", "myFile.txtx", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.txt", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\*", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "C:\\", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "C:", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "home", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "\\home", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\*", "\\home", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\*", "\\.home", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\.*", "\\.home", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("\\*.", "\\.", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".test", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "test", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable(".*", ".test", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable(".*", "test", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*.", ".", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*.", "a.", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable(".", ".test", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "..", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "test.dat", options), true);
     
     // Multiple star.
-    EXPECT_EQ(FileHandler::fnmatchPortable("**", ""), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("****", ""), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("**", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("**", "fhakfskfam fmamw"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("****", "*"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("**a**", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("**a**", "abcdef"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("**a**", "bcdef"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("**a**", "bcdefa"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("h****o*wor**d***", "hello world"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("h****o*wo**d**r***", "hello world"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\******.txt", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\******txt", "C:\\path\\to\\.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\******.txt", "C:\\path\\to\\.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\******txt", "C:\\path\\to\\txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("***", ".test"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable(".***", ".test"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("***.", "."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("***.", ".."), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("***.", "a."), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("**", "", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("****", "", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("**", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("**", "fhakfskfam fmamw", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("****", "*", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("**a**", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("**a**", "abcdef", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("**a**", "bcdef", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("**a**", "bcdefa", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("h****o*wor**d***", "hello world", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("h****o*wo**d**r***", "hello world", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\******.txt", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\******txt", "C:\\path\\to\\.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\******.txt", "C:\\path\\to\\.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\******txt", "C:\\path\\to\\txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("***", ".test", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable(".***", ".test", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("***.", ".", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("***.", "..", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("***.", "a.", options), true);
 }
 
 TEST(TestGlobbing, Brackets) {
-    FileHandler::pathSeparator = '\\';
-    FileHandler::globMatchesHiddenFiles = false;
+    GlobOptions options;
+    options.pathSeparator = '\\';
+    options.matchesHiddenFiles = false;
     
     // No ranges.
-    EXPECT_EQ(FileHandler::fnmatchPortable("[", ""), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[", "["), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("]", ""), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("]", "]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]", ""), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]", "ab"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]", "[]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]hello", ""), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]hello", "[]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]hello", "hello"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]hello", "[]hello"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a]", ""), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ ]", " "), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "G"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "r"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "h"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "g"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "G"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "r"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "[asjwGDr"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "asjwGDr"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[][]", "["), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[][]", "]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[][]", "[]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[]]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[]]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[]]", "[]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[]", "["), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[]", "[[]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]]", "]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]]", "[]]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a][]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a][]", "a[]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[][b]", "["), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[][b]", "b"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[][b]", "]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[][b]", "[]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "[ab][cd]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "abcd"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "ac"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "ab"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "bc"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "bd"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "ad"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "cd"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "da"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[[[[[[[[", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[[[[[[[[", "[[[[[[[[["), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("]]]]]]]]]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("]]]]]]]]]", "]]]]]]]]]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a]", ""), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^a]", ""), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^a]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a]", "b"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^a]", "b"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a!]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a^]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a!]", "!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a^]", "^"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!^]", "^"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!^]", "g"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^!]", "!"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^!]", "g"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "G"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "r"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "h"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "g"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr", "h"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr", "[!asjwGDr"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr", "[asjwGDr"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[f]ile.txt", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[f]ile.txt", "C:\\path\\to\\aile.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[!f]ile.txt", "C:\\path\\to\\aile.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[file][file][file][file].txt", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[file][file][file][file].txt", "C:\\path\\to\\life.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to[\\]file.txt", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[f\\]ile.txt", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[\\f]ile.txt", "C:\\path\\to\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[f\\]ile.txt", "C:\\path\\to\\[f\\]ile.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file[.]txt", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file[.]txt", "C:\\path\\to\\filetxt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[.]file", "C:\\path\\to\\.file"), true);    // The standard unix glob does not support this, but it seems like a good idea since brace expansion is not a feature of this function.
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[!.]file", "C:\\path\\to\\.file"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[!.]file", "C:\\path\\to\\afile"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[.]file", ".file"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[.]file", "file"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!.]file", ".file"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!.]file", "afile"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!", "!"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!", "[!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^", "^"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^", "[^"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "[!]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]x", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]x", "[!]x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]x", "!x"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]x", "^x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "^"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "[^]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^]x", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^]x", "[^]x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^]x", "^x"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^]x", "!x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]]", "!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]]", "x"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "x"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "f"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!!]", "[!!]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!!]", "!"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!!]", "^"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!!]", "]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^^]", "[^^]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^^]", "^"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^^]", "!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^^]", "]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!][!]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!][!]", "!"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!][!]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!][!]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[![]!]", "[!]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[![]!]", "!!]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[![]!]", "a!]"), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[", "", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[", "[", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("]", "", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("]", "]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]", "", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]", "ab", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]", "[]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]hello", "", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]hello", "[]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]hello", "hello", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]hello", "[]hello", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a]", "", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ ]", " ", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "G", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "r", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "h", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr]", "g", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "G", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "r", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "[asjwGDr", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[asjwGDr", "asjwGDr", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[][]", "[", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[][]", "]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[][]", "[]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[]]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[]]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[]]", "[]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[]", "[", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[]", "[[]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]]", "]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]]", "[]]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a][]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a][]", "a[]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[][b]", "[", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[][b]", "b", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[][b]", "]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[][b]", "[]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "[ab][cd]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "abcd", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "ac", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "ab", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "bc", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "bd", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "ad", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "cd", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ab][cd]", "da", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[[[[[[[[", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[[[[[[[[", "[[[[[[[[[", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("]]]]]]]]]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("]]]]]]]]]", "]]]]]]]]]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a]", "", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^a]", "", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^a]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a]", "b", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^a]", "b", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a!]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a^]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a!]", "!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a^]", "^", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!^]", "^", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!^]", "g", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^!]", "!", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^!]", "g", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "G", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "r", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "h", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr]", "g", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr", "h", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr", "[!asjwGDr", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!asjwGDr", "[asjwGDr", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[f]ile.txt", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[f]ile.txt", "C:\\path\\to\\aile.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[!f]ile.txt", "C:\\path\\to\\aile.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[file][file][file][file].txt", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[file][file][file][file].txt", "C:\\path\\to\\life.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to[\\]file.txt", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[f\\]ile.txt", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[\\f]ile.txt", "C:\\path\\to\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[f\\]ile.txt", "C:\\path\\to\\[f\\]ile.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file[.]txt", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\file[.]txt", "C:\\path\\to\\filetxt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[.]file", "C:\\path\\to\\.file", options), true);    // The standard unix glob does not support this, but it seems like a good idea since brace expansion is not a feature of this function.
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[!.]file", "C:\\path\\to\\.file", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\[!.]file", "C:\\path\\to\\afile", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[.]file", ".file", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[.]file", "file", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!.]file", ".file", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!.]file", "afile", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!", "!", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!", "[!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^", "^", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^", "[^", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]", "[!]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]x", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]x", "[!]x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]x", "!x", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]x", "^x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "^", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^]", "[^]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^]x", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^]x", "[^]x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^]x", "^x", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^]x", "!x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]]", "!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]]", "x", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "x", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]abcdef]", "f", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!!]", "[!!]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!!]", "!", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!!]", "^", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!!]", "]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^^]", "[^^]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^^]", "^", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^^]", "!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^^]", "]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!][!]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!][!]", "!", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!][!]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!][!]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[![]!]", "[!]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[![]!]", "!!]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[![]!]", "a!]", options), true);
     
     // Ranges.
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-", "[-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a", "[-a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-", "[a-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("-]", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("-]", "-]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("-a]", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("-a]", "-a]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a-]", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("a-]", "a-]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-]", "[-]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-]", "[-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-]", "-]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-]", "-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a]", "-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc]", "-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-]", "-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[abc-]", "-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[abc-]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[abc-]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a-]", "-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a-]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a-]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-a-]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc-]", "-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc-]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc-]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc-]", "x"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "[a-a]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "`"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "b"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-b]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-b]", "b"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-b]", "c"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "`"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "b"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "h"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "m"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "v"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "z"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "{"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[z-a]", "z"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[z-a]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[z-a]", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[z-a]", "[z-a]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[b-a]", "b"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[b-a]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[b-a]", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[b-a]", "[b-a]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "`"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "b"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "c"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "d"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "g"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "F"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "G"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "H"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "I"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "J"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "j"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "k"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "b"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "c"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "d"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "e"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "f"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "`"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "b"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "h"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "m"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "v"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "z"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "{"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-z]", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-z]", "z"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-z]", "x"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-z]", "!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-]", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-]", "x"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-]", "!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-a]", "a"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-a]", "b"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-a]", "-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-a]", "!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]]a-z]", "]a-z]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]]a-z]", "]b"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]a-z]", "]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]a-z]", "b"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[]a-z]", "A"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[]a-z]", "[a-z]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[]a-z]", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[[]a-z]", "b"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-", "!"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-", "[!-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^-", "["), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^-", "^"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^-", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[^-", "[^-"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-]", "-"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-]", "!"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!-]", "x"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[![-]]", "a]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[![-]]", "[]"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]-[]", "["), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]-[]", "]"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]-[]", "a"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("[!]-[]", "-"), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-", "[-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a", "[-a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-", "[a-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("-]", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("-]", "-]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("-a]", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("-a]", "-a]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a-]", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("a-]", "a-]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-]", "[-]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-]", "[-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-]", "-]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-]", "-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a]", "-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc]", "-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-]", "-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[abc-]", "-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[abc-]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[abc-]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a-]", "-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a-]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a-]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-a-]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc-]", "-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc-]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc-]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[-abc-]", "x", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "[a-a]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "`", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "b", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-a]", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-b]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-b]", "b", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-b]", "c", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "`", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "b", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "h", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "m", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "v", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "z", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-z]", "{", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[z-a]", "z", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[z-a]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[z-a]", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[z-a]", "[z-a]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[b-a]", "b", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[b-a]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[b-a]", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[b-a]", "[b-a]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "`", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "b", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "c", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "d", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "g", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "F", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "G", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "H", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "I", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "J", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "j", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[a-cG-Ij]", "k", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "b", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "c", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "d", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "e", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[ac-e]", "f", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "`", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "b", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "h", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "m", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "v", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "z", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-z]", "{", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-z]", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-z]", "z", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-z]", "x", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-z]", "!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-]", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-]", "x", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-]", "!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-a]", "a", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-a]", "b", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-a]", "-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!a-a]", "!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]]a-z]", "]a-z]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]]a-z]", "]b", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]a-z]", "]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]a-z]", "b", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[]a-z]", "A", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[]a-z]", "[a-z]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[]a-z]", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[[]a-z]", "b", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-", "!", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-", "[!-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^-", "[", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^-", "^", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^-", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[^-", "[^-", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-]", "-", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-]", "!", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!-]", "x", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[![-]]", "a]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[![-]]", "[]", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]-[]", "[", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]-[]", "]", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]-[]", "a", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("[!]-[]", "-", options), true);
 }
 
 TEST(TestGlobbing, Comprehensive) {
-    FileHandler::pathSeparator = '\\';
-    FileHandler::globMatchesHiddenFiles = false;
-    
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "a.aaa"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.cc"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.data"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\.hid"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!gh"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", ".a!jam!gh"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "x?!jam!gh"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!h"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!g@"), false);
+    GlobOptions options;
+    options.pathSeparator = '\\';
+    options.matchesHiddenFiles = false;
+    
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "a.aaa", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.cc", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.data", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\.hid", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!gh", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", ".a!jam!gh", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "x?!jam!gh", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!h", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!g@", options), false);
     
     // These take some time, but are also very rare edge cases that do not need to be optimized.
-    EXPECT_EQ(FileHandler::fnmatchPortable("*a*??????*a*?????????a???????????????", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*a*??????*a*?????????a???????????????", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabaaaaaaaaaaaaaaa"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*a*??????*a*?????????a???????????????", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabaaaaaaaaaaaaaa"), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*a*??????*a*?????????a???????????????", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*a*??????*a*?????????a???????????????", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabaaaaaaaaaaaaaaa", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*a*??????*a*?????????a???????????????", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabaaaaaaaaaaaaaa", options), true);
 }
 
 TEST(TestGlobbing, GlobMatchesHidden) {
-    FileHandler::pathSeparator = '\\';
-    FileHandler::globMatchesHiddenFiles = true;
-    
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", "x"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?", "."), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", "Bunch OF random text."), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".Bunch OF random text."), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "a.aaa"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\file.txt"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.txt"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.cc"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.data"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\.hid"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!gh"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", ".a!jam!gh"), true);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "x?!jam!gh"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!h"), false);
-    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!g@"), false);
+    GlobOptions options;
+    options.pathSeparator = '\\';
+    options.matchesHiddenFiles = true;
+    
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", "x", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?", ".", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", "Bunch OF random text.", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("*", ".Bunch OF random text.", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "a.aaa", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\file.txt", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.txt", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.cc", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\file.data", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("C:\\path\\to\\*.???", "C:\\path\\to\\.hid", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!gh", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", ".a!jam!gh", options), true);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "x?!jam!gh", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!h", options), false);
+    EXPECT_EQ(FileHandler::fnmatchPortable("?[!!-@]*g[a-zA-Z0-9]", "xa!jam!g@", options), false);
 }
 
 // ****************************************************************************
@@ -930,3 +978,1626 @@ TEST(TestArgumentParser, Test2) {
         EXPECT_TRUE(argv[13] == nullptr);
     }
 }
+
+TEST(TestArgumentParser, AttachedParameter) {
+    int listFlag = 0;
+    ArgumentParser argParser({
+        {'\0', "output", ArgumentParser::RequiredArg, nullptr, 'o'},
+        {'\0', "stats", ArgumentParser::OptionalArg, nullptr, 's'},
+        {'l', "list", ArgumentParser::NoArg, &listFlag, 1},
+        {'r', "", ArgumentParser::RequiredArg, nullptr, 'r'}
+    });
+    const char* argv[] = {
+        "--output=ndjson",
+        "--stats=",
+        "file.txt",
+        "--list=yes",
+        "--=x",
+        "--output",
+        "a=b",
+        nullptr
+    };
+    argParser.setArguments(argv, 0);
+    
+    EXPECT_EQ(argParser.nextOption(), 'o');
+    EXPECT_TRUE(std::strcmp(argParser.getOptionArg(), "ndjson") == 0);
+    EXPECT_EQ(argParser.nextOption(), 's');
+    EXPECT_TRUE(std::strcmp(argParser.getOptionArg(), "") == 0);
+    std::string errorMessage;
+    EXPECT_EQ(argParser.nextOption(&errorMessage), '?');    // Flags can't take a parameter.
+    EXPECT_EQ(errorMessage, "Unknown option --list=yes");
+    EXPECT_EQ(listFlag, 0);
+    EXPECT_EQ(argParser.nextOption(&errorMessage), '?');    // Doesn't match the option with no long name.
+    EXPECT_EQ(argParser.nextOption(), 'o');
+    EXPECT_TRUE(std::strcmp(argParser.getOptionArg(), "a=b") == 0);
+    EXPECT_EQ(argParser.nextOption(), -1);
+    EXPECT_EQ(argParser.getIndex(), 6);
+    EXPECT_TRUE(std::strcmp(argv[6], "file.txt") == 0);
+}
+
+// ****************************************************************************
+// * TestBackupJournal                                                        *
+// ****************************************************************************
+
+TEST(TestBackupJournal, ResumeAfterKill) {
+    const std::filesystem::path journalPath = std::filesystem::temp_directory_path() / "backup_tools_test.journal";
+    {
+        BackupJournal journal;
+        journal.create(journalPath, {
+            {BackupJournal::Add, "src/a dir", "dest/a dir"},
+            {BackupJournal::Add, "src/a dir/file.txt", "dest/a dir/file.txt"},
+            {BackupJournal::Rename, "dest/old.txt", "dest/new.txt"},
+            {BackupJournal::Remove, "", "dest/removed.txt"},
+            {BackupJournal::Replace, "src/modified.txt", "dest/modified.txt"}
+        });
+        journal.markCompleted(0);
+        journal.markCompleted(2);
+        EXPECT_EQ(journal.getNumCompleted(), 2u);
+    }
+    {
+        std::ofstream partialWrite(journalPath, std::ios::binary | std::ios::app);    // Simulate a process killed in the middle of writing an index.
+        partialWrite.put('\x03');
+    }
+    {
+        BackupJournal journal;
+        ASSERT_TRUE(journal.load(journalPath));
+        ASSERT_EQ(journal.getOperations().size(), 5u);
+        EXPECT_EQ(journal.getNumCompleted(), 2u);
+        EXPECT_TRUE(journal.isCompleted(0));
+        EXPECT_FALSE(journal.isCompleted(1));
+        EXPECT_TRUE(journal.isCompleted(2));
+        EXPECT_FALSE(journal.isCompleted(3));
+        EXPECT_EQ(journal.getOperations()[1].type, BackupJournal::Add);
+        EXPECT_EQ(journal.getOperations()[1].source, std::filesystem::path("src/a dir/file.txt"));
+        EXPECT_EQ(journal.getOperations()[3].type, BackupJournal::Remove);
+        EXPECT_TRUE(journal.getOperations()[3].source.empty());
+        EXPECT_EQ(journal.getOperations()[4].dest, std::filesystem::path("dest/modified.txt"));
+        journal.markCompleted(4);
+    }
+    {
+        BackupJournal journal;
+        ASSERT_TRUE(journal.load(journalPath));
+        EXPECT_EQ(journal.getNumCompleted(), 3u);
+        EXPECT_TRUE(journal.isCompleted(4));
+        journal.remove();
+    }
+    EXPECT_FALSE(std::filesystem::exists(journalPath));
+    
+    BackupJournal journal;
+    EXPECT_FALSE(journal.load(journalPath));
+}
+
+// ****************************************************************************
+// * TestIoThrottle                                                           *
+// ****************************************************************************
+
+TEST(TestIoThrottle, ParseByteRate) {
+    EXPECT_EQ(IoThrottle::parseByteRate("1000"), 1000.0);
+    EXPECT_EQ(IoThrottle::parseByteRate("1000B"), 1000.0);
+    EXPECT_EQ(IoThrottle::parseByteRate("4k"), 4096.0);
+    EXPECT_EQ(IoThrottle::parseByteRate("20M"), 20.0 * 1024 * 1024);
+    EXPECT_EQ(IoThrottle::parseByteRate("20MB"), 20.0 * 1024 * 1024);
+    EXPECT_EQ(IoThrottle::parseByteRate("1.5G"), 1.5 * 1024 * 1024 * 1024);
+    EXPECT_THROW(IoThrottle::parseByteRate(""), std::runtime_error);
+    EXPECT_THROW(IoThrottle::parseByteRate("M"), std::runtime_error);
+    EXPECT_THROW(IoThrottle::parseByteRate("20X"), std::runtime_error);
+    EXPECT_THROW(IoThrottle::parseByteRate("20MBB"), std::runtime_error);
+    EXPECT_THROW(IoThrottle::parseByteRate("-5"), std::runtime_error);
+    EXPECT_THROW(IoThrottle::parseByteRate("0"), std::runtime_error);
+    EXPECT_THROW(IoThrottle::parseByteRate("nan"), std::runtime_error);
+    EXPECT_THROW(IoThrottle::parseByteRate("infM"), std::runtime_error);
+    EXPECT_THROW(IoThrottle::parseByteRate("1e400"), std::runtime_error);
+    EXPECT_THROW(IoThrottle::parseIoPriority("high"), std::runtime_error);
+}
+
+TEST(TestIoThrottle, RateLimiter) {
+    RateLimiter unlimited;
+    EXPECT_FALSE(unlimited.isLimited());
+    
+    RateLimiter limiter(1000.0);    // Burst is 100 tokens, so taking 600 should wait about half a second.
+    EXPECT_TRUE(limiter.isLimited());
+    auto startTime = std::chrono::steady_clock::now();
+    limiter.acquire(300.0);
+    limiter.acquire(300.0);
+    auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+    EXPECT_GE(elapsedMs, 400);
+    EXPECT_LT(elapsedMs, 2000);
+}
+
+TEST(TestIoThrottle, ConcurrencyLimit) {
+    IoThrottle ioThrottle(0.0, 0.0, 0.0, 2);
+    EXPECT_FALSE(ioThrottle.isLimited());
+    EXPECT_TRUE(ioThrottle.hasConcurrencyLimit());
+    
+    std::atomic<int> numActive(0), maxActive(0);
+    std::mutex releaseMutex;
+    std::condition_variable releaseCondition;
+    bool released = false;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 6; ++i) {
+        threads.emplace_back([&]() {
+            IoThrottle::IoSlot ioSlot(&ioThrottle);
+            const int active = ++numActive;
+            int previousMax = maxActive;
+            while (active > previousMax && !maxActive.compare_exchange_weak(previousMax, active)) {}
+            std::unique_lock<std::mutex> lock(releaseMutex);    // Hold the slot until the main thread has checked the count.
+            releaseCondition.wait(lock, [&released]() { return released; });
+            --numActive;
+        });
+    }
+    while (numActive < 2) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));    // Gives the other threads time to get in if the limit is broken.
+    EXPECT_EQ(numActive, 2);
+    {
+        std::lock_guard<std::mutex> lock(releaseMutex);
+        released = true;
+    }
+    releaseCondition.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_LE(maxActive, 2);
+    IoThrottle::IoSlot noLimitSlot(nullptr);    // Does nothing.
+}
+
+#ifdef __linux__
+TEST(TestIoThrottle, PriorityScope) {
+    const long previousPriority = syscall(SYS_ioprio_get, 1, 0);    // IOPRIO_WHO_PROCESS of the calling thread.
+    ASSERT_GE(previousPriority, 0);
+    {
+        IoThrottle::PriorityScope priorityScope(IoPriority::Idle);
+        EXPECT_EQ(syscall(SYS_ioprio_get, 1, 0) >> 13, 3);    // IOPRIO_CLASS_IDLE.
+        {
+            IoThrottle::PriorityScope unchangedScope(IoPriority::Unchanged);
+        }
+        EXPECT_EQ(syscall(SYS_ioprio_get, 1, 0) >> 13, 3);
+    }
+    EXPECT_EQ(syscall(SYS_ioprio_get, 1, 0), previousPriority);
+}
+#endif
+
+// ****************************************************************************
+// * TestFileReader                                                           *
+// ****************************************************************************
+
+namespace {
+    
+void writeTestFile(const std::filesystem::path& filename, size_t size, char seed) {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    for (size_t i = 0; i < size; ++i) {
+        file.put(static_cast<char>(seed + i * 31 % 251));
+    }
+}
+
+#ifdef __linux__
+/**
+ * Returns the fraction of pages from the file that are in the page cache.
+ */
+double getPageCacheResidency(const std::filesystem::path& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    size_t fileSize = static_cast<size_t>(std::filesystem::file_size(filename));
+    void* addr = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> residentPages((fileSize + pageSize - 1) / pageSize);
+    mincore(addr, fileSize, residentPages.data());
+    munmap(addr, fileSize);
+    size_t count = 0;
+    for (unsigned char page : residentPages) {
+        count += page & 1;
+    }
+    return static_cast<double>(count) / static_cast<double>(residentPages.size());
+}
+
+/**
+ * Flushes the file and asks the kernel to drop it from the page cache.
+ */
+void evictFromPageCache(const std::filesystem::path& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+#endif
+
+}
+
+TEST(TestFileReader, ReadModes) {
+    const std::filesystem::path sourcePath = std::filesystem::temp_directory_path() / "backup_tools_test_reader1";
+    const std::filesystem::path destPath = std::filesystem::temp_directory_path() / "backup_tools_test_reader2";
+    writeTestFile(sourcePath, 1000000, 'a');
+    writeTestFile(destPath, 1000000, 'a');
+    
+    for (PageCacheMode mode : {PageCacheMode::Normal, PageCacheMode::DropBehind, PageCacheMode::Direct}) {
+        FileReader reader;
+        ASSERT_TRUE(reader.open(sourcePath, mode));
+        EXPECT_EQ(reader.getSize(), 1000000u);
+        AlignedBuffer buffer(64 * 1024);
+        size_t total = 0, numRead;
+        while ((numRead = reader.read(buffer.data(), buffer.size())) > 0) {
+            for (size_t i = 0; i < numRead; ++i) {
+                ASSERT_EQ(buffer.data()[i], static_cast<char>('a' + (total + i) * 31 % 251));
+            }
+            total += numRead;
+        }
+        EXPECT_EQ(total, 1000000u);
+        
+        FileHandler fileHandler;
+        fileHandler.setPageCacheMode(mode);
+        EXPECT_TRUE(fileHandler.checkFileEquivalence(sourcePath, destPath, true));
+    }
+    
+    writeTestFile(destPath, 1000000, 'b');
+    FileHandler fileHandler;
+    fileHandler.setPageCacheMode(PageCacheMode::Direct);
+    EXPECT_FALSE(fileHandler.checkFileEquivalence(sourcePath, destPath, true));
+    FileReader reader;
+    EXPECT_FALSE(reader.open(std::filesystem::temp_directory_path() / "backup_tools_test_missing", PageCacheMode::DropBehind));
+    EXPECT_THROW(FileReader::parsePageCacheMode("sometimes"), std::runtime_error);
+    
+    std::filesystem::remove(sourcePath);
+    std::filesystem::remove(destPath);
+}
+
+#ifdef __linux__
+TEST(TestFileReader, PageCacheResidency) {
+    const std::filesystem::path sourcePath = std::filesystem::temp_directory_path() / "backup_tools_test_reader1";
+    const std::filesystem::path destPath = std::filesystem::temp_directory_path() / "backup_tools_test_reader2";
+    writeTestFile(sourcePath, 32 * 1024 * 1024, 'a');
+    writeTestFile(destPath, 32 * 1024 * 1024, 'a');
+    evictFromPageCache(sourcePath);
+    evictFromPageCache(destPath);
+    if (getPageCacheResidency(sourcePath) > 0.1) {
+        std::filesystem::remove(sourcePath);
+        std::filesystem::remove(destPath);
+        GTEST_SKIP() << "Filesystem for temporary files does not support dropping pages (tmpfs?).";
+    }
+    
+    FileHandler fileHandler;
+    fileHandler.setPageCacheMode(PageCacheMode::DropBehind);
+    EXPECT_TRUE(fileHandler.checkFileEquivalence(sourcePath, destPath, true));
+    EXPECT_LT(getPageCacheResidency(sourcePath), 0.1);    // Scanning should leave almost nothing behind in the cache.
+    EXPECT_LT(getPageCacheResidency(destPath), 0.1);
+    
+    fileHandler.setPageCacheMode(PageCacheMode::Normal);
+    EXPECT_TRUE(fileHandler.checkFileEquivalence(sourcePath, destPath, true));
+    EXPECT_GT(getPageCacheResidency(sourcePath), 0.5);    // Without dropping, most of the file stays cached.
+    
+    std::filesystem::remove(sourcePath);
+    std::filesystem::remove(destPath);
+}
+#endif
+
+// ****************************************************************************
+// * TestIoScheduler                                                          *
+// ****************************************************************************
+
+TEST(TestIoScheduler, SortPaths) {
+    EXPECT_EQ(IoScheduler::parseIoOrder("name"), IoOrder::Name);
+    EXPECT_EQ(IoScheduler::parseIoOrder("inode"), IoOrder::Inode);
+    EXPECT_EQ(IoScheduler::parseIoOrder("physical"), IoOrder::Physical);
+    EXPECT_THROW(IoScheduler::parseIoOrder("random"), std::runtime_error);
+    
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_scheduler";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directory(tempDir);
+    std::vector<std::filesystem::path> paths;
+    for (char c : std::string("dbeac")) {    // Create files out of name order so the inode order is different.
+        paths.push_back(tempDir / std::string(1, c));
+        writeTestFile(paths.back(), 8192, c);
+    }
+    paths.push_back(tempDir / "missing");
+    
+    IoScheduler nameScheduler(IoOrder::Name);
+    EXPECT_EQ(nameScheduler.sortPaths(paths), std::vector<size_t>({0, 1, 2, 3, 4, 5}));
+    for (IoOrder order : {IoOrder::Inode, IoOrder::Physical}) {    // Every path must show up exactly once.
+        IoScheduler scheduler(order);
+        std::vector<size_t> indices = scheduler.sortPaths(paths);
+        std::sort(indices.begin(), indices.end());
+        EXPECT_EQ(indices, std::vector<size_t>({0, 1, 2, 3, 4, 5}));
+    }
+    #ifdef __linux__
+    IoScheduler inodeScheduler(IoOrder::Inode);
+    std::vector<size_t> indices = inodeScheduler.sortPaths(paths);
+    EXPECT_EQ(indices.front(), 5u);    // Missing files go first.
+    for (size_t i = 2; i < indices.size(); ++i) {
+        struct stat lhs, rhs;
+        ASSERT_EQ(stat(paths[indices[i - 1]].c_str(), &lhs), 0);
+        ASSERT_EQ(stat(paths[indices[i]].c_str(), &rhs), 0);
+        EXPECT_LT(lhs.st_ino, rhs.st_ino);
+    }
+    #endif
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestSnapshot                                                             *
+// ****************************************************************************
+
+TEST(TestSnapshot, FindLatestSnapshot) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_snapshot";
+    std::filesystem::remove_all(tempDir);
+    EXPECT_EQ(Application::findLatestSnapshot(tempDir), std::filesystem::path());
+    std::filesystem::create_directory(tempDir);
+    EXPECT_EQ(Application::findLatestSnapshot(tempDir), std::filesystem::path());
+    
+    for (const char* name : {"2021-05-31_153000", "2021-05-31_153000-9", "2021-05-31_153000-10", "2021-04-30_235959", "2021-05-31_15300", "2021-05-31_153000-", "latest", "2021-05-31_153000-x"}) {
+        std::filesystem::create_directory(tempDir / name);
+    }
+    writeTestFile(tempDir / "2099-01-01_000000", 10, 'a');    // Files are never snapshots.
+    EXPECT_EQ(Application::findLatestSnapshot(tempDir), tempDir / "2021-05-31_153000-10");
+    
+    std::tm time = {};
+    time.tm_year = 2021 - 1900;
+    time.tm_mon = 4;
+    time.tm_mday = 31;
+    time.tm_hour = 15;
+    time.tm_min = 30;
+    time.tm_isdst = -1;
+    const std::time_t snapshotTime = std::mktime(&time);
+    EXPECT_EQ(Application::makeSnapshotPath(tempDir, snapshotTime), tempDir / "2021-05-31_153000-1");
+    time.tm_sec = 1;
+    EXPECT_EQ(Application::makeSnapshotPath(tempDir, std::mktime(&time)), tempDir / "2021-05-31_153001");
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+namespace {
+    
+/**
+ * Returns the options for a forced backup without output or a throttle. The
+ * cache is skipped so that each backup does a full compare.
+ */
+Application::BackupOptions makeTestBackupOptions(DurabilityLevel durability = DurabilityLevel::None, bool resume = false) {
+    Application::BackupOptions options;
+    options.outputLimit = 0;
+    options.displayConfirmation = false;
+    options.skipCache = true;
+    options.fastCompare = false;
+    options.forceBackup = true;
+    options.resumeBackup = resume;
+    options.durability = durability;
+    options.ioThrottle = nullptr;
+    options.ioPriority = IoPriority::Unchanged;
+    options.pageCacheMode = PageCacheMode::Normal;
+    options.ioOrder = IoOrder::Name;
+    options.incremental = false;
+    options.dirtyPaths = nullptr;
+    options.copyQueue = nullptr;
+    options.changeWriter = nullptr;
+    return options;
+}
+
+/**
+ * Runs a forced backup of the config.txt in directory (the backup files in
+ * .backuptools go there too). With resume set, the journal in directory is
+ * finished instead.
+ */
+void runTestBackup(const std::filesystem::path& directory, DurabilityLevel durability = DurabilityLevel::None, bool resume = false) {
+    const Application::BackupOptions options = makeTestBackupOptions(durability, resume);
+    const std::filesystem::path previousPath = std::filesystem::current_path();
+    std::filesystem::current_path(directory);
+    try {
+        Application().startBackup("config.txt", options);
+    } catch (...) {
+        std::filesystem::current_path(previousPath);
+        throw;
+    }
+    std::filesystem::current_path(previousPath);
+}
+
+}
+
+TEST(TestSnapshot, DeletedFileDropped) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_snapshot_drop";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src");
+    writeTestFile(tempDir / "src/a.txt", 10, 'a');
+    writeTestFile(tempDir / "src/b.txt", 10, 'b');
+    std::ofstream(tempDir / "config.txt") << "set snapshot true\nin \"" << (tempDir / "dest").string() << "\" add \"" << (tempDir / "src").string() << "\"\n";
+    
+    runTestBackup(tempDir);
+    const std::filesystem::path firstSnapshot = Application::findLatestSnapshot(tempDir / "dest");
+    ASSERT_FALSE(firstSnapshot.empty());
+    EXPECT_TRUE(std::filesystem::exists(firstSnapshot / "src/b.txt"));
+    
+    std::filesystem::remove(tempDir / "src/b.txt");    // The deletion is the only change, it still needs a new snapshot.
+    runTestBackup(tempDir);
+    const std::filesystem::path secondSnapshot = Application::findLatestSnapshot(tempDir / "dest");
+    ASSERT_NE(secondSnapshot, firstSnapshot);
+    EXPECT_TRUE(std::filesystem::exists(secondSnapshot / "src/a.txt"));
+    EXPECT_FALSE(std::filesystem::exists(secondSnapshot / "src/b.txt"));
+    EXPECT_TRUE(std::filesystem::exists(firstSnapshot / "src/b.txt"));    // Older snapshots keep it.
+    
+    runTestBackup(tempDir);    // Nothing changed since, so no new snapshot.
+    EXPECT_EQ(Application::findLatestSnapshot(tempDir / "dest"), secondSnapshot);
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestFileSyncer                                                           *
+// ****************************************************************************
+
+TEST(TestFileSyncer, ParseDurabilityLevel) {
+    EXPECT_EQ(FileSyncer::parseDurabilityLevel("none"), DurabilityLevel::None);
+    EXPECT_EQ(FileSyncer::parseDurabilityLevel("batch"), DurabilityLevel::Batch);
+    EXPECT_EQ(FileSyncer::parseDurabilityLevel("per-file"), DurabilityLevel::PerFile);
+    EXPECT_THROW(FileSyncer::parseDurabilityLevel("Batch"), std::runtime_error);
+    EXPECT_THROW(FileSyncer::parseDurabilityLevel("perfile"), std::runtime_error);
+    EXPECT_THROW(FileSyncer::parseDurabilityLevel(""), std::runtime_error);
+}
+
+TEST(TestFileSyncer, CommitFile) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_file_syncer";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directory(tempDir);
+    
+    FileSyncer perFileSyncer(DurabilityLevel::PerFile);
+    writeTestFile(tempDir / "a.tmp", 100, 'a');
+    perFileSyncer.commitFile(tempDir / "a.tmp", tempDir / "a.txt", 100);
+    EXPECT_TRUE(std::filesystem::exists(tempDir / "a.txt"));    // Committed right away.
+    EXPECT_FALSE(std::filesystem::exists(tempDir / "a.tmp"));
+    
+    FileSyncer batchSyncer(DurabilityLevel::Batch);
+    writeTestFile(tempDir / "b.tmp", 100, 'b');
+    writeTestFile(tempDir / "c.tmp", 100, 'c');
+    batchSyncer.commitFile(tempDir / "b.tmp", tempDir / "b.txt", 100);
+    batchSyncer.commitFile(tempDir / "c.tmp", tempDir / "c.txt", 100);
+    EXPECT_FALSE(batchSyncer.needsFlush());
+    EXPECT_FALSE(std::filesystem::exists(tempDir / "b.txt"));    // Nothing shows up until the flush.
+    EXPECT_FALSE(std::filesystem::exists(tempDir / "c.txt"));
+    EXPECT_TRUE(std::filesystem::exists(tempDir / "b.tmp"));
+    batchSyncer.flush();
+    EXPECT_TRUE(std::filesystem::exists(tempDir / "b.txt"));
+    EXPECT_TRUE(std::filesystem::exists(tempDir / "c.txt"));
+    EXPECT_FALSE(std::filesystem::exists(tempDir / "b.tmp"));
+    EXPECT_FALSE(std::filesystem::exists(tempDir / "c.tmp"));
+    
+    for (int i = 0; i < 600; ++i) {    // A large batch asks to be flushed.
+        writeTestFile(tempDir / ("d" + std::to_string(i) + ".tmp"), 1, 'd');
+        batchSyncer.commitFile(tempDir / ("d" + std::to_string(i) + ".tmp"), tempDir / ("d" + std::to_string(i) + ".txt"), 1);
+    }
+    EXPECT_TRUE(batchSyncer.needsFlush());
+    batchSyncer.flush();
+    EXPECT_FALSE(batchSyncer.needsFlush());
+    EXPECT_TRUE(std::filesystem::exists(tempDir / "d599.txt"));
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestFileSyncer, BatchCompletedAfterFlush) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_file_syncer_journal";
+    for (DurabilityLevel durability : {DurabilityLevel::Batch, DurabilityLevel::PerFile}) {
+        std::filesystem::remove_all(tempDir);
+        std::filesystem::create_directories(tempDir / "src");
+        std::filesystem::create_directories(tempDir / "dest");
+        writeTestFile(tempDir / "src/a.txt", 10, 'a');
+        std::ofstream(tempDir / "config.txt") << "in \"" << (tempDir / "dest").string() << "\" add \"" << (tempDir / "src").string() << "\"\n";
+        BackupJournal().create(tempDir / ".backuptools/config.txt.journal", {
+            {BackupJournal::Add, tempDir / "src/a.txt", tempDir / "dest/a.txt"},
+            {BackupJournal::Add, tempDir / "src/missing.txt", tempDir / "dest/missing.txt"}    // Fails before the batch gets flushed.
+        });
+        EXPECT_THROW(runTestBackup(tempDir, durability, true), std::runtime_error);
+        
+        BackupJournal journal;
+        ASSERT_TRUE(journal.load(tempDir / ".backuptools/config.txt.journal"));
+        if (durability == DurabilityLevel::Batch) {
+            EXPECT_FALSE(journal.isCompleted(0));    // The copy was never made durable, so it must not be skipped on resume.
+            EXPECT_FALSE(std::filesystem::exists(tempDir / "dest/a.txt"));
+        } else {
+            EXPECT_TRUE(journal.isCompleted(0));
+            EXPECT_TRUE(std::filesystem::exists(tempDir / "dest/a.txt"));
+        }
+        EXPECT_FALSE(journal.isCompleted(1));
+        journal.remove();
+    }
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestBackupJournal, ResumeRefreshesCache) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_resume_cache";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src");
+    std::filesystem::create_directories(tempDir / "dest");
+    writeTestFile(tempDir / "src/a.txt", 10, 'a');
+    std::ofstream(tempDir / "config.txt") << "in \"" << (tempDir / "dest").string() << "\" add \"" << (tempDir / "src").string() << "\"\n";
+    BackupJournal().create(tempDir / ".backuptools/config.txt.journal", {
+        {BackupJournal::Add, tempDir / "src/a.txt", tempDir / "dest/a.txt"}
+    });
+    
+    Application::BackupOptions options = makeTestBackupOptions(DurabilityLevel::None, true);
+    options.skipCache = false;
+    const std::filesystem::path previousPath = std::filesystem::current_path();
+    std::filesystem::current_path(tempDir);
+    Application().startBackup("config.txt", options);
+    std::filesystem::current_path(previousPath);
+    EXPECT_TRUE(std::filesystem::exists(tempDir / "dest/a.txt"));
+    EXPECT_FALSE(std::filesystem::exists(tempDir / ".backuptools/config.txt.journal"));
+    
+    FileHandler fileHandler;    // The check after the resumed operations saves the copied file in the cache.
+    ASSERT_TRUE(fileHandler.loadCacheFile(tempDir / ".backuptools/config.txt.cache", std::filesystem::last_write_time(tempDir / "config.txt")));
+    EXPECT_TRUE(fileHandler.isEquivalenceCached(tempDir / "src/a.txt", tempDir / "dest/a.txt"));
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestChunkStore                                                           *
+// ****************************************************************************
+
+TEST(TestChunkStore, Sha256) {
+    EXPECT_EQ(Sha256::toHex(Sha256::hash("", 0)), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(Sha256::toHex(Sha256::hash("abc", 3)), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    const std::string message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    EXPECT_EQ(Sha256::toHex(Sha256::hash(message.data(), message.length())), "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    
+    Sha256 sha;
+    for (char c : message) {
+        sha.update(&c, 1);
+    }
+    EXPECT_EQ(Sha256::toHex(sha.finish()), "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    EXPECT_EQ(Sha256::toHex(sha.finish()), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");    // Object resets after finish().
+}
+
+TEST(TestChunkStore, DeduplicateShiftedData) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_chunk_store";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src");
+    
+    std::mt19937 rng(1234);
+    std::string data(2 * 1024 * 1024, '\0');
+    for (char& c : data) {
+        c = static_cast<char>(rng());
+    }
+    std::ofstream(tempDir / "src" / "a.bin", std::ios::binary) << data;
+    std::ofstream(tempDir / "src" / "b.bin", std::ios::binary) << "inserted at the start" << data;
+    
+    ChunkStore store(tempDir / "store");
+    EXPECT_TRUE(ChunkStore::isStore(tempDir / "store"));
+    store.discardPending();
+    store.storeDirectory("src");
+    store.storeFile(tempDir / "src" / "a.bin", "src/a.bin", nullptr, PageCacheMode::Normal);
+    store.storeFile(tempDir / "src" / "b.bin", "src/b.bin", nullptr, PageCacheMode::Normal);
+    FileSyncer syncer(DurabilityLevel::None);
+    const std::filesystem::path snapshotPath = store.getSnapshotsPath() / "2021-05-31_153000";
+    store.commitSnapshot(snapshotPath, syncer);
+    
+    ChunkStore reopenedStore(tempDir / "store");
+    const ChunkStore::Manifest& manifest = reopenedStore.loadManifest(snapshotPath);
+    ASSERT_EQ(manifest.size(), 3u);
+    const ChunkStore::ManifestEntry& a = manifest.at("src/a.bin");
+    const ChunkStore::ManifestEntry& b = manifest.at("src/b.bin");
+    EXPECT_TRUE(manifest.at("src").isDirectory);
+    EXPECT_EQ(a.size, data.size());
+    EXPECT_EQ(a.digest, Sha256::hash(data.data(), data.size()));
+    EXPECT_GT(a.chunks.size(), 8u);
+    std::set<ChunkStore::Digest> uniqueChunks(a.chunks.begin(), a.chunks.end());
+    uniqueChunks.insert(b.chunks.begin(), b.chunks.end());
+    EXPECT_LE(uniqueChunks.size(), a.chunks.size() + 2);    // Only the chunks around the inserted bytes should differ.
+    uintmax_t packSize = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(tempDir / "store" / "packs")) {
+        packSize += std::filesystem::file_size(entry.path());
+    }
+    EXPECT_LT(packSize, data.size() + ChunkStore::MAX_CHUNK_SIZE * 2);
+    
+    for (size_t offset = 0; offset < data.size(); ) {    // Chunk sizes stay within the limits.
+        const size_t chunkSize = ChunkStore::findChunkBoundary(reinterpret_cast<const uint8_t*>(data.data()) + offset, data.size() - offset);
+        offset += chunkSize;
+        if (offset < data.size()) {
+            EXPECT_GT(chunkSize, ChunkStore::MIN_CHUNK_SIZE);
+            EXPECT_LE(chunkSize, ChunkStore::MAX_CHUNK_SIZE);
+        }
+    }
+    
+    reopenedStore.restoreSnapshot(snapshotPath, tempDir / "out");
+    std::ifstream restoredFile(tempDir / "out" / "src" / "b.bin", std::ios::binary);
+    std::string restoredData((std::istreambuf_iterator<char>(restoredFile)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(restoredData, "inserted at the start" + data);
+    restoredFile.close();
+    
+    EXPECT_THROW(ChunkStore(tempDir / "src"), std::runtime_error);    // Directory is not empty and not a store.
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestChunkStore, RestoreRejectsUnsafePaths) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_chunk_store_restore";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir);
+    writeTestFile(tempDir / "a.txt", 10, 'a');
+    
+    FileSyncer syncer(DurabilityLevel::None);
+    for (const char* relativePath : {"../escape.txt", "/tmp/escape.txt", "dir/../../escape.txt"}) {
+        std::filesystem::remove_all(tempDir / "store");
+        ChunkStore store(tempDir / "store");
+        store.storeFile(tempDir / "a.txt", "b.txt", nullptr, PageCacheMode::Normal);
+        store.storeFile(tempDir / "a.txt", relativePath, nullptr, PageCacheMode::Normal);    // Like a damaged manifest.
+        const std::filesystem::path snapshotPath = store.getSnapshotsPath() / "2021-05-31_153000";
+        store.commitSnapshot(snapshotPath, syncer);
+        
+        EXPECT_THROW(store.restoreSnapshot(snapshotPath, tempDir / "out"), std::runtime_error) << relativePath;
+        EXPECT_FALSE(std::filesystem::exists(tempDir / "out" / "b.txt"));    // Nothing is written.
+        EXPECT_FALSE(std::filesystem::exists(tempDir / "escape.txt"));
+    }
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestChunkStore, DeletedFileDropped) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_chunk_store_drop";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src");
+    writeTestFile(tempDir / "src/a.txt", 10, 'a');
+    writeTestFile(tempDir / "src/b.txt", 10, 'b');
+    std::ofstream(tempDir / "config.txt") << "set chunk-store true\nin \"" << (tempDir / "store").string() << "\" add \"" << (tempDir / "src").string() << "\"\n";
+    
+    runTestBackup(tempDir);
+    const std::filesystem::path firstSnapshot = Application::findLatestSnapshot(tempDir / "store/snapshots");
+    ASSERT_FALSE(firstSnapshot.empty());
+    EXPECT_EQ(ChunkStore(tempDir / "store").loadManifest(firstSnapshot).count("src/b.txt"), 1u);
+    
+    std::filesystem::remove(tempDir / "src/b.txt");    // The deletion is the only change, it still needs a new manifest.
+    runTestBackup(tempDir);
+    const std::filesystem::path secondSnapshot = Application::findLatestSnapshot(tempDir / "store/snapshots");
+    ASSERT_NE(secondSnapshot, firstSnapshot);
+    ChunkStore store(tempDir / "store");
+    EXPECT_EQ(store.loadManifest(secondSnapshot).count("src/a.txt"), 1u);
+    EXPECT_EQ(store.loadManifest(secondSnapshot).count("src/b.txt"), 0u);
+    EXPECT_EQ(store.loadManifest(firstSnapshot).count("src/b.txt"), 1u);
+    
+    runTestBackup(tempDir);    // Nothing changed since, so no new manifest.
+    EXPECT_EQ(Application::findLatestSnapshot(tempDir / "store/snapshots"), secondSnapshot);
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestChunkStore, StoreCompletedWithCommit) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_chunk_store_journal";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src");
+    writeTestFile(tempDir / "src/a.txt", 10, 'a');
+    std::ofstream(tempDir / "config.txt") << "set chunk-store true\nin \"" << (tempDir / "store").string() << "\" add \"" << (tempDir / "src").string() << "\"\n";
+    
+    Application::FileChanges changes = Application().checkBackup(tempDir / "config.txt", [] {
+        Application::BackupOptions options = {};
+        options.forceBackup = true;    // Nothing gets printed.
+        options.skipCache = true;
+        return options;
+    }());
+    EXPECT_FALSE(std::filesystem::exists(tempDir / "store"));    // A check does not create the store.
+    ASSERT_EQ(changes.storeCommits.size(), 1u);
+    
+    ChunkStore(tempDir / "store").discardPending();
+    const std::filesystem::path snapshotPath = changes.storeCommits.begin()->second;
+    const std::vector<BackupJournal::Operation> operations = {
+        {BackupJournal::Store, tempDir / "src/a.txt", tempDir / "store/src/a.txt"},
+        {BackupJournal::Store, tempDir / "src/missing.txt", tempDir / "store/src/missing.txt"},
+        {BackupJournal::Commit, tempDir / "store", snapshotPath}
+    };
+    BackupJournal().create(tempDir / ".backuptools/config.txt.journal", operations);
+    EXPECT_THROW(runTestBackup(tempDir, DurabilityLevel::PerFile, true), std::runtime_error);
+    BackupJournal journal;
+    ASSERT_TRUE(journal.load(tempDir / ".backuptools/config.txt.journal"));
+    EXPECT_FALSE(journal.isCompleted(0));    // The stored file is not in a committed snapshot yet.
+    journal.remove();
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestCompressor                                                           *
+// ****************************************************************************
+
+TEST(TestCompressor, BlockRoundTrip) {
+    std::mt19937 rng(5678);
+    std::vector<std::vector<uint8_t>> blocks;
+    blocks.push_back({});
+    blocks.push_back({'a'});
+    blocks.push_back(std::vector<uint8_t>(13, 'b'));
+    blocks.push_back(std::vector<uint8_t>(Compressor::BLOCK_SIZE, 0));
+    std::vector<uint8_t> text;
+    while (text.size() < Compressor::BLOCK_SIZE) {
+        const std::string line = "line " + std::to_string(rng() % 1000) + " of a repetitive log file\n";
+        text.insert(text.end(), line.begin(), line.end());
+    }
+    text.resize(Compressor::BLOCK_SIZE);
+    blocks.push_back(text);
+    std::vector<uint8_t> random(100000);
+    for (uint8_t& x : random) {
+        x = static_cast<uint8_t>(rng());
+    }
+    blocks.push_back(random);
+    
+    for (const auto& block : blocks) {
+        std::vector<uint8_t> compressed(block.size() + block.size() / 255 + 16);
+        const size_t compressedSize = Compressor::compressBlock(block.data(), block.size(), compressed.data(), compressed.size());
+        ASSERT_GT(compressedSize, 0u);
+        std::vector<uint8_t> output(block.size());
+        EXPECT_TRUE(Compressor::decompressBlock(compressed.data(), compressedSize, output.data(), output.size()));
+        EXPECT_EQ(output, block);
+        if (block.size() > 1) {
+            EXPECT_FALSE(Compressor::decompressBlock(compressed.data(), compressedSize - 1, output.data(), output.size()));    // Truncated data is detected.
+        }
+    }
+    EXPECT_LT(Compressor::compressBlock(blocks[3].data(), blocks[3].size(), std::vector<uint8_t>(blocks[3].size()).data(), blocks[3].size()), 2000u);
+    std::vector<uint8_t> small(random.size() - 1);
+    EXPECT_EQ(Compressor::compressBlock(random.data(), random.size(), small.data(), small.size()), 0u);    // Random data does not fit in less space.
+    
+    EXPECT_TRUE(Compressor::isAlreadyCompressed(reinterpret_cast<const uint8_t*>("\x89PNG\r\n\x1a\n"), 8));
+    EXPECT_TRUE(Compressor::isAlreadyCompressed(reinterpret_cast<const uint8_t*>("\0\0\0\x18" "ftypmp42"), 12));
+    EXPECT_FALSE(Compressor::isAlreadyCompressed(text.data(), text.size()));
+    EXPECT_FALSE(Compressor::isAlreadyCompressed(reinterpret_cast<const uint8_t*>("\x1f"), 1));
+}
+
+TEST(TestCompressor, CompressedFileEquivalence) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_compressor";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directory(tempDir);
+    
+    std::string text;
+    for (int i = 0; text.size() < Compressor::BLOCK_SIZE * 3 + 100; ++i) {
+        text += "entry " + std::to_string(i % 777) + " has some text\n";
+    }
+    std::ofstream(tempDir / "source.txt", std::ios::binary) << text;
+    ASSERT_TRUE(Compressor::compressFile(tempDir / "source.txt", tempDir / "compressed", nullptr, PageCacheMode::Normal));
+    EXPECT_LT(std::filesystem::file_size(tempDir / "compressed"), text.size() / 4);
+    Compressor::Header header;
+    ASSERT_TRUE(Compressor::readHeader(tempDir / "compressed", header));
+    EXPECT_EQ(header.size, text.size());
+    EXPECT_EQ(header.digest, Sha256::hash(text.data(), text.size()));
+    
+    FileHandler fileHandler;
+    EXPECT_TRUE(fileHandler.checkFileEquivalence(tempDir / "source.txt", tempDir / "compressed", true, false, true));
+    EXPECT_TRUE(fileHandler.checkFileEquivalence(tempDir / "compressed", tempDir / "source.txt", true, false, true));
+    EXPECT_FALSE(fileHandler.checkFileEquivalence(tempDir / "source.txt", tempDir / "compressed", true));    // Headers are only checked for destinations with compression or decompression.
+    EXPECT_FALSE(fileHandler.checkFileEquivalence(tempDir / "compressed", tempDir / "source.txt", true));
+    text[text.size() / 2] = '!';
+    std::ofstream(tempDir / "changed.txt", std::ios::binary) << text;
+    EXPECT_FALSE(fileHandler.checkFileEquivalence(tempDir / "changed.txt", tempDir / "compressed", true, false, true));
+    
+    ASSERT_TRUE(Compressor::decompressFile(tempDir / "compressed", tempDir / "restored.txt", nullptr));
+    EXPECT_TRUE(fileHandler.checkFileEquivalence(tempDir / "source.txt", tempDir / "restored.txt", true));
+    EXPECT_EQ(std::filesystem::file_size(tempDir / "restored.txt"), header.size);
+    EXPECT_FALSE(Compressor::decompressFile(tempDir / "source.txt", tempDir / "unused", nullptr));
+    
+    writeTestFile(tempDir / "archive.gz", 1000, '\0');
+    std::fstream(tempDir / "archive.gz", std::ios::binary | std::ios::in | std::ios::out) << "\x1f\x8b";
+    EXPECT_FALSE(Compressor::compressFile(tempDir / "archive.gz", tempDir / "unused", nullptr, PageCacheMode::Normal));
+    EXPECT_FALSE(std::filesystem::exists(tempDir / "unused"));
+    
+    std::fstream corruptFile(tempDir / "compressed", std::ios::binary | std::ios::in | std::ios::out);
+    corruptFile.seekp(Compressor::HEADER_SIZE + 100);
+    corruptFile.put('\xff');
+    corruptFile.close();
+    EXPECT_THROW(Compressor::decompressFile(tempDir / "compressed", tempDir / "restored.txt", nullptr), std::runtime_error);
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestCompressor, RestoreWithDecompress) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_compressor_restore";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src");
+    std::filesystem::create_directories(tempDir / "plain");
+    std::filesystem::create_directories(tempDir / "restore");
+    std::string text;
+    for (int i = 0; text.size() < 100000; ++i) {
+        text += "line " + std::to_string(i % 100) + "\n";
+    }
+    std::ofstream(tempDir / "src/a.txt", std::ios::binary) << text;
+    std::ofstream(tempDir / "config.txt") << "set compress true\nin \"" << (tempDir / "backup").string() << "\" add \"" << (tempDir / "src").string() << "\"\n";
+    runTestBackup(tempDir);
+    Compressor::Header header;
+    ASSERT_TRUE(Compressor::readHeader(tempDir / "backup/src/a.txt", header));
+    
+    std::ofstream(tempDir / "plain/config.txt") << "in \"" << (tempDir / "plain/out").string() << "\" add \"" << (tempDir / "backup").string() << "\"\n";
+    runTestBackup(tempDir / "plain");    // Without decompress, the files are copied as they are.
+    EXPECT_TRUE(Compressor::readHeader(tempDir / "plain/out/backup/src/a.txt", header));
+    std::ofstream(tempDir / "plain/out/backup/src/a.txt", std::ios::binary | std::ios::trunc) << text;
+    runTestBackup(tempDir / "plain");    // The header is not checked either, so the decompressed file is a modification.
+    EXPECT_TRUE(Compressor::readHeader(tempDir / "plain/out/backup/src/a.txt", header));
+    
+    std::ofstream(tempDir / "restore/config.txt") << "set decompress true\nin \"" << (tempDir / "restore/out").string() << "\" add \"" << (tempDir / "backup").string() << "\"\n";
+    runTestBackup(tempDir / "restore");
+    std::ifstream restoredFile(tempDir / "restore/out/backup/src/a.txt", std::ios::binary);
+    const std::string restoredData((std::istreambuf_iterator<char>(restoredFile)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(restoredData, text);
+    restoredFile.close();
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestFanOut                                                               *
+// ****************************************************************************
+
+TEST(TestFanOut, CompareMultipleDests) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_fan_out";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directory(tempDir);
+    
+    writeTestFile(tempDir / "source", 600 * 1024, 'a');
+    writeTestFile(tempDir / "same1", 600 * 1024, 'a');
+    writeTestFile(tempDir / "same2", 600 * 1024, 'a');
+    writeTestFile(tempDir / "changed", 600 * 1024, 'a');
+    std::fstream(tempDir / "changed", std::ios::binary | std::ios::in | std::ios::out).seekp(500 * 1024).put('b');
+    writeTestFile(tempDir / "shorter", 1000, 'a');
+    
+    FileHandler fileHandler;
+    const std::vector<bool> results = fileHandler.checkFileEquivalence(tempDir / "source", {tempDir / "same1", tempDir / "changed", tempDir / "shorter", tempDir / "same2"}, true);
+    EXPECT_EQ(results, std::vector<bool>({true, false, false, true}));
+    EXPECT_TRUE(fileHandler.checkFileEquivalence(tempDir / "source", std::vector<std::filesystem::path>()).empty());
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestFanOut, CacheKeyedByBothPaths) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_fan_out";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directory(tempDir);
+    writeTestFile(tempDir / "source", 1000, 'a');
+    writeTestFile(tempDir / "same", 1000, 'a');
+    writeTestFile(tempDir / "changed", 1000, 'b');
+    std::filesystem::last_write_time(tempDir / "changed", std::filesystem::last_write_time(tempDir / "same"));    // Only the path tells these apart in the cache.
+    
+    FileHandler fileHandler;
+    EXPECT_TRUE(fileHandler.checkFileEquivalence(tempDir / "source", tempDir / "same"));
+    EXPECT_TRUE(fileHandler.isEquivalenceCached(tempDir / "source", tempDir / "same"));
+    EXPECT_FALSE(fileHandler.isEquivalenceCached(tempDir / "source", tempDir / "changed"));
+    EXPECT_FALSE(fileHandler.checkFileEquivalence(tempDir / "source", tempDir / "changed"));
+    EXPECT_EQ(fileHandler.checkFileEquivalence(tempDir / "source", {tempDir / "same", tempDir / "changed"}), std::vector<bool>({true, false}));    // Same entries for multiple destinations.
+    
+    const std::filesystem::file_time_type configTime = std::filesystem::last_write_time(tempDir / "source");
+    fileHandler.saveCacheFile(tempDir / "cache", configTime);
+    FileHandler loadedHandler;
+    ASSERT_TRUE(loadedHandler.loadCacheFile(tempDir / "cache", configTime));
+    EXPECT_TRUE(loadedHandler.isEquivalenceCached(tempDir / "source", tempDir / "same"));
+    EXPECT_TRUE(loadedHandler.isEquivalenceCached(tempDir / "source", tempDir / "changed"));
+    EXPECT_FALSE(loadedHandler.checkFileEquivalence(tempDir / "source", tempDir / "changed"));
+    
+    std::ofstream oldCacheFile(tempDir / "old_cache", std::ios::binary);    // Format without a header, starts with the config time.
+    oldCacheFile.write(reinterpret_cast<const char*>(&configTime), sizeof(configTime));
+    oldCacheFile.put('\n');
+    oldCacheFile.close();
+    EXPECT_FALSE(loadedHandler.loadCacheFile(tempDir / "old_cache", configTime));
+    EXPECT_FALSE(loadedHandler.isEquivalenceCached(tempDir / "source", tempDir / "same"));
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestFanOut, ConfigMultipleDests) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_fan_out";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src/sub");
+    writeTestFile(tempDir / "src/a.txt", 10, 'a');
+    writeTestFile(tempDir / "src/sub/b.txt", 10, 'b');
+    
+    const std::string config = "root SRC \"" + (tempDir / "src").string() + "\"\n"
+        "in \"" + (tempDir / "dest1").string() + "\" add SRC\n"
+        "in \"" + (tempDir / "dest2").string() + "\" add SRC\n"
+        "set fan-out true\n"
+        "in \"" + (tempDir / "dest3").string() + "\" add SRC\n"
+        "in \"" + (tempDir / "dest4").string() + "\" add SRC\n"
+        "in \"" + (tempDir / "dest4").string() + "\" add SRC/a.txt\n";
+    std::ofstream(tempDir / "config.txt") << config;
+    
+    FileHandler fileHandler;
+    fileHandler.loadConfigFile(tempDir / "config.txt");
+    std::map<std::filesystem::path, std::set<std::filesystem::path>> trackedPaths;
+    for (WriteReadPathTree pathTree = fileHandler.nextWriteReadPathTree(); !pathTree.isEmpty(); pathTree = fileHandler.nextWriteReadPathTree()) {
+        trackedPaths[pathTree.writePrefix.filename()].insert(pathTree.relativePaths.begin(), pathTree.relativePaths.end());
+    }
+    const std::filesystem::path src = "src";
+    const std::set<std::filesystem::path> allPaths = {src, src / "a.txt", src / "sub", src / "sub" / "b.txt"};
+    EXPECT_EQ(trackedPaths["dest1"], allPaths);
+    EXPECT_TRUE(trackedPaths["dest2"].empty());    // Added before fan-out was set, so the paths stay with dest1.
+    EXPECT_EQ(trackedPaths["dest3"], allPaths);
+    EXPECT_EQ(trackedPaths["dest4"], allPaths);    // The second add for dest4 is a duplicate and gets skipped.
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestDirectoryWatcher                                                     *
+// ****************************************************************************
+
+#ifdef __linux__
+TEST(TestDirectoryWatcher, DirtyPaths) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_watcher";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "sub");
+    writeTestFile(tempDir / "sub/a.txt", 10, 'a');
+    
+    DirectoryWatcher watcher;
+    ASSERT_TRUE(watcher.addWatchRecursive(tempDir));
+    EXPECT_EQ(watcher.getNumWatches(), 2u);
+    std::set<std::filesystem::path> dirtyPaths;
+    EXPECT_FALSE(watcher.waitForChanges(std::chrono::milliseconds(0), dirtyPaths));
+    
+    writeTestFile(tempDir / "sub/a.txt", 20, 'b');
+    std::filesystem::create_directories(tempDir / "new/deep");
+    writeTestFile(tempDir / "new/deep/b.txt", 10, 'c');
+    std::filesystem::remove(tempDir / "sub/a.txt");
+    EXPECT_TRUE(watcher.waitForChanges(std::chrono::milliseconds(1000), dirtyPaths));
+    while (watcher.waitForChanges(std::chrono::milliseconds(50), dirtyPaths)) {}
+    EXPECT_EQ(dirtyPaths, std::set<std::filesystem::path>({tempDir / "new", tempDir / "sub/a.txt"}));
+    EXPECT_EQ(watcher.getNumWatches(), 4u);    // New directories get watched too.
+    EXPECT_FALSE(watcher.checkOverflow());
+    
+    dirtyPaths.clear();
+    writeTestFile(tempDir / "new/deep/c.txt", 10, 'd');
+    EXPECT_TRUE(watcher.waitForChanges(std::chrono::milliseconds(1000), dirtyPaths));
+    EXPECT_EQ(dirtyPaths, std::set<std::filesystem::path>({tempDir / "new/deep/c.txt"}));
+    
+    std::filesystem::remove_all(tempDir / "new");
+    while (watcher.waitForChanges(std::chrono::milliseconds(50), dirtyPaths)) {}
+    EXPECT_EQ(watcher.getNumWatches(), 2u);
+    
+    std::filesystem::remove_all(tempDir);
+}
+#endif
+
+// ****************************************************************************
+// * TestTreeState                                                            *
+// ****************************************************************************
+
+TEST(TestTreeState, ReuseUnchangedListings) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_tree_state";
+    const std::filesystem::path stateFilename = std::filesystem::temp_directory_path() / "backup_tools_test_tree_state.tree";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "a");
+    std::filesystem::create_directories(tempDir / "b");
+    writeTestFile(tempDir / "a/file1", 10, 'a');
+    std::filesystem::create_directory_symlink("a", tempDir / "link");
+    const auto oldTime = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);    // Recent changes are never trusted.
+    for (const auto& p : {tempDir, tempDir / "a", tempDir / "b"}) {
+        std::filesystem::last_write_time(p, oldTime);
+    }
+    
+    auto getNames = [](const std::vector<TreeState::Entry>& entries) {
+        std::map<std::string, TreeState::EntryType> names;
+        for (const auto& entry : entries) {
+            names.emplace(entry.name, entry.type);
+        }
+        return names;
+    };
+    std::map<std::string, TreeState::EntryType> rootNames;
+    {
+        TreeState treeState;
+        EXPECT_FALSE(treeState.load(tempDir / "missing.tree"));
+        rootNames = getNames(treeState.listDirectory(tempDir));
+        EXPECT_EQ(rootNames, (std::map<std::string, TreeState::EntryType>({{"a", TreeState::EntryType::Directory}, {"b", TreeState::EntryType::Directory}, {"link", TreeState::EntryType::Symlink}})));
+        treeState.listDirectory(tempDir / "a");
+        treeState.listDirectory(tempDir / "b");
+        EXPECT_EQ(treeState.getNumListed(), 3u);
+        EXPECT_EQ(treeState.getNumReused(), 0u);
+        treeState.save(stateFilename);
+    }
+    
+    writeTestFile(tempDir / "a/file2", 10, 'b');
+    TreeState treeState;
+    ASSERT_TRUE(treeState.load(stateFilename));
+    EXPECT_EQ(getNames(treeState.listDirectory(tempDir)), rootNames);
+    EXPECT_EQ(getNames(treeState.listDirectory(tempDir / "a")), (std::map<std::string, TreeState::EntryType>({{"file1", TreeState::EntryType::File}, {"file2", TreeState::EntryType::File}})));
+    EXPECT_TRUE(treeState.listDirectory(tempDir / "b").empty());
+    EXPECT_EQ(treeState.getNumListed(), 1u);    // Only the modified directory gets listed again.
+    EXPECT_EQ(treeState.getNumReused(), 2u);
+    EXPECT_THROW(treeState.listDirectory(tempDir / "missing"), std::filesystem::filesystem_error);
+    
+    std::filesystem::resize_file(stateFilename, std::filesystem::file_size(stateFilename) - 3);
+    EXPECT_FALSE(treeState.load(stateFilename));
+    
+    std::filesystem::remove(stateFilename);
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestTreeState, StartScanKeepsListings) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_tree_state_scan";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "a");
+    writeTestFile(tempDir / "a/file1", 10, 'a');
+    const auto oldTime = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    for (const auto& p : {tempDir, tempDir / "a"}) {
+        std::filesystem::last_write_time(p, oldTime);
+    }
+    
+    TreeState treeState;
+    std::unique_ptr<DirectoryWatcher> watcher;
+    if (DirectoryWatcher::isSupported()) {
+        watcher = std::make_unique<DirectoryWatcher>();
+        treeState.setWatcher(watcher.get());
+    }
+    treeState.listDirectory(tempDir);
+    treeState.listDirectory(tempDir / "a");
+    EXPECT_EQ(treeState.getNumListed(), 2u);
+    
+    treeState.startScan();
+    EXPECT_EQ(treeState.listDirectory(tempDir / "a").size(), 1u);
+    EXPECT_EQ(treeState.getNumListed(), 0u);
+    EXPECT_EQ(treeState.getNumReused(), 1u);
+    
+    writeTestFile(tempDir / "a/file1", 10, 'b');    // Changes to files do not modify the directory, but the watcher sees them.
+    if (watcher) {
+        std::set<std::filesystem::path> dirtyPaths;
+        EXPECT_TRUE(watcher->waitForChanges(std::chrono::milliseconds(1000), dirtyPaths));
+        EXPECT_EQ(dirtyPaths.count(tempDir / "a/file1"), 1u);
+        EXPECT_FALSE(watcher->checkOverflow());
+    }
+    
+    writeTestFile(tempDir / "a/file2", 10, 'b');
+    treeState.startScan();
+    EXPECT_EQ(treeState.listDirectory(tempDir / "a").size(), 2u);
+    EXPECT_EQ(treeState.getNumListed(), 1u);
+    EXPECT_EQ(treeState.getNumReused(), 0u);
+    
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestStats                                                                *
+// ****************************************************************************
+
+TEST(TestStats, TimersAndCounters) {
+    Stats::setEnabled(false);
+    Stats::add(Stats::BytesRead, 100);
+    Stats::setEnabled(true);
+    EXPECT_EQ(Stats::get(Stats::BytesRead), 0u);
+    Stats::add(Stats::BytesRead, 100);
+    Stats::add(Stats::CacheHits);
+    Stats::add(Stats::CacheHits);
+    EXPECT_EQ(Stats::get(Stats::BytesRead), 100u);
+    EXPECT_EQ(Stats::get(Stats::CacheHits), 2u);
+    
+    {
+        Stats::ScopedTimer outerTimer(Stats::DetectRenames);
+        Stats::ScopedTimer innerTimer(Stats::CompareFiles);    // Pauses the outer timer.
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    EXPECT_GE(Stats::getTime(Stats::CompareFiles), std::chrono::milliseconds(50));
+    EXPECT_LT(Stats::getTime(Stats::DetectRenames), std::chrono::milliseconds(25));
+    
+    std::ostringstream jsonOutput;
+    Stats::print(jsonOutput, true);
+    EXPECT_EQ(jsonOutput.str().rfind("{\"phases\":{\"parse_cache\":", 0), 0u);
+    EXPECT_NE(jsonOutput.str().find("\"bytes_read\":100,"), std::string::npos);
+    EXPECT_NE(jsonOutput.str().find("\"cache_hits\":2,"), std::string::npos);
+    
+    Stats::setEnabled(false);
+    {
+        Stats::ScopedTimer timer(Stats::SaveCache);
+    }
+    Stats::add(Stats::CacheHits);
+    EXPECT_EQ(Stats::get(Stats::CacheHits), 2u);
+    EXPECT_EQ(Stats::getTime(Stats::SaveCache), std::chrono::nanoseconds(0));
+    
+    Stats::setEnabled(true);
+    std::thread([]() {    // Overlaps with the time of this thread, so it counts towards the phase but does not reduce "other".
+        Stats::ScopedTimer timer(Stats::FileOperations);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }).join();
+    EXPECT_GE(Stats::getTime(Stats::FileOperations), std::chrono::milliseconds(50));
+    jsonOutput.str("");
+    Stats::print(jsonOutput, true);
+    const size_t otherIndex = jsonOutput.str().find("\"other\":");
+    ASSERT_NE(otherIndex, std::string::npos);
+    EXPECT_GE(std::stod(jsonOutput.str().substr(otherIndex + 8)), 0.045);
+    
+    {
+        Stats::ScopedEnable statsEnable(true);
+        EXPECT_TRUE(Stats::isEnabled());
+        Stats::add(Stats::CacheHits);
+    }
+    EXPECT_FALSE(Stats::isEnabled());
+    EXPECT_EQ(Stats::get(Stats::CacheHits), 1u);    // Results are kept after disabling.
+    {
+        Stats::ScopedEnable statsEnable(false);
+        EXPECT_FALSE(Stats::isEnabled());
+    }
+}
+
+// ****************************************************************************
+// * TestTreeGenerator                                                        *
+// ****************************************************************************
+
+TEST(TestTreeGenerator, DeterministicTrees) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_generator";
+    std::filesystem::remove_all(tempDir);
+    
+    auto listTree = [](const std::filesystem::path& root) {
+        std::map<std::string, std::string> tree;    // Relative path and contents, directories have "<dir>".
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(root)) {
+            std::string contents = "<dir>";
+            if (!entry.is_directory()) {
+                std::ifstream file(entry.path(), std::ios::binary);
+                contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            }
+            tree.emplace(entry.path().lexically_relative(root).string(), contents);
+        }
+        return tree;
+    };
+    
+    TreeGenerator::Options options;
+    options.depth = 2;
+    options.fanOut = 3;
+    options.filesPerDirectory = 5;
+    options.medianFileSize = 100;
+    options.hiddenRatio = 0.2;
+    options.duplicateRatio = 0.2;
+    EXPECT_EQ(TreeGenerator::countFiles(options), 65u);
+    const auto totals = TreeGenerator(42).generate(tempDir / "a", options);
+    TreeGenerator(42).generate(tempDir / "b", options);
+    TreeGenerator(43).generate(tempDir / "c", options);
+    EXPECT_EQ(totals.numFiles, 65u);
+    EXPECT_EQ(totals.numDirectories, 12u);
+    EXPECT_GT(totals.numDuplicates, 0u);
+    EXPECT_EQ(listTree(tempDir / "a"), listTree(tempDir / "b"));
+    EXPECT_NE(listTree(tempDir / "a"), listTree(tempDir / "c"));
+    
+    TreeGenerator::Mutations mutations;
+    mutations.numAdds = 4;
+    mutations.numDeletes = 3;
+    mutations.numModifies = 2;
+    mutations.numRenames = 5;
+    const auto before = listTree(tempDir / "a");
+    TreeGenerator(7).mutate(tempDir / "a", mutations, options);
+    TreeGenerator(7).mutate(tempDir / "b", mutations, options);
+    const auto after = listTree(tempDir / "a");
+    EXPECT_EQ(after, listTree(tempDir / "b"));
+    size_t numFilesAfter = 0, numUnchanged = 0;
+    for (const auto& [name, contents] : after) {
+        if (contents != "<dir>") {
+            ++numFilesAfter;
+            auto found = before.find(name);
+            numUnchanged += (found != before.end() && found->second == contents);
+        }
+    }
+    EXPECT_EQ(numFilesAfter, 65u + 4u - 3u);
+    EXPECT_EQ(numUnchanged, 65u - 3u - 2u - 5u);
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestTreeGenerator, FileSizes) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_generator";
+    std::filesystem::remove_all(tempDir);
+    TreeGenerator::Options options;
+    options.depth = 0;
+    options.filesPerDirectory = 1001;
+    options.medianFileSize = 1000;
+    options.fileSizeSigma = 1.0;
+    options.maxFileSize = 100000;
+    options.hiddenRatio = 0.0;
+    options.duplicateRatio = 0.0;
+    const auto totals = TreeGenerator(42).generate(tempDir / "a", options);
+    EXPECT_EQ(totals.numBytes, 1633081u);    // Integer math only, so this is the same everywhere.
+    size_t numBelowMedian = 0, numAboveSigma = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(tempDir / "a")) {
+        const uintmax_t size = entry.file_size();
+        EXPECT_LE(size, options.maxFileSize);
+        numBelowMedian += (size < 1000);
+        numAboveSigma += (size > 2718);    // One standard deviation above is e times the median, about 16% of the files.
+    }
+    EXPECT_NEAR(static_cast<double>(numBelowMedian), 500.0, 60.0);
+    EXPECT_NEAR(static_cast<double>(numAboveSigma), 159.0, 40.0);
+    
+    options.fileSizeSigma = 0.0;
+    const auto medianTotals = TreeGenerator(42).generate(tempDir / "b", options);
+    EXPECT_EQ(medianTotals.numBytes, 1001u * 1000u);
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestMultipleConfigs                                                      *
+// ****************************************************************************
+
+TEST(TestMultipleConfigs, SeparateGlobOptions) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_multiple_configs";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src");
+    writeTestFile(tempDir / "src/a.txt", 10, 'a');
+    writeTestFile(tempDir / "src/.hidden.txt", 10, 'b');
+    writeTestFile(tempDir / "src/[b].txt", 10, 'c');
+    std::ofstream(tempDir / "config1.txt") << "set match-hidden false\nin \"" << (tempDir / "dest1").string() << "\" add \"" << (tempDir / "src" / "*.txt").string() << "\"\n";
+    std::ofstream(tempDir / "config2.txt") << "set glob-matching false\nin \"" << (tempDir / "dest2").string() << "\" add \"" << (tempDir / "src" / "[b].txt").string() << "\"\n";
+    
+    std::set<std::filesystem::path> trackedPaths[2];
+    std::atomic<int> numStarted(0);
+    std::atomic<bool> mismatch(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 2; ++i) {    // The set commands only change the FileHandler that reads them.
+        threads.emplace_back([&, i]() {
+            ++numStarted;
+            while (numStarted < 2) {    // Start both scans at the same time so that they overlap.
+                std::this_thread::yield();
+            }
+            for (int j = 0; j < 50; ++j) {
+                std::set<std::filesystem::path> paths;
+                FileHandler fileHandler;
+                fileHandler.loadConfigFile(tempDir / ("config" + std::to_string(i + 1) + ".txt"));
+                for (WriteReadPathTree pathTree = fileHandler.nextWriteReadPathTree(); !pathTree.isEmpty(); pathTree = fileHandler.nextWriteReadPathTree()) {
+                    paths.insert(pathTree.relativePaths.begin(), pathTree.relativePaths.end());
+                }
+                if (j == 0) {
+                    trackedPaths[i] = paths;
+                } else if (paths != trackedPaths[i]) {
+                    mismatch = true;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const std::filesystem::path src = "src";
+    EXPECT_EQ(trackedPaths[0], std::set<std::filesystem::path>({"a.txt", "[b].txt"}));    // The hidden file is not matched.
+    EXPECT_EQ(trackedPaths[1], std::set<std::filesystem::path>({src, src / "[b].txt"}));
+    EXPECT_FALSE(mismatch);
+    
+    FileHandler fileHandler;
+    EXPECT_TRUE(fileHandler.getGlobOptions().matching);
+    EXPECT_TRUE(fileHandler.getGlobOptions().matchesHiddenFiles);
+    std::filesystem::remove_all(tempDir);
+}
+
+TEST(TestMultipleConfigs, StartBackups) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_multiple_configs";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src");
+    writeTestFile(tempDir / "src/a.txt", 10, 'a');
+    writeTestFile(tempDir / "src/.hidden.txt", 10, 'b');
+    std::ofstream(tempDir / "config1.txt") << "set match-hidden false\nin \"" << (tempDir / "dest1").string() << "\" add \"" << (tempDir / "src" / "*.txt").string() << "\"\n";
+    std::ofstream(tempDir / "config2.txt") << "in \"" << (tempDir / "dest2").string() << "\" add \"" << (tempDir / "src").string() << "\"\n";
+    
+    IoThrottle ioThrottle(0.0, 0.0, 0.0, 1);    // Like "--max-concurrent-io 1", shared by both configs.
+    Application::BackupOptions options = makeTestBackupOptions();
+    options.ioThrottle = &ioThrottle;
+    std::ostringstream output;
+    std::streambuf* coutBuffer = std::cout.rdbuf(output.rdbuf());
+    const std::filesystem::path previousPath = std::filesystem::current_path();
+    std::filesystem::current_path(tempDir);
+    size_t numFailed = 0;
+    try {
+        numFailed = Application::startBackups({"config1.txt", "config2.txt", "missing.txt"}, options, 2);
+    } catch (...) {
+        std::filesystem::current_path(previousPath);
+        std::cout.rdbuf(coutBuffer);
+        throw;
+    }
+    std::filesystem::current_path(previousPath);
+    std::cout.rdbuf(coutBuffer);
+    
+    EXPECT_EQ(numFailed, 1u);    // Only the missing config fails, the others still finish.
+    EXPECT_TRUE(std::filesystem::exists(tempDir / "dest1/a.txt"));
+    EXPECT_FALSE(std::filesystem::exists(tempDir / "dest1/.hidden.txt"));
+    EXPECT_TRUE(std::filesystem::exists(tempDir / "dest2/src/a.txt"));
+    EXPECT_TRUE(std::filesystem::exists(tempDir / "dest2/src/.hidden.txt"));
+    EXPECT_NE(output.str().find("[config1.txt]"), std::string::npos);
+    EXPECT_NE(output.str().find("[config2.txt]"), std::string::npos);
+    EXPECT_NE(output.str().find("Finished backups of 2 of 3 configs."), std::string::npos);
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestConfigPlan                                                           *
+// ****************************************************************************
+
+TEST(TestConfigPlan, SaveAndLoad) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_config_plan";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "src/sub");
+    writeTestFile(tempDir / "src/a.txt", 10, 'a');
+    writeTestFile(tempDir / "src/b.log", 10, 'b');
+    writeTestFile(tempDir / "src/sub/c.txt", 10, 'c');
+    
+    const std::string config = "root SRC \"" + (tempDir / "src").string() + "\"\n"
+        "ignore *.log\n"
+        "set snapshot true\n"
+        "in \"" + (tempDir / "dest1").string() + "\" add SRC/sub/../sub\n"
+        "include *.log\n"
+        "set snapshot false\n"
+        "set match-hidden false\n"
+        "set compress true\n"
+        "set decompress true\n"
+        "in \"" + (tempDir / "dest2").string() + "\"\n"
+        "add SRC\n"
+        "set glob-matching false\n";
+    std::ofstream(tempDir / "config.txt") << config;
+    
+    ConfigPlan plan;
+    plan.compile(tempDir / "config.txt");
+    const auto& steps = plan.getSteps();
+    ASSERT_EQ(steps.size(), 4u);
+    EXPECT_EQ(steps[0].type, ConfigPlan::StepType::Ignore);
+    EXPECT_EQ(steps[1].type, ConfigPlan::StepType::Add);
+    EXPECT_EQ(steps[1].path, tempDir / "src" / "sub");    // The root is substituted and the path is normalized.
+    EXPECT_TRUE(steps[1].snapshot);
+    EXPECT_TRUE(steps[1].globOptions.matchesHiddenFiles);
+    EXPECT_EQ(steps[2].type, ConfigPlan::StepType::Include);
+    EXPECT_EQ(steps[3].writePath, tempDir / "dest2");
+    EXPECT_EQ(steps[3].writePathId, 1u);
+    EXPECT_FALSE(steps[3].snapshot);
+    EXPECT_FALSE(steps[3].globOptions.matchesHiddenFiles);
+    EXPECT_TRUE(steps[3].globOptions.matching);    // Only set after the last add.
+    EXPECT_FALSE(steps[1].compress);
+    EXPECT_TRUE(steps[3].compress);
+    EXPECT_TRUE(steps[3].decompress);
+    EXPECT_FALSE(plan.getGlobOptions().matching);
+    plan.save(tempDir / "config.plan");
+    
+    auto loadedPlan = std::make_shared<ConfigPlan>();
+    EXPECT_TRUE(loadedPlan->loadOrCompile(tempDir / "config.txt", tempDir / "config.plan"));
+    EXPECT_EQ(loadedPlan->getDigest(), plan.getDigest());
+    ASSERT_EQ(loadedPlan->getSteps().size(), steps.size());
+    for (size_t i = 0; i < steps.size(); ++i) {
+        EXPECT_EQ(loadedPlan->getSteps()[i].type, steps[i].type);
+        EXPECT_EQ(loadedPlan->getSteps()[i].path, steps[i].path);
+        EXPECT_EQ(loadedPlan->getSteps()[i].writePath, steps[i].writePath);
+        EXPECT_EQ(loadedPlan->getSteps()[i].writePathId, steps[i].writePathId);
+        EXPECT_EQ(loadedPlan->getSteps()[i].snapshot, steps[i].snapshot);
+        EXPECT_EQ(loadedPlan->getSteps()[i].chunkStore, steps[i].chunkStore);
+        EXPECT_EQ(loadedPlan->getSteps()[i].compress, steps[i].compress);
+        EXPECT_EQ(loadedPlan->getSteps()[i].decompress, steps[i].decompress);
+        EXPECT_EQ(loadedPlan->getSteps()[i].fanOut, steps[i].fanOut);
+        EXPECT_EQ(loadedPlan->getSteps()[i].globOptions.matching, steps[i].globOptions.matching);
+        EXPECT_EQ(loadedPlan->getSteps()[i].globOptions.matchesHiddenFiles, steps[i].globOptions.matchesHiddenFiles);
+    }
+    EXPECT_EQ(loadedPlan->getGlobOptions().matching, plan.getGlobOptions().matching);
+    EXPECT_EQ(loadedPlan->getGlobOptions().matchesHiddenFiles, plan.getGlobOptions().matchesHiddenFiles);
+    
+    {
+        std::fstream planFile(tempDir / "config.plan", std::ios::in | std::ios::out | std::ios::binary);    // A bool stored as anything other than 0 or 1 means a corrupt plan.
+        planFile.seekp(8 + plan.getDigest().size());
+        planFile.put(2);
+    }
+    ConfigPlan corruptPlan;
+    EXPECT_FALSE(corruptPlan.loadOrCompile(tempDir / "config.txt", tempDir / "config.plan"));
+    EXPECT_EQ(corruptPlan.getSteps().size(), steps.size());
+    EXPECT_FALSE(corruptPlan.getGlobOptions().matching);
+    
+    FileHandler fileHandler;    // The loaded plan gives the same paths as reading the config.
+    fileHandler.loadConfigPlan(loadedPlan);
+    std::map<std::filesystem::path, std::set<std::filesystem::path>> trackedPaths;
+    for (WriteReadPathTree pathTree = fileHandler.nextWriteReadPathTree(); !pathTree.isEmpty(); pathTree = fileHandler.nextWriteReadPathTree()) {
+        trackedPaths[pathTree.writePrefix.filename()].insert(pathTree.relativePaths.begin(), pathTree.relativePaths.end());
+    }
+    const std::filesystem::path src = "src";
+    EXPECT_EQ(trackedPaths["dest1"], std::set<std::filesystem::path>({"sub", std::filesystem::path("sub") / "c.txt"}));
+    EXPECT_EQ(trackedPaths["dest2"], std::set<std::filesystem::path>({src, src / "a.txt", src / "b.log"}));
+    EXPECT_FALSE(fileHandler.getGlobOptions().matching);
+    
+    std::ofstream(tempDir / "config.txt", std::ios::app) << "ignore *.txt\n";    // Any change to the config makes the saved plan stale.
+    ConfigPlan changedPlan;
+    EXPECT_FALSE(changedPlan.loadOrCompile(tempDir / "config.txt", tempDir / "config.plan"));
+    EXPECT_EQ(changedPlan.getSteps().size(), steps.size() + 1);
+    EXPECT_NE(changedPlan.getDigest(), plan.getDigest());
+    
+    std::ofstream(tempDir / "config.txt", std::ios::app) << "include *.dat\n";
+    try {
+        changedPlan.compile(tempDir / "config.txt");
+        FAIL() << "Expected an error for the include.";
+    } catch (std::runtime_error& ex) {
+        EXPECT_NE(std::string(ex.what()).find("at line 14"), std::string::npos);
+    }
+    std::filesystem::remove_all(tempDir);
+}
+
+// ****************************************************************************
+// * TestBoundedQueue                                                         *
+// ****************************************************************************
+
+TEST(TestBoundedQueue, ProducerConsumer) {
+    BoundedQueue<int> queue(4);
+    std::atomic<int> numPushed(0);
+    std::thread producer([&]() {
+        for (int i = 0; i < 100; ++i) {
+            EXPECT_TRUE(queue.push(i));
+            ++numPushed;
+        }
+        queue.close();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(numPushed, 4);    // Producer waits for space once the queue is full.
+    
+    std::vector<int> items;
+    int item;
+    while (queue.pop(item)) {
+        items.push_back(item);
+    }
+    producer.join();
+    ASSERT_EQ(items.size(), 100u);
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(items[i], i);
+    }
+    
+    BoundedQueue<int> queue2(2);
+    EXPECT_TRUE(queue2.push(1));
+    queue2.close();
+    EXPECT_FALSE(queue2.push(2));    // Closed queue drops new items but keeps the remaining ones.
+    EXPECT_TRUE(queue2.pop(item));
+    EXPECT_EQ(item, 1);
+    EXPECT_FALSE(queue2.pop(item));
+}
+
+// ****************************************************************************
+// * TestChangeWriter                                                         *
+// ****************************************************************************
+
+TEST(TestChangeWriter, NdjsonLines) {
+    std::stringbuf output;
+    {
+        ChangeWriter writer(&output, 16);    // Small buffer so that it flushes between changes.
+        writer.writeChange(ChangeWriter::Addition, "src/a.txt", "dst/a.txt");
+        writer.writeChange(ChangeWriter::Deletion, "", "dst/say \"hi\"\\\n.txt");
+        EXPECT_FALSE(output.str().empty());
+        writer.writeChange(ChangeWriter::Rename, "dst/old.txt", "dst/new.txt");
+        writer.writeChange(ChangeWriter::Modification, "src/b.txt", "dst/b.txt");
+        EXPECT_EQ(writer.getCount(ChangeWriter::Deletion), 1u);
+        writer.writeSummary(7);
+    }
+    EXPECT_EQ(output.str(),
+        "{\"type\":\"add\",\"source\":\"src/a.txt\",\"dest\":\"dst/a.txt\"}\n"
+        "{\"type\":\"delete\",\"dest\":\"dst/say \\\"hi\\\"\\\\\\u000a.txt\"}\n"
+        "{\"type\":\"rename\",\"source\":\"dst/old.txt\",\"dest\":\"dst/new.txt\"}\n"
+        "{\"type\":\"modify\",\"source\":\"src/b.txt\",\"dest\":\"dst/b.txt\"}\n"
+        "{\"type\":\"summary\",\"scanned\":7,\"deletions\":1,\"additions\":1,\"modifications\":1,\"renames\":1,\"drops\":0}\n");
+}
+
+TEST(TestChangeWriter, InvalidUtf8) {
+    std::stringbuf output;
+    {
+        ChangeWriter writer(&output);
+        writer.writeChange(ChangeWriter::Deletion, "", "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80");    // Valid 2, 3, and 4 byte sequences.
+        writer.writeChange(ChangeWriter::Deletion, "", "latin1 caf\xe9.txt");
+        writer.writeChange(ChangeWriter::Deletion, "", "\xc0\xaf \xed\xa0\x80 \xf4\x90\x80\x80 \xe2\x82");    // Overlong, surrogate, too large, and truncated.
+    }
+    EXPECT_EQ(output.str(),
+        "{\"type\":\"delete\",\"dest\":\"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80\"}\n"
+        "{\"type\":\"delete\",\"dest\":\"latin1 caf\\ufffd.txt\"}\n"
+        "{\"type\":\"delete\",\"dest\":\"\\ufffd\\ufffd \\ufffd\\ufffd\\ufffd \\ufffd\\ufffd\\ufffd\\ufffd \\ufffd\\ufffd\"}\n");
+}
+
+// ****************************************************************************
+// * TestProgressReporter                                                     *
+// ****************************************************************************
+
+TEST(TestProgressReporter, CountsAndFinalDraw) {
+    std::stringstream output;
+    std::streambuf* coutBuffer = std::cout.rdbuf(output.rdbuf());
+    {
+        ProgressReporter progress(ProgressOutput::Log, "file operations completed", 400, 100);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&progress]() {
+                for (int j = 0; j < 75; ++j) {
+                    progress.add();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        progress.setMessage("Ignored");    // Only shown in a terminal.
+        EXPECT_EQ(progress.getCount(), 400u);
+    }
+    EXPECT_EQ(output.str(), "400 of 400 file operations completed (100%).\n");
+    
+    output.str("");
+    {
+        ProgressReporter progress(ProgressOutput::Terminal, "items scanned", 0, 0, 1000.0);
+        progress.add(5);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    EXPECT_EQ(output.str().find("5 items scanned\r"), 2u);    // After the spinner character.
+    EXPECT_EQ(output.str().substr(output.str().length() - 5), "\r\033[2K");
+    
+    output.str("");
+    {
+        ProgressReporter progress(ProgressOutput::None, "items scanned");
+        progress.add();
+    }
+    EXPECT_TRUE(output.str().empty());
+    std::cout.rdbuf(coutBuffer);
+}
+
+// ****************************************************************************
+// * TestDirectoryReader                                                      *
+// ****************************************************************************
+
+TEST(TestDirectoryReader, MatchesDirectoryIterator) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_dir_reader";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "sub");
+    for (int i = 0; i < 300; ++i) {
+        writeTestFile(tempDir / ("file" + std::to_string(i) + ".txt"), 1, 'a');
+    }
+    #ifndef _WIN32
+        std::filesystem::create_directory_symlink("sub", tempDir / "link");
+    #endif
+    
+    std::map<std::string, bool> expected;
+    for (const auto& entry : std::filesystem::directory_iterator(tempDir)) {
+        expected.emplace(entry.path().filename().string(), entry.is_directory());
+    }
+    
+    DirectoryReader reader(512);    // Small buffer so that the listing takes multiple reads.
+    for (int pass = 0; pass < 2; ++pass) {    // The reader can be opened again.
+        std::map<std::string, bool> found;
+        reader.open(tempDir);
+        DirectoryReader::Entry entry;
+        while (reader.next(entry)) {
+            EXPECT_EQ(entry.name.data()[entry.name.length()], '\0');
+            EXPECT_EQ(entry.type == DirectoryReader::EntryType::Symlink, entry.name == "link");
+            EXPECT_TRUE(found.emplace(std::string(entry.name), reader.isDirectory(entry)).second);
+        }
+        EXPECT_FALSE(reader.next(entry));
+        EXPECT_EQ(found, expected);
+    }
+    
+    EXPECT_THROW(reader.open(tempDir / "missing"), std::filesystem::filesystem_error);
+    std::filesystem::remove_all(tempDir);
+}
+
+#ifndef _WIN32
+TEST(TestDirectoryReader, DirectoryHandles) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_dir_handles";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::path deepDir = tempDir;
+    for (int i = 0; i < 6; ++i) {
+        deepDir /= "d" + std::to_string(i);
+    }
+    std::filesystem::create_directories(deepDir);
+    std::filesystem::create_directories(tempDir / "other");
+    writeTestFile(deepDir / "file", 100, 'a');
+    writeTestFile(tempDir / "other/file", 50, 'b');
+    
+    DirectoryHandles directories(4);
+    std::filesystem::path currentDir = tempDir;
+    for (int i = 0; i < 6; ++i) {
+        currentDir /= "d" + std::to_string(i);
+        EXPECT_GE(directories.getDirectory(currentDir), 0);
+    }
+    EXPECT_EQ(directories.getNumOpen(), 4u);    // Only the deepest ones are kept.
+    
+    FileReader reader;
+    ASSERT_TRUE(reader.open(deepDir / "file", PageCacheMode::Normal, &directories));
+    EXPECT_EQ(reader.getSize(), 100u);
+    EXPECT_EQ(directories.getNumOpen(), 4u);
+    ASSERT_TRUE(reader.open(tempDir / "other/file", PageCacheMode::Normal, &directories));
+    EXPECT_EQ(reader.getSize(), 50u);
+    EXPECT_EQ(directories.getNumOpen(), 1u);    // Moving to another branch closes the old one.
+    reader.close();
+    EXPECT_FALSE(reader.open(tempDir / "missing/file", PageCacheMode::Normal, &directories));
+    EXPECT_THROW(directories.getDirectory(tempDir / "missing"), std::filesystem::filesystem_error);
+    
+    directories.closeAll();
+    EXPECT_EQ(directories.getNumOpen(), 0u);
+    std::filesystem::remove_all(tempDir);
+}
+#endif
+
+// ****************************************************************************
+// * TestPrintTree                                                            *
+// ****************************************************************************
+
+TEST(TestPrintTree, IgnoredDirectoriesNotExpanded) {
+    const std::filesystem::path tempDir = std::filesystem::temp_directory_path() / "backup_tools_test_print_tree";
+    std::filesystem::remove_all(tempDir);
+    std::filesystem::create_directories(tempDir / "w/proj/keep");
+    std::filesystem::create_directories(tempDir / "w/other/x");
+    std::filesystem::create_directories(tempDir / "w/solo");
+    writeTestFile(tempDir / "w/proj/keep/f.txt", 10, 'a');
+    writeTestFile(tempDir / "w/other/x/y.txt", 10, 'b');
+    writeTestFile(tempDir / "w/solo/one.txt", 10, 'c');
+    writeTestFile(tempDir / "w/solo/rest.txt", 10, 'd');
+    std::ofstream(tempDir / "config.txt") << "in \"" << (tempDir / "dest").string() << "\"\nadd \"" << (tempDir / "w/proj").string() << "\"\nadd \"" << (tempDir / "w/solo/one.txt").string() << "\"\n";
+    
+    std::stringstream output;
+    std::streambuf* coutBuffer = std::cout.rdbuf(output.rdbuf());
+    Application app;
+    app.printPaths(tempDir / "config.txt", false, true, false);
+    std::cout.rdbuf(coutBuffer);
+    
+    EXPECT_NE(output.str().find("4 directories, 3 files\n"), std::string::npos) << output.str();    // The contents of "other" are not counted.
+    EXPECT_NE(output.str().find("2 ignored directories, 1 ignored files\n"), std::string::npos) << output.str();
+    std::filesystem::remove_all(tempDir);
+}